@@ -18,6 +18,8 @@
  */
 
 #include <Python.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "_pyecc.h"
 
@@ -41,6 +43,15 @@ static char new_state_doc[] = "\
 Generate a new ECC_State object that will ensure the \
 libgcrypt state necessary for crypto is all set up and \
 ready for use\n\
+  new_state([ephemerals[, dh_cache[, binary[, curve[, secmem_size[, legacy_mac]]]]]])\n\
+With ephemerals > 0 a background thread keeps that many \
+ECIES ephemeral keys precomputed to speed up encryption, \
+with dh_cache > 0 dh() remembers that many session keys, \
+with binary set keys and signatures are raw bytes instead \
+of the printable compact format, curve defaults to DEFAULT_CURVE, \
+secmem_size sizes libgcrypt's secure memory pool if this is the \
+first state of the process, legacy_mac accepts the MAC over no data \
+older releases wrote\n\
 ";
 static void *_release_state(void *_state)
 {
@@ -50,7 +61,33 @@ static void *_release_state(void *_state)
 }
 static PyObject *py_new_state(PyObject *self, PyObject *args, PyObject *kwargs)
 {
-    ECC_State state = ecc_new_state(NULL);
+    ECC_Options opts;
+    ECC_State state;
+    unsigned int ephemerals = 0, dh_cache = 0, secmem_size = 0;
+    int binary = 0, legacy_mac = 0;
+    char *curve = NULL;
+
+    if (!PyArg_ParseTuple(args, "|IIizIi", &ephemerals, &dh_cache, &binary, 
+                &curve, &secmem_size, &legacy_mac))
+        return NULL;
+
+    opts = ecc_new_options();
+    opts->ephemerals = ephemerals;
+    opts->dh_cache = dh_cache;
+    opts->secmem_size = secmem_size;
+    opts->legacy_mac = legacy_mac ? true : false;
+    opts->format = binary ? ECC_FORMAT_BINARY : ECC_FORMAT_COMPACT;
+    if (curve)
+        opts->curve = curve;
+    Py_BEGIN_ALLOW_THREADS
+    state = ecc_new_state(opts);
+    Py_END_ALLOW_THREADS
+
+    if ( (state) && (!state->curveparams) ) {
+        ecc_free_state(state);
+        PyErr_Format(PyExc_ValueError, "Unknown curve \"%s\"", curve);
+        return NULL;
+    }
 
     PyObject *rc = PyCObject_FromVoidPtr(state, (fp)(_release_state));
     if (!PyCObject_Check(rc)) {
@@ -62,39 +99,198 @@ static PyObject *py_new_state(PyObject *self, PyObject *args, PyObject *kwargs)
 }
 
 
-static char encrypt_doc[] = "\
-Encrypt a string buffer of data, expects to be \
-passed a buffer, a ECC_KeyPair PyCObject and a \
-ECC_State PyCObject \
-\n\
-";
-static PyObject *py_encrypt(PyObject *self, PyObject *args, PyObject *kwargs)
+/*
+ * Read only counterpart of _get_writable_buffer(), Python 2's mmap and 
+ * buffer objects only speak the old buffer protocol
+ */
+static int _get_readable_buffer(PyObject *obj, Py_buffer *view)
 {
-    PyObject *temp_state, *temp_keypair;
+    const void *buf;
+    Py_ssize_t len;
+
+    if (PyObject_CheckBuffer(obj))
+        return PyObject_GetBuffer(obj, view, PyBUF_SIMPLE);
+    if (PyObject_AsReadBuffer(obj, &buf, &len) < 0)
+        return -1;
+    return PyBuffer_FillInfo(view, obj, (void *)(buf), len, 1, PyBUF_SIMPLE);
+}
+
+/*
+ * Fetch a signature out of any buffer, returns a new reference to the 
+ * string holding it.  Compact signatures end at their NUL byte, which a
+ * buffer need not have, so anything but a string is copied into one.
+ * Binary signatures of the wrong size come back as NULL since the
+ * library trusts them to be full length
+ */
+static PyObject *_get_signature(PyObject *obj, char **signature, ECC_State state)
+{
+    PyObject *rc;
+    Py_buffer view;
+
+    if (PyString_Check(obj)) {
+        Py_INCREF(obj);
+        rc = obj;
+    }
+    else {
+        if (_get_readable_buffer(obj, &view) < 0)
+            return NULL;
+        rc = PyString_FromStringAndSize((const char *)(view.buf), view.len);
+        PyBuffer_Release(&view);
+        if (!rc)
+            return NULL;
+    }
+
+    *signature = PyString_AS_STRING(rc);
+    if ( (state) && (state->options) && 
+            (state->options->format == ECC_FORMAT_BINARY) &&
+            (PyString_GET_SIZE(rc) != ecc_signature_size(state)) )
+        *signature = NULL;
+    return rc;
+}
+
+/*
+ * The library counts bytes in unsigned int and hands sizes back as int,
+ * anything longer than INT_MAX - slack bytes would be cut short silently
+ */
+static int _check_length(Py_ssize_t len, int slack)
+{
+    if (len > (Py_ssize_t)(INT_MAX - slack)) {
+        PyErr_Format(PyExc_OverflowError, "data is too long, at most %d bytes are supported",
+                INT_MAX - slack);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Python 2's mmap and buffer objects only speak the old buffer protocol,
+ * which "w*" does not accept
+ */
+static int _get_writable_buffer(PyObject *obj, Py_buffer *view)
+{
+    void *buf;
+    Py_ssize_t len;
+
+    if (PyObject_CheckBuffer(obj))
+        return PyObject_GetBuffer(obj, view, PyBUF_WRITABLE);
+    if (PyObject_AsWriteBuffer(obj, &buf, &len) < 0)
+        return -1;
+    return PyBuffer_FillInfo(view, obj, buf, len, 0, PyBUF_WRITABLE);
+}
+
+/*
+ * Common guts of encrypt(), decrypt() and their *_into() variants, the
+ * input can be any object supporting the buffer protocol and is never
+ * modified.  The result is written straight into either the caller's 
+ * buffer or the string we return.
+ */
+static PyObject *_py_crypt(PyObject *args, bool decrypt, bool into)
+{
+    PyObject *temp_state, *temp_keypair, *temp_out = NULL, *rc = NULL;
     ECC_State state;
     ECC_KeyPair keypair;
-    char *data;
-    unsigned int datalen;
+    Py_buffer data, out;
+    int needed, written;
 
-    if (!PyArg_ParseTuple(args, "s#OO", &data, &datalen, &temp_keypair,
-            &temp_state)) {
+    if (into) {
+        if (!PyArg_ParseTuple(args, "s*OOO", &data, &temp_out, &temp_keypair,
+                &temp_state))
+            return NULL;
+    }
+    else if (!PyArg_ParseTuple(args, "s*OO", &data, &temp_keypair,
+                &temp_state)) {
         return NULL;
     }
 
-    if (datalen <= 0) {
+    if ( (!decrypt) && (data.len <= 0) ) {
         PyErr_SetString(PyExc_TypeError, "data can not have a length of zero");
+        PyBuffer_Release(&data);
+        return NULL;
+    }
+    if (_check_length(data.len, 0) < 0) {
+        PyBuffer_Release(&data);
         return NULL;
     }
 
     state = (ECC_State)(PyCObject_AsVoidPtr(temp_state));
     keypair = (ECC_KeyPair)(PyCObject_AsVoidPtr(temp_keypair));
 
-    ECC_Data result = ecc_encrypt(data, datalen, keypair, state);
-
-    if ( (result == NULL) || (result->data == NULL) )
+    if (decrypt)
+        needed = ecc_decrypted_size((unsigned int)(data.len), state);
+    else
+        needed = ecc_encrypted_size((unsigned int)(data.len), state);
+    if (needed < 0) {
+        PyBuffer_Release(&data);
         Py_RETURN_NONE;
+    }
+
+    if (into) {
+        if (_get_writable_buffer(temp_out, &out) < 0) {
+            PyBuffer_Release(&data);
+            return NULL;
+        }
+        if (out.len < needed) {
+            PyErr_Format(PyExc_ValueError, "output buffer is too small, %d bytes are needed",
+                    needed);
+            goto done;
+        }
+    }
+    else {
+        if (!(rc = PyString_FromStringAndSize(NULL, needed)))
+            goto done;
+        out.buf = PyString_AS_STRING(rc);
+        out.len = needed;
+    }
 
-    return PyString_FromStringAndSize((char *)(result->data), result->datalen);
+    /*
+     * The buffers stay exported to us for the duration of the call and
+     * the string is not visible to anybody else yet, so other threads can
+     * run while we crunch numbers
+     */
+    Py_BEGIN_ALLOW_THREADS
+    if (decrypt)
+        written = ecc_decrypt_into(data.buf, (unsigned int)(data.len), out.buf,
+                (unsigned int)(needed), keypair, state);
+    else
+        written = ecc_encrypt_into(data.buf, (unsigned int)(data.len), out.buf,
+                (unsigned int)(needed), keypair, state);
+    Py_END_ALLOW_THREADS
+
+    if (written < 0) {
+        Py_XDECREF(rc);
+        Py_INCREF(Py_None);
+        rc = Py_None;
+    }
+    else if (into)
+        rc = PyInt_FromLong((long)(written));
+
+done:
+    if (into)
+        PyBuffer_Release(&out);
+    PyBuffer_Release(&data);
+    return rc;
+}
+
+static char encrypt_doc[] = "\
+Encrypt a buffer of data, expects to be \
+passed a buffer, a ECC_KeyPair PyCObject and a \
+ECC_State PyCObject \
+\n\
+";
+static PyObject *py_encrypt(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_crypt(args, false, false);
+}
+
+static char encrypt_into_doc[] = "\
+Encrypt a buffer of data into a writable buffer, expects to be \
+passed the data, the output buffer, a ECC_KeyPair PyCObject and a \
+ECC_State PyCObject. Returns the number of bytes written or None \
+\n\
+";
+static PyObject *py_encrypt_into(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_crypt(args, false, true);
 }
 
 static char decrypt_doc[] = "\
@@ -105,31 +301,420 @@ ECC_State PyCObject \
 ";
 static PyObject *py_decrypt(PyObject *self, PyObject *args, PyObject *kwargs)
 {
-    PyObject *temp_state, *temp_keypair;
+    return _py_crypt(args, true, false);
+}
+
+static char decrypt_into_doc[] = "\
+Decrypt a buffer of encrypted data into a writable buffer, takes the \
+same arguments as encrypt_into()\n\
+";
+static PyObject *py_decrypt_into(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_crypt(args, true, true);
+}
+
+static char encrypt_multi_doc[] = "\
+Encrypt a buffer of data once for several recipients\n\
+  encrypt_multi(data, keypairs, state)\n\
+Each of the keypairs can decrypt the result with decrypt_multi()\n\
+";
+static PyObject *py_encrypt_multi(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *temp_state, *temp_keypairs, *keypairs = NULL, *rc = NULL;
+    ECC_KeyPair *kps = NULL;
+    ECC_State state;
+    ECC_Data result;
+    Py_buffer data;
+    Py_ssize_t i, n;
+
+    if (!PyArg_ParseTuple(args, "s*OO", &data, &temp_keypairs, &temp_state))
+        return NULL;
+    if (_check_length(data.len, 0) < 0)
+        goto done;
+
+    /* The tuple keeps the keypairs alive while the GIL is released */
+    if (!(keypairs = PySequence_Tuple(temp_keypairs)))
+        goto done;
+    n = PyTuple_GET_SIZE(keypairs);
+    if (n == 0) {
+        PyErr_SetString(PyExc_ValueError, "keypairs can not be empty");
+        goto done;
+    }
+    if (!(kps = (ECC_KeyPair *)(PyMem_Malloc(sizeof(ECC_KeyPair) * n)))) {
+        PyErr_NoMemory();
+        goto done;
+    }
+    for (i = 0; i < n; ++i) {
+        PyObject *kp = PyTuple_GET_ITEM(keypairs, i);
+        if (!PyCObject_Check(kp)) {
+            PyErr_SetString(PyExc_TypeError, "expected an ECC_KeyPair object");
+            goto done;
+        }
+        kps[i] = (ECC_KeyPair)(PyCObject_AsVoidPtr(kp));
+    }
+
+    state = (ECC_State)(PyCObject_AsVoidPtr(temp_state));
+
+    Py_BEGIN_ALLOW_THREADS
+    result = ecc_encrypt_multi(data.buf, (unsigned int)(data.len), kps, 
+            (unsigned int)(n), state);
+    Py_END_ALLOW_THREADS
+
+    if (result == NULL) {
+        Py_INCREF(Py_None);
+        rc = Py_None;
+        goto done;
+    }
+    rc = PyString_FromStringAndSize((char *)(result->data), result->datalen);
+    ecc_free_data(result);
+
+done:
+    PyMem_Free(kps);
+    Py_XDECREF(keypairs);
+    PyBuffer_Release(&data);
+    return rc;
+}
+
+static char decrypt_multi_doc[] = "\
+Decrypt the output of encrypt_multi() with one of its recipients' keypairs\n\
+  decrypt_multi(data, keypair, state)\n\
+Returns None if the keypair is not a recipient or the data is corrupt\n\
+";
+static PyObject *py_decrypt_multi(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *temp_state, *temp_keypair, *rc;
     ECC_State state;
     ECC_KeyPair keypair;
-    ECC_Data encrypted;
-    char *data;
-    int datalen;
+    ECC_Data result;
+    Py_buffer data;
 
-    if (!PyArg_ParseTuple(args, "s#OO", &data, &datalen, &temp_keypair,
-            &temp_state)) {
+    if (!PyArg_ParseTuple(args, "s*OO", &data, &temp_keypair, &temp_state))
+        return NULL;
+    if (_check_length(data.len, 0) < 0) {
+        PyBuffer_Release(&data);
         return NULL;
     }
 
     state = (ECC_State)(PyCObject_AsVoidPtr(temp_state));
     keypair = (ECC_KeyPair)(PyCObject_AsVoidPtr(temp_keypair));
-    
-    encrypted = ecc_new_data();
-    encrypted->data = data;
-    encrypted->datalen = datalen;
 
-    ECC_Data result = ecc_decrypt(encrypted, keypair, state);
+    Py_BEGIN_ALLOW_THREADS
+    result = ecc_decrypt_multi(data.buf, (unsigned int)(data.len), keypair, 
+            state);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&data);
 
-    if ( (result == NULL) || (result->data == NULL) )
+    if (result == NULL)
         Py_RETURN_NONE;
+    rc = PyString_FromStringAndSize((char *)(result->data), result->datalen);
+    ecc_free_data(result);
+    return rc;
+}
 
-    return PyString_FromStringAndSize((char *)(result->data), result->datalen);
+/*
+ * Incremental encryption and decryption, the ECC_Stream PyCObject must
+ * not be used by two threads at once and the keypair and state it was
+ * created with have to outlive it
+ */
+static PyObject *_py_stream_init(PyObject *args, bool encrypt, bool sign)
+{
+    PyObject *temp_state, *temp_keypair, *temp_peer = NULL, *rc;
+    ECC_State state;
+    ECC_KeyPair keypair, peer = NULL;
+    ECC_Stream stream;
+
+    if (sign) {
+        if (!PyArg_ParseTuple(args, "OOO", &temp_keypair, &temp_peer, &temp_state))
+            return NULL;
+    }
+    else if (!PyArg_ParseTuple(args, "OO", &temp_keypair, &temp_state)) {
+        return NULL;
+    }
+
+    state = (ECC_State)(PyCObject_AsVoidPtr(temp_state));
+    keypair = (ECC_KeyPair)(PyCObject_AsVoidPtr(temp_keypair));
+    if (sign)
+        peer = (ECC_KeyPair)(PyCObject_AsVoidPtr(temp_peer));
+
+    Py_BEGIN_ALLOW_THREADS
+    if (sign && encrypt)
+        stream = ecc_signcrypt_init(keypair, peer, state);
+    else if (sign)
+        stream = ecc_veridec_init(keypair, peer, state);
+    else if (encrypt)
+        stream = ecc_encrypt_init(keypair, state);
+    else
+        stream = ecc_decrypt_init(keypair, state);
+    Py_END_ALLOW_THREADS
+
+    if (!stream)
+        Py_RETURN_NONE;
+
+    rc = PyCObject_FromVoidPtr(stream, (fp)(ecc_free_stream));
+    if (!rc)
+        ecc_free_stream(stream);
+    return rc;
+}
+
+static PyObject *_py_stream_update(PyObject *args, bool encrypt, bool final, 
+        bool sign)
+{
+    PyObject *temp_stream, *temp_state, *rc;
+    ECC_Stream stream;
+    ECC_State state;
+    Py_buffer data;
+    int size, written;
+
+    data.buf = NULL;
+    data.len = 0;
+    if (final) {
+        if (!PyArg_ParseTuple(args, "OO", &temp_stream, &temp_state))
+            return NULL;
+    }
+    else if (!PyArg_ParseTuple(args, "Os*O", &temp_stream, &data, &temp_state)) {
+        return NULL;
+    }
+
+    stream = (ECC_Stream)(PyCObject_AsVoidPtr(temp_stream));
+    state = (ECC_State)(PyCObject_AsVoidPtr(temp_state));
+
+    if (sign)
+        size = ecc_signcrypted_size(0, state);
+    else
+        size = encrypt ? ecc_encrypted_size(0, state) : 0;
+    if (size < 0) {
+        Py_INCREF(Py_None);
+        rc = Py_None;
+        goto done;
+    }
+    if (_check_length(data.len, size) < 0) {
+        rc = NULL;
+        goto done;
+    }
+    size += (int)(data.len);
+
+    if (!(rc = PyString_FromStringAndSize(NULL, size)))
+        goto done;
+
+    Py_BEGIN_ALLOW_THREADS
+    if (final && sign)
+        written = ecc_signcrypt_final(stream, PyString_AS_STRING(rc), size);
+    else if (final)
+        written = ecc_encrypt_final(stream, PyString_AS_STRING(rc), size);
+    else if (encrypt)
+        written = ecc_encrypt_update(stream, data.buf, (unsigned int)(data.len), 
+                PyString_AS_STRING(rc), size);
+    else
+        written = ecc_decrypt_update(stream, data.buf, (unsigned int)(data.len), 
+                PyString_AS_STRING(rc), size);
+    Py_END_ALLOW_THREADS
+
+    if (written < 0) {
+        Py_DECREF(rc);
+        Py_INCREF(Py_None);
+        rc = Py_None;
+    }
+    else
+        _PyString_Resize(&rc, written);
+
+done:
+    if (!final)
+        PyBuffer_Release(&data);
+    return rc;
+}
+
+static char encrypt_init_doc[] = "\
+Start encrypting a stream of data, expects a ECC_KeyPair PyCObject and \
+a ECC_State PyCObject and returns a ECC_Stream PyCObject (or None)\n\
+";
+static PyObject *py_encrypt_init(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_stream_init(args, true, false);
+}
+
+static char encrypt_update_doc[] = "\
+Encrypt the next buffer of a stream, expects the ECC_Stream PyCObject, \
+the buffer and the ECC_State PyCObject. Returns the encrypted string \
+(or None)\n\
+";
+static PyObject *py_encrypt_update(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_stream_update(args, true, false, false);
+}
+
+static char encrypt_final_doc[] = "\
+Finish encrypting a stream, expects the ECC_Stream PyCObject and the \
+ECC_State PyCObject. Returns the remaining string (or None)\n\
+";
+static PyObject *py_encrypt_final(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_stream_update(args, true, true, false);
+}
+
+static char decrypt_init_doc[] = "\
+Start decrypting a stream of data, takes the same arguments as \
+encrypt_init()\n\
+";
+static PyObject *py_decrypt_init(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_stream_init(args, false, false);
+}
+
+static char decrypt_update_doc[] = "\
+Decrypt the next buffer of a stream, takes the same arguments as \
+encrypt_update()\n\
+";
+static PyObject *py_decrypt_update(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_stream_update(args, false, false, false);
+}
+
+static char decrypt_final_doc[] = "\
+Finish decrypting a stream, expects the ECC_Stream PyCObject and \
+returns False if the ciphertext was truncated or its MAC does not check \
+out\n\
+";
+static PyObject *py_decrypt_final(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *temp_stream;
+    bool rc;
+
+    if (!PyArg_ParseTuple(args, "O", &temp_stream))
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    rc = ecc_decrypt_final((ECC_Stream)(PyCObject_AsVoidPtr(temp_stream)));
+    Py_END_ALLOW_THREADS
+
+    if (rc)
+        Py_RETURN_TRUE;
+    Py_RETURN_FALSE;
+}
+
+/*
+ * Single pass signcryption, the format of seccure-signcrypt: the first 
+ * keypair is ours (private), the peer's is the other end's (public)
+ */
+static PyObject *_py_signcrypt(PyObject *args, bool veridec)
+{
+    PyObject *temp_state, *temp_keypair, *temp_peer, *rc;
+    ECC_State state;
+    ECC_KeyPair keypair, peer;
+    Py_buffer data;
+    int needed, written;
+
+    if (!PyArg_ParseTuple(args, "s*OOO", &data, &temp_keypair, &temp_peer,
+                &temp_state))
+        return NULL;
+
+    state = (ECC_State)(PyCObject_AsVoidPtr(temp_state));
+    keypair = (ECC_KeyPair)(PyCObject_AsVoidPtr(temp_keypair));
+    peer = (ECC_KeyPair)(PyCObject_AsVoidPtr(temp_peer));
+    if (_check_length(data.len, 0) < 0) {
+        PyBuffer_Release(&data);
+        return NULL;
+    }
+
+    if (veridec)
+        needed = ecc_veridecrypted_size((unsigned int)(data.len), state);
+    else
+        needed = ecc_signcrypted_size((unsigned int)(data.len), state);
+    if (needed < 0) {
+        PyBuffer_Release(&data);
+        Py_RETURN_NONE;
+    }
+    if (!(rc = PyString_FromStringAndSize(NULL, needed)))
+        goto done;
+
+    Py_BEGIN_ALLOW_THREADS
+    if (veridec)
+        written = ecc_veridec_into(data.buf, (unsigned int)(data.len), 
+                PyString_AS_STRING(rc), needed, keypair, peer, state);
+    else
+        written = ecc_signcrypt_into(data.buf, (unsigned int)(data.len), 
+                PyString_AS_STRING(rc), needed, keypair, peer, state);
+    Py_END_ALLOW_THREADS
+
+    if (written < 0) {
+        Py_DECREF(rc);
+        Py_INCREF(Py_None);
+        rc = Py_None;
+    }
+
+done:
+    PyBuffer_Release(&data);
+    return rc;
+}
+
+static char signcrypt_doc[] = "\
+Sign a buffer of data with our keypair and encrypt it to the peer's in \
+one pass\n\
+  signcrypt(data, keypair, peer, state)\n\
+";
+static PyObject *py_signcrypt(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_signcrypt(args, false);
+}
+
+static char veridec_doc[] = "\
+Decrypt signcrypt() output with our keypair and verify it was signed by \
+the peer\n\
+  veridec(data, keypair, peer, state)\n\
+Returns None if the data is corrupt or forged\n\
+";
+static PyObject *py_veridec(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_signcrypt(args, true);
+}
+
+static char signcrypt_init_doc[] = "\
+Start signcrypting a stream of data, expects our ECC_KeyPair, the peer's \
+ECC_KeyPair and the ECC_State PyCObjects. The stream is fed with \
+encrypt_update() and finished with signcrypt_final()\n\
+";
+static PyObject *py_signcrypt_init(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_stream_init(args, true, true);
+}
+
+static char signcrypt_final_doc[] = "\
+Finish signcrypting a stream, takes the same arguments as \
+encrypt_final()\n\
+";
+static PyObject *py_signcrypt_final(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_stream_update(args, true, true, true);
+}
+
+static char veridec_init_doc[] = "\
+Start decrypting a stream of signcrypt() output, takes the same \
+arguments as signcrypt_init(). The stream is fed with decrypt_update() \
+and finished with veridec_final()\n\
+";
+static PyObject *py_veridec_init(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_stream_init(args, false, true);
+}
+
+static char veridec_final_doc[] = "\
+Finish decrypting a signcrypted stream, expects the ECC_Stream PyCObject \
+and returns False if the ciphertext was truncated or forged\n\
+";
+static PyObject *py_veridec_final(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *temp_stream;
+    bool rc;
+
+    if (!PyArg_ParseTuple(args, "O", &temp_stream))
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    rc = ecc_veridec_final((ECC_Stream)(PyCObject_AsVoidPtr(temp_stream)));
+    Py_END_ALLOW_THREADS
+
+    if (rc)
+        Py_RETURN_TRUE;
+    Py_RETURN_FALSE;
 }
 
 static char new_keypair_doc[] = "\
@@ -140,13 +725,10 @@ static void *_release_keypair(void *_keypair)
 {
     if (_keypair) {
         ECC_KeyPair kp = (ECC_KeyPair)(_keypair);
-        if (kp->priv) {
-            free(kp->priv);
-        }
         if (kp->pub) {
             free(kp->pub);
         }
-        free(kp);
+        ecc_free_keypair(kp);
     }
     Py_RETURN_NONE;
 }
@@ -182,31 +764,241 @@ static PyObject *py_new_keypair(PyObject *self, PyObject *args, PyObject *kwargs
 }
 
 
+/*
+ * Common guts of verify() and verify_digest(), the data can be any 
+ * buffer and may contain NUL bytes
+ */
+static PyObject *_py_verify(PyObject *args, bool digest)
+{
+    PyObject *temp_state, *temp_keypair;
+    ECC_State state;
+    ECC_KeyPair keypair;
+    Py_buffer data;
+    PyObject *temp_sig, *sig;
+    char *signature;
+    bool valid = false;
+
+    if (!PyArg_ParseTuple(args, "s*OOO", &data, &temp_sig, &temp_keypair,
+            &temp_state)) {
+        return NULL;
+    }
+    if ( (digest) && (data.len != ECC_DIGEST_LEN) ) {
+        PyErr_Format(PyExc_ValueError, "digest must be %d bytes long", ECC_DIGEST_LEN);
+        PyBuffer_Release(&data);
+        return NULL;
+    }
+    if (_check_length(data.len, 0) < 0) {
+        PyBuffer_Release(&data);
+        return NULL;
+    }
+
+    state = (ECC_State)(PyCObject_AsVoidPtr(temp_state));
+    keypair = (ECC_KeyPair)(PyCObject_AsVoidPtr(temp_keypair));
+    if (!(sig = _get_signature(temp_sig, &signature, state))) {
+        PyBuffer_Release(&data);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    if ( (signature) && (digest) )
+        valid = ecc_verify_digest(data.buf, signature, keypair, state);
+    else if (signature)
+        valid = ecc_verify_s(data.buf, (unsigned int)(data.len), signature, 
+                keypair, state);
+    Py_END_ALLOW_THREADS
+
+    Py_DECREF(sig);
+    PyBuffer_Release(&data);
+    if (valid)
+        Py_RETURN_TRUE;
+    Py_RETURN_FALSE;
+}
+
 static char verify_doc[] = "\
 Verify that the specified data matches the given signature \
 and vice versa. Should return a True/False depending on the \
 success of the verification call\n\
 ";
 static PyObject *py_verify(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_verify(args, false);
+}
+
+static char verify_digest_doc[] = "\
+Verify a signature against a precomputed 64 byte SHA-512 digest, \
+takes the same arguments as verify()\n\
+";
+static PyObject *py_verify_digest(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_verify(args, true);
+}
+
+
+static char verify_batch_doc[] = "\
+Verify a list of data buffers against a list of signatures \
+in one go, expects either a single ECC_KeyPair PyCObject or a \
+list of them, one per item, and a ECC_State PyCObject. Returns \
+a list of True/False, one per item\n\
+";
+static PyObject *py_verify_batch(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *temp_data, *temp_sigs, *temp_keypairs, *temp_state;
+    PyObject *data = NULL, *sigs = NULL, *keypairs = NULL, *held = NULL, *rc = NULL;
+    ECC_State state;
+    ECC_KeyPair *kps = NULL;
+    char **messages = NULL, **signatures = NULL;
+    unsigned int *lengths = NULL;
+    bool *results = NULL;
+    Py_buffer *views = NULL;
+    Py_ssize_t i, n = 0, acquired = 0;
+
+    if (!PyArg_ParseTuple(args, "OOOO", &temp_data, &temp_sigs, 
+            &temp_keypairs, &temp_state)) {
+        return NULL;
+    }
+
+    /*
+     * Tuples rather than PySequence_Fast() so that nobody can pull the 
+     * items out from under us while the GIL is released
+     */
+    data = PySequence_Tuple(temp_data);
+    sigs = PySequence_Tuple(temp_sigs);
+    if ( (!data) || (!sigs) )
+        goto done;
+    if (!PyCObject_Check(temp_keypairs)) {
+        keypairs = PySequence_Fast(temp_keypairs, 
+                "keypairs must be a keypair or a sequence of them");
+        if (!keypairs)
+            goto done;
+    }
+
+    n = PyTuple_GET_SIZE(data);
+    if ( (PyTuple_GET_SIZE(sigs) != n) ||
+            ( (keypairs) && (PySequence_Fast_GET_SIZE(keypairs) != n) ) ) {
+        PyErr_SetString(PyExc_ValueError, "all sequences must have the same length");
+        goto done;
+    }
+
+    messages = (char **)(PyMem_Malloc(sizeof(char *) * (n + 1)));
+    signatures = (char **)(PyMem_Malloc(sizeof(char *) * (n + 1)));
+    lengths = (unsigned int *)(PyMem_Malloc(sizeof(unsigned int) * (n + 1)));
+    kps = (ECC_KeyPair *)(PyMem_Malloc(sizeof(ECC_KeyPair) * (n + 1)));
+    results = (bool *)(PyMem_Malloc(sizeof(bool) * (n + 1)));
+    views = (Py_buffer *)(PyMem_Malloc(sizeof(Py_buffer) * (n + 1)));
+    if ( (!messages) || (!signatures) || (!lengths) || (!kps) || (!results) ||
+            (!views) ) {
+        PyErr_NoMemory();
+        goto done;
+    }
+    if (!(held = PyTuple_New(n)))
+        goto done;
+
+    /*
+     * The views keep the messages from being resized meanwhile, `held`
+     * keeps the signature strings alive
+     */
+    state = (ECC_State)(PyCObject_AsVoidPtr(temp_state));
+    for (i = 0; i < n; ++i) {
+        PyObject *kp = keypairs ? PySequence_Fast_GET_ITEM(keypairs, i) : temp_keypairs;
+        PyObject *sig;
+
+        if (_get_readable_buffer(PyTuple_GET_ITEM(data, i), &views[acquired]) < 0)
+            goto done;
+        messages[i] = (char *)(views[acquired].buf);
+        if (_check_length(views[acquired++].len, 0) < 0)
+            goto done;
+        lengths[i] = (unsigned int)(views[i].len);
+        if (!(sig = _get_signature(PyTuple_GET_ITEM(sigs, i), &signatures[i], state)))
+            goto done;
+        PyTuple_SET_ITEM(held, i, sig);
+        if (!PyCObject_Check(kp)) {
+            PyErr_SetString(PyExc_TypeError, "expected an ECC_KeyPair object");
+            goto done;
+        }
+        kps[i] = (ECC_KeyPair)(PyCObject_AsVoidPtr(kp));
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ecc_verify_batch(messages, lengths, signatures, kps, (unsigned int)(n), 
+            results, state);
+    Py_END_ALLOW_THREADS
+
+    if (!(rc = PyList_New(n)))
+        goto done;
+    for (i = 0; i < n; ++i) {
+        PyObject *b = results[i] ? Py_True : Py_False;
+        Py_INCREF(b);
+        PyList_SET_ITEM(rc, i, b);
+    }
+
+done:
+    for (i = 0; i < acquired; ++i)
+        PyBuffer_Release(&views[i]);
+    PyMem_Free(views);
+    PyMem_Free(messages);
+    PyMem_Free(signatures);
+    PyMem_Free(lengths);
+    PyMem_Free(kps);
+    PyMem_Free(results);
+    Py_XDECREF(held);
+    Py_XDECREF(data);
+    Py_XDECREF(sigs);
+    Py_XDECREF(keypairs);
+    return rc;
+}
+
+
+/*
+ * Common guts of sign() and sign_digest()
+ */
+static PyObject *_py_sign(PyObject *args, bool digest)
 {
     PyObject *temp_state, *temp_keypair;
     ECC_State state;
     ECC_KeyPair keypair;
-    char *data, *signature;
+    ECC_Data result;
+    PyObject *rc;
+    Py_buffer data;
 
-    if (!PyArg_ParseTuple(args, "ssOO", &data, &signature, &temp_keypair,
+    if (!PyArg_ParseTuple(args, "z*OO", &data, &temp_keypair,
             &temp_state)) {
         return NULL;
     }
+    if (data.buf == NULL) {
+        PyBuffer_Release(&data);
+        Py_RETURN_NONE;
+    }
+    if ( (digest) && (data.len != ECC_DIGEST_LEN) ) {
+        PyErr_Format(PyExc_ValueError, "digest must be %d bytes long", ECC_DIGEST_LEN);
+        PyBuffer_Release(&data);
+        return NULL;
+    }
+    if (_check_length(data.len, 0) < 0) {
+        PyBuffer_Release(&data);
+        return NULL;
+    }
 
     state = (ECC_State)(PyCObject_AsVoidPtr(temp_state));
     keypair = (ECC_KeyPair)(PyCObject_AsVoidPtr(temp_keypair));
 
-    if (ecc_verify(data, signature, keypair, state)) 
-        Py_RETURN_TRUE;
-    Py_RETURN_FALSE;
-}
+    Py_BEGIN_ALLOW_THREADS
+    if (digest)
+        result = ecc_sign_digest(data.buf, keypair, state);
+    else
+        result = ecc_sign_s(data.buf, (unsigned int)(data.len), keypair, state);
+    Py_END_ALLOW_THREADS
 
+    PyBuffer_Release(&data);
+    if ( (result == NULL) || (result->data == NULL) ) {
+        if (result)
+            ecc_free_data(result);
+        Py_RETURN_NONE;
+    }
+    
+    rc = PyString_FromStringAndSize((const char *)(result->data), result->datalen);
+    ecc_free_data(result);
+    return rc;
+}
 
 static char sign_doc[] = "\
 Sign the specified string or block of data \
@@ -215,69 +1007,582 @@ of the signature or None\n\
 ";
 static PyObject *py_sign(PyObject *self, PyObject *args, PyObject *kwargs)
 {
-    PyObject *temp_state, *temp_keypair;
+    return _py_sign(args, false);
+}
+
+static char sign_digest_doc[] = "\
+Sign a precomputed 64 byte SHA-512 digest, takes the same arguments \
+as sign()\n\
+";
+static PyObject *py_sign_digest(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_sign(args, true);
+}
+
+static char dh_doc[] = "\
+Derive the 64 byte Diffie-Hellman session key between our keypair's \
+private key and the peer keypair's public key\n\
+  dh(keypair, peer, state)\n\
+Returns None if either key is unusable\n\
+";
+static PyObject *py_dh(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *temp_state, *temp_keypair, *temp_peer;
     ECC_State state;
-    ECC_KeyPair keypair;
-    char *data;
+    ECC_KeyPair keypair, peer;
+    char key[ECC_DH_KEY_LEN];
+    bool rc;
 
-    if (!PyArg_ParseTuple(args, "zOO", &data, &temp_keypair,
-            &temp_state)) {
+    if (!PyArg_ParseTuple(args, "OOO", &temp_keypair, &temp_peer, &temp_state))
         return NULL;
-    }
 
     state = (ECC_State)(PyCObject_AsVoidPtr(temp_state));
     keypair = (ECC_KeyPair)(PyCObject_AsVoidPtr(temp_keypair));
+    peer = (ECC_KeyPair)(PyCObject_AsVoidPtr(temp_peer));
+
+    Py_BEGIN_ALLOW_THREADS
+    rc = ecc_dh(keypair, peer, key, state);
+    Py_END_ALLOW_THREADS
 
-    ECC_Data result = ecc_sign(data, keypair, state);
-    if ( (result == NULL) || (result->data == NULL) ) 
+    if (!rc)
         Py_RETURN_NONE;
-    
-    return PyString_FromString((const char *)(result->data));
+    return PyString_FromStringAndSize(key, ECC_DH_KEY_LEN);
+}
+
+static char stats_doc[] = "\
+Read the instrumentation counters of an ECC_State PyCObject, returns \
+a dict of the counters with the calls and cumulative nanoseconds per \
+group of calls under 'calls' and 'nsec', or None if libseccure was \
+built without ECC_STATS\n\
+  stats(state)\n\
+";
+static const char *_stats_ops[ECC_OP_MAX] = {
+    "keygen", "encrypt", "decrypt", "multi", "stream", "sign", "verify",
+    "verify_batch", "dh", "signcrypt",
+};
+static PyObject *py_stats(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *temp_state, *rc, *calls, *nsec, *value;
+    struct _ECC_Stats stats;
+    int i;
+
+    if (!PyArg_ParseTuple(args, "O", &temp_state))
+        return NULL;
+
+    if (!ecc_get_stats((ECC_State)(PyCObject_AsVoidPtr(temp_state)), &stats))
+        Py_RETURN_NONE;
+
+    calls = PyDict_New();
+    nsec = PyDict_New();
+    for (i = 0; i < ECC_OP_MAX; i++) {
+        value = PyLong_FromUnsignedLongLong(stats.calls[i]);
+        PyDict_SetItemString(calls, _stats_ops[i], value);
+        Py_DECREF(value);
+        value = PyLong_FromUnsignedLongLong(stats.nsec[i]);
+        PyDict_SetItemString(nsec, _stats_ops[i], value);
+        Py_DECREF(value);
+    }
+    rc = Py_BuildValue("{sKsKsKsKsKsKsKsNsN}",
+            "invm", stats.invm, "mulm", stats.mulm,
+            "pointmul_fixed", stats.pointmul_fixed,
+            "pointmul_variable", stats.pointmul_variable,
+            "pointmul_dual", stats.pointmul_dual,
+            "decompress", stats.decompress, "secmem", stats.secmem,
+            "calls", calls, "nsec", nsec);
+    return rc;
+}
+
+static char reset_stats_doc[] = "\
+Zero the instrumentation counters of an ECC_State PyCObject\n\
+  reset_stats(state)\n\
+";
+static PyObject *py_reset_stats(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *temp_state;
+
+    if (!PyArg_ParseTuple(args, "O", &temp_state))
+        return NULL;
+
+    ecc_reset_stats((ECC_State)(PyCObject_AsVoidPtr(temp_state)));
+    Py_RETURN_NONE;
 }
 
 static char keygen_doc[] = "\
 Generate a set of keys, returns a tuple containing \
 three values: (serialized public key, serialized private key, curve)\n\
+  keygen([binary[, curve]])\n\
+With binary set the keys are serialized as raw bytes\n\
 ";
 static PyObject *py_keygen(PyObject *self, PyObject *args, PyObject *kwargs)
 {
+    ECC_Options opts;
     ECC_State state;
     ECC_KeyPair keypair;
     PyObject *rc;
+    char *priv, *curve = NULL;
+    int binary = 0;
 
-    state = ecc_new_state(NULL);
+    if (!PyArg_ParseTuple(args, "|iz", &binary, &curve))
+        return NULL;
+
+    opts = ecc_new_options();
+    opts->format = binary ? ECC_FORMAT_BINARY : ECC_FORMAT_COMPACT;
+    if (curve)
+        opts->curve = curve;
+    state = ecc_new_state(opts);
     if (!state)
         Py_RETURN_NONE;
+    if (!state->curveparams) {
+        ecc_free_state(state);
+        PyErr_Format(PyExc_ValueError, "Unknown curve \"%s\"", curve);
+        return NULL;
+    }
 
+    Py_BEGIN_ALLOW_THREADS
     keypair = ecc_keygen(NULL, state);
+    Py_END_ALLOW_THREADS
     if (!keypair) {
         ecc_free_state(state);
         Py_RETURN_NONE;
     }
 
     rc = PyTuple_New(3);
+    priv = ecc_serialize_private_key(keypair, state);
    
     /*
      * Returns (pub, priv, curve)
      */
-    PyTuple_SetItem(rc, 0, PyString_FromString((const char *)(keypair->pub)));
-    PyTuple_SetItem(rc, 1, PyString_FromString(ecc_serialize_private_key(keypair, state)));
-    PyTuple_SetItem(rc, 2, PyString_FromString(DEFAULT_CURVE));
+    PyTuple_SetItem(rc, 0, PyString_FromStringAndSize((const char *)(keypair->pub), 
+            ecc_public_key_size(state)));
+    PyTuple_SetItem(rc, 1, PyString_FromStringAndSize(priv, 
+            ecc_private_key_size(state)));
+    PyTuple_SetItem(rc, 2, PyString_FromString(state->curve));
 
+    /*
+     * The private key lives in secure memory, which runs out quickly if
+     * every keypair is leaked
+     */
+    if (priv) {
+        memset(priv, 0, ecc_private_key_size(state));
+        free(priv);
+    }
+    free(keypair->pub);
+    ecc_free_keypair(keypair);
     ecc_free_state(state);
 
     return rc;
 }
 
+static char keygen_many_doc[] = "\
+Generate n sets of keys from one seed, sharing the curve and format \
+of an ECC_State PyCObject, returns a list of n tuples \
+(serialized public key, serialized private key)\n\
+  keygen_many(n, state)\n\
+";
+static PyObject *py_keygen_many(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *temp_state, *rc = NULL, *item;
+    ECC_State state;
+    ECC_KeyPair *kps;
+    unsigned int n, i;
+    int publen, privlen;
+    char *priv;
+
+    if (!PyArg_ParseTuple(args, "IO", &n, &temp_state))
+        return NULL;
+
+    state = (ECC_State)(PyCObject_AsVoidPtr(temp_state));
+    publen = ecc_public_key_size(state);
+    privlen = ecc_private_key_size(state);
+    if (n == 0)
+        return PyList_New(0);
+
+    Py_BEGIN_ALLOW_THREADS
+    kps = ecc_keygen_batch(n, state);
+    Py_END_ALLOW_THREADS
+    if (!kps)
+        Py_RETURN_NONE;
+
+    rc = PyList_New(n);
+    for (i = 0; i < n; i++) {
+        priv = ecc_serialize_private_key(kps[i], state);
+        item = PyTuple_New(2);
+        PyTuple_SetItem(item, 0, PyString_FromStringAndSize(
+                (const char *)(kps[i]->pub), publen));
+        PyTuple_SetItem(item, 1, PyString_FromStringAndSize(priv, privlen));
+        PyList_SetItem(rc, i, item);
+
+        if (priv) {
+            memset(priv, 0, privlen);
+            free(priv);
+        }
+        free(kps[i]->pub);
+        ecc_free_keypair(kps[i]);
+    }
+    free(kps);
+    return rc;
+}
+
+
+/*
+ * The *_many() calls spread a list of items over a handful of native
+ * threads which grab MANY_CHUNK items at a time off a shared job, the 
+ * GIL is released for the whole run
+ */
+#define MANY_CHUNK 16
+#define MANY_MAX_THREADS 64
+
+enum many_op {
+    MANY_ENCRYPT,
+    MANY_DECRYPT,
+    MANY_SIGN,
+    MANY_VERIFY
+};
+
+struct many_job {
+    enum many_op op;
+    ECC_KeyPair keypair;
+    ECC_State state;
+    char **in;
+    unsigned int *inlen;
+    char **sigs;
+    char **dst;
+    unsigned int *dstlen;
+    int *written;
+    ECC_Data *out;
+    bool *valid;
+    unsigned int n, next;
+    pthread_mutex_t lock;
+};
+
+static void _many_chunk(struct many_job *job, unsigned int i, unsigned int end)
+{
+    ECC_KeyPair kps[MANY_CHUNK];
+    unsigned int j;
+
+    if (job->op == MANY_VERIFY) {
+        for (j = 0; j < end - i; ++j)
+            kps[j] = job->keypair;
+        ecc_verify_batch(job->in + i, job->inlen + i, job->sigs + i, kps, 
+                end - i, job->valid + i, job->state);
+        return;
+    }
+
+    for (; i < end; ++i) {
+        switch (job->op) {
+            case MANY_ENCRYPT:
+                if (job->dst[i])
+                    job->written[i] = ecc_encrypt_into(job->in[i], job->inlen[i],
+                            job->dst[i], job->dstlen[i], job->keypair, job->state);
+                break;
+            case MANY_DECRYPT:
+                if (job->dst[i])
+                    job->written[i] = ecc_decrypt_into(job->in[i], job->inlen[i],
+                            job->dst[i], job->dstlen[i], job->keypair, job->state);
+                break;
+            case MANY_SIGN:
+                job->out[i] = ecc_sign_s(job->in[i], job->inlen[i], job->keypair, 
+                        job->state);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static void *_many_worker(void *_job)
+{
+    struct many_job *job = (struct many_job *)(_job);
+    unsigned int i, end;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        i = job->next;
+        end = (job->n - i > MANY_CHUNK) ? i + MANY_CHUNK : job->n;
+        job->next = end;
+        pthread_mutex_unlock(&job->lock);
+
+        if (i >= end)
+            break;
+        _many_chunk(job, i, end);
+    }
+    return NULL;
+}
+
+/*
+ * Run the job on up to `threads` threads (one per CPU if not positive), 
+ * the calling thread does its share so a failing pthread_create() only
+ * costs us parallelism
+ */
+static void _many_run(struct many_job *job, int threads)
+{
+    pthread_t workers[MANY_MAX_THREADS];
+    int started = 0, i;
+    unsigned int chunks = (job->n + MANY_CHUNK - 1) / MANY_CHUNK;
+
+    if (threads <= 0)
+        threads = (int)(sysconf(_SC_NPROCESSORS_ONLN));
+    if (threads > MANY_MAX_THREADS)
+        threads = MANY_MAX_THREADS;
+    if ((unsigned int)(threads) > chunks)
+        threads = (int)(chunks);
+
+    pthread_mutex_init(&job->lock, NULL);
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 1; i < threads; ++i) {
+        if (pthread_create(&workers[started], NULL, _many_worker, job) == 0)
+            started++;
+    }
+    _many_worker(job);
+    for (i = 0; i < started; ++i)
+        pthread_join(workers[i], NULL);
+    Py_END_ALLOW_THREADS
+    pthread_mutex_destroy(&job->lock);
+}
+
+static PyObject *_py_many(PyObject *args, enum many_op op)
+{
+    PyObject *temp_data, *temp_sigs = NULL, *temp_keypair, *temp_state;
+    PyObject *data = NULL, *sigs = NULL, *held = NULL, *rc = NULL;
+    struct many_job job;
+    Py_buffer *views = NULL;
+    int threads = 0;
+    Py_ssize_t i, n = 0, acquired = 0;
+
+    memset(&job, 0, sizeof(job));
+    job.op = op;
+
+    if (op == MANY_VERIFY) {
+        if (!PyArg_ParseTuple(args, "OOOO|i", &temp_data, &temp_sigs, 
+                &temp_keypair, &temp_state, &threads))
+            return NULL;
+    }
+    else if (!PyArg_ParseTuple(args, "OOO|i", &temp_data, &temp_keypair, 
+                &temp_state, &threads)) {
+        return NULL;
+    }
+
+    /*
+     * Pin the inputs in tuples of our own, the GIL is released while the
+     * workers run
+     */
+    if (!(data = PySequence_Tuple(temp_data)))
+        goto done;
+    n = PyTuple_GET_SIZE(data);
+    if (temp_sigs) {
+        if (!(sigs = PySequence_Tuple(temp_sigs)))
+            goto done;
+        if (PyTuple_GET_SIZE(sigs) != n) {
+            PyErr_SetString(PyExc_ValueError, "all sequences must have the same length");
+            goto done;
+        }
+    }
+    if ( (!PyCObject_Check(temp_keypair)) || (!PyCObject_Check(temp_state)) ) {
+        PyErr_SetString(PyExc_TypeError, "expected ECC_KeyPair and ECC_State objects");
+        goto done;
+    }
+
+    job.in = (char **)(PyMem_Malloc(sizeof(char *) * (n + 1)));
+    job.inlen = (unsigned int *)(PyMem_Malloc(sizeof(unsigned int) * (n + 1)));
+    job.sigs = (char **)(PyMem_Malloc(sizeof(char *) * (n + 1)));
+    job.dst = (char **)(PyMem_Malloc(sizeof(char *) * (n + 1)));
+    job.dstlen = (unsigned int *)(PyMem_Malloc(sizeof(unsigned int) * (n + 1)));
+    job.written = (int *)(PyMem_Malloc(sizeof(int) * (n + 1)));
+    job.out = (ECC_Data *)(PyMem_Malloc(sizeof(ECC_Data) * (n + 1)));
+    job.valid = (bool *)(PyMem_Malloc(sizeof(bool) * (n + 1)));
+    views = (Py_buffer *)(PyMem_Malloc(sizeof(Py_buffer) * (n + 1)));
+    if ( (!job.in) || (!job.inlen) || (!job.sigs) || (!job.dst) || (!job.dstlen) ||
+            (!job.written) || (!job.out) || (!job.valid) || (!views) ) {
+        PyErr_NoMemory();
+        goto done;
+    }
+    memset(job.out, 0, sizeof(ECC_Data) * (n + 1));
+    if ( (sigs) && (!(held = PyTuple_New(n))) )
+        goto done;
+    job.state = (ECC_State)(PyCObject_AsVoidPtr(temp_state));
+
+    /*
+     * Any buffer will do, the views we hold keep them from being resized
+     * meanwhile and `held` keeps the signature strings alive
+     */
+    for (i = 0; i < n; ++i) {
+        if (!PyArg_Parse(PyTuple_GET_ITEM(data, i), "s*", &views[acquired]))
+            goto done;
+        job.in[i] = (char *)(views[acquired].buf);
+        if (_check_length(views[acquired++].len, 0) < 0)
+            goto done;
+        job.inlen[i] = (unsigned int)(views[i].len);
+        if (sigs) {
+            PyObject *sig = _get_signature(PyTuple_GET_ITEM(sigs, i), 
+                    &job.sigs[i], job.state);
+            if (!sig)
+                goto done;
+            PyTuple_SET_ITEM(held, i, sig);
+        }
+    }
+
+    job.keypair = (ECC_KeyPair)(PyCObject_AsVoidPtr(temp_keypair));
+    job.n = (unsigned int)(n);
+
+    if (!(rc = PyList_New(n)))
+        goto done;
+
+    /*
+     * Encryption and decryption write straight into the strings we are
+     * going to return, nobody else can see them until we are done
+     */
+    if ( (op == MANY_ENCRYPT) || (op == MANY_DECRYPT) ) {
+        for (i = 0; i < n; ++i) {
+            PyObject *item = Py_None;
+            int needed = -1;
+
+            if (op == MANY_DECRYPT)
+                needed = ecc_decrypted_size(job.inlen[i], job.state);
+            else if (job.inlen[i] > 0)
+                needed = ecc_encrypted_size(job.inlen[i], job.state);
+
+            job.dst[i] = NULL;
+            job.written[i] = -1;
+            if (needed < 0)
+                Py_INCREF(item);
+            else if ((item = PyString_FromStringAndSize(NULL, needed))) {
+                job.dst[i] = PyString_AS_STRING(item);
+                job.dstlen[i] = (unsigned int)(needed);
+            }
+            else {
+                Py_CLEAR(rc);
+                goto done;
+            }
+            PyList_SET_ITEM(rc, i, item);
+        }
+    }
+
+    _many_run(&job, threads);
+
+    for (i = 0; i < n; ++i) {
+        PyObject *item = NULL;
+
+        if (op == MANY_VERIFY)
+            item = PyBool_FromLong(job.valid[i]);
+        else if (op == MANY_SIGN) {
+            if ( (job.out[i]) && (job.out[i]->data) )
+                item = PyString_FromStringAndSize((const char *)(job.out[i]->data), 
+                        job.out[i]->datalen);
+        }
+        else if ( (!job.dst[i]) || (job.written[i] >= 0) )
+            continue;
+
+        if (!item) {
+            if (PyErr_Occurred()) {
+                Py_CLEAR(rc);
+                goto done;
+            }
+            Py_INCREF(Py_None);
+            item = Py_None;
+        }
+        PyList_SetItem(rc, i, item);
+    }
+
+done:
+    if (job.out) {
+        for (i = 0; i < n; ++i) {
+            if (job.out[i])
+                ecc_free_data(job.out[i]);
+        }
+    }
+    PyMem_Free(job.in);
+    PyMem_Free(job.inlen);
+    PyMem_Free(job.sigs);
+    PyMem_Free(job.dst);
+    PyMem_Free(job.dstlen);
+    PyMem_Free(job.written);
+    PyMem_Free(job.out);
+    PyMem_Free(job.valid);
+    for (i = 0; i < acquired; ++i)
+        PyBuffer_Release(&views[i]);
+    PyMem_Free(views);
+    Py_XDECREF(held);
+    Py_XDECREF(data);
+    Py_XDECREF(sigs);
+    return rc;
+}
+
+static char encrypt_many_doc[] = "\
+Encrypt a list of string buffers on a pool of native threads, expects \
+a list, a ECC_KeyPair PyCObject, a ECC_State PyCObject and optionally \
+the number of threads to use (defaults to one per CPU). Returns a list \
+of encrypted strings (or None), in order\n\
+";
+static PyObject *py_encrypt_many(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_many(args, MANY_ENCRYPT);
+}
+
+static char decrypt_many_doc[] = "\
+Decrypt a list of encrypted buffers on a pool of native threads, takes \
+the same arguments as encrypt_many()\n\
+";
+static PyObject *py_decrypt_many(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_many(args, MANY_DECRYPT);
+}
+
+static char sign_many_doc[] = "\
+Sign a list of strings on a pool of native threads, takes the same \
+arguments as encrypt_many() and returns a list of signatures (or None)\n\
+";
+static PyObject *py_sign_many(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_many(args, MANY_SIGN);
+}
+
+static char verify_many_doc[] = "\
+Verify a list of data buffers against a list of signatures on a pool \
+of native threads, expects the two lists, a ECC_KeyPair PyCObject, a \
+ECC_State PyCObject and optionally the number of threads. Returns a \
+list of True/False, one per item\n\
+";
+static PyObject *py_verify_many(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return _py_many(args, MANY_VERIFY);
+}
+
 
 static struct PyMethodDef _pyecc_methods[] = {
-    {"new_state", (PyCFunction)py_new_state, METH_NOARGS, new_state_doc},
+    {"new_state", (PyCFunction)py_new_state, METH_VARARGS, new_state_doc},
     {"new_keypair", (PyCFunction)py_new_keypair, METH_VARARGS, new_keypair_doc},
     {"verify", (PyCFunction)py_verify, METH_VARARGS, verify_doc},
+    {"verify_digest", (PyCFunction)py_verify_digest, METH_VARARGS, verify_digest_doc},
+    {"verify_batch", (PyCFunction)py_verify_batch, METH_VARARGS, verify_batch_doc},
     {"sign", (PyCFunction)py_sign, METH_VARARGS, sign_doc},
+    {"sign_digest", (PyCFunction)py_sign_digest, METH_VARARGS, sign_digest_doc},
     {"encrypt", (PyCFunction)py_encrypt, METH_VARARGS, encrypt_doc},
     {"decrypt", (PyCFunction)py_decrypt, METH_VARARGS, decrypt_doc},
-    {"keygen", (PyCFunction)(py_keygen), METH_NOARGS, keygen_doc},
+    {"encrypt_into", (PyCFunction)py_encrypt_into, METH_VARARGS, encrypt_into_doc},
+    {"decrypt_into", (PyCFunction)py_decrypt_into, METH_VARARGS, decrypt_into_doc},
+    {"dh", (PyCFunction)py_dh, METH_VARARGS, dh_doc},
+    {"encrypt_multi", (PyCFunction)py_encrypt_multi, METH_VARARGS, encrypt_multi_doc},
+    {"decrypt_multi", (PyCFunction)py_decrypt_multi, METH_VARARGS, decrypt_multi_doc},
+    {"encrypt_init", (PyCFunction)py_encrypt_init, METH_VARARGS, encrypt_init_doc},
+    {"encrypt_update", (PyCFunction)py_encrypt_update, METH_VARARGS, encrypt_update_doc},
+    {"encrypt_final", (PyCFunction)py_encrypt_final, METH_VARARGS, encrypt_final_doc},
+    {"decrypt_init", (PyCFunction)py_decrypt_init, METH_VARARGS, decrypt_init_doc},
+    {"decrypt_update", (PyCFunction)py_decrypt_update, METH_VARARGS, decrypt_update_doc},
+    {"decrypt_final", (PyCFunction)py_decrypt_final, METH_VARARGS, decrypt_final_doc},
+    {"signcrypt", (PyCFunction)py_signcrypt, METH_VARARGS, signcrypt_doc},
+    {"veridec", (PyCFunction)py_veridec, METH_VARARGS, veridec_doc},
+    {"signcrypt_init", (PyCFunction)py_signcrypt_init, METH_VARARGS, signcrypt_init_doc},
+    {"signcrypt_final", (PyCFunction)py_signcrypt_final, METH_VARARGS, signcrypt_final_doc},
+    {"veridec_init", (PyCFunction)py_veridec_init, METH_VARARGS, veridec_init_doc},
+    {"veridec_final", (PyCFunction)py_veridec_final, METH_VARARGS, veridec_final_doc},
+    {"keygen", (PyCFunction)(py_keygen), METH_VARARGS, keygen_doc},
+    {"keygen_many", (PyCFunction)(py_keygen_many), METH_VARARGS, keygen_many_doc},
+    {"encrypt_many", (PyCFunction)py_encrypt_many, METH_VARARGS, encrypt_many_doc},
+    {"decrypt_many", (PyCFunction)py_decrypt_many, METH_VARARGS, decrypt_many_doc},
+    {"sign_many", (PyCFunction)py_sign_many, METH_VARARGS, sign_many_doc},
+    {"verify_many", (PyCFunction)py_verify_many, METH_VARARGS, verify_many_doc},
+    {"stats", (PyCFunction)py_stats, METH_VARARGS, stats_doc},
+    {"reset_stats", (PyCFunction)py_reset_stats, METH_VARARGS, reset_stats_doc},
     {NULL}
 };
 
@@ -0,0 +1,142 @@
+#!/usr/bin/env python
+'''
+    Copyright 2009 Slide, Inc.
+
+    Times the pyecc calls, the Python side counterpart of
+    seccure/bench/bench.c, reporting ops/sec and the p50/p99 latency
+    of single calls:
+
+        python bench.py [-b bench] [-t seconds] [-j threads,...]
+                        [-s size,...] [-f text|csv|json]
+
+    With several thread counts every benchmark is run once per count,
+    the calls release the GIL so the threads really run at once
+'''
+import json
+import optparse
+import sys
+import threading
+import time
+
+import pyecc
+
+MIN_SAMPLES = 5
+
+def _sized(setup):
+    setup.sized = True
+    return setup
+
+#
+# Every benchmark returns the call to time, built from an ECC object
+# of its thread's own and the payload size
+#
+def bench_generate(ecc, size):
+    return lambda: pyecc.ECC.generate()
+
+def bench_sign(ecc, size):
+    return lambda: ecc.sign('x' * 64)
+
+def bench_verify(ecc, size):
+    signature = ecc.sign('x' * 64)
+    return lambda: ecc.verify('x' * 64, signature)
+
+def bench_verify_batch(ecc, size):
+    data = ['message %d' % i for i in range(16)]
+    signatures = [ecc.sign(d) for d in data]
+    return lambda: ecc.verify_batch(data, signatures)
+
+def bench_dh(ecc, size):
+    peer = pyecc.ECC.generate()
+    return lambda: ecc.dh(peer)
+
+@_sized
+def bench_encrypt(ecc, size):
+    plaintext = 'x' * size
+    return lambda: ecc.encrypt(plaintext)
+
+@_sized
+def bench_decrypt(ecc, size):
+    ciphertext = ecc.encrypt('x' * size)
+    return lambda: ecc.decrypt(ciphertext)
+
+@_sized
+def bench_encrypt_into(ecc, size):
+    plaintext = 'x' * size
+    buf = bytearray(len(ecc.encrypt(plaintext)))
+    return lambda: ecc.encrypt_into(plaintext, buf)
+
+BENCHES = [(name[len('bench_'):], func) for name, func in sorted(globals().items())
+        if name.startswith('bench_')]
+
+def run(setup, size, threads, seconds):
+    ecc = pyecc.ECC.generate()
+    calls = [setup(pyecc.ECC(public=ecc._public, private=ecc._private), size)
+            for i in range(threads)]
+    samples = [[] for i in range(threads)]
+    barrier = threading.Event()
+
+    def worker(call, out):
+        barrier.wait()
+        deadline = time.time() + seconds
+        while len(out) < MIN_SAMPLES or time.time() < deadline:
+            t0 = time.time()
+            call()
+            out.append(time.time() - t0)
+
+    workers = [threading.Thread(target=worker, args=(calls[i], samples[i]))
+            for i in range(threads)]
+    for w in workers:
+        w.start()
+    start = time.time()
+    barrier.set()
+    for w in workers:
+        w.join()
+    elapsed = time.time() - start
+
+    merged = sorted(sum(samples, []))
+    return (len(merged), len(merged) / elapsed,
+            merged[len(merged) // 2] * 1e6, merged[int(len(merged) * 0.99)] * 1e6)
+
+def main():
+    parser = optparse.OptionParser(usage='%prog [options]')
+    parser.add_option('-b', dest='bench', help='only run benchmarks matching BENCH')
+    parser.add_option('-t', dest='seconds', type='float', default=0.2,
+            help='seconds per benchmark')
+    parser.add_option('-j', dest='threads', default='1',
+            help='comma separated thread counts')
+    parser.add_option('-s', dest='sizes', default='64,4096,1048576',
+            help='comma separated payload sizes')
+    parser.add_option('-f', dest='format', default='text',
+            choices=('text', 'csv', 'json'))
+    options, args = parser.parse_args()
+    threads = [int(t) for t in options.threads.split(',')]
+    sizes = [int(s) for s in options.sizes.split(',')]
+
+    results = []
+    if options.format == 'csv':
+        print 'curve,bench,size,threads,ops,ops_per_sec,p50_us,p99_us'
+    elif options.format == 'text':
+        print '%-8s %-16s %8s %7s %12s %10s %10s' % ('curve', 'bench', 'size',
+                'threads', 'ops/sec', 'p50(us)', 'p99(us)')
+
+    for name, setup in BENCHES:
+        if options.bench and options.bench not in name:
+            continue
+        for size in (sizes if getattr(setup, 'sized', False) else [0]):
+            for count in threads:
+                ops, per_sec, p50, p99 = run(setup, size, count, options.seconds)
+                row = (pyecc.DEFAULT_CURVE, name, size, count, ops, per_sec, p50, p99)
+                if options.format == 'csv':
+                    print '%s,%s,%d,%d,%d,%.1f,%.3f,%.3f' % row
+                elif options.format == 'json':
+                    results.append(dict(zip(('curve', 'bench', 'size', 'threads',
+                            'ops', 'ops_per_sec', 'p50_us', 'p99_us'), row)))
+                else:
+                    print '%-8s %-16s %8d %7d %12.1f %10.2f %10.2f' % (row[:4] + row[5:])
+                sys.stdout.flush()
+
+    if options.format == 'json':
+        print json.dumps(results, indent=1)
+
+if __name__ == '__main__':
+    main()
@@ -21,26 +21,132 @@ import _pyecc
 
 DEFAULT_CURVE = _pyecc.DEFAULT_CURVE
 
+class StreamWriter(object):
+    '''
+        A file-like object encrypting (or decrypting) everything
+        written to it on the fly and passing the result on to
+        `fileobj`, only a few bytes are buffered at any time.
+        close() finishes the stream but leaves `fileobj` open.
+        With a `peer` keypair the stream is signcrypted to (or
+        verified as coming from) that peer
+    '''
+    def __init__(self, ecc, fileobj, decrypt=False, peer=None):
+        self._ecc = ecc
+        self._fileobj = fileobj
+        self._decrypt = decrypt
+        self._peer = peer
+        if peer and decrypt:
+            self._stream = _pyecc.veridec_init(ecc._kp, peer, ecc._state)
+        elif peer:
+            self._stream = _pyecc.signcrypt_init(ecc._kp, peer, ecc._state)
+        elif decrypt:
+            self._stream = _pyecc.decrypt_init(ecc._kp, ecc._state)
+        else:
+            self._stream = _pyecc.encrypt_init(ecc._kp, ecc._state)
+        if not self._stream:
+            raise ValueError('Cannot set up the stream, is the key right?')
+        self.closed = False
+
+    def write(self, data):
+        if self.closed:
+            raise ValueError('I/O operation on closed stream')
+        if self._decrypt:
+            out = _pyecc.decrypt_update(self._stream, data, self._ecc._state)
+        else:
+            out = _pyecc.encrypt_update(self._stream, data, self._ecc._state)
+        if out is None:
+            raise ValueError('Failed to process the stream')
+        if out:
+            self._fileobj.write(out)
+
+    def writelines(self, lines):
+        for line in lines:
+            self.write(line)
+
+    def flush(self):
+        self._fileobj.flush()
+
+    def close(self):
+        if self.closed:
+            return
+        self.closed = True
+        if self._decrypt and self._peer:
+            if not _pyecc.veridec_final(self._stream):
+                raise ValueError('Truncated ciphertext or bad signature')
+            return
+        if self._decrypt:
+            if not _pyecc.decrypt_final(self._stream):
+                raise ValueError('Truncated or tampered ciphertext')
+            return
+        if self._peer:
+            out = _pyecc.signcrypt_final(self._stream, self._ecc._state)
+        else:
+            out = _pyecc.encrypt_final(self._stream, self._ecc._state)
+        if out is None:
+            raise ValueError('Failed to finish the stream')
+        self._fileobj.write(out)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc_info):
+        self.close()
+
+class _ListWriter(list):
+    write = list.append
+
 class ECC(object):
     '''
         The ECC object must be instantiated to work with
         any encrypted data, as some amount of state is required
         at once
+
+        Passing ephemerals=N keeps N ECIES ephemeral keys
+        precomputed in the background, which makes encrypt()
+        and friends cheaper when messages come in bursts,
+        dh_cache=N remembers the last N session keys dh()
+        derived, binary=True takes and hands out keys and
+        signatures as raw bytes, which are smaller and quicker
+        to parse than the printable default.  secmem_size=N
+        sizes libgcrypt's secure memory pool, which only the
+        first ECC object of the process gets to do.  Decryption
+        checks the MAC, legacy_mac=True also accepts the MAC over
+        no data at all that older releases wrote, and with it
+        tampered ciphertexts of theirs
     '''
     def __init__(self, *args, **kwargs):
         self._private = kwargs.get('private')
         self._public = kwargs.get('public')
         self._curve = kwargs.get('curve')
-        self._state = _pyecc.new_state()
+        self._state = _pyecc.new_state(kwargs.get('ephemerals', 0),
+                kwargs.get('dh_cache', 0), kwargs.get('binary', False),
+                self._curve, kwargs.get('secmem_size', 0),
+                kwargs.get('legacy_mac', False))
         self._kp = _pyecc.new_keypair(self._public, self._private, self._state)
 
     @classmethod
-    def generate(cls):
-        keys = _pyecc.keygen()
+    def generate(cls, **kwargs):
+        keys = _pyecc.keygen(kwargs.get('binary', False), kwargs.get('curve'))
         if keys:
-            return cls(public=keys[0], private=keys[1], curve=keys[2])
+            kwargs['curve'] = keys[2]
+            return cls(public=keys[0], private=keys[1], **kwargs)
         return None
 
+    @classmethod
+    def generate_many(cls, n, **kwargs):
+        '''
+            Generate n new ECC objects at once, takes the same
+            keyword arguments as the constructor.  This is a lot
+            cheaper per key than calling generate() n times
+        '''
+        state = _pyecc.new_state(0, 0, kwargs.get('binary', False),
+                kwargs.get('curve'), kwargs.get('secmem_size', 0))
+        keys = _pyecc.keygen_many(n, state)
+        if keys is None:
+            return None
+        return [cls(public=public, private=private, **kwargs)
+                for public, private in keys]
+
 
     def encrypt(self, plaintext):
         return _pyecc.encrypt(plaintext, self._kp, self._state)
@@ -49,6 +155,77 @@ class ECC(object):
         assert ciphertext, 'You cannot decrypt "nothing"'
         return _pyecc.decrypt(ciphertext, self._kp, self._state)
 
+    def encrypt_into(self, plaintext, buf):
+        '''
+            Encrypt any buffer object straight into the writable
+            buffer `buf` (a bytearray, mmap, ...), returns the
+            number of bytes written
+        '''
+        return _pyecc.encrypt_into(plaintext, buf, self._kp, self._state)
+
+    def decrypt_into(self, ciphertext, buf):
+        '''
+            Decrypt into the writable buffer `buf`, returns the
+            number of bytes written
+        '''
+        assert ciphertext, 'You cannot decrypt "nothing"'
+        return _pyecc.decrypt_into(ciphertext, buf, self._kp, self._state)
+
+    def encrypt_multi(self, plaintext, recipients):
+        '''
+            Encrypt `plaintext` once for all of `recipients`, ECC
+            objects or serialized public keys, each of which can
+            decrypt_multi() the result
+        '''
+        keypairs = []
+        for r in recipients:
+            if isinstance(r, ECC):
+                keypairs.append(r._kp)
+            else:
+                keypairs.append(_pyecc.new_keypair(r, None, self._state))
+        return _pyecc.encrypt_multi(plaintext, keypairs, self._state)
+
+    def _peer_kp(self, peer):
+        if isinstance(peer, ECC):
+            return peer._kp
+        return _pyecc.new_keypair(peer, None, self._state)
+
+    def dh(self, peer):
+        '''
+            Derive the 64 byte Diffie-Hellman session key between
+            our private key and `peer`, an ECC object or a
+            serialized public key; returns None if either key is
+            unusable.  ECC.generate() makes ephemeral keys.
+        '''
+        return _pyecc.dh(self._kp, self._peer_kp(peer), self._state)
+
+    def signcrypt(self, plaintext, recipient):
+        '''
+            Sign `plaintext` with our private key and encrypt it to
+            `recipient` (an ECC object or a serialized public key) in
+            one pass, in the format of seccure-signcrypt
+        '''
+        assert plaintext, 'You cannot signcrypt "nothing"'
+        return _pyecc.signcrypt(plaintext, self._kp, self._peer_kp(recipient),
+                self._state)
+
+    def veridec(self, ciphertext, sender):
+        '''
+            Decrypt signcrypt() output sent to us and verify it was
+            signed by `sender`, returns None for corrupt or forged data
+        '''
+        assert ciphertext, 'You cannot veridec "nothing"'
+        return _pyecc.veridec(ciphertext, self._kp, self._peer_kp(sender),
+                self._state)
+
+    def decrypt_multi(self, ciphertext):
+        '''
+            Decrypt encrypt_multi() output, returns None unless this
+            key is one of the recipients and the data is intact
+        '''
+        assert ciphertext, 'You cannot decrypt "nothing"'
+        return _pyecc.decrypt_multi(ciphertext, self._kp, self._state)
+
     def sign(self, data):
         if not self._kp:
             print 'You need a keypair object to verify a signature'
@@ -70,3 +247,133 @@ class ECC(object):
             return False
 
         return _pyecc.verify(data, signature, self._kp, self._state)
+
+    def sign_digest(self, digest):
+        '''
+            Sign a precomputed 64 byte SHA-512 digest of the data,
+            e.g. hashlib.sha512(data).digest(), sign(data) is the
+            same as sign_digest() of its digest
+        '''
+        return _pyecc.sign_digest(digest, self._kp, self._state)
+
+    def verify_digest(self, digest, signature):
+        '''
+            Verify a signature against a precomputed 64 byte
+            SHA-512 digest of the data
+        '''
+        return _pyecc.verify_digest(digest, signature, self._kp, self._state)
+
+    def verify_batch(self, data, signatures):
+        '''
+            Verify a list of data blocks against a list of
+            signatures made with this object's key, returns
+            a list of True/False, one per signature
+        '''
+        if not self._kp:
+            print 'You need a keypair object to verify a signature'
+            return False
+
+        if not self._state:
+            print 'ECC object should have an internal _state member'
+            return False
+
+        return _pyecc.verify_batch(data, signatures, self._kp, self._state)
+
+    def encrypt_many(self, plaintexts, threads=0):
+        '''
+            Encrypt a list of strings, spreading the work over
+            `threads` native threads (one per CPU by default),
+            returns the list of encrypted strings in order
+        '''
+        return _pyecc.encrypt_many(plaintexts, self._kp, self._state, threads)
+
+    def decrypt_many(self, ciphertexts, threads=0):
+        '''
+            Decrypt a list of strings encrypted with this object's
+            key, see encrypt_many()
+        '''
+        return _pyecc.decrypt_many(ciphertexts, self._kp, self._state, threads)
+
+    def sign_many(self, data, threads=0):
+        '''
+            Sign a list of data blocks, returns the list of
+            signatures in order, see encrypt_many()
+        '''
+        return _pyecc.sign_many(data, self._kp, self._state, threads)
+
+    def verify_many(self, data, signatures, threads=0):
+        '''
+            Like verify_batch() but spread over `threads` native
+            threads, returns a list of True/False, one per signature
+        '''
+        return _pyecc.verify_many(data, signatures, self._kp, self._state, threads)
+
+    def stats(self):
+        '''
+            Return the instrumentation counters of this object's
+            state as a dict, or None unless the module was built
+            with ECC_STATS defined
+        '''
+        return _pyecc.stats(self._state)
+
+    def reset_stats(self):
+        '''
+            Zero the instrumentation counters, see stats()
+        '''
+        _pyecc.reset_stats(self._state)
+
+    def encrypt_to(self, fileobj):
+        '''
+            Return a file-like StreamWriter encrypting whatever is
+            written to it into `fileobj`
+        '''
+        return StreamWriter(self, fileobj)
+
+    def decrypt_to(self, fileobj):
+        '''
+            Return a file-like StreamWriter decrypting whatever is
+            written to it into `fileobj`, close() raises ValueError
+            unless the MAC checks out
+        '''
+        return StreamWriter(self, fileobj, decrypt=True)
+
+    def signcrypt_to(self, fileobj, recipient):
+        '''
+            Return a file-like StreamWriter signcrypting whatever is
+            written to it into `fileobj` for `recipient`
+        '''
+        return StreamWriter(self, fileobj, peer=self._peer_kp(recipient))
+
+    def veridec_to(self, fileobj, sender):
+        '''
+            Return a file-like StreamWriter decrypting signcrypted data
+            from `sender` into `fileobj`, close() raises ValueError
+            unless the signature checks out.  Nothing written out can
+            be trusted before then
+        '''
+        return StreamWriter(self, fileobj, decrypt=True,
+                peer=self._peer_kp(sender))
+
+    def encrypt_iter(self, chunks):
+        '''
+            Encrypt an iterable of strings (a file, a generator, ...)
+            lazily, yielding the ciphertext piece by piece
+        '''
+        return self._stream_iter(chunks, False)
+
+    def decrypt_iter(self, chunks):
+        '''
+            Decrypt an iterable of strings lazily, see encrypt_iter()
+        '''
+        return self._stream_iter(chunks, True)
+
+    def _stream_iter(self, chunks, decrypt):
+        out = _ListWriter()
+        writer = StreamWriter(self, out, decrypt=decrypt)
+        for chunk in chunks:
+            writer.write(chunk)
+            while out:
+                yield out.pop(0)
+        writer.close()
+        for piece in out:
+            yield piece
@@ -42,6 +42,7 @@
 #include <gcrypt.h>
 
 #include "aes256ctr.h"
+#include "stats.h"
 
 /******************************************************************************/
 
@@ -76,7 +77,7 @@ struct aes256ctr* aes256ctr_init(const char *key)
 
 void aes256ctr_enc(struct aes256ctr *ac, char *buf, int len)
 {
-  gcry_error_t err;
+  gcry_error_t err __attribute__((unused)); /* only assert()ed */
   int full_blocks;
 
   for(; len && (ac->idx < CIPHER_BLOCK_SIZE); len--)
@@ -99,6 +100,58 @@ void aes256ctr_enc(struct aes256ctr *ac, char *buf, int len)
   }
 }
 
+/* Like aes256ctr_enc() but reading from `in` and writing to `out`, which
+   must not overlap, saving the caller a copy */
+void aes256ctr_crypt(struct aes256ctr *ac, char *out, const char *in, int len)
+{
+  gcry_error_t err __attribute__((unused)); /* only assert()ed */
+  int full_blocks;
+
+  for(; len && (ac->idx < CIPHER_BLOCK_SIZE); len--)
+    *out++ = *in++ ^ ac->buf[ac->idx++];
+
+  full_blocks = (len / CIPHER_BLOCK_SIZE) * CIPHER_BLOCK_SIZE;
+  err = gcry_cipher_encrypt(ac->ch, out, full_blocks, in, full_blocks);
+  assert(! gcry_err_code(err));
+  len -= full_blocks;
+  out += full_blocks;
+  in += full_blocks;
+
+  if (len) {
+    memset(ac->buf, 0, CIPHER_BLOCK_SIZE);
+    err = gcry_cipher_encrypt(ac->ch, ac->buf, CIPHER_BLOCK_SIZE, NULL, 0);
+    assert(! gcry_err_code(err));
+    ac->idx = 0;
+    
+    for(; len && (ac->idx < CIPHER_BLOCK_SIZE); len--)
+      *out++ = *in++ ^ ac->buf[ac->idx++];
+  }
+}
+
+/* Position the keystream at byte `offset`, where it would be after
+   encrypting that many bytes from the start */
+void aes256ctr_seek(struct aes256ctr *ac, unsigned long long offset)
+{
+  unsigned long long block = offset / CIPHER_BLOCK_SIZE;
+  char ctr[CIPHER_BLOCK_SIZE];
+  gcry_error_t err __attribute__((unused)); /* only assert()ed */
+  int i;
+
+  memset(ctr, 0, CIPHER_BLOCK_SIZE);
+  for(i = CIPHER_BLOCK_SIZE - 1; block; i--, block >>= 8)
+    ctr[i] = block & 0xff;
+  err = gcry_cipher_setctr(ac->ch, ctr, CIPHER_BLOCK_SIZE);
+  assert(! gcry_err_code(err));
+  ac->idx = CIPHER_BLOCK_SIZE;
+
+  if (offset % CIPHER_BLOCK_SIZE) {
+    memset(ac->buf, 0, CIPHER_BLOCK_SIZE);
+    err = gcry_cipher_encrypt(ac->ch, ac->buf, CIPHER_BLOCK_SIZE, NULL, 0);
+    assert(! gcry_err_code(err));
+    ac->idx = offset % CIPHER_BLOCK_SIZE;
+  }
+}
+
 void aes256ctr_done(struct aes256ctr *ac)
 {
   gcry_cipher_close(ac->ch);
@@ -121,6 +174,26 @@ int hmacsha256_init(gcry_md_hd_t *mh, const char *key, int len)
   return ! gcry_err_code(err);
 }
 
+/* The MAC of segment `idx`, or with SEGMENT_END_TAG the final tag over
+   `idx` segments, is left in `mh` for gcry_md_read() */
+void hmacsha256_segment(gcry_md_hd_t mh, char tag, int seglen, 
+			unsigned long long idx, const char *buf, int len)
+{
+  unsigned char hdr[1 + 4 + 8];
+  int i;
+
+  hdr[0] = tag;
+  for(i = 0; i < 4; i++)
+    hdr[1 + i] = seglen >> (8 * (3 - i));
+  for(i = 0; i < 8; i++)
+    hdr[5 + i] = idx >> (8 * (7 - i));
+  gcry_md_reset(mh);
+  gcry_md_write(mh, hdr, sizeof(hdr));
+  if (len)
+    gcry_md_write(mh, buf, len);
+  gcry_md_final(mh);
+}
+
 void aes256cprng_fillbuf(struct aes256cprng *cprng, char *buf, int len)
 {
   memset(buf, 0, len);
@@ -57,10 +57,32 @@ struct aes256ctr {
 struct aes256ctr* aes256ctr_init(const char *key);
 void aes256ctr_enc(struct aes256ctr *ac, char *buf, int len);
 #define aes256ctr_dec aes256ctr_enc
+void aes256ctr_crypt(struct aes256ctr *ac, char *out, const char *in, int len);
+void aes256ctr_seek(struct aes256ctr *ac, unsigned long long offset);
 void aes256ctr_done(struct aes256ctr *ac);
 
 int hmacsha256_init(gcry_md_hd_t *mh, const char *key, int len);
 
+/* The segmented format (seccure -x, ecc_encrypt_segments_init()) cuts the
+   body into segments of a fixed size that is given in the header.
+   Segment i is encrypted at offset i * segment size of the same CTR
+   stream and followed by its own MAC, which covers its index, so segments
+   can be processed in parallel and a forgery is noticed at the segment it
+   is in.  The final tag covers the number of segments, which catches
+   truncation at a segment boundary:
+
+     R | segment size (4 bytes) | C_0 | MAC_0 | ... | C_n-1 | MAC_n-1 | MAC_n
+
+   Only the last segment may be short, all numbers are big endian */
+
+#define SEGMENT_HEADER_LEN 4
+#define SEGMENT_SIZE_MAX (4 << 20)
+#define SEGMENT_TAG 'S'
+#define SEGMENT_END_TAG 'E'
+
+void hmacsha256_segment(gcry_md_hd_t mh, char tag, int seglen, 
+			unsigned long long idx, const char *buf, int len);
+
 #define aes256cprng aes256ctr
 #define aes256cprng_init aes256ctr_init
 void aes256cprng_fillbuf(struct aes256cprng *cprng, char *buf, int len);
@@ -0,0 +1,454 @@
+/*
+ *  bench - Copyright 2009 Slide, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * Times the protocol primitives and the library calls built on them for
+ * every curve, reporting ops/sec and the p50/p99 latency of single calls.
+ *
+ *   bench [-c curve] [-b bench] [-t seconds] [-j threads,...]
+ *         [-s size,...] [-f text|csv|json]
+ *
+ * With several thread counts every benchmark is run once per count, all
+ * threads calling the primitive at once on inputs of their own
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <gcrypt.h>
+
+#include "curves.h"
+#include "numtheory.h"
+#include "protocol.h"
+#include "serialize.h"
+#include "libseccure.h"
+
+#define MAX_SAMPLES (1 << 18)
+#define MIN_SAMPLES 5
+#define MAX_THREADS 64
+#define MAX_SIZES 16
+
+/*
+ * Everything one thread works on, set up before the clock starts
+ */
+struct bench_ctx {
+	struct curve_params *cp;
+	gcry_mpi_t d, sig, square, root;
+	struct affine_point Q, R;
+	struct point_table *qt;
+	char digest[ECC_DIGEST_LEN];
+	char key[64];
+	char *compact;
+	ECC_State state;
+	ECC_KeyPair keypair;
+	unsigned int size;
+	char *payload, *ciphertext, *out;
+	int ciphertext_len, out_len;
+};
+
+struct bench {
+	const char *name;
+	bool sized;
+	void (*run)(struct bench_ctx *ctx);
+};
+
+struct bench_thread {
+	const struct bench *bench;
+	struct bench_ctx ctx;
+	pthread_t thread;
+	pthread_barrier_t *barrier;
+	double seconds;
+	unsigned long long *samples;
+	int count;
+	unsigned long long elapsed;
+};
+
+enum output_format {
+	OUTPUT_TEXT,
+	OUTPUT_CSV,
+	OUTPUT_JSON
+};
+
+static enum output_format format = OUTPUT_TEXT;
+static int results = 0;
+
+
+static void run_pointmul(struct bench_ctx *ctx)
+{
+	struct affine_point P = pointmul(&ctx->Q, ctx->d, &ctx->cp->dp);
+	point_release(&P);
+}
+
+static void run_pointmul_table(struct bench_ctx *ctx)
+{
+	struct affine_point P = pointmul_table(ctx->qt, ctx->d, &ctx->cp->dp);
+	point_release(&P);
+}
+
+static void run_pointmul_base(struct bench_ctx *ctx)
+{
+	struct affine_point P = pointmul_base(ctx->d, &ctx->cp->dp);
+	point_release(&P);
+}
+
+static void run_ecdsa_sign(struct bench_ctx *ctx)
+{
+	gcry_mpi_release(ECDSA_sign(ctx->digest, ctx->d, ctx->cp));
+}
+
+static void run_ecdsa_verify(struct bench_ctx *ctx)
+{
+	ECDSA_verify(ctx->digest, &ctx->Q, ctx->sig, ctx->cp);
+}
+
+static void run_ecdsa_verify_table(struct bench_ctx *ctx)
+{
+	ECDSA_verify_table(ctx->digest, ctx->qt, ctx->sig, ctx->cp);
+}
+
+static void run_ecies_encryption(struct bench_ctx *ctx)
+{
+	struct affine_point R = ECIES_encryption(ctx->key, &ctx->Q, ctx->cp);
+	point_release(&R);
+}
+
+static void run_ecies_decryption(struct bench_ctx *ctx)
+{
+	ECIES_decryption(ctx->key, &ctx->R, ctx->d, ctx->cp);
+}
+
+static void run_serialize_mpi(struct bench_ctx *ctx)
+{
+	serialize_mpi(ctx->compact, ctx->cp->sig_len_compact, DF_COMPACT, ctx->sig);
+}
+
+static void run_deserialize_mpi(struct bench_ctx *ctx)
+{
+	gcry_mpi_t x;
+
+	if (deserialize_mpi(&x, DF_COMPACT, ctx->compact, ctx->cp->sig_len_compact))
+		gcry_mpi_release(x);
+}
+
+static void run_mod_root(struct bench_ctx *ctx)
+{
+	mod_root(ctx->root, ctx->square, ctx->cp->dp.m);
+}
+
+static void run_ecc_encrypt(struct bench_ctx *ctx)
+{
+	ecc_encrypt_into(ctx->payload, ctx->size, ctx->out, ctx->out_len,
+			ctx->keypair, ctx->state);
+}
+
+static void run_ecc_decrypt(struct bench_ctx *ctx)
+{
+	ecc_decrypt_into(ctx->ciphertext, ctx->ciphertext_len, ctx->out,
+			ctx->out_len, ctx->keypair, ctx->state);
+}
+
+static const struct bench benches[] = {
+	{ "pointmul", false, run_pointmul },
+	{ "pointmul_table", false, run_pointmul_table },
+	{ "pointmul_base", false, run_pointmul_base },
+	{ "ECDSA_sign", false, run_ecdsa_sign },
+	{ "ECDSA_verify", false, run_ecdsa_verify },
+	{ "ECDSA_verify_table", false, run_ecdsa_verify_table },
+	{ "ECIES_encryption", false, run_ecies_encryption },
+	{ "ECIES_decryption", false, run_ecies_decryption },
+	{ "serialize_mpi", false, run_serialize_mpi },
+	{ "deserialize_mpi", false, run_deserialize_mpi },
+	{ "mod_root", false, run_mod_root },
+	{ "ecc_encrypt", true, run_ecc_encrypt },
+	{ "ecc_decrypt", true, run_ecc_decrypt },
+	{ NULL, false, NULL }
+};
+
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+static void ctx_init(struct bench_ctx *ctx, struct curve_params *cp,
+		ECC_State state, ECC_KeyPair keypair, unsigned int size)
+{
+	struct affine_point P;
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->cp = cp;
+	ctx->state = state;
+	ctx->keypair = keypair;
+	ctx->size = size;
+
+	gcry_randomize(ctx->digest, ECC_DIGEST_LEN, GCRY_WEAK_RANDOM);
+	ctx->d = get_random_exponent(cp);
+	ctx->Q = pointmul_base(ctx->d, &cp->dp);
+	ctx->qt = point_table_new(&ctx->Q, KEY_WNAF_WIDTH, &cp->dp);
+	ctx->sig = ECDSA_sign(ctx->digest, ctx->d, cp);
+	ctx->R = ECIES_encryption(ctx->key, &ctx->Q, cp);
+	ctx->compact = malloc(cp->sig_len_compact);
+	serialize_mpi(ctx->compact, cp->sig_len_compact, DF_COMPACT, ctx->sig);
+
+	/* y^2 of a point is a square mod p, the case decompression hits */
+	P = pointmul_base(ctx->sig, &cp->dp);
+	ctx->square = gcry_mpi_new(0);
+	ctx->root = gcry_mpi_new(0);
+	gcry_mpi_mulm(ctx->square, P.y, P.y, cp->dp.m);
+	point_release(&P);
+
+	if (size) {
+		ctx->payload = malloc(size);
+		gcry_randomize(ctx->payload, size, GCRY_WEAK_RANDOM);
+		ctx->out_len = ecc_encrypted_size(size, state);
+		ctx->out = malloc(ctx->out_len);
+		ctx->ciphertext_len = ctx->out_len;
+		ctx->ciphertext = malloc(ctx->ciphertext_len);
+		ecc_encrypt_into(ctx->payload, size, ctx->ciphertext,
+				ctx->ciphertext_len, keypair, state);
+	}
+}
+
+static void ctx_release(struct bench_ctx *ctx)
+{
+	gcry_mpi_release(ctx->d);
+	gcry_mpi_release(ctx->sig);
+	gcry_mpi_release(ctx->square);
+	gcry_mpi_release(ctx->root);
+	point_release(&ctx->Q);
+	point_release(&ctx->R);
+	point_table_release(ctx->qt);
+	free(ctx->compact);
+	free(ctx->payload);
+	free(ctx->ciphertext);
+	free(ctx->out);
+}
+
+static void *bench_thread(void *arg)
+{
+	struct bench_thread *t = (struct bench_thread *)(arg);
+	unsigned long long start, deadline, t0, t1;
+
+	pthread_barrier_wait(t->barrier);
+	start = t1 = now_ns();
+	deadline = start + (unsigned long long)(t->seconds * 1e9);
+	while ( (t->count < MAX_SAMPLES) &&
+			((t->count < MIN_SAMPLES) || (t1 < deadline)) ) {
+		t0 = now_ns();
+		t->bench->run(&t->ctx);
+		t1 = now_ns();
+		t->samples[t->count++] = t1 - t0;
+	}
+	t->elapsed = t1 - start;
+	return NULL;
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)(a);
+	unsigned long long y = *(const unsigned long long *)(b);
+
+	return (x > y) - (x < y);
+}
+
+static void report(const char *curve, const char *name, unsigned int size,
+		int threads, int ops, double per_sec, double p50, double p99)
+{
+	switch (format) {
+		case OUTPUT_CSV:
+			if (!results)
+				printf("curve,bench,size,threads,ops,ops_per_sec,p50_us,p99_us\n");
+			printf("%s,%s,%u,%d,%d,%.1f,%.3f,%.3f\n", curve, name, size,
+					threads, ops, per_sec, p50, p99);
+			break;
+		case OUTPUT_JSON:
+			printf("%s\n  {\"curve\": \"%s\", \"bench\": \"%s\", \"size\": %u, "
+					"\"threads\": %d, \"ops\": %d, \"ops_per_sec\": %.1f, "
+					"\"p50_us\": %.3f, \"p99_us\": %.3f}", results ? "," : "[",
+					curve, name, size, threads, ops, per_sec, p50, p99);
+			break;
+		default:
+			if (!results)
+				printf("%-18s %-20s %8s %7s %12s %10s %10s\n", "curve", "bench",
+						"size", "threads", "ops/sec", "p50(us)", "p99(us)");
+			printf("%-18s %-20s %8u %7d %12.1f %10.2f %10.2f\n", curve, name,
+					size, threads, per_sec, p50, p99);
+	}
+	results++;
+	fflush(stdout);
+}
+
+static void run_bench(const struct bench *bench, struct curve_params *cp,
+		ECC_State state, ECC_KeyPair keypair, unsigned int size,
+		int threads, double seconds)
+{
+	struct bench_thread t[threads];
+	pthread_barrier_t barrier;
+	unsigned long long *all, elapsed = 0;
+	int i, n = 0;
+
+	pthread_barrier_init(&barrier, NULL, threads);
+	for (i = 0; i < threads; i++) {
+		ctx_init(&t[i].ctx, cp, state, keypair, size);
+		t[i].bench = bench;
+		t[i].barrier = &barrier;
+		t[i].seconds = seconds;
+		t[i].count = 0;
+		if (!(t[i].samples = malloc(sizeof(unsigned long long) * MAX_SAMPLES))) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+	for (i = 1; i < threads; i++)
+		pthread_create(&t[i].thread, NULL, bench_thread, &t[i]);
+	bench_thread(&t[0]);
+	for (i = 1; i < threads; i++)
+		pthread_join(t[i].thread, NULL);
+	pthread_barrier_destroy(&barrier);
+
+	for (i = 0; i < threads; i++) {
+		n += t[i].count;
+		if (t[i].elapsed > elapsed)
+			elapsed = t[i].elapsed;
+	}
+	all = malloc(sizeof(unsigned long long) * n);
+	for (i = 0, n = 0; i < threads; i++) {
+		memcpy(all + n, t[i].samples, sizeof(unsigned long long) * t[i].count);
+		n += t[i].count;
+		free(t[i].samples);
+		ctx_release(&t[i].ctx);
+	}
+	qsort(all, n, sizeof(unsigned long long), compare_samples);
+
+	report(cp->name, bench->name, size, threads, n, n / (elapsed / 1e9),
+			all[n / 2] / 1e3, all[(int)(n * 0.99)] / 1e3);
+	free(all);
+}
+
+/*
+ * Parse a list like "1,2,4" into `values`
+ */
+static int parse_list(const char *arg, unsigned int *values, int max)
+{
+	char *end;
+	int n = 0;
+
+	while ( (*arg) && (n < max) ) {
+		values[n++] = (unsigned int)(strtoul(arg, &end, 10));
+		if ( (end == arg) || ((*end) && (*end != ',')) )
+			return -1;
+		arg = (*end) ? end + 1 : end;
+	}
+	return n;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "bench [-c curve] [-b bench] [-t seconds] [-j threads,...]\n"
+			"      [-s size,...] [-f text|csv|json]\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *curve = NULL, *only = NULL, *name;
+	unsigned int threads[MAX_SIZES] = { 1 }, sizes[MAX_SIZES] = { 64, 4096, 1 << 20 };
+	int nthreads = 1, nsizes = 3, i, j, k, s, opt;
+	double seconds = 0.2;
+
+	while ((opt = getopt(argc, argv, "c:b:t:j:s:f:h")) != -1) {
+		switch (opt) {
+			case 'c': curve = optarg; break;
+			case 'b': only = optarg; break;
+			case 't':
+				if ((seconds = atof(optarg)) <= 0)
+					usage();
+				break;
+			case 'j':
+				nthreads = parse_list(optarg, threads, MAX_SIZES);
+				for (i = 0; i < nthreads; i++)
+					if ( (threads[i] < 1) || (threads[i] > MAX_THREADS) )
+						usage();
+				if (nthreads < 1)
+					usage();
+				break;
+			case 's':
+				if ((nsizes = parse_list(optarg, sizes, MAX_SIZES)) < 1)
+					usage();
+				break;
+			case 'f':
+				if (!strcmp(optarg, "csv"))
+					format = OUTPUT_CSV;
+				else if (!strcmp(optarg, "json"))
+					format = OUTPUT_JSON;
+				else if (!strcmp(optarg, "text"))
+					format = OUTPUT_TEXT;
+				else
+					usage();
+				break;
+			default:
+				usage();
+		}
+	}
+
+	for (i = 0; (name = curve_name(i)); i++) {
+		ECC_Options opts;
+		ECC_State state;
+		ECC_KeyPair keypair;
+		struct curve_params *cp;
+
+		if ( (curve) && (!strstr(name, curve)) )
+			continue;
+
+		/* The state sets up libgcrypt for the primitives as well */
+		opts = ecc_new_options();
+		opts->curve = (char *)(name);
+		if ( (!(state = ecc_new_state(opts))) ||
+				(!(keypair = ecc_keygen(NULL, state))) ) {
+			fprintf(stderr, "Cannot set up %s\n", name);
+			return 1;
+		}
+		cp = state->curveparams;
+
+		for (j = 0; benches[j].name; j++) {
+			if ( (only) && (!strstr(benches[j].name, only)) )
+				continue;
+			for (s = 0; s < (benches[j].sized ? nsizes : 1); s++)
+				for (k = 0; k < nthreads; k++)
+					run_bench(&benches[j], cp, state, keypair,
+							benches[j].sized ? sizes[s] : 0,
+							(int)(threads[k]), seconds);
+		}
+
+		free(keypair->pub);
+		ecc_free_keypair(keypair);
+		ecc_free_state(state);
+	}
+
+	if (format == OUTPUT_JSON)
+		printf(results ? "\n]\n" : "[]\n");
+	return 0;
+}
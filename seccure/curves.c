@@ -37,6 +37,7 @@
  */
 
 #include <gcrypt.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -130,13 +131,14 @@ static const struct curve curves[CURVE_NUM] = {
 
 /******************************************************************************/
 
+/* The curve parameters are public, they stay out of secure memory like the
+   tables computed from them                                               */
 static void SCAN(gcry_mpi_t *x, const char *s)
 {
 	if (gcry_mpi_scan(x, GCRYMPI_FMT_HEX, s, 0, NULL) != 0) {
 		fprintf(stderr, "Error scanning curve into MPI: %s\n", s);
 		return;
 	}
-	gcry_mpi_set_flag(*x, GCRYMPI_FLAG_SECURE);
 }
 
 static struct curve_params* load_curve(const struct curve *c)
@@ -161,6 +163,14 @@ static struct curve_params* load_curve(const struct curve *c)
 
   h = gcry_mpi_new(0);
 
+  gcry_mpi_add_ui(h, dp->a, 3);
+  if (! gcry_mpi_cmp(h, dp->m))
+    dp->a_type = CURVE_A_MINUS_3;
+  else if (! gcry_mpi_cmp_ui(dp->a, 0))
+    dp->a_type = CURVE_A_ZERO;
+  else
+    dp->a_type = CURVE_A_GENERIC;
+
   gcry_mpi_add(h, dp->m, dp->m);
   gcry_mpi_sub_ui(h, h, 1);
   cp->pk_len_bin = get_serialization_len(h, DF_BIN);
@@ -183,6 +193,11 @@ static struct curve_params* load_curve(const struct curve *c)
   cp->elem_len_bin = get_serialization_len(dp->m, DF_BIN);
   cp->order_len_bin = get_serialization_len(dp->order, DF_BIN);
 
+  root_params_init(&dp->root, dp->m);
+  if ((dp->field = field_new(dp->m)))
+    field_from_mpi(dp->field, dp->fa, dp->a);
+  dp->bt = base_table_new(dp);
+
 #if 0   /* enable this when adding a new curve to do some sanity checks */
   if (! gcry_mpi_cmp_ui(dp->b, 0)) {
     fprintf(stderr, "FATAL: b == 0\n");
@@ -228,6 +243,11 @@ struct curve_params* curve_by_name(const char *name)
   return NULL;
 }
 
+const char* curve_name(int i)
+{
+  return (i >= 0 && i < CURVE_NUM) ? curves[i].name : NULL;
+}
+
 struct curve_params* curve_by_pk_len_compact(int len)
 {
   const struct curve *c = curves;
@@ -238,6 +258,28 @@ struct curve_params* curve_by_pk_len_compact(int len)
   return NULL;
 }
 
+/* A process wide registry of the curves above.  Every entry is loaded the
+   first time it is asked for, along with its base point tables, and stays
+   read-only afterwards.  Callers only borrow it, so they must not hand it
+   to curve_release().                                                      */
+static struct curve_params *registry[CURVE_NUM];
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct curve_params* curve_shared_by_name(const char *name)
+{
+  struct curve_params *cp = NULL;
+  int i;
+  for(i = 0; i < CURVE_NUM; i++)
+    if (strstr(curves[i].name, name)) {
+      pthread_mutex_lock(&registry_lock);
+      if (! (cp = registry[i]))
+	cp = registry[i] = load_curve(&curves[i]);
+      pthread_mutex_unlock(&registry_lock);
+      break;
+    }
+  return cp;
+}
+
 void curve_release(struct curve_params *cp)
 {
   struct domain_params *dp = &cp->dp;
@@ -247,5 +289,10 @@ void curve_release(struct curve_params *cp)
   gcry_mpi_release(dp->order);
   gcry_mpi_release(dp->base.x);
   gcry_mpi_release(dp->base.y);
+  if (dp->bt)
+    base_table_release(dp->bt);
+  if (dp->field)
+    field_release(dp->field);
+  root_params_release(&dp->root);
   free(cp);
 }
@@ -53,6 +53,9 @@ struct curve_params {
 
 struct curve_params* curve_by_name(const char *name);
 struct curve_params* curve_by_pk_len_compact(int len);
+const char* curve_name(int i);
 void curve_release(struct curve_params *cp);
 
+struct curve_params* curve_shared_by_name(const char *name);
+
 #endif /* INC_CURVES_H */
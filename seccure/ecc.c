@@ -38,10 +38,17 @@
 
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 #include <gcrypt.h>
 
 #include "ecc.h"
 #include "numtheory.h"
+#include "stats.h"
+
+#ifdef ECC_STATS
+__thread struct stats_counters stats_thread;
+#endif
 
 /******************************************************************************/
 
@@ -55,6 +62,31 @@ struct affine_point point_new(void)
   return r;
 }
 
+/* For results that need not be kept secret, like public keys              */
+static struct affine_point point_new_public(void)
+{
+  struct affine_point r;
+  r.x = gcry_mpi_new(0);
+  r.y = gcry_mpi_new(0);
+  return r;
+}
+
+/* gcry_mpi_set() hands the flags of u over to w as well, loading a public
+   value into a secret w would let w grow out of secure memory later on.
+   Adding zero copies the value only and leaves w where it was allocated. */
+static void mpi_load(gcry_mpi_t w, const gcry_mpi_t u)
+{
+  gcry_mpi_add_ui(w, u, 0);
+}
+
+/* A temporary for computations on x, in secure memory only if x is      */
+static gcry_mpi_t mpi_new_like(const gcry_mpi_t x)
+{
+  if (gcry_mpi_get_flag(x, GCRYMPI_FLAG_SECURE))
+    return gcry_mpi_snew(0);
+  return gcry_mpi_new(0);
+}
+
 void point_release(struct affine_point *p)
 {
   gcry_mpi_release(p->x);
@@ -65,8 +97,8 @@ void point_release(struct affine_point *p)
 
 void point_set(struct affine_point *p1, const struct affine_point *p2)
 {
-  gcry_mpi_set(p1->x, p2->x);
-  gcry_mpi_set(p1->y, p2->y);
+  mpi_load(p1->x, p2->x);
+  mpi_load(p1->y, p2->y);
 }
 
 void point_load_zero(struct affine_point *p)
@@ -85,8 +117,8 @@ int point_on_curve(const struct affine_point *p, const struct domain_params *dp)
   int res;
   if (! (res = point_is_zero(p))) {
     gcry_mpi_t h1, h2;
-    h1 = gcry_mpi_snew(0);
-    h2 = gcry_mpi_snew(0);
+    h1 = mpi_new_like(p->x);
+    h2 = mpi_new_like(p->y);
     gcry_mpi_mulm(h1, p->x, p->x, dp->m);
     gcry_mpi_addm(h1, h1, dp->a, dp->m);
     gcry_mpi_mulm(h1, h1, p->x, dp->m);
@@ -104,28 +136,84 @@ int point_compress(const struct affine_point *p)
   return gcry_mpi_test_bit(p->y, 0);
 }
 
+/* y = sqrt(x^3 + ax + b) on the native field backend, the same strategies
+   as in mod_root_fast()                                                    */
+static int fpoint_root(gcry_mpi_t y, const gcry_mpi_t x,
+		       const struct domain_params *dp)
+{
+  const struct field *f = dp->field;
+  const struct root_params *rp = &dp->root;
+  field_elem fx, h, t, b, c, one;
+  int i, m, r, res = 1;
+  field_from_mpi(f, fx, x);
+  field_sqr(f, h, fx);
+  field_add(f, h, h, dp->fa);
+  field_mul(f, h, h, fx);
+  field_from_mpi(f, t, dp->b);
+  field_add(f, h, h, t);
+  if (rp->type == ROOT_3MOD4) {
+    field_pow(f, fx, h, rp->e);
+    field_sqr(f, t, fx);
+    res = field_equal(f, t, h);
+  }
+  else if (! field_is_zero(f, h)) {
+    field_set_ui(f, one, 1);
+    field_from_mpi(f, c, rp->y);
+    field_pow(f, b, h, rp->e);
+    field_mul(f, fx, h, b);
+    field_mul(f, b, b, fx);
+    r = rp->r;
+    while (! field_equal(f, b, one)) {
+      field_sqr(f, t, b);
+      for(m = 1; ! field_equal(f, t, one); m++)
+	field_sqr(f, t, t);
+      if (m >= r) {
+	res = 0;
+	break;
+      }
+      field_set(f, t, c);
+      for(i = 0; i < r - m - 1; i++)
+	field_sqr(f, t, t);
+      field_sqr(f, c, t);
+      r = m;
+      field_mul(f, fx, fx, t);
+      field_mul(f, b, b, c);
+    }
+  }
+  else
+    field_set_ui(f, fx, 0);
+  if (res)
+    field_to_mpi(f, y, fx);
+  return res;
+}
+
 int point_decompress(struct affine_point *p, const gcry_mpi_t x, int yflag, 
 		     const struct domain_params *dp)
 {
   gcry_mpi_t h, y;
-  int res, rc;
-  h = gcry_mpi_snew(0);
-  y = gcry_mpi_snew(0);
-  gcry_mpi_mulm(h, x, x, dp->m);
-  gcry_mpi_addm(h, h, dp->a, dp->m);
-  gcry_mpi_mulm(h, h, x, dp->m);
-  gcry_mpi_addm(h, h, dp->b, dp->m);
-  if ((res = mod_root(y, h, dp->m)))
+  int res;
+  STATS_COUNT(decompress);
+  h = gcry_mpi_new(0);
+  y = gcry_mpi_new(0);
+  if (dp->field)
+    res = fpoint_root(y, x, dp);
+  else {
+    gcry_mpi_mulm(h, x, x, dp->m);
+    gcry_mpi_addm(h, h, dp->a, dp->m);
+    gcry_mpi_mulm(h, h, x, dp->m);
+    gcry_mpi_addm(h, h, dp->b, dp->m);
+    res = mod_root_fast(y, h, dp->m, &dp->root);
+  }
+  if (res)
     if ((res = (gcry_mpi_cmp_ui(y, 0) || ! yflag))) {
-      p->x = gcry_mpi_snew(0);
-      p->y = gcry_mpi_snew(0);
+      p->x = gcry_mpi_new(0);
+      p->y = gcry_mpi_new(0);
       gcry_mpi_set(p->x, x);
       if (gcry_mpi_test_bit(y, 0) == yflag)
 	gcry_mpi_set(p->y, y);
       else
 	gcry_mpi_sub(p->y, dp->m, y);
-    rc = point_on_curve(p, dp);
-    assert(rc);
+      assert(point_on_curve(p, dp));
     }
   gcry_mpi_release(h);
   gcry_mpi_release(y);
@@ -151,7 +239,7 @@ void point_double(struct affine_point *p, const struct domain_params *dp)
     gcry_mpi_subm(p->x, p->x, t2, dp->m);
     gcry_mpi_mulm(t1, t1, p->x, dp->m);
     gcry_mpi_subm(p->y, t1, p->y, dp->m);
-    gcry_mpi_set(p->x, t2);
+    mpi_load(p->x, t2);
     gcry_mpi_release(t1);
     gcry_mpi_release(t2);
   }
@@ -204,6 +292,16 @@ struct jacobian_point jacobian_new(void)
   return r;
 }
 
+/* For points that need not be kept secret, like multiples of the base */
+static struct jacobian_point jacobian_new_public(void)
+{
+  struct jacobian_point r;
+  r.x = gcry_mpi_new(0);
+  r.y = gcry_mpi_new(0);
+  r.z = gcry_mpi_new(0);
+  return r;
+}
+
 void jacobian_release(struct jacobian_point *p)
 {
   gcry_mpi_release(p->x);
@@ -215,14 +313,21 @@ void jacobian_load_affine(struct jacobian_point *p1,
 			  const struct affine_point *p2)
 {
   if (! point_is_zero(p2)) {
-    gcry_mpi_set(p1->x, p2->x);
-    gcry_mpi_set(p1->y, p2->y);
+    mpi_load(p1->x, p2->x);
+    mpi_load(p1->y, p2->y);
     gcry_mpi_set_ui(p1->z, 1);
   }
   else
     gcry_mpi_set_ui(p1->z, 0);
 }
 
+void jacobian_set(struct jacobian_point *p1, const struct jacobian_point *p2)
+{
+  mpi_load(p1->x, p2->x);
+  mpi_load(p1->y, p2->y);
+  mpi_load(p1->z, p2->z);
+}
+
 void jacobian_load_zero(struct jacobian_point *p)
 {
   gcry_mpi_set_ui(p->z, 0);
@@ -233,20 +338,69 @@ int jacobian_is_zero(const struct jacobian_point *p)
   return ! gcry_mpi_cmp_ui(p->z, 0);
 }
 
-void jacobian_double(struct jacobian_point *p, const struct domain_params *dp)
+/* The temporaries of the point arithmetic below.  A scalar multiplication
+   sets up one scratch area, sized for the double length products, and
+   hands it to all of its doublings and additions instead of having each of
+   them take a few MPIs from the secure memory pool and give them back.  */
+#define SCRATCH_MPIS 5
+
+struct mpi_scratch {
+  gcry_mpi_t t[SCRATCH_MPIS];
+};
+
+static void scratch_init(struct mpi_scratch *s, const struct domain_params *dp)
+{
+  int i;
+  for(i = 0; i < SCRATCH_MPIS; i++)
+    s->t[i] = gcry_mpi_snew(2 * gcry_mpi_get_nbits(dp->m));
+}
+
+/* For the multiplications that only involve public values, verifications
+   and the tables of odd multiples                                        */
+static void scratch_init_public(struct mpi_scratch *s,
+				const struct domain_params *dp)
+{
+  int i;
+  for(i = 0; i < SCRATCH_MPIS; i++)
+    s->t[i] = gcry_mpi_new(2 * gcry_mpi_get_nbits(dp->m));
+}
+
+static void scratch_release(struct mpi_scratch *s)
+{
+  int i;
+  for(i = 0; i < SCRATCH_MPIS; i++)
+    gcry_mpi_release(s->t[i]);
+}
+
+static void sjacobian_double(struct jacobian_point *p, struct mpi_scratch *s,
+			     const struct domain_params *dp)
 {
   if (gcry_mpi_cmp_ui(p->z, 0)) {
     if (gcry_mpi_cmp_ui(p->y, 0)) {
-      gcry_mpi_t t1, t2;
-      t1 = gcry_mpi_snew(0);
-      t2 = gcry_mpi_snew(0);
-      gcry_mpi_mulm(t1, p->x, p->x, dp->m);
-      gcry_mpi_addm(t2, t1, t1, dp->m);
-      gcry_mpi_addm(t2, t2, t1, dp->m);
-      gcry_mpi_mulm(t1, p->z, p->z, dp->m);
-      gcry_mpi_mulm(t1, t1, t1, dp->m);
-      gcry_mpi_mulm(t1, t1, dp->a, dp->m);
-      gcry_mpi_addm(t1, t1, t2, dp->m);
+      gcry_mpi_t t1 = s->t[0], t2 = s->t[1];
+      switch (dp->a_type) {
+      case CURVE_A_MINUS_3:   /* 3 X^2 - 3 Z^4 = 3 (X - Z^2) (X + Z^2) */
+	gcry_mpi_mulm(t1, p->z, p->z, dp->m);
+	gcry_mpi_subm(t2, p->x, t1, dp->m);
+	gcry_mpi_addm(t1, p->x, t1, dp->m);
+	gcry_mpi_mulm(t2, t2, t1, dp->m);
+	gcry_mpi_addm(t1, t2, t2, dp->m);
+	gcry_mpi_addm(t1, t1, t2, dp->m);
+	break;
+      case CURVE_A_ZERO:
+	gcry_mpi_mulm(t2, p->x, p->x, dp->m);
+	gcry_mpi_addm(t1, t2, t2, dp->m);
+	gcry_mpi_addm(t1, t1, t2, dp->m);
+	break;
+      default:
+	gcry_mpi_mulm(t1, p->x, p->x, dp->m);
+	gcry_mpi_addm(t2, t1, t1, dp->m);
+	gcry_mpi_addm(t2, t2, t1, dp->m);
+	gcry_mpi_mulm(t1, p->z, p->z, dp->m);
+	gcry_mpi_mulm(t1, t1, t1, dp->m);
+	gcry_mpi_mulm(t1, t1, dp->a, dp->m);
+	gcry_mpi_addm(t1, t1, t2, dp->m);
+      }
       gcry_mpi_mulm(p->z, p->z, p->y, dp->m);
       gcry_mpi_addm(p->z, p->z, p->z, dp->m);
       gcry_mpi_mulm(p->y, p->y, p->y, dp->m);
@@ -261,35 +415,39 @@ void jacobian_double(struct jacobian_point *p, const struct domain_params *dp)
       gcry_mpi_mulm(t2, p->y, p->y, dp->m);
       gcry_mpi_addm(t2, t2, t2, dp->m);
       gcry_mpi_subm(p->y, t1, t2, dp->m);
-      gcry_mpi_release(t1);
-      gcry_mpi_release(t2);
     }
     else
       gcry_mpi_set_ui(p->z, 0);
   }
 }
 
-void jacobian_affine_point_add(struct jacobian_point *p1, 
-			       const struct affine_point *p2,
-			       const struct domain_params *dp)
+void jacobian_double(struct jacobian_point *p, const struct domain_params *dp)
+{
+  struct mpi_scratch s;
+  scratch_init(&s, dp);
+  sjacobian_double(p, &s, dp);
+  scratch_release(&s);
+}
+
+static void sjacobian_affine_point_add(struct jacobian_point *p1, 
+				       const struct affine_point *p2,
+				       struct mpi_scratch *s,
+				       const struct domain_params *dp)
 {
   if (! point_is_zero(p2)) {
     if (gcry_mpi_cmp_ui(p1->z, 0)) {
-      gcry_mpi_t t1, t2, t3;
-      t1 = gcry_mpi_snew(0);
-      t2 = gcry_mpi_snew(0);
+      gcry_mpi_t t1 = s->t[0], t2 = s->t[1], t3 = s->t[2];
       gcry_mpi_mulm(t1, p1->z, p1->z, dp->m);
       gcry_mpi_mulm(t2, t1, p2->x, dp->m);
       gcry_mpi_mulm(t1, t1, p1->z, dp->m);
       gcry_mpi_mulm(t1, t1, p2->y, dp->m);
       if (! gcry_mpi_cmp(p1->x, t2)) {
 	if (! gcry_mpi_cmp(p1->y, t1))
-	  jacobian_double(p1, dp);
+	  sjacobian_double(p1, s, dp);
 	else
 	  jacobian_load_zero(p1);
       }
       else {
-	t3 = gcry_mpi_snew(0);
 	gcry_mpi_subm(p1->x, p1->x, t2, dp->m);
 	gcry_mpi_subm(p1->y, p1->y, t1, dp->m);
 	gcry_mpi_mulm(p1->z, p1->z, p1->x, dp->m);
@@ -304,35 +462,612 @@ void jacobian_affine_point_add(struct jacobian_point *p1,
 	gcry_mpi_subm(t2, t2, p1->x, dp->m);
 	gcry_mpi_mulm(p1->y, p1->y, t2, dp->m);
 	gcry_mpi_subm(p1->y, p1->y, t1, dp->m);
-	gcry_mpi_release(t3);
       }
-      gcry_mpi_release(t1);
-      gcry_mpi_release(t2);
     }
     else
       jacobian_load_affine(p1, p2);
   }
 }
 
-struct affine_point jacobian_to_affine(const struct jacobian_point *p,
-				       const struct domain_params *dp)
+void jacobian_affine_point_add(struct jacobian_point *p1, 
+			       const struct affine_point *p2,
+			       const struct domain_params *dp)
+{
+  struct mpi_scratch s;
+  scratch_init(&s, dp);
+  sjacobian_affine_point_add(p1, p2, &s, dp);
+  scratch_release(&s);
+}
+
+static void sjacobian_point_add(struct jacobian_point *p1,
+				const struct jacobian_point *p2,
+				struct mpi_scratch *s,
+				const struct domain_params *dp)
+{
+  if (gcry_mpi_cmp_ui(p2->z, 0)) {
+    if (gcry_mpi_cmp_ui(p1->z, 0)) {
+      gcry_mpi_t t1 = s->t[0], t2 = s->t[1], t3 = s->t[2], t4 = s->t[3];
+      gcry_mpi_t t5 = s->t[4];
+      gcry_mpi_mulm(t1, p2->z, p2->z, dp->m);
+      gcry_mpi_mulm(t3, p1->x, t1, dp->m);
+      gcry_mpi_mulm(t1, t1, p2->z, dp->m);
+      gcry_mpi_mulm(t1, t1, p1->y, dp->m);
+      gcry_mpi_mulm(t2, p1->z, p1->z, dp->m);
+      gcry_mpi_mulm(t4, p2->x, t2, dp->m);
+      gcry_mpi_mulm(t2, t2, p1->z, dp->m);
+      gcry_mpi_mulm(t2, t2, p2->y, dp->m);
+      if (! gcry_mpi_cmp(t3, t4)) {
+	if (! gcry_mpi_cmp(t1, t2))
+	  sjacobian_double(p1, s, dp);
+	else
+	  jacobian_load_zero(p1);
+      }
+      else {
+	gcry_mpi_subm(t4, t4, t3, dp->m);
+	gcry_mpi_subm(t2, t2, t1, dp->m);
+	gcry_mpi_mulm(p1->z, p1->z, p2->z, dp->m);
+	gcry_mpi_mulm(p1->z, p1->z, t4, dp->m);
+	gcry_mpi_mulm(t5, t4, t4, dp->m);
+	gcry_mpi_mulm(t3, t3, t5, dp->m);
+	gcry_mpi_mulm(t5, t5, t4, dp->m);
+	gcry_mpi_mulm(p1->x, t2, t2, dp->m);
+	gcry_mpi_subm(p1->x, p1->x, t5, dp->m);
+	gcry_mpi_subm(p1->x, p1->x, t3, dp->m);
+	gcry_mpi_subm(p1->x, p1->x, t3, dp->m);
+	gcry_mpi_subm(t3, t3, p1->x, dp->m);
+	gcry_mpi_mulm(t3, t3, t2, dp->m);
+	gcry_mpi_mulm(t1, t1, t5, dp->m);
+	gcry_mpi_subm(p1->y, t3, t1, dp->m);
+      }
+    }
+    else
+      jacobian_set(p1, p2);
+  }
+}
+
+void jacobian_point_add(struct jacobian_point *p1,
+			const struct jacobian_point *p2,
+			const struct domain_params *dp)
+{
+  struct mpi_scratch s;
+  scratch_init(&s, dp);
+  sjacobian_point_add(p1, p2, &s, dp);
+  scratch_release(&s);
+}
+
+static void jacobian_store_affine(struct affine_point *r,
+				  const struct jacobian_point *p,
+				  const struct domain_params *dp)
 {
-  struct affine_point r = point_new();
   if (gcry_mpi_cmp_ui(p->z, 0)) {
     gcry_mpi_t h;
-    h = gcry_mpi_snew(0);
+    h = mpi_new_like(r->x);
     gcry_mpi_invm(h, p->z, dp->m);
-    gcry_mpi_mulm(r.y, h, h, dp->m);
-    gcry_mpi_mulm(r.x, p->x, r.y, dp->m);
-    gcry_mpi_mulm(r.y, r.y, h, dp->m);
-    gcry_mpi_mulm(r.y, r.y, p->y, dp->m);
+    gcry_mpi_mulm(r->y, h, h, dp->m);
+    gcry_mpi_mulm(r->x, p->x, r->y, dp->m);
+    gcry_mpi_mulm(r->y, r->y, h, dp->m);
+    gcry_mpi_mulm(r->y, r->y, p->y, dp->m);
     gcry_mpi_release(h);
   }
+  else
+    point_load_zero(r);
+}
+
+struct affine_point jacobian_to_affine(const struct jacobian_point *p,
+				       const struct domain_params *dp)
+{
+  struct affine_point r = point_new();
+  jacobian_store_affine(&r, p, dp);
+  return r;
+}
+
+/* Section 2.2.2 in the "Guide to Elliptic Curve Cryptography": n points
+   share one inversion at the cost of 3(n - 1) extra multiplications       */
+static void jacobian_store_affine_chunk(struct affine_point *r,
+					const struct jacobian_point *p, int n,
+					const struct domain_params *dp)
+{
+  gcry_mpi_t c[n], h, zi;
+  int i;
+  if (n <= 0)
+    return;
+  for(i = 0; i < n; i++) {
+    c[i] = mpi_new_like(r[0].x);
+    if (i && ! jacobian_is_zero(&p[i]))
+      gcry_mpi_mulm(c[i], c[i - 1], p[i].z, dp->m);
+    else if (i)
+      gcry_mpi_set(c[i], c[i - 1]);
+    else if (! jacobian_is_zero(&p[i]))
+      gcry_mpi_set(c[i], p[i].z);
+    else
+      gcry_mpi_set_ui(c[i], 1);
+  }
+  h = mpi_new_like(r[0].x);
+  zi = mpi_new_like(r[0].x);
+  gcry_mpi_invm(h, c[n - 1], dp->m);
+  for(i = n - 1; i >= 0; i--) {
+    if (jacobian_is_zero(&p[i])) {
+      point_load_zero(&r[i]);
+      continue;
+    }
+    if (i) {
+      gcry_mpi_mulm(zi, h, c[i - 1], dp->m);
+      gcry_mpi_mulm(h, h, p[i].z, dp->m);
+    }
+    else
+      gcry_mpi_set(zi, h);
+    gcry_mpi_mulm(r[i].y, zi, zi, dp->m);
+    gcry_mpi_mulm(r[i].x, p[i].x, r[i].y, dp->m);
+    gcry_mpi_mulm(r[i].y, r[i].y, zi, dp->m);
+    gcry_mpi_mulm(r[i].y, r[i].y, p[i].y, dp->m);
+  }
+  for(i = 0; i < n; i++)
+    gcry_mpi_release(c[i]);
+  gcry_mpi_release(h);
+  gcry_mpi_release(zi);
+}
+
+static void jacobian_store_affine_batch(struct affine_point *r,
+					const struct jacobian_point *p, int n,
+					const struct domain_params *dp)
+{
+  for(; n > POINT_BATCH_MAX; r += POINT_BATCH_MAX, p += POINT_BATCH_MAX,
+	n -= POINT_BATCH_MAX)
+    jacobian_store_affine_chunk(r, p, POINT_BATCH_MAX, dp);
+  jacobian_store_affine_chunk(r, p, n, dp);
+}
+
+void jacobian_to_affine_batch(struct affine_point *r,
+			      const struct jacobian_point *p, int n,
+			      const struct domain_params *dp)
+{
+  int i;
+  if (n <= 0)
+    return;
+  for(i = 0; i < n; i++)
+    r[i] = point_new();
+  jacobian_store_affine_batch(r, p, n, dp);
+}
+
+/******************************************************************************/
+
+/* The point arithmetic of above on the native field backend, the caller
+   makes sure that dp->field is set                                         */
+
+static void fpoint_load(struct field_point *r, const struct affine_point *p,
+			const struct domain_params *dp)
+{
+  field_from_mpi(dp->field, r->x, p->x);
+  field_from_mpi(dp->field, r->y, p->y);
+}
+
+static int fpoint_is_zero(const struct field_point *p,
+			  const struct domain_params *dp)
+{
+  return field_is_zero(dp->field, p->x) && field_is_zero(dp->field, p->y);
+}
+
+static void fpoint_negate(struct field_point *r, const struct field_point *p,
+			  const struct domain_params *dp)
+{
+  field_set(dp->field, r->x, p->x);
+  field_neg(dp->field, r->y, p->y);
+}
+
+static void fjacobian_load_affine(struct field_jacobian *r,
+				  const struct field_point *p,
+				  const struct domain_params *dp)
+{
+  if (! fpoint_is_zero(p, dp)) {
+    field_set(dp->field, r->x, p->x);
+    field_set(dp->field, r->y, p->y);
+    field_set_ui(dp->field, r->z, 1);
+  }
+  else
+    field_set_ui(dp->field, r->z, 0);
+}
+
+static void fjacobian_double(struct field_jacobian *p,
+			     const struct domain_params *dp)
+{
+  const struct field *f = dp->field;
+  field_elem t1, t2;
+  if (! field_is_zero(f, p->z)) {
+    if (! field_is_zero(f, p->y)) {
+      switch (dp->a_type) {
+      case CURVE_A_MINUS_3:
+	field_sqr(f, t1, p->z);
+	field_sub(f, t2, p->x, t1);
+	field_add(f, t1, p->x, t1);
+	field_mul(f, t2, t2, t1);
+	field_add(f, t1, t2, t2);
+	field_add(f, t1, t1, t2);
+	break;
+      case CURVE_A_ZERO:
+	field_sqr(f, t2, p->x);
+	field_add(f, t1, t2, t2);
+	field_add(f, t1, t1, t2);
+	break;
+      default:
+	field_sqr(f, t1, p->x);
+	field_add(f, t2, t1, t1);
+	field_add(f, t2, t2, t1);
+	field_sqr(f, t1, p->z);
+	field_sqr(f, t1, t1);
+	field_mul(f, t1, t1, dp->fa);
+	field_add(f, t1, t1, t2);
+      }
+      field_mul(f, p->z, p->z, p->y);
+      field_add(f, p->z, p->z, p->z);
+      field_sqr(f, p->y, p->y);
+      field_add(f, p->y, p->y, p->y);
+      field_mul(f, t2, p->x, p->y);
+      field_add(f, t2, t2, t2);
+      field_sqr(f, p->x, t1);
+      field_sub(f, p->x, p->x, t2);
+      field_sub(f, p->x, p->x, t2);
+      field_sub(f, t2, t2, p->x);
+      field_mul(f, t1, t1, t2);
+      field_sqr(f, t2, p->y);
+      field_add(f, t2, t2, t2);
+      field_sub(f, p->y, t1, t2);
+    }
+    else
+      field_set_ui(f, p->z, 0);
+  }
+}
+
+static void fjacobian_affine_point_add(struct field_jacobian *p1,
+				       const struct field_point *p2,
+				       const struct domain_params *dp)
+{
+  const struct field *f = dp->field;
+  field_elem t1, t2, t3;
+  if (! fpoint_is_zero(p2, dp)) {
+    if (! field_is_zero(f, p1->z)) {
+      field_sqr(f, t1, p1->z);
+      field_mul(f, t2, t1, p2->x);
+      field_mul(f, t1, t1, p1->z);
+      field_mul(f, t1, t1, p2->y);
+      if (field_equal(f, p1->x, t2)) {
+	if (field_equal(f, p1->y, t1))
+	  fjacobian_double(p1, dp);
+	else
+	  field_set_ui(f, p1->z, 0);
+      }
+      else {
+	field_sub(f, p1->x, p1->x, t2);
+	field_sub(f, p1->y, p1->y, t1);
+	field_mul(f, p1->z, p1->z, p1->x);
+	field_sqr(f, t3, p1->x);
+	field_mul(f, t2, t2, t3);
+	field_mul(f, t3, t3, p1->x);
+	field_mul(f, t1, t1, t3);
+	field_sqr(f, p1->x, p1->y);
+	field_sub(f, p1->x, p1->x, t3);
+	field_sub(f, p1->x, p1->x, t2);
+	field_sub(f, p1->x, p1->x, t2);
+	field_sub(f, t2, t2, p1->x);
+	field_mul(f, p1->y, p1->y, t2);
+	field_sub(f, p1->y, p1->y, t1);
+      }
+    }
+    else
+      fjacobian_load_affine(p1, p2, dp);
+  }
+}
+
+static void fjacobian_point_add(struct field_jacobian *p1,
+				const struct field_jacobian *p2,
+				const struct domain_params *dp)
+{
+  const struct field *f = dp->field;
+  field_elem t1, t2, t3, t4, t5;
+  if (! field_is_zero(f, p2->z)) {
+    if (! field_is_zero(f, p1->z)) {
+      field_sqr(f, t1, p2->z);
+      field_mul(f, t3, p1->x, t1);
+      field_mul(f, t1, t1, p2->z);
+      field_mul(f, t1, t1, p1->y);
+      field_sqr(f, t2, p1->z);
+      field_mul(f, t4, p2->x, t2);
+      field_mul(f, t2, t2, p1->z);
+      field_mul(f, t2, t2, p2->y);
+      if (field_equal(f, t3, t4)) {
+	if (field_equal(f, t1, t2))
+	  fjacobian_double(p1, dp);
+	else
+	  field_set_ui(f, p1->z, 0);
+      }
+      else {
+	field_sub(f, t4, t4, t3);
+	field_sub(f, t2, t2, t1);
+	field_mul(f, p1->z, p1->z, p2->z);
+	field_mul(f, p1->z, p1->z, t4);
+	field_sqr(f, t5, t4);
+	field_mul(f, t3, t3, t5);
+	field_mul(f, t5, t5, t4);
+	field_sqr(f, p1->x, t2);
+	field_sub(f, p1->x, p1->x, t5);
+	field_sub(f, p1->x, p1->x, t3);
+	field_sub(f, p1->x, p1->x, t3);
+	field_sub(f, t3, t3, p1->x);
+	field_mul(f, t3, t3, t2);
+	field_mul(f, t1, t1, t5);
+	field_sub(f, p1->y, t3, t1);
+      }
+    }
+    else
+      *p1 = *p2;
+  }
+}
+
+/* Like jacobian_store_affine_batch(), the zero point becomes (0, 0).  The
+   inversion runs in secure memory unless the points are public.            */
+static void fjacobian_store_affine_chunk(struct field_point *r,
+					 const struct field_jacobian *p, int n,
+					 int secure,
+					 const struct domain_params *dp)
+{
+  const struct field *f = dp->field;
+  field_elem c[n], h, zi;
+  int i;
+  if (! n)
+    return;
+  if (! field_is_zero(f, p[0].z))
+    field_set(f, c[0], p[0].z);
+  else
+    field_set_ui(f, c[0], 1);
+  for(i = 1; i < n; i++) {
+    if (! field_is_zero(f, p[i].z))
+      field_mul(f, c[i], c[i - 1], p[i].z);
+    else
+      field_set(f, c[i], c[i - 1]);
+  }
+  field_inv(f, h, c[n - 1], secure);
+  for(i = n - 1; i >= 0; i--) {
+    if (field_is_zero(f, p[i].z)) {
+      field_set_ui(f, r[i].x, 0);
+      field_set_ui(f, r[i].y, 0);
+      continue;
+    }
+    if (i) {
+      field_mul(f, zi, h, c[i - 1]);
+      field_mul(f, h, h, p[i].z);
+    }
+    else
+      field_set(f, zi, h);
+    field_sqr(f, r[i].y, zi);
+    field_mul(f, r[i].x, p[i].x, r[i].y);
+    field_mul(f, r[i].y, r[i].y, zi);
+    field_mul(f, r[i].y, r[i].y, p[i].y);
+  }
+  memset(c, 0, sizeof(c));
+  memset(h, 0, sizeof(h));
+  memset(zi, 0, sizeof(zi));
+}
+
+static void fjacobian_store_affine_batch(struct field_point *r,
+					 const struct field_jacobian *p, int n,
+					 int secure,
+					 const struct domain_params *dp)
+{
+  for(; n > POINT_BATCH_MAX; r += POINT_BATCH_MAX, p += POINT_BATCH_MAX,
+	n -= POINT_BATCH_MAX)
+    fjacobian_store_affine_chunk(r, p, POINT_BATCH_MAX, secure, dp);
+  fjacobian_store_affine_chunk(r, p, n, secure, dp);
+}
+
+static void fjacobian_store_affine(struct affine_point *r,
+				   const struct field_jacobian *p,
+				   const struct domain_params *dp)
+{
+  struct field_point h;
+  fjacobian_store_affine_batch(&h, p, 1, 
+			       gcry_mpi_get_flag(r->x, GCRYMPI_FLAG_SECURE), dp);
+  field_to_mpi(dp->field, r->x, h.x);
+  field_to_mpi(dp->field, r->y, h.y);
+  memset(&h, 0, sizeof(h));
+}
+
+static struct affine_point fjacobian_to_affine(const struct field_jacobian *p,
+					       const struct domain_params *dp)
+{
+  struct affine_point r = point_new();
+  fjacobian_store_affine(&r, p, dp);
   return r;
 }
 
 /******************************************************************************/
 
+/* Algorithms 3.35 and 3.36 in the "Guide to Elliptic Curve Cryptography"    */
+
+/* Stores the width-w NAF digits of exp in naf (least significant first,
+   at most nbits(exp) + 1 of them) and returns their number.  v is the
+   current w-bit window of exp plus the carry of the previous digits.      */
+static int wnaf_recode(signed char *naf, const gcry_mpi_t exp, int w)
+{
+  int n = gcry_mpi_get_nbits(exp);
+  int i, j, d, v = 0;
+  for(j = w - 1; j >= 0; j--)
+    v = (v << 1) | !! gcry_mpi_test_bit(exp, j);
+  for(i = 0; i < n || v; i++) {
+    d = 0;
+    if (v & 1) {
+      d = (v & (1 << (w - 1))) ? v - (1 << w) : v;
+      v -= d;
+    }
+    naf[i] = d;
+    v >>= 1;
+    v += !! gcry_mpi_test_bit(exp, i + w) << (w - 1);
+  }
+  return i;
+}
+
+static void point_negate(struct affine_point *r, const struct affine_point *p,
+			 const struct domain_params *dp)
+{
+  mpi_load(r->x, p->x);
+  if (gcry_mpi_cmp_ui(p->y, 0))
+    gcry_mpi_sub(r->y, dp->m, p->y);
+  else
+    gcry_mpi_set_ui(r->y, 0);
+}
+
+/* T[i] = (2i + 1) P and T[count + i] = -(2i + 1) P for i < count.  The
+   multiples are summed up in Jacobian coordinates and brought back to
+   affine form with a single inversion (Montgomery's trick).               */
+static void odd_multiples(struct affine_point *T, int count,
+			  const struct affine_point *p,
+			  const struct domain_params *dp)
+{
+  struct jacobian_point J[count], p2;
+  struct mpi_scratch s;
+  int i;
+  for(i = 0; i < count; i++)
+    J[i] = jacobian_new_public();
+  p2 = jacobian_new_public();
+  scratch_init_public(&s, dp);
+  jacobian_load_affine(&J[0], p);
+  jacobian_set(&p2, &J[0]);
+  sjacobian_double(&p2, &s, dp);
+  for(i = 1; i < count; i++) {
+    jacobian_set(&J[i], &J[i - 1]);
+    sjacobian_point_add(&J[i], &p2, &s, dp);
+  }
+  scratch_release(&s);
+  jacobian_store_affine_batch(T, J, count, dp);
+  for(i = 0; i < count; i++) {
+    point_negate(&T[count + i], &T[i], dp);
+    jacobian_release(&J[i]);
+  }
+  jacobian_release(&p2);
+}
+
+/* Adds the entry for the NAF digit d from a table built by odd_multiples */
+static void wnaf_add(struct jacobian_point *r, const struct affine_point *T,
+		     int count, int d, struct mpi_scratch *s,
+		     const struct domain_params *dp)
+{
+  if (d > 0)
+    sjacobian_affine_point_add(r, &T[d / 2], s, dp);
+  else if (d < 0)
+    sjacobian_affine_point_add(r, &T[count - d / 2], s, dp);
+}
+
+static void fodd_multiples(struct field_point *T, int count,
+			   const struct field_point *p,
+			   const struct domain_params *dp)
+{
+  struct field_jacobian J[count], p2;
+  int i;
+  fjacobian_load_affine(&J[0], p, dp);
+  p2 = J[0];
+  fjacobian_double(&p2, dp);
+  for(i = 1; i < count; i++) {
+    J[i] = J[i - 1];
+    fjacobian_point_add(&J[i], &p2, dp);
+  }
+  fjacobian_store_affine_batch(T, J, count, 0, dp);
+  for(i = 0; i < count; i++)
+    fpoint_negate(&T[count + i], &T[i], dp);
+  memset(J, 0, sizeof(J));
+  memset(&p2, 0, sizeof(p2));
+}
+
+static void fwnaf_add(struct field_jacobian *r, const struct field_point *T,
+		      int count, int d, const struct domain_params *dp)
+{
+  if (d > 0)
+    fjacobian_affine_point_add(r, &T[d / 2], dp);
+  else if (d < 0)
+    fjacobian_affine_point_add(r, &T[count - d / 2], dp);
+}
+
+/******************************************************************************/
+
+/* Tables of odd multiples for the wNAF methods.  A point that is multiplied
+   only once gets a table of width WNAF_WIDTH on the stack, one that is used
+   over and over again (a public key) can keep a wider table around.  The
+   entries are public and stay out of secure memory.                       */
+
+static void point_table_fill(struct point_table *pt,
+			     const struct domain_params *dp)
+{
+  int i;
+  if (pt->fodd) {
+    struct field_point P;
+    fpoint_load(&P, &pt->p, dp);
+    fodd_multiples(pt->fodd, pt->count, &P, dp);
+  }
+  else {
+    for(i = 0; i < 2 * pt->count; i++) {
+      pt->odd[i].x = gcry_mpi_new(0);
+      pt->odd[i].y = gcry_mpi_new(0);
+    }
+    odd_multiples(pt->odd, pt->count, &pt->p, dp);
+  }
+}
+
+static void point_table_clear(struct point_table *pt)
+{
+  int i;
+  if (pt->odd)
+    for(i = 0; i < 2 * pt->count; i++)
+      point_release(&pt->odd[i]);
+}
+
+/* Sets up pt in the caller's storage T or fT (2 * WNAF_POINTS entries),
+   pt->p is only borrowed from p.  Undo with point_table_clear().          */
+static void point_table_stack(struct point_table *pt,
+			      const struct affine_point *p,
+			      struct affine_point *T, struct field_point *fT,
+			      const struct domain_params *dp)
+{
+  pt->p = *p;
+  pt->width = WNAF_WIDTH;
+  pt->count = WNAF_POINTS;
+  pt->odd = dp->field ? NULL : T;
+  pt->fodd = dp->field ? fT : NULL;
+  point_table_fill(pt, dp);
+}
+
+struct point_table* point_table_new(const struct affine_point *p, int w,
+				    const struct domain_params *dp)
+{
+  struct point_table *pt;
+  if (! (pt = malloc(sizeof(struct point_table))))
+    return NULL;
+  pt->width = w;
+  pt->count = 1 << (w - 2);
+  pt->odd = NULL;
+  pt->fodd = NULL;
+  if (dp->field)
+    pt->fodd = malloc(2 * pt->count * sizeof(struct field_point));
+  else
+    pt->odd = malloc(2 * pt->count * sizeof(struct affine_point));
+  if (! pt->odd && ! pt->fodd) {
+    free(pt);
+    return NULL;
+  }
+  pt->p.x = gcry_mpi_new(0);
+  pt->p.y = gcry_mpi_new(0);
+  point_set(&pt->p, p);
+  point_table_fill(pt, dp);
+  return pt;
+}
+
+void point_table_release(struct point_table *pt)
+{
+  point_table_clear(pt);
+  point_release(&pt->p);
+  free(pt->odd);
+  free(pt->fodd);
+  free(pt);
+}
+
+/******************************************************************************/
+
 /* Algorithm 3.27 in the "Guide to Elliptic Curve Cryptography"               */
 
 #if 0
@@ -354,27 +1089,619 @@ struct affine_point pointmul(const struct affine_point *p,
 
 #else
 
+static void pointmul_naf(struct jacobian_point *r,
+			 const struct point_table *pt,
+			 const signed char *naf, int n,
+			 const struct domain_params *dp)
+{
+  struct mpi_scratch s;
+  STATS_COUNT(pointmul_variable);
+  scratch_init(&s, dp);
+  jacobian_load_zero(r);
+  while (n) {
+    sjacobian_double(r, &s, dp);
+    wnaf_add(r, pt->odd, pt->count, naf[--n], &s, dp);
+  }
+  scratch_release(&s);
+}
+
+static void fpointmul_naf(struct field_jacobian *r,
+			  const struct point_table *pt,
+			  const signed char *naf, int n,
+			  const struct domain_params *dp)
+{
+  STATS_COUNT(pointmul_variable);
+  field_set_ui(dp->field, r->z, 0);
+  while (n) {
+    fjacobian_double(r, dp);
+    fwnaf_add(r, pt->fodd, pt->count, naf[--n], dp);
+  }
+}
+
+struct affine_point pointmul_table(const struct point_table *pt,
+				   const gcry_mpi_t exp,
+				   const struct domain_params *dp)
+{
+  struct affine_point R;
+  int n = gcry_mpi_get_nbits(exp);
+  signed char naf[n + 1];
+
+  n = wnaf_recode(naf, exp, pt->width);
+  if (pt->fodd) {
+    struct field_jacobian r;
+    fpointmul_naf(&r, pt, naf, n, dp);
+    R = fjacobian_to_affine(&r, dp);
+    memset(&r, 0, sizeof(r));
+  }
+  else {
+    struct jacobian_point r = jacobian_new();
+    pointmul_naf(&r, pt, naf, n, dp);
+    R = jacobian_to_affine(&r, dp);
+    jacobian_release(&r);
+  }
+  memset(naf, 0, sizeof(naf));
+
+  assert(point_on_curve(&R, dp));
+  return R;
+}
+
 struct affine_point pointmul(const struct affine_point *p,
 			     const gcry_mpi_t exp, 
 			     const struct domain_params *dp)
 {
-  struct jacobian_point r = jacobian_new();
-  struct affine_point R;
-  int n = gcry_mpi_get_nbits(exp);
-  int rc = 0;
-  while (n) {
-    jacobian_double(&r, dp);
-    if (gcry_mpi_test_bit(exp, --n))
-      jacobian_affine_point_add(&r, p, dp);
+  struct affine_point R, T[2 * WNAF_POINTS];
+  struct field_point fT[2 * WNAF_POINTS];
+  struct point_table pt;
+
+  point_table_stack(&pt, p, T, fT, dp);
+  R = pointmul_table(&pt, exp, dp);
+  point_table_clear(&pt);
+  return R;
+}
+
+#endif
+
+/******************************************************************************/
+
+/* Algorithm 3.45 in the "Guide to Elliptic Curve Cryptography"               */
+
+struct base_table* base_table_new(const struct domain_params *dp)
+{
+  struct base_table *bt;
+  struct affine_point *comb;
+  struct jacobian_point J[2 << COMB_WIDTH], r;
+  struct mpi_scratch s;
+  int i, j, a, n = 1 << COMB_WIDTH;
+
+  if (! (bt = malloc(sizeof(struct base_table))))
+    return NULL;
+
+  bt->bits = gcry_mpi_get_nbits(dp->order);
+  bt->d = (bt->bits + COMB_WIDTH - 1) / COMB_WIDTH;
+  bt->e = (bt->d + 1) / 2;
+  /* The table only holds public values, keep it out of secure memory */
+  comb = bt->comb;
+  for(i = 0; i < 2 * n; i++) {
+    comb[i].x = gcry_mpi_new(0);
+    comb[i].y = gcry_mpi_new(0);
+  }
+  for(i = 0; i < 2 * BASE_WNAF_POINTS; i++) {
+    bt->odd[i].x = gcry_mpi_new(0);
+    bt->odd[i].y = gcry_mpi_new(0);
+  }
+  odd_multiples(bt->odd, BASE_WNAF_POINTS, &dp->base, dp);
+
+  /* J[2^j] = 2^(jd) G and J[n + 2^j] = 2^(jd + e) G, the other entries
+     are sums of these.  All of them share one inversion.                  */
+  for(i = 0; i < 2 * n; i++)
+    J[i] = jacobian_new_public();
+  r = jacobian_new_public();
+  scratch_init(&s, dp);
+  jacobian_load_zero(&J[0]);
+  jacobian_load_zero(&J[n]);
+  jacobian_load_affine(&r, &dp->base);
+  for(j = 0; j < COMB_WIDTH; j++) {
+    jacobian_set(&J[1 << j], &r);
+    for(i = 0; i < bt->e; i++)
+      sjacobian_double(&r, &s, dp);
+    jacobian_set(&J[n + (1 << j)], &r);
+    for(; i < bt->d; i++)
+      sjacobian_double(&r, &s, dp);
   }
-  R = jacobian_to_affine(&r, dp);
   jacobian_release(&r);
-  rc = point_on_curve(&R, dp);
-  assert(rc);
+
+  for(a = 3; a < n; a++)
+    if (a & (a - 1)) {
+      for(j = 0; ! (a & (1 << j)); j++);
+      jacobian_set(&J[a], &J[a & ~(1 << j)]);
+      sjacobian_point_add(&J[a], &J[1 << j], &s, dp);
+      jacobian_set(&J[n + a], &J[n + (a & ~(1 << j))]);
+      sjacobian_point_add(&J[n + a], &J[n + (1 << j)], &s, dp);
+    }
+  scratch_release(&s);
+  jacobian_store_affine_batch(comb, J, 2 * n, dp);
+  for(i = 0; i < 2 * n; i++)
+    jacobian_release(&J[i]);
+
+  bt->fcomb = bt->fodd = NULL;
+  if (dp->field) {
+    bt->fcomb = malloc((2 << COMB_WIDTH) * sizeof(struct field_point));
+    bt->fodd = malloc(2 * BASE_WNAF_POINTS * sizeof(struct field_point));
+    if (! bt->fcomb || ! bt->fodd) {
+      base_table_release(bt);
+      return NULL;
+    }
+    for(i = 0; i < 2 * n; i++)
+      fpoint_load(&bt->fcomb[i], &comb[i], dp);
+    for(i = 0; i < 2 * BASE_WNAF_POINTS; i++)
+      fpoint_load(&bt->fodd[i], &bt->odd[i], dp);
+  }
+
+  return bt;
+}
+
+void base_table_release(struct base_table *bt)
+{
+  int i;
+  for(i = 0; i < 2 << COMB_WIDTH; i++)
+    point_release(&bt->comb[i]);
+  for(i = 0; i < 2 * BASE_WNAF_POINTS; i++)
+    point_release(&bt->odd[i]);
+  free(bt->fcomb);
+  free(bt->fodd);
+  free(bt);
+}
+
+static int comb_column(const gcry_mpi_t exp, int i, int d)
+{
+  int j, a = 0;
+  for(j = COMB_WIDTH - 1; j >= 0; j--)
+    a = (a << 1) | !! gcry_mpi_test_bit(exp, j * d + i);
+  return a;
+}
+
+static void comb_mul(struct jacobian_point *r, const gcry_mpi_t k,
+		     const struct domain_params *dp)
+{
+  const struct base_table *bt = dp->bt;
+  struct mpi_scratch s;
+  int i, a;
+
+  STATS_COUNT(pointmul_fixed);
+  scratch_init(&s, dp);
+  jacobian_load_zero(r);
+  for(i = bt->e - 1; i >= 0; i--) {
+    sjacobian_double(r, &s, dp);
+    if ((a = comb_column(k, i, bt->d)))
+      sjacobian_affine_point_add(r, &bt->comb[a], &s, dp);
+    if (i + bt->e < bt->d && (a = comb_column(k, i + bt->e, bt->d)))
+      sjacobian_affine_point_add(r, &bt->comb[(1 << COMB_WIDTH) + a], &s, dp);
+  }
+  scratch_release(&s);
+}
+
+static void fcomb_mul(struct field_jacobian *r, const gcry_mpi_t k,
+		      const struct domain_params *dp)
+{
+  const struct base_table *bt = dp->bt;
+  int i, a;
+
+  STATS_COUNT(pointmul_fixed);
+  field_set_ui(dp->field, r->z, 0);
+  for(i = bt->e - 1; i >= 0; i--) {
+    fjacobian_double(r, dp);
+    if ((a = comb_column(k, i, bt->d)))
+      fjacobian_affine_point_add(r, &bt->fcomb[a], dp);
+    if (i + bt->e < bt->d && (a = comb_column(k, i + bt->e, bt->d)))
+      fjacobian_affine_point_add(r, &bt->fcomb[(1 << COMB_WIDTH) + a], dp);
+  }
+}
+
+/* G has order n, so oversized exponents can be reduced first.  Returns the
+   exponent to use, *h must be released by the caller if it is set.       */
+static gcry_mpi_t base_exponent(const gcry_mpi_t exp, gcry_mpi_t *h,
+				const struct domain_params *dp)
+{
+  *h = NULL;
+  if (gcry_mpi_get_nbits(exp) <= dp->bt->bits)
+    return exp;
+  *h = gcry_mpi_snew(0);
+  gcry_mpi_mod(*h, exp, dp->order);
+  return *h;
+}
+
+struct affine_point pointmul_base(const gcry_mpi_t exp,
+				  const struct domain_params *dp)
+{
+  struct affine_point R;
+  gcry_mpi_t k, h;
+
+  if (! dp->bt)
+    return pointmul(&dp->base, exp, dp);
+
+  k = base_exponent(exp, &h, dp);
+  if (dp->bt->fcomb) {
+    struct field_jacobian r;
+    fcomb_mul(&r, k, dp);
+    R = fjacobian_to_affine(&r, dp);
+    memset(&r, 0, sizeof(r));
+  }
+  else {
+    struct jacobian_point r = jacobian_new();
+    comb_mul(&r, k, dp);
+    R = jacobian_to_affine(&r, dp);
+    jacobian_release(&r);
+  }
+  if (h)
+    gcry_mpi_release(h);
+  assert(point_on_curve(&R, dp));
   return R;
 }
 
-#endif
+/* pointmul_base() for n exponents at once, R[i] = k[i] G, the points of
+   a chunk share a single inversion.  The results are public keys and stay out of
+   secure memory, there may be a lot of them.                              */
+void pointmul_base_batch(struct affine_point *R, const gcry_mpi_t *k, int n,
+			 const struct domain_params *dp)
+{
+  gcry_mpi_t e, h;
+  int i;
+
+  for(; n > POINT_BATCH_MAX; R += POINT_BATCH_MAX, k += POINT_BATCH_MAX,
+	n -= POINT_BATCH_MAX)
+    pointmul_base_batch(R, k, POINT_BATCH_MAX, dp);
+  if (! dp->bt || n <= 0) {
+    for(i = 0; i < n; i++)
+      R[i] = pointmul_base(k[i], dp);
+    return;
+  }
+
+  if (dp->bt->fcomb) {
+    struct field_jacobian r[n];
+    struct field_point x[n];
+    for(i = 0; i < n; i++) {
+      e = base_exponent(k[i], &h, dp);
+      fcomb_mul(&r[i], e, dp);
+      if (h)
+	gcry_mpi_release(h);
+    }
+    fjacobian_store_affine_batch(x, r, n, 1, dp);
+    for(i = 0; i < n; i++) {
+      R[i] = point_new_public();
+      field_to_mpi(dp->field, R[i].x, x[i].x);
+      field_to_mpi(dp->field, R[i].y, x[i].y);
+    }
+    memset(r, 0, sizeof(r));
+    memset(x, 0, sizeof(x));
+  }
+  else {
+    struct jacobian_point r[n];
+    for(i = 0; i < n; i++) {
+      e = base_exponent(k[i], &h, dp);
+      r[i] = jacobian_new();
+      comb_mul(&r[i], e, dp);
+      if (h)
+	gcry_mpi_release(h);
+      R[i] = point_new_public();
+    }
+    jacobian_store_affine_batch(R, r, n, dp);
+    for(i = 0; i < n; i++)
+      jacobian_release(&r[i]);
+  }
+
+  for(i = 0; i < n; i++)
+    assert(point_on_curve(&R[i], dp));
+}
+
+/* R = k G and Z = l Q, both brought back to affine coordinates with a
+   single inversion                                                        */
+void pointmul_base_pair_table(struct affine_point *R, struct affine_point *Z,
+			      const gcry_mpi_t k, const struct point_table *qt,
+			      const gcry_mpi_t l, const struct domain_params *dp)
+{
+  struct affine_point X[2];
+  signed char naf[gcry_mpi_get_nbits(l) + 1];
+  gcry_mpi_t e, h;
+  int n;
+
+  if (! dp->bt) {
+    *R = pointmul_base(k, dp);
+    *Z = pointmul_table(qt, l, dp);
+    return;
+  }
+
+  e = base_exponent(k, &h, dp);
+  n = wnaf_recode(naf, l, qt->width);
+  if (dp->field) {
+    struct field_jacobian r[2];
+    struct field_point x[2];
+    fcomb_mul(&r[0], e, dp);
+    fpointmul_naf(&r[1], qt, naf, n, dp);
+    fjacobian_store_affine_batch(x, r, 2, 1, dp);
+    for(n = 0; n < 2; n++) {
+      X[n] = point_new();
+      field_to_mpi(dp->field, X[n].x, x[n].x);
+      field_to_mpi(dp->field, X[n].y, x[n].y);
+    }
+    memset(r, 0, sizeof(r));
+    memset(x, 0, sizeof(x));
+  }
+  else {
+    struct jacobian_point r[2];
+    r[0] = jacobian_new();
+    r[1] = jacobian_new();
+    comb_mul(&r[0], e, dp);
+    pointmul_naf(&r[1], qt, naf, n, dp);
+    jacobian_to_affine_batch(X, r, 2, dp);
+    jacobian_release(&r[0]);
+    jacobian_release(&r[1]);
+  }
+  memset(naf, 0, sizeof(naf));
+  if (h)
+    gcry_mpi_release(h);
+
+  *R = X[0];
+  *Z = X[1];
+  assert(point_on_curve(R, dp) && point_on_curve(Z, dp));
+}
+
+void pointmul_base_pair(struct affine_point *R, struct affine_point *Z,
+			const gcry_mpi_t k, const struct affine_point *q,
+			const gcry_mpi_t l, const struct domain_params *dp)
+{
+  struct affine_point T[2 * WNAF_POINTS];
+  struct field_point fT[2 * WNAF_POINTS];
+  struct point_table pt;
+
+  point_table_stack(&pt, q, T, fT, dp);
+  pointmul_base_pair_table(R, Z, k, &pt, l, dp);
+  point_table_clear(&pt);
+}
+
+/* pointmul_base_pair_table() for n pairs at once, R[i] = k[i] G and
+   Z[i] = l[i] Q[i].  The 2n points of a chunk of n = POINT_BATCH_MAX / 2
+   pairs share a single inversion.                                          */
+void pointmul_base_pair_batch(struct affine_point *R, struct affine_point *Z,
+			      const gcry_mpi_t *k,
+			      const struct point_table *const *qt,
+			      const gcry_mpi_t *l, int n,
+			      const struct domain_params *dp)
+{
+  const int chunk = POINT_BATCH_MAX / 2;
+  gcry_mpi_t e, h;
+  int i, m;
+
+  for(; n > chunk; R += chunk, Z += chunk, k += chunk, qt += chunk, l += chunk,
+	n -= chunk)
+    pointmul_base_pair_batch(R, Z, k, qt, l, chunk, dp);
+  if (! dp->bt || n <= 0) {
+    for(i = 0; i < n; i++)
+      pointmul_base_pair_table(&R[i], &Z[i], k[i], qt[i], l[i], dp);
+    return;
+  }
+
+  if (dp->field) {
+    struct field_jacobian r[2 * n];
+    struct field_point x[2 * n];
+    for(i = 0; i < n; i++) {
+      signed char naf[gcry_mpi_get_nbits(l[i]) + 1];
+      e = base_exponent(k[i], &h, dp);
+      m = wnaf_recode(naf, l[i], qt[i]->width);
+      fcomb_mul(&r[i], e, dp);
+      fpointmul_naf(&r[n + i], qt[i], naf, m, dp);
+      memset(naf, 0, sizeof(naf));
+      if (h)
+	gcry_mpi_release(h);
+    }
+    fjacobian_store_affine_batch(x, r, 2 * n, 1, dp);
+    for(i = 0; i < n; i++) {
+      R[i] = point_new();
+      field_to_mpi(dp->field, R[i].x, x[i].x);
+      field_to_mpi(dp->field, R[i].y, x[i].y);
+      Z[i] = point_new();
+      field_to_mpi(dp->field, Z[i].x, x[n + i].x);
+      field_to_mpi(dp->field, Z[i].y, x[n + i].y);
+    }
+    memset(r, 0, sizeof(r));
+    memset(x, 0, sizeof(x));
+  }
+  else {
+    struct jacobian_point r[2 * n];
+    struct affine_point X[2 * n];
+    for(i = 0; i < n; i++) {
+      signed char naf[gcry_mpi_get_nbits(l[i]) + 1];
+      e = base_exponent(k[i], &h, dp);
+      m = wnaf_recode(naf, l[i], qt[i]->width);
+      r[i] = jacobian_new();
+      r[n + i] = jacobian_new();
+      comb_mul(&r[i], e, dp);
+      pointmul_naf(&r[n + i], qt[i], naf, m, dp);
+      memset(naf, 0, sizeof(naf));
+      if (h)
+	gcry_mpi_release(h);
+    }
+    jacobian_to_affine_batch(X, r, 2 * n, dp);
+    for(i = 0; i < n; i++) {
+      R[i] = X[i];
+      Z[i] = X[n + i];
+    }
+    for(i = 0; i < 2 * n; i++)
+      jacobian_release(&r[i]);
+  }
+
+  for(i = 0; i < n; i++)
+    assert(point_on_curve(&R[i], dp) && point_on_curve(&Z[i], dp));
+}
+
+/******************************************************************************/
+
+/* Algorithm 3.51 in the "Guide to Elliptic Curve Cryptography": u1 G + u2 Q
+   with a single doubling chain.  G is taken from the wider precomputed
+   table, Q from a point_table.                                             */
+
+static void dual_mul(struct jacobian_point *r,
+		     const signed char *naf1, int n1,
+		     const struct point_table *qt,
+		     const signed char *naf2, int n2,
+		     const struct domain_params *dp)
+{
+  struct mpi_scratch s;
+  int n;
+  STATS_COUNT(pointmul_dual);
+  scratch_init_public(&s, dp);
+  jacobian_load_zero(r);
+  for(n = n1 > n2 ? n1 : n2; n--; ) {
+    sjacobian_double(r, &s, dp);
+    if (n < n1)
+      wnaf_add(r, dp->bt->odd, BASE_WNAF_POINTS, naf1[n], &s, dp);
+    if (n < n2)
+      wnaf_add(r, qt->odd, qt->count, naf2[n], &s, dp);
+  }
+  scratch_release(&s);
+}
+
+static void fdual_mul(struct field_jacobian *r,
+		      const signed char *naf1, int n1,
+		      const struct point_table *qt,
+		      const signed char *naf2, int n2,
+		      const struct domain_params *dp)
+{
+  int n;
+  STATS_COUNT(pointmul_dual);
+  field_set_ui(dp->field, r->z, 0);
+  for(n = n1 > n2 ? n1 : n2; n--; ) {
+    fjacobian_double(r, dp);
+    if (n < n1)
+      fwnaf_add(r, dp->bt->fodd, BASE_WNAF_POINTS, naf1[n], dp);
+    if (n < n2)
+      fwnaf_add(r, qt->fodd, qt->count, naf2[n], dp);
+  }
+}
+
+/* Recodes u1 (reduced mod n first if needed) and u2 for the loops above.
+   naf1 needs room for bits(n) + 1 digits, naf2 for bits(u2) + 1.         */
+static void dual_recode(signed char *naf1, int *n1, signed char *naf2,
+			int *n2, const gcry_mpi_t u1, const gcry_mpi_t u2,
+			const struct point_table *qt,
+			const struct domain_params *dp)
+{
+  gcry_mpi_t k, h;
+  k = base_exponent(u1, &h, dp);
+  *n1 = wnaf_recode(naf1, k, BASE_WNAF_WIDTH);
+  *n2 = wnaf_recode(naf2, u2, qt->width);
+  if (h)
+    gcry_mpi_release(h);
+}
+
+struct affine_point pointmul_dual_table(const gcry_mpi_t u1,
+					const struct point_table *qt,
+					const gcry_mpi_t u2,
+					const struct domain_params *dp)
+{
+  const struct base_table *bt = dp->bt;
+  struct affine_point R, X;
+  signed char naf1[gcry_mpi_get_nbits(dp->order) + 1];
+  signed char naf2[gcry_mpi_get_nbits(u2) + 1];
+  int n1, n2;
+
+  if (! bt) {
+    R = pointmul(&dp->base, u1, dp);
+    X = pointmul_table(qt, u2, dp);
+    point_add(&R, &X, dp);
+    point_release(&X);
+    return R;
+  }
+
+  dual_recode(naf1, &n1, naf2, &n2, u1, u2, qt, dp);
+  if (bt->fodd) {
+    struct field_jacobian r;
+    fdual_mul(&r, naf1, n1, qt, naf2, n2, dp);
+    R = point_new_public();
+    fjacobian_store_affine(&R, &r, dp);
+  }
+  else {
+    struct jacobian_point r = jacobian_new_public();
+    dual_mul(&r, naf1, n1, qt, naf2, n2, dp);
+    R = point_new_public();
+    jacobian_store_affine(&R, &r, dp);
+    jacobian_release(&r);
+  }
+  memset(naf1, 0, sizeof(naf1));
+  memset(naf2, 0, sizeof(naf2));
+
+  assert(point_on_curve(&R, dp));
+  return R;
+}
+
+struct affine_point pointmul_dual(const gcry_mpi_t u1,
+				  const struct affine_point *q,
+				  const gcry_mpi_t u2,
+				  const struct domain_params *dp)
+{
+  struct affine_point R, T[2 * WNAF_POINTS];
+  struct field_point fT[2 * WNAF_POINTS];
+  struct point_table pt;
+
+  point_table_stack(&pt, q, T, fT, dp);
+  R = pointmul_dual_table(u1, &pt, u2, dp);
+  point_table_clear(&pt);
+  return R;
+}
+
+/* R[i] = u1[i] G + u2[i] Q[i] for all i < n.  The results of a chunk
+   share a single inversion when they are brought back to affine
+   coordinates.                                                            */
+void pointmul_dual_batch(struct affine_point *R, const gcry_mpi_t *u1,
+			 const struct point_table *const *qt,
+			 const gcry_mpi_t *u2, int n,
+			 const struct domain_params *dp)
+{
+  const struct base_table *bt = dp->bt;
+  signed char naf1[gcry_mpi_get_nbits(dp->order) + 1];
+  int i, n1, n2;
+
+  for(; n > POINT_BATCH_MAX; R += POINT_BATCH_MAX, u1 += POINT_BATCH_MAX,
+	qt += POINT_BATCH_MAX, u2 += POINT_BATCH_MAX, n -= POINT_BATCH_MAX)
+    pointmul_dual_batch(R, u1, qt, u2, POINT_BATCH_MAX, dp);
+  if (! bt || n <= 0) {
+    for(i = 0; i < n; i++)
+      R[i] = pointmul_dual_table(u1[i], qt[i], u2[i], dp);
+    return;
+  }
+
+  if (bt->fodd) {
+    struct field_jacobian r[n];
+    struct field_point x[n];
+    for(i = 0; i < n; i++) {
+      signed char naf2[gcry_mpi_get_nbits(u2[i]) + 1];
+      dual_recode(naf1, &n1, naf2, &n2, u1[i], u2[i], qt[i], dp);
+      fdual_mul(&r[i], naf1, n1, qt[i], naf2, n2, dp);
+    }
+    fjacobian_store_affine_batch(x, r, n, 0, dp);
+    for(i = 0; i < n; i++) {
+      R[i] = point_new_public();
+      field_to_mpi(dp->field, R[i].x, x[i].x);
+      field_to_mpi(dp->field, R[i].y, x[i].y);
+    }
+  }
+  else {
+    struct jacobian_point r[n];
+    for(i = 0; i < n; i++) {
+      signed char naf2[gcry_mpi_get_nbits(u2[i]) + 1];
+      dual_recode(naf1, &n1, naf2, &n2, u1[i], u2[i], qt[i], dp);
+      r[i] = jacobian_new_public();
+      dual_mul(&r[i], naf1, n1, qt[i], naf2, n2, dp);
+    }
+    for(i = 0; i < n; i++)
+      R[i] = point_new_public();
+    jacobian_store_affine_batch(R, r, n, dp);
+    for(i = 0; i < n; i++)
+      jacobian_release(&r[i]);
+  }
+
+  for(i = 0; i < n; i++)
+    assert(point_on_curve(&R[i], dp));
+}
 
 /******************************************************************************/
 
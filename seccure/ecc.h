@@ -43,6 +43,9 @@
 
 #include <gcrypt.h>
 
+#include "field.h"
+#include "numtheory.h"
+
 struct affine_point {
   gcry_mpi_t x, y;
 };
@@ -51,10 +54,49 @@ struct jacobian_point {
   gcry_mpi_t x, y, z;
 };
 
+/* The same points in the native representation of a struct field          */
+struct field_point {
+  field_elem x, y;
+};
+
+struct field_jacobian {
+  field_elem x, y, z;
+};
+
+struct base_table;
+
+/* Values of the coefficient a that allow faster point doubling           */
+#define CURVE_A_GENERIC 0
+#define CURVE_A_MINUS_3 1
+#define CURVE_A_ZERO    2
+
+/* If m is one of the special primes the scalar multiplications run on the
+   native field backend, field is NULL otherwise.  root holds the square
+   root strategy for m used by point decompression.                        */
 struct domain_params {
   gcry_mpi_t a, b, m, order;
   struct affine_point base;
-  int cofactor;
+  int cofactor, a_type;
+  struct base_table *bt;
+  struct field *field;
+  field_elem fa;
+  struct root_params root;
+};
+
+/* Precomputed multiples of the base point for the fixed-base comb method.
+   comb[a] holds [a_{w-1},...,a_0]G, comb[2^w + a] holds 2^e times that.   */
+#define COMB_WIDTH 5
+
+/* odd[] holds G, 3G, ..., (2^(w-1) - 1)G and their negatives for the
+   interleaved u1 G + u2 Q of signature verification                        */
+#define BASE_WNAF_WIDTH 6
+#define BASE_WNAF_POINTS (1 << (BASE_WNAF_WIDTH - 2))
+
+struct base_table {
+  int bits, d, e;
+  struct affine_point comb[2 << COMB_WIDTH];
+  struct affine_point odd[2 * BASE_WNAF_POINTS];
+  struct field_point *fcomb, *fodd;
 };
 
 struct affine_point point_new(void);
@@ -76,19 +118,85 @@ struct jacobian_point jacobian_new(void);
 void jacobian_release(struct jacobian_point *p);
 void jacobian_load_affine(struct jacobian_point *p1,
 			  const struct affine_point *p2);
+void jacobian_set(struct jacobian_point *p1, const struct jacobian_point *p2);
 void jacobian_load_zero(struct jacobian_point *p);
 int jacobian_is_zero(const struct jacobian_point *p);
 void jacobian_double(struct jacobian_point *p, const struct domain_params *dp);
 void jacobian_affine_point_add(struct jacobian_point *p1, 
 			       const struct affine_point *p2,
 			       const struct domain_params *dp);
+void jacobian_point_add(struct jacobian_point *p1,
+			const struct jacobian_point *p2,
+			const struct domain_params *dp);
 struct affine_point jacobian_to_affine(const struct jacobian_point *p,
 				       const struct domain_params *dp);
+/* The *_batch() functions take any n but work through it in chunks of at
+   most POINT_BATCH_MAX points, the points of a chunk share one inversion.
+   The chunk bounds what these functions keep on the stack.                 */
+#define POINT_BATCH_MAX 64
+
+void jacobian_to_affine_batch(struct affine_point *r,
+			      const struct jacobian_point *p, int n,
+			      const struct domain_params *dp);
+
+
+/* Variable-base multiplication uses a width-w NAF over the odd multiples
+   P, 3P, ..., (2^(w-1) - 1)P                                                */
+#define WNAF_WIDTH 4
+#define WNAF_POINTS (1 << (WNAF_WIDTH - 2))
+
+/* Public keys that are used over and over again keep a wider table        */
+#define KEY_WNAF_WIDTH 6
+
+/* The odd multiples of p and their negatives, on the native field backend
+   if the curve has one (fodd) and as MPIs otherwise (odd)                   */
+struct point_table {
+  struct affine_point p;
+  int width, count;
+  struct affine_point *odd;
+  struct field_point *fodd;
+};
 
+struct point_table* point_table_new(const struct affine_point *p, int w,
+				    const struct domain_params *dp);
+void point_table_release(struct point_table *pt);
 
 struct affine_point pointmul(const struct affine_point *p,
 			     const gcry_mpi_t exp, 
 			     const struct domain_params *dp);
+struct affine_point pointmul_table(const struct point_table *pt,
+				   const gcry_mpi_t exp,
+				   const struct domain_params *dp);
+
+struct base_table* base_table_new(const struct domain_params *dp);
+void base_table_release(struct base_table *bt);
+struct affine_point pointmul_base(const gcry_mpi_t exp,
+				  const struct domain_params *dp);
+void pointmul_base_batch(struct affine_point *R, const gcry_mpi_t *k, int n,
+			 const struct domain_params *dp);
+void pointmul_base_pair(struct affine_point *R, struct affine_point *Z,
+			const gcry_mpi_t k, const struct affine_point *q,
+			const gcry_mpi_t l, const struct domain_params *dp);
+void pointmul_base_pair_table(struct affine_point *R, struct affine_point *Z,
+			      const gcry_mpi_t k, const struct point_table *qt,
+			      const gcry_mpi_t l, const struct domain_params *dp);
+void pointmul_base_pair_batch(struct affine_point *R, struct affine_point *Z,
+			      const gcry_mpi_t *k,
+			      const struct point_table *const *qt,
+			      const gcry_mpi_t *l, int n,
+			      const struct domain_params *dp);
+struct affine_point pointmul_dual(const gcry_mpi_t u1,
+				  const struct affine_point *q,
+				  const gcry_mpi_t u2,
+				  const struct domain_params *dp);
+struct affine_point pointmul_dual_table(const gcry_mpi_t u1,
+					const struct point_table *qt,
+					const gcry_mpi_t u2,
+					const struct domain_params *dp);
+void pointmul_dual_batch(struct affine_point *R, const gcry_mpi_t *u1,
+			 const struct point_table *const *qt,
+			 const gcry_mpi_t *u2, int n,
+			 const struct domain_params *dp);
 
 
 int embedded_key_validation(const struct affine_point *p,
@@ -0,0 +1,541 @@
+/*
+ *  seccure  -  Copyright 2009 B. Poettering
+ *
+ *  Maintained by R. Tyler Ballance <tyler@slide.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* 
+ *   SECCURE Elliptic Curve Crypto Utility for Reliable Encryption
+ *
+ * Current homepage: http://slideinc.github.com/PyECC
+ * Original homepage: http://point-at-infinity.org/seccure/
+ *
+ *
+ * seccure implements a selection of asymmetric algorithms based on  
+ * elliptic curve cryptography (ECC). See the manpage or the project's  
+ * homepage for further details.
+ *
+ * This code links against the GNU gcrypt library "libgcrypt" (which
+ * is part of the GnuPG project). Use the included Makefile to build
+ * the binary.
+ * 
+ * Report bugs to: http://github.com/rtyler/PyECC/issues
+ */
+
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gcrypt.h>
+
+#include "field.h"
+#include "stats.h"
+
+/******************************************************************************/
+
+static uint64_t add_limbs(uint64_t *r, const uint64_t *a, const uint64_t *b,
+			  int n)
+{
+  uint64_t s, c = 0;
+  int i;
+  for(i = 0; i < n; i++) {
+    s = a[i] + c;
+    c = s < c;
+    r[i] = s + b[i];
+    c += r[i] < s;
+  }
+  return c;
+}
+
+static uint64_t sub_limbs(uint64_t *r, const uint64_t *a, const uint64_t *b,
+			  int n)
+{
+  uint64_t d, b1, c = 0;
+  int i;
+  for(i = 0; i < n; i++) {
+    d = a[i] - b[i];
+    b1 = a[i] < b[i];
+    b1 |= d < c;
+    r[i] = d - c;
+    c = b1;
+  }
+  return c;
+}
+
+static int cmp_limbs(const uint64_t *a, const uint64_t *b, int n)
+{
+  while (n--)
+    if (a[n] != b[n])
+      return a[n] < b[n] ? -1 : 1;
+  return 0;
+}
+
+#ifdef __SIZEOF_INT128__
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+static void mul_limbs(uint64_t *t, const uint64_t *a, const uint64_t *b,
+		      int n)
+{
+  uint128_t c;
+  int i, j;
+  memset(t, 0, 2 * n * sizeof(uint64_t));
+  for(i = 0; i < n; i++) {
+    c = 0;
+    for(j = 0; j < n; j++) {
+      c += (uint128_t)a[i] * b[j] + t[i + j];
+      t[i + j] = c;
+      c >>= 64;
+    }
+    t[i + n] = c;
+  }
+}
+
+/* The cross products are summed once and doubled, then the squares of the
+   single limbs are added                                                   */
+static void sqr_limbs(uint64_t *t, const uint64_t *a, int n)
+{
+  uint128_t c;
+  int i, j;
+  memset(t, 0, 2 * n * sizeof(uint64_t));
+  for(i = 0; i < n; i++) {
+    c = 0;
+    for(j = i + 1; j < n; j++) {
+      c += (uint128_t)a[i] * a[j] + t[i + j];
+      t[i + j] = c;
+      c >>= 64;
+    }
+    t[i + n] = c;
+  }
+  for(i = 2 * n - 1; i > 0; i--)
+    t[i] = t[i] << 1 | t[i - 1] >> 63;
+  t[0] <<= 1;
+  c = 0;
+  for(i = 0; i < n; i++) {
+    c += (uint128_t)a[i] * a[i] + t[2 * i];
+    t[2 * i] = c;
+    c >>= 64;
+    c += t[2 * i + 1];
+    t[2 * i + 1] = c;
+    c >>= 64;
+  }
+}
+
+#else
+
+/* Without 128 bit integers the limbs are multiplied as 32 bit words        */
+static void mul_limbs(uint64_t *t, const uint64_t *a, const uint64_t *b,
+		      int n)
+{
+  uint32_t x[FIELD_WORDS], y[FIELD_WORDS], z[2 * FIELD_WORDS];
+  uint64_t c;
+  int i, j;
+  for(i = 0; i < 2 * n; i++) {
+    x[i] = a[i / 2] >> 32 * (i % 2);
+    y[i] = b[i / 2] >> 32 * (i % 2);
+  }
+  memset(z, 0, sizeof(z));
+  for(i = 0; i < 2 * n; i++) {
+    c = 0;
+    for(j = 0; j < 2 * n; j++) {
+      c += (uint64_t)x[i] * y[j] + z[i + j];
+      z[i + j] = c;
+      c >>= 32;
+    }
+    z[i + 2 * n] = c;
+  }
+  for(i = 0; i < 2 * n; i++)
+    t[i] = z[2 * i] | (uint64_t)z[2 * i + 1] << 32;
+}
+
+static void sqr_limbs(uint64_t *t, const uint64_t *a, int n)
+{
+  mul_limbs(t, a, a, n);
+}
+
+#endif
+
+/******************************************************************************/
+
+/* Algorithms 2.27 to 2.30 in the "Guide to Elliptic Curve Cryptography".
+   A term lists the 32 bit words c_i of the double length product that make
+   up one of the summands s_j, most significant word first.                 */
+
+#define _ -1
+
+struct solinas_term {
+  int coef;
+  signed char c[12];
+};
+
+static const struct solinas_term p192_terms[] = {
+  { 1, {  5,  4,  3,  2,  1,  0 } },
+  { 1, {  _,  _,  7,  6,  7,  6 } },
+  { 1, {  9,  8,  9,  8,  _,  _ } },
+  { 1, { 11, 10, 11, 10, 11, 10 } },
+};
+
+static const struct solinas_term p224_terms[] = {
+  {  1, {  6,  5,  4,  3,  2,  1,  0 } },
+  {  1, { 10,  9,  8,  7,  _,  _,  _ } },
+  {  1, {  _, 13, 12, 11,  _,  _,  _ } },
+  { -1, { 13, 12, 11, 10,  9,  8,  7 } },
+  { -1, {  _,  _,  _,  _, 13, 12, 11 } },
+};
+
+static const struct solinas_term p256_terms[] = {
+  {  1, {  7,  6,  5,  4,  3,  2,  1,  0 } },
+  {  2, { 15, 14, 13, 12, 11,  _,  _,  _ } },
+  {  2, {  _, 15, 14, 13, 12,  _,  _,  _ } },
+  {  1, { 15, 14,  _,  _,  _, 10,  9,  8 } },
+  {  1, {  8, 13, 15, 14, 13, 11, 10,  9 } },
+  { -1, { 10,  8,  _,  _,  _, 13, 12, 11 } },
+  { -1, { 11,  9,  _,  _, 15, 14, 13, 12 } },
+  { -1, { 12,  _, 10,  9,  8, 15, 14, 13 } },
+  { -1, { 13,  _, 11, 10,  9,  _, 15, 14 } },
+};
+
+static const struct solinas_term p384_terms[] = {
+  {  1, { 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0 } },
+  {  2, {  _,  _,  _,  _,  _, 23, 22, 21,  _,  _,  _,  _ } },
+  {  1, { 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12 } },
+  {  1, { 20, 19, 18, 17, 16, 15, 14, 13, 12, 23, 22, 21 } },
+  {  1, { 19, 18, 17, 16, 15, 14, 13, 12, 20,  _, 23,  _ } },
+  {  1, {  _,  _,  _,  _, 23, 22, 21, 20,  _,  _,  _,  _ } },
+  {  1, {  _,  _,  _,  _,  _,  _, 23, 22, 21,  _,  _, 20 } },
+  { -1, { 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 23 } },
+  { -1, {  _,  _,  _,  _,  _,  _,  _, 23, 22, 21, 20,  _ } },
+  { -1, {  _,  _,  _,  _,  _,  _,  _, 23, 23,  _,  _,  _ } },
+};
+
+#undef _
+
+/* Flattens the terms into one list of word indices per result word, the
+   words to be added come first.  A coefficient of 2 lists the word twice.  */
+static void solinas_setup(struct field *f, const struct solinas_term *terms,
+			  int nterms)
+{
+  int i, j, k, c, sign, n = 0;
+  for(i = 0; i < f->words; i++) {
+    f->start[i] = n;
+    for(sign = 1; sign >= -1; sign -= 2) {
+      for(j = 0; j < nterms; j++)
+	if ((c = terms[j].c[f->words - 1 - i]) >= 0 &&
+	    terms[j].coef * sign > 0)
+	  for(k = abs(terms[j].coef); k; k--)
+	    f->red[n++] = c;
+      if (sign > 0)
+	f->neg[i] = n;
+    }
+  }
+  f->start[i] = n;
+}
+
+static uint32_t add_words(uint32_t *r, const uint32_t *a, int n)
+{
+  uint64_t c = 0;
+  int i;
+  for(i = 0; i < n; i++) {
+    c += (uint64_t)r[i] + a[i];
+    r[i] = c;
+    c >>= 32;
+  }
+  return c;
+}
+
+static uint32_t sub_words(uint32_t *r, const uint32_t *a, int n)
+{
+  uint64_t c = 0;
+  int i;
+  for(i = 0; i < n; i++) {
+    c = (uint64_t)r[i] - a[i] - c;
+    r[i] = c;
+    c >>= 63;
+  }
+  return c;
+}
+
+static int cmp_words(const uint32_t *a, const uint32_t *b, int n)
+{
+  while (n--)
+    if (a[n] != b[n])
+      return a[n] < b[n] ? -1 : 1;
+  return 0;
+}
+
+/* The sum is computed with a signed carry and brought into [0, p) by adding
+   or subtracting p a few times, p is close to 2^(32n) for all these primes */
+static void solinas_reduce(const struct field *f, uint64_t *r,
+			   const uint64_t *t)
+{
+  uint32_t c[2 * FIELD_WORDS], w[FIELD_WORDS];
+  int64_t acc = 0;
+  int i, j, n = f->words;
+  for(i = 0; i < 2 * n; i++)
+    c[i] = t[i / 2] >> 32 * (i % 2);
+  for(i = 0; i < n; i++) {
+    for(j = f->start[i]; j < f->neg[i]; j++)
+      acc += c[f->red[j]];
+    for(; j < f->start[i + 1]; j++)
+      acc -= c[f->red[j]];
+    w[i] = acc;
+    acc = (acc - w[i]) / ((int64_t)1 << 32);
+  }
+  while (acc < 0)
+    acc += add_words(w, f->p32, n);
+  while (acc > 0 || cmp_words(w, f->p32, n) >= 0)
+    acc -= sub_words(w, f->p32, n);
+  for(i = 0; i < f->limbs; i++)
+    r[i] = w[2 * i];
+  for(i = 1; i < n; i += 2)
+    r[i / 2] |= (uint64_t)w[i] << 32;
+}
+
+/* Algorithm 2.31 in the "Guide to Elliptic Curve Cryptography"               */
+static void p521_reduce(const struct field *f, uint64_t *r, const uint64_t *t)
+{
+  uint64_t h[9];
+  int i;
+  for(i = 0; i < 9; i++)
+    h[i] = t[8 + i] >> 9 | t[9 + i] << 55;
+  memcpy(r, t, 9 * sizeof(uint64_t));
+  r[8] &= 0x1ff;
+  add_limbs(r, r, h, 9);
+  while (cmp_limbs(r, f->p, 9) >= 0)
+    sub_limbs(r, r, f->p, 9);
+}
+
+/******************************************************************************/
+
+/* a must fit into n limbs                                                 */
+static void mpi_to_limbs(uint64_t *r, int n, const gcry_mpi_t a)
+{
+  unsigned char buf[8 * FIELD_LIMBS];
+  size_t len, i;
+  assert(gcry_mpi_get_nbits(a) <= 64 * (unsigned int)n);
+  memset(r, 0, n * sizeof(uint64_t));
+  if (gcry_mpi_print(GCRYMPI_FMT_USG, buf, 8 * n, &len, a)) {
+    /* Out of secure memory for the scratch buffer of a secure MPI, see
+       serialize_mpi()                                                   */
+    for(i = 0; i < 64 * (size_t)n; i++)
+      if (gcry_mpi_test_bit(a, i))
+	r[i / 64] |= (uint64_t)1 << (i % 64);
+    return;
+  }
+  for(i = 0; i < len; i++)
+    r[i / 8] |= (uint64_t)buf[len - 1 - i] << 8 * (i % 8);
+  memset(buf, 0, len);
+}
+
+/* Values in [p, 2^(64n)) are reduced by subtraction, the rare wider ones
+   by gcrypt                                                                */
+void field_from_mpi(const struct field *f, uint64_t *r, const gcry_mpi_t a)
+{
+  gcry_mpi_t h;
+  if (gcry_mpi_get_nbits(a) > 64 * (unsigned int)f->limbs) {
+    h = gcry_mpi_get_flag(a, GCRYMPI_FLAG_SECURE) ? gcry_mpi_snew(0) :
+      gcry_mpi_new(0);
+    gcry_mpi_mod(h, a, f->m);
+    mpi_to_limbs(r, f->limbs, h);
+    gcry_mpi_release(h);
+  }
+  else
+    mpi_to_limbs(r, f->limbs, a);
+  while (cmp_limbs(r, f->p, f->limbs) >= 0)
+    sub_limbs(r, r, f->p, f->limbs);
+}
+
+/* Built up in r itself, 32 bits at a time: gcry_mpi_scan() would have to
+   allocate the value outside of secure memory first.  Cleared with
+   gcry_mpi_mul_ui(), gcry_mpi_set_ui() drops the secure flag of r        */
+void field_to_mpi(const struct field *f, gcry_mpi_t r, const uint64_t *a)
+{
+  int i;
+  gcry_mpi_mul_ui(r, r, 0);
+  for(i = 2 * f->limbs - 1; i >= 0; i--) {
+    gcry_mpi_mul_2exp(r, r, 32);
+    gcry_mpi_add_ui(r, r, (unsigned long)(uint32_t)(a[i / 2] >> 32 * (i % 2)));
+  }
+}
+
+/******************************************************************************/
+
+struct special_prime {
+  const char *m;
+  const struct solinas_term *terms;
+  int nterms;
+};
+
+#define TERMS(t) t, sizeof(t) / sizeof(struct solinas_term)
+
+static const struct special_prime primes[] = {
+  { "fffffffffffffffffffffffffffffffeffffffffffffffff", TERMS(p192_terms) },
+  { "ffffffffffffffffffffffffffffffff000000000000000000000001",
+    TERMS(p224_terms) },
+  { "ffffffff00000001000000000000000000000000ffffffffffffffffffffffff",
+    TERMS(p256_terms) },
+  { "fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffe"
+    "ffffffff0000000000000000ffffffff", TERMS(p384_terms) },
+  { "1ff"
+    "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+    "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff",
+    NULL, 0 },
+};
+
+#define PRIME_NUM (sizeof(primes) / sizeof(struct special_prime))
+
+/* Returns NULL if m has no special reduction, the caller then stays with
+   gcrypt's generic MPI arithmetic                                          */
+struct field* field_new(const gcry_mpi_t m)
+{
+  struct field *f;
+  gcry_mpi_t h;
+  unsigned int i;
+  int rc;
+  for(i = 0; i < PRIME_NUM; i++) {
+    if (gcry_mpi_scan(&h, GCRYMPI_FMT_HEX, primes[i].m, 0, NULL))
+      continue;
+    rc = gcry_mpi_cmp(h, m);
+    gcry_mpi_release(h);
+    if (! rc)
+      break;
+  }
+  if (i == PRIME_NUM || ! (f = malloc(sizeof(struct field))))
+    return NULL;
+  f->words = (gcry_mpi_get_nbits(m) + 31) / 32;
+  f->limbs = (f->words + 1) / 2;
+  f->m = gcry_mpi_copy(m);
+  mpi_to_limbs(f->p, f->limbs, m);
+  for(rc = 0; rc < f->words; rc++)
+    f->p32[rc] = f->p[rc / 2] >> 32 * (rc % 2);
+  if (primes[i].terms) {
+    solinas_setup(f, primes[i].terms, primes[i].nterms);
+    f->reduce = solinas_reduce;
+  }
+  else
+    f->reduce = p521_reduce;
+  return f;
+}
+
+void field_release(struct field *f)
+{
+  gcry_mpi_release(f->m);
+  free(f);
+}
+
+/******************************************************************************/
+
+void field_set(const struct field *f, uint64_t *r, const uint64_t *a)
+{
+  memcpy(r, a, f->limbs * sizeof(uint64_t));
+}
+
+void field_set_ui(const struct field *f, uint64_t *r, uint64_t a)
+{
+  memset(r, 0, f->limbs * sizeof(uint64_t));
+  r[0] = a;
+}
+
+int field_is_zero(const struct field *f, const uint64_t *a)
+{
+  uint64_t x = 0;
+  int i;
+  for(i = 0; i < f->limbs; i++)
+    x |= a[i];
+  return ! x;
+}
+
+int field_equal(const struct field *f, const uint64_t *a, const uint64_t *b)
+{
+  return ! cmp_limbs(a, b, f->limbs);
+}
+
+void field_add(const struct field *f, uint64_t *r, const uint64_t *a,
+	       const uint64_t *b)
+{
+  if (add_limbs(r, a, b, f->limbs) || cmp_limbs(r, f->p, f->limbs) >= 0)
+    sub_limbs(r, r, f->p, f->limbs);
+}
+
+void field_sub(const struct field *f, uint64_t *r, const uint64_t *a,
+	       const uint64_t *b)
+{
+  if (sub_limbs(r, a, b, f->limbs))
+    add_limbs(r, r, f->p, f->limbs);
+}
+
+void field_neg(const struct field *f, uint64_t *r, const uint64_t *a)
+{
+  if (! field_is_zero(f, a))
+    sub_limbs(r, f->p, a, f->limbs);
+  else
+    field_set(f, r, a);
+}
+
+void field_mul(const struct field *f, uint64_t *r, const uint64_t *a,
+	       const uint64_t *b)
+{
+  uint64_t t[2 * FIELD_LIMBS];
+  STATS_COUNT(mulm);
+  mul_limbs(t, a, b, f->limbs);
+  f->reduce(f, r, t);
+}
+
+void field_sqr(const struct field *f, uint64_t *r, const uint64_t *a)
+{
+  uint64_t t[2 * FIELD_LIMBS];
+  STATS_COUNT(mulm);
+  sqr_limbs(t, a, f->limbs);
+  f->reduce(f, r, t);
+}
+
+/* Left-to-right exponentiation with 4-bit windows, e is public           */
+void field_pow(const struct field *f, uint64_t *r, const uint64_t *a,
+	       const gcry_mpi_t e)
+{
+  field_elem T[16];
+  int n = gcry_mpi_get_nbits(e);
+  int i, j, d;
+  field_set_ui(f, T[0], 1);
+  field_set(f, T[1], a);
+  for(i = 2; i < 16; i++)
+    field_mul(f, T[i], T[i - 1], T[1]);
+  field_set_ui(f, r, 1);
+  for(i = (n + 3) / 4 - 1; i >= 0; i--) {
+    for(j = 0; j < 4; j++)
+      field_sqr(f, r, r);
+    for(d = 0, j = 3; j >= 0; j--)
+      d = (d << 1) | !! gcry_mpi_test_bit(e, 4 * i + j);
+    if (d)
+      field_mul(f, r, r, T[d]);
+  }
+  memset(T, 0, sizeof(T));
+}
+
+/* Inversions are rare enough to be left to gcrypt, in secure memory unless
+   a is known to be public                                                 */
+void field_inv(const struct field *f, uint64_t *r, const uint64_t *a,
+	       int secure)
+{
+  gcry_mpi_t h;
+  h = secure ? gcry_mpi_snew(0) : gcry_mpi_new(0);
+  field_to_mpi(f, h, a);
+  gcry_mpi_invm(h, h, f->m);
+  field_from_mpi(f, r, h);
+  gcry_mpi_release(h);
+}
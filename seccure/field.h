@@ -0,0 +1,92 @@
+/*
+ *  seccure  -  Copyright 2009 B. Poettering
+ *
+ *  Maintained by R. Tyler Ballance <tyler@slide.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* 
+ *   SECCURE Elliptic Curve Crypto Utility for Reliable Encryption
+ *
+ * Current homepage: http://slideinc.github.com/PyECC
+ * Original homepage: http://point-at-infinity.org/seccure/
+ *
+ *
+ * seccure implements a selection of asymmetric algorithms based on  
+ * elliptic curve cryptography (ECC). See the manpage or the project's  
+ * homepage for further details.
+ *
+ * This code links against the GNU gcrypt library "libgcrypt" (which
+ * is part of the GnuPG project). Use the included Makefile to build
+ * the binary.
+ * 
+ * Report bugs to: http://github.com/rtyler/PyECC/issues
+ */
+
+
+
+#ifndef INC_FIELD_H
+#define INC_FIELD_H
+
+#include <stdint.h>
+#include <gcrypt.h>
+
+/* Native arithmetic in the NIST prime fields.  Elements are little endian
+   arrays of 64 bit limbs and are always kept fully reduced.               */
+
+#define FIELD_LIMBS 9
+#define FIELD_WORDS (2 * FIELD_LIMBS)
+
+typedef uint64_t field_elem[FIELD_LIMBS];
+
+struct field {
+  int limbs, words;
+  uint64_t p[FIELD_LIMBS];
+  gcry_mpi_t m;
+  /* word i of a Solinas reduction is the sum of the words red[start[i]],
+     ..., red[neg[i] - 1] minus red[neg[i]], ..., red[start[i + 1] - 1]
+     of the double length product                                           */
+  unsigned char red[16 * FIELD_WORDS], start[FIELD_WORDS + 1];
+  unsigned char neg[FIELD_WORDS];
+  uint32_t p32[FIELD_WORDS];
+  void (*reduce)(const struct field *f, uint64_t *r, const uint64_t *t);
+};
+
+struct field* field_new(const gcry_mpi_t m);
+void field_release(struct field *f);
+
+void field_from_mpi(const struct field *f, uint64_t *r, const gcry_mpi_t a);
+void field_to_mpi(const struct field *f, gcry_mpi_t r, const uint64_t *a);
+
+void field_set(const struct field *f, uint64_t *r, const uint64_t *a);
+void field_set_ui(const struct field *f, uint64_t *r, uint64_t a);
+int field_is_zero(const struct field *f, const uint64_t *a);
+int field_equal(const struct field *f, const uint64_t *a, const uint64_t *b);
+
+void field_add(const struct field *f, uint64_t *r, const uint64_t *a,
+	       const uint64_t *b);
+void field_sub(const struct field *f, uint64_t *r, const uint64_t *a,
+	       const uint64_t *b);
+void field_neg(const struct field *f, uint64_t *r, const uint64_t *a);
+void field_mul(const struct field *f, uint64_t *r, const uint64_t *a,
+	       const uint64_t *b);
+void field_sqr(const struct field *f, uint64_t *r, const uint64_t *a);
+void field_pow(const struct field *f, uint64_t *r, const uint64_t *a,
+	       const gcry_mpi_t e);
+void field_inv(const struct field *f, uint64_t *r, const uint64_t *a,
+	       int secure);
+
+#endif /* INC_FIELD_H */
@@ -20,10 +20,15 @@
  */
 
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <strings.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <gcrypt.h>
 
@@ -33,8 +38,21 @@
 #include "protocol.h"
 #include "serialize.h"
 #include "aes256ctr.h"
+#include "stats.h"
 
-static unsigned int __init_ecc_refcount = 0;
+#if GCRYPT_VERSION_NUMBER < 0x010600
+/* Older libgcrypt releases need to be told how to lock */
+GCRY_THREAD_OPTION_PTHREAD_IMPL;
+#endif
+
+/*
+ * __init_ecc_lock guards the one-time libgcrypt setup, __keypair_lock guards
+ * filling the public key cache of an ::ECC_KeyPair.  libgcrypt stays set up
+ * until the process exits, keypairs and data may outlive every state
+ */
+static pthread_mutex_t __init_ecc_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t __keypair_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool __init_ecc_done = false;
 
 /**
  * Print a warning to stderr
@@ -70,34 +88,167 @@ bool __verify_state(ECC_State state)
 	return true;
 }
 
+#ifdef ECC_STATS
+/*
+ * __stats_call is the bookkeeping of one public call, STATS_CALL() sets it
+ * up and the cleanup attribute folds the counters the thread gathered in
+ * the meantime into the state on every way out of the function.  Calls
+ * nested in another public call leave the booking to the outer one.
+ */
+struct __stats_call {
+	ECC_State state;
+	ECC_Op op;
+	struct stats_counters start;
+	struct timespec begin;
+};
+static __thread unsigned int __stats_depth = 0;
+
+static void __stats_begin(struct __stats_call *call, ECC_Op op, ECC_State state)
+{
+	if (__stats_depth++ > 0)
+		return;
+	call->state = state;
+	call->op = op;
+	call->start = stats_thread;
+	clock_gettime(CLOCK_MONOTONIC, &call->begin);
+}
+
+static void __stats_end(struct __stats_call *call)
+{
+	struct timespec end;
+	ECC_Stats stats;
+
+	if ( (--__stats_depth > 0) || (call->state == NULL) )
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	stats = &call->state->stats;
+	__sync_fetch_and_add(&stats->invm, stats_thread.invm - call->start.invm);
+	__sync_fetch_and_add(&stats->mulm, stats_thread.mulm - call->start.mulm);
+	__sync_fetch_and_add(&stats->pointmul_fixed, 
+			stats_thread.pointmul_fixed - call->start.pointmul_fixed);
+	__sync_fetch_and_add(&stats->pointmul_variable, 
+			stats_thread.pointmul_variable - call->start.pointmul_variable);
+	__sync_fetch_and_add(&stats->pointmul_dual, 
+			stats_thread.pointmul_dual - call->start.pointmul_dual);
+	__sync_fetch_and_add(&stats->decompress, 
+			stats_thread.decompress - call->start.decompress);
+	__sync_fetch_and_add(&stats->secmem, stats_thread.secmem - call->start.secmem);
+	__sync_fetch_and_add(&stats->calls[call->op], 1);
+	__sync_fetch_and_add(&stats->nsec[call->op], 
+			(end.tv_sec - call->begin.tv_sec) * 1000000000ULL + 
+			end.tv_nsec - call->begin.tv_nsec);
+}
+
+#define STATS_CALL(op, state) \
+	struct __stats_call __stats_call __attribute__((cleanup(__stats_end))); \
+	__stats_begin(&__stats_call, op, state)
+#else
+#define STATS_CALL(op, state)
+#endif
+
+/**
+ * The serialization the state's ECC_Options.format asks for
+ */
+static enum disp_format __format(ECC_State state)
+{
+	if ( (state) && (state->options) && 
+			(state->options->format == ECC_FORMAT_BINARY) )
+		return DF_BIN;
+	return DF_COMPACT;
+}
+
+static bool __decompress_pub(struct affine_point *P, ECC_KeyPair keypair, 
+		ECC_State state)
+{
+	struct curve_params *cp = state->curveparams;
+
+	if (__format(state) == DF_BIN) {
+		if (keypair->pub_bytes != cp->pk_len_bin)
+			return false;
+		return decompress_from_string(P, keypair->pub, DF_BIN, cp);
+	}
+	if (strlen(keypair->pub) != cp->pk_len_compact)
+		return false;
+	return decompress_from_string(P, keypair->pub, DF_COMPACT, cp);
+}
+
+/**
+ * Return the decoded and validated public key of the ::ECC_KeyPair along
+ * with its table of multiples, both are built on first use and cached in
+ * the keypair.  The cache is filled at most once, under __keypair_lock, and
+ * never changes afterwards so that threads can share the keypair; it binds
+ * the keypair to the curve it was first used with.
+ */
+struct point_table *__keypair_table(ECC_KeyPair keypair, ECC_State state)
+{
+	struct curve_params *cp = state->curveparams;
+	struct point_table *pt = NULL;
+	struct affine_point P;
+
+#ifdef __ATOMIC_ACQUIRE
+	pt = __atomic_load_n(&keypair->pub_table, __ATOMIC_ACQUIRE);
+#endif
+	if (!pt) {
+		pthread_mutex_lock(&__keypair_lock);
+		if ( (!(pt = keypair->pub_table)) &&
+				(__decompress_pub(&P, keypair, state)) ) {
+			pt = point_table_new(&P, KEY_WNAF_WIDTH, &cp->dp);
+			point_release(&P);
+			if (pt) {
+				keypair->pub_curve = cp->name;
+#ifdef __ATOMIC_RELEASE
+				__atomic_store_n(&keypair->pub_table, pt, __ATOMIC_RELEASE);
+#else
+				keypair->pub_table = pt;
+#endif
+			}
+		}
+		pthread_mutex_unlock(&__keypair_lock);
+		if (!pt)
+			return NULL;
+	}
+
+	if (strcmp(keypair->pub_curve, cp->name) != 0) {
+		__warning("The ECC_KeyPair is already in use with another curve");
+		return NULL;
+	}
+	return pt;
+}
+
 
 /**
  * Handle initializing libgcrypt and some other preliminary necessities
  */
-bool __init_ecc(ECC_State state)
+bool __init_gcrypt(ECC_Options options)
 {
 	gcry_error_t err = 0;
-	
-	/* Make sure we don't accidentally double-init */
-	if (state->gcrypt_init)
-		return true;
 
-	if (__init_ecc_refcount > 0) {
-		__init_ecc_refcount++;
-		state->gcrypt_init = true;
-		return true;
-	}
-	
+#if GCRYPT_VERSION_NUMBER < 0x010600
+	gcry_control(GCRYCTL_SET_THREAD_CBS, &gcry_threads_pthread);
+#endif
 	if (!gcry_check_version(REQUIRED_LIBGCRYPT)) {
 		__gwarning("Incorrect libgcrypt version", err);
 		return false;
 	}
 
-	err = gcry_control(GCRYCTL_INIT_SECMEM, 1);
+	/*
+	 * The application might have set up libgcrypt on its own already
+	 */
+	if (gcry_control(GCRYCTL_INITIALIZATION_FINISHED_P))
+		return true;
+
+	/*
+	 * libgcrypt rounds tiny pools up to its minimum size
+	 */
+	if ( (options != NULL) && (options->secmem_size) )
+		err = gcry_control(GCRYCTL_INIT_SECMEM, options->secmem_size);
+	else
+		err = gcry_control(GCRYCTL_INIT_SECMEM, 1);
 	if (gcry_err_code(err))
 		__gwarning("Cannot enable libgcrypt's secure memory management", err);
 
-	if ( (state->options != NULL) && (state->options->secure_random) ) {
+	if ( (options != NULL) && (options->secure_random) ) {
 		err = gcry_control(GCRYCTL_USE_SECURE_RNDPOOL, 1);
 		if (gcry_err_code(err))
 			__gwarning("Cannot enable libgcrupt's secure random number generator", err);
@@ -108,25 +259,402 @@ bool __init_ecc(ECC_State state)
 #endif
 	gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
 
-	state->gcrypt_init = true;
-	if (__init_ecc_refcount != 0) {
-		fprintf(stderr, "We've attempted to re-initialize the secure memory pool?\n");
+	return true;
+}
+
+/**
+ * Make sure libgcrypt is set up, exactly once per process no matter how many
+ * threads create their ::ECC_State objects at the same time
+ */
+bool __init_ecc(ECC_State state)
+{
+	bool rc = true;
+
+	/* Make sure we don't accidentally double-init */
+	if (state->gcrypt_init)
+		return true;
+
+	pthread_mutex_lock(&__init_ecc_lock);
+	if (!__init_ecc_done)
+		rc = __init_ecc_done = __init_gcrypt(state->options);
+	if (rc)
+		state->gcrypt_init = true;
+	pthread_mutex_unlock(&__init_ecc_lock);
+
+	return rc;
+}
+
+/**
+ * The ECIES ephemeral pool: a background thread keeps up to `size` 
+ * ephemeral keys (k, R = k*G and R compressed) around, so that encrypting
+ * only has to compute k*Q.  Every entry is handed out once and wiped after
+ * use.  The thread goes back to sleep whenever the pool is full.
+ *
+ * A forked child inherits the entries but not the thread.  Handing out the
+ * parent's entries would have both processes encrypt with the same keys, so
+ * the child wipes them on first use and starts a thread of its own.
+ */
+struct ephemeral_entry {
+	gcry_mpi_t k;
+	struct affine_point R;
+};
+
+struct ephemeral_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t wakeup;
+	pthread_t thread;
+	pid_t pid; /* the process the entries and the thread belong to */
+	bool running, stop;
+	unsigned int size, count;
+	struct curve_params *cp;
+	struct ephemeral_entry *entries;
+	char *headers;
+	struct ephemeral_pool *next; /* on the list of __ephemeral_pools */
+};
+
+/*
+ * All live pools, so that fork() can find their locks: the pthread_atfork()
+ * handlers hold every pool lock across the fork and the child sets them up
+ * afresh, no other thread of the parent can have kept one locked
+ */
+static pthread_mutex_t __ephemeral_pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t __ephemeral_atfork_once = PTHREAD_ONCE_INIT;
+static struct ephemeral_pool *__ephemeral_pools = NULL;
+
+static void __ephemeral_prefork(void)
+{
+	struct ephemeral_pool *pool;
+
+	pthread_mutex_lock(&__ephemeral_pools_lock);
+	for (pool = __ephemeral_pools; pool != NULL; pool = pool->next)
+		pthread_mutex_lock(&pool->lock);
+}
+
+static void __ephemeral_postfork_parent(void)
+{
+	struct ephemeral_pool *pool;
+
+	for (pool = __ephemeral_pools; pool != NULL; pool = pool->next)
+		pthread_mutex_unlock(&pool->lock);
+	pthread_mutex_unlock(&__ephemeral_pools_lock);
+}
+
+static void __ephemeral_postfork_child(void)
+{
+	struct ephemeral_pool *pool;
+
+	for (pool = __ephemeral_pools; pool != NULL; pool = pool->next) {
+		pthread_mutex_init(&pool->lock, NULL);
+		pthread_cond_init(&pool->wakeup, NULL);
+		pool->running = false;
 	}
-	__init_ecc_refcount = 2;
+	pthread_mutex_init(&__ephemeral_pools_lock, NULL);
+}
 
-	return true;
+static void __ephemeral_atfork(void)
+{
+	pthread_atfork(__ephemeral_prefork, __ephemeral_postfork_parent, 
+			__ephemeral_postfork_child);
+}
+
+static void __ephemeral_wipe(gcry_mpi_t k, struct affine_point *R)
+{
+	gcry_mpi_set_ui(k, 0);
+	gcry_mpi_release(k);
+	point_release(R);
+}
+
+static void *__ephemeral_refill(void *_pool)
+{
+	struct ephemeral_pool *pool = (struct ephemeral_pool *)(_pool);
+	unsigned int len = pool->cp->pk_len_bin;
+	struct affine_point R;
+	char header[len];
+	gcry_mpi_t k;
+
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->stop) {
+		if (pool->count == pool->size) {
+			pthread_cond_wait(&pool->wakeup, &pool->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		k = ECIES_ephemeral(&R, pool->cp);
+		compress_to_string(header, DF_BIN, &R, pool->cp);
+
+		pthread_mutex_lock(&pool->lock);
+		if ( (pool->stop) || (pool->count == pool->size) ) {
+			__ephemeral_wipe(k, &R);
+			continue;
+		}
+		pool->entries[pool->count].k = k;
+		pool->entries[pool->count].R = R;
+		memcpy(pool->headers + pool->count * len, header, len);
+		pool->count++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/**
+ * Called with the pool lock held: in a forked child wipe what the parent
+ * precomputed and, unless the pool is being stopped, restart the refill 
+ * thread.  A child that cannot start one is left with an empty pool.
+ */
+static void __ephemeral_adopt(struct ephemeral_pool *pool)
+{
+	unsigned int i;
+
+	if (pool->pid == getpid())
+		return;
+
+	for (i = 0; i < pool->count; ++i)
+		__ephemeral_wipe(pool->entries[i].k, &pool->entries[i].R);
+	memset(pool->headers, 0, pool->size * pool->cp->pk_len_bin);
+	pool->count = 0;
+	pool->pid = getpid();
+	if (!pool->stop)
+		pool->running = (pthread_create(&pool->thread, NULL, 
+				__ephemeral_refill, pool) == 0);
+}
+
+static void __ephemeral_pool_free(struct ephemeral_pool *pool)
+{
+	struct ephemeral_pool **p;
+	unsigned int i;
+
+	if (pool == NULL)
+		return;
+
+	pthread_mutex_lock(&__ephemeral_pools_lock);
+	for (p = &__ephemeral_pools; *p != NULL; p = &(*p)->next) {
+		if (*p == pool) {
+			*p = pool->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&__ephemeral_pools_lock);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	__ephemeral_adopt(pool);
+	pthread_cond_signal(&pool->wakeup);
+	pthread_mutex_unlock(&pool->lock);
+	if (pool->running)
+		pthread_join(pool->thread, NULL);
+
+	for (i = 0; i < pool->count; ++i)
+		__ephemeral_wipe(pool->entries[i].k, &pool->entries[i].R);
+	pthread_cond_destroy(&pool->wakeup);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->entries);
+	free(pool->headers);
+	free(pool);
+}
+
+static struct ephemeral_pool *__ephemeral_pool_new(struct curve_params *cp, 
+		unsigned int size)
+{
+	struct ephemeral_pool *pool;
+
+	if (size > ECC_EPHEMERALS_MAX)
+		size = ECC_EPHEMERALS_MAX;
+
+	pool = (struct ephemeral_pool *)(malloc(sizeof(struct ephemeral_pool)));
+	if (!pool)
+		return NULL;
+	pool->entries = (struct ephemeral_entry *)(malloc(sizeof(struct ephemeral_entry) * size));
+	pool->headers = (char *)(malloc(sizeof(char) * size * cp->pk_len_bin));
+	if ( (!pool->entries) || (!pool->headers) ) {
+		free(pool->entries);
+		free(pool->headers);
+		free(pool);
+		return NULL;
+	}
+
+	pthread_once(&__ephemeral_atfork_once, __ephemeral_atfork);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wakeup, NULL);
+	pool->pid = getpid();
+	pool->stop = false;
+	pool->size = size;
+	pool->count = 0;
+	pool->cp = cp;
+
+	if (pthread_create(&pool->thread, NULL, __ephemeral_refill, pool) != 0) {
+		pthread_cond_destroy(&pool->wakeup);
+		pthread_mutex_destroy(&pool->lock);
+		free(pool->entries);
+		free(pool->headers);
+		free(pool);
+		return NULL;
+	}
+	pool->running = true;
+
+	pthread_mutex_lock(&__ephemeral_pools_lock);
+	pool->next = __ephemeral_pools;
+	__ephemeral_pools = pool;
+	pthread_mutex_unlock(&__ephemeral_pools_lock);
+	return pool;
+}
+
+/**
+ * Take a precomputed ephemeral key out of the pool, if there is one
+ */
+static bool __ephemeral_take(struct ephemeral_pool *pool, gcry_mpi_t *k, 
+		struct affine_point *R, char *header)
+{
+	unsigned int len;
+	bool rc = false;
+
+	if (pool == NULL)
+		return false;
+
+	len = pool->cp->pk_len_bin;
+	pthread_mutex_lock(&pool->lock);
+	__ephemeral_adopt(pool);
+	if (pool->count > 0) {
+		pool->count--;
+		*k = pool->entries[pool->count].k;
+		*R = pool->entries[pool->count].R;
+		memcpy(header, pool->headers + pool->count * len, len);
+		pthread_cond_signal(&pool->wakeup);
+		rc = true;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return rc;
+}
+
+/**
+ * Derive the keys for encrypting to P into keybuf and write the point R
+ * the recipient needs into `header`, with a precomputed ephemeral key if
+ * the state's pool has one
+ */
+static void __ecies_encrypt(char *keybuf, char *header, struct point_table *P, 
+		ECC_State state)
+{
+	struct curve_params *cp = state->curveparams;
+	struct affine_point R;
+	gcry_mpi_t k;
+	bool done = false;
+
+	if (__ephemeral_take(state->ephemerals, &k, &R, header)) {
+		done = ECIES_encryption_ephemeral(keybuf, k, &R, P, cp);
+		__ephemeral_wipe(k, &R);
+	}
+	if (!done) {
+		R = ECIES_encryption_table(keybuf, P, cp);
+		compress_to_string(header, DF_BIN, &R, cp);
+		point_release(&R);
+	}
+}
+
+/**
+ * The DH session key cache: up to `size` derived keys, keyed by a SHA-256
+ * over the curve, our private key and the peer's public key, the least 
+ * recently used one goes first.  The entries live in secure memory.
+ */
+#define DH_ID_LEN 32
+
+struct dh_entry {
+	char id[DH_ID_LEN];
+	char key[ECC_DH_KEY_LEN];
+	unsigned long used;
+};
+
+struct dh_cache {
+	pthread_mutex_t lock;
+	unsigned int size, count;
+	unsigned long clock;
+	struct dh_entry *entries;
+};
+
+static void __dh_cache_free(struct dh_cache *cache)
+{
+	if (cache == NULL)
+		return;
+	bzero(cache->entries, sizeof(struct dh_entry) * cache->size);
+	gcry_free(cache->entries);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+static struct dh_cache *__dh_cache_new(unsigned int size)
+{
+	struct dh_cache *cache;
+
+	if (size > ECC_DH_CACHE_MAX)
+		size = ECC_DH_CACHE_MAX;
+
+	cache = (struct dh_cache *)(malloc(sizeof(struct dh_cache)));
+	if (!cache)
+		return NULL;
+	cache->entries = (struct dh_entry *)(gcry_malloc_secure(
+				sizeof(struct dh_entry) * size));
+	if (!cache->entries) {
+		free(cache);
+		return NULL;
+	}
+	pthread_mutex_init(&cache->lock, NULL);
+	cache->size = size;
+	cache->count = 0;
+	cache->clock = 0;
+	return cache;
+}
+
+static bool __dh_cache_get(struct dh_cache *cache, const char *id, char *key)
+{
+	unsigned int i;
+	bool rc = false;
+
+	pthread_mutex_lock(&cache->lock);
+	for (i = 0; i < cache->count; ++i) {
+		if (!memcmp(cache->entries[i].id, id, DH_ID_LEN)) {
+			memcpy(key, cache->entries[i].key, ECC_DH_KEY_LEN);
+			cache->entries[i].used = ++cache->clock;
+			rc = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+	return rc;
+}
+
+static void __dh_cache_put(struct dh_cache *cache, const char *id, 
+		const char *key)
+{
+	unsigned int i, slot = 0;
+
+	pthread_mutex_lock(&cache->lock);
+	for (i = 0; i < cache->count; ++i) {
+		/* Another thread might have got here first */
+		if (!memcmp(cache->entries[i].id, id, DH_ID_LEN)) {
+			slot = i;
+			break;
+		}
+		if (cache->entries[i].used < cache->entries[slot].used)
+			slot = i;
+	}
+	if ( (i == cache->count) && (cache->count < cache->size) )
+		slot = cache->count++;
+	memcpy(cache->entries[slot].id, id, DH_ID_LEN);
+	memcpy(cache->entries[slot].key, key, ECC_DH_KEY_LEN);
+	cache->entries[slot].used = ++cache->clock;
+	pthread_mutex_unlock(&cache->lock);
 }
 
 struct curve_params *__curve_from_opts(ECC_Options opts)
 {
 	struct curve_params *c_params;
 	/*
-	 * Pull out the curve if it's passed in on the opts object
+	 * Pull out the curve if it's passed in on the opts object, the
+	 * curve_params are shared by every state using the same curve
 	 */
 	if ( (opts != NULL) && (opts->curve != NULL) ) 
-		c_params = curve_by_name(opts->curve);
+		c_params = curve_shared_by_name(opts->curve);
 	else
-		c_params = curve_by_name(DEFAULT_CURVE);
+		c_params = curve_shared_by_name(DEFAULT_CURVE);
 
 	return c_params;
 }
@@ -153,6 +681,27 @@ ECC_State ecc_new_state(ECC_Options opts)
 	}
 
 	state->curveparams = __curve_from_opts(opts);
+	/*
+	 * The caller's opts->curve may be temporary, keep our own copy of the
+	 * canonical name rather than pointing back at it
+	 */
+	if ( (state->curveparams) && 
+			(!(state->curve = strdup(state->curveparams->name))) ) {
+		__warning("Cannot allocate enough memory in ecc_new_state()");
+		free(state);
+		return NULL;
+	}
+
+	if ( (opts) && (opts->ephemerals > 0) && (state->curveparams) ) {
+		state->ephemerals = __ephemeral_pool_new(state->curveparams, 
+				opts->ephemerals);
+		if (!state->ephemerals)
+			__warning("Cannot set up the pool of ECIES ephemeral keys");
+	}
+	if ( (opts) && (opts->dh_cache > 0) ) {
+		if (!(state->dh_cache = __dh_cache_new(opts->dh_cache)))
+			__warning("Cannot set up the DH session key cache");
+	}
 
 	return state;
 }
@@ -162,15 +711,11 @@ void ecc_free_state(ECC_State state)
 	if (state == NULL)
 		return;
 	
+	__ephemeral_pool_free(state->ephemerals);
+	__dh_cache_free(state->dh_cache);
 	if (state->options)
 		free(state->options);
-	
-	if (state->curveparams)
-		curve_release(state->curveparams);
-	
-	if (state->gcrypt_init) {
-		__init_ecc_refcount--;
-	}
+	free(state->curve);
 
 	free(state);
 	state = NULL;
@@ -183,6 +728,8 @@ void ecc_free_keypair(ECC_KeyPair kp)
 
 	if (kp->priv)
 		gcry_mpi_release(kp->priv);
+	if (kp->pub_table)
+		point_table_release(kp->pub_table);
 
 	free(kp);
 	kp = NULL;
@@ -196,13 +743,14 @@ ECC_KeyPair ecc_new_keypair(char *pubkey, char *privkey, ECC_State state)
 	 * If we have a pubkey, it should be cp->pk_len_compact and no larger
 	 */
 	if (pubkey)
-		publen = state->curveparams->pk_len_compact;
+		publen = ecc_public_key_size(state);
 	/*
 	 * Relying on the private key being passed in as a legit string (i.e.
-	 * a hex encoded MPI
+	 * a hex encoded MPI, binary keys have their fixed size
 	 */
 	if (privkey)
-		privlen = strlen((const char *)(privkey));
+		privlen = (__format(state) == DF_BIN) ? ecc_private_key_size(state) :
+				strlen((const char *)(privkey));
 
 	return ecc_new_keypair_s(pubkey, publen, privkey, privlen, state);
 }
@@ -221,6 +769,8 @@ ECC_KeyPair ecc_new_keypair_s(char *pubkey, unsigned int pubkeylen,
 	kp->pub = NULL;
 	kp->priv = NULL;
 	kp->pub_bytes = 0;
+	kp->pub_table = NULL;
+	kp->pub_curve = NULL;
 
 	if (pubkey != NULL) {
 		kp->pub = pubkey;
@@ -228,7 +778,7 @@ ECC_KeyPair ecc_new_keypair_s(char *pubkey, unsigned int pubkeylen,
 	}
 
 	if (privkey != NULL) {
-		if (!deserialize_mpi(&kp->priv, DF_COMPACT, privkey, privkeylen)) {
+		if (!deserialize_mpi(&kp->priv, __format(state), privkey, privkeylen)) {
 			__warning("Failed to deserialize the private key in ecc_new_keypair_s()");
 			ecc_free_keypair(kp);
 			return NULL;
@@ -276,74 +826,132 @@ ECC_Options ecc_new_options()
 	 */
 	opts->secure_random = true;
 	opts->curve = DEFAULT_CURVE;
+	opts->ephemerals = 0;
+	opts->dh_cache = 0;
+	opts->format = ECC_FORMAT_COMPACT;
+	opts->secmem_size = 0;
+	opts->legacy_mac = false;
 
 	return opts;
 }
 
-ECC_KeyPair ecc_keygen(void *priv, ECC_State state)
-{
-	ECC_KeyPair result = NULL;
-	struct affine_point ap;
-	char *r;
-	unsigned int bits;
-
-	if (priv != NULL)
-		return NULL;
+/*
+ * Number of keys __keygen() brings back to affine coordinates with a
+ * single inversion, their points are kept on the stack
+ */
+#define KEYGEN_BATCH 64
 
-	/* 
-	 * Generate our own private key via /dev/urandom
-	 */
-	bits = gcry_mpi_get_nbits(state->curveparams->dp.order);
-	r = (char *)(malloc(bits));
+/*
+ * Fill kps with n fresh keypairs.  One seed from the strong entropy pool
+ * is expanded through aes256cprng into all n private keys, the public 
+ * points come from the fixed-base table KEYGEN_BATCH at a time.
+ */
+static bool __keygen(ECC_KeyPair *kps, unsigned int n, ECC_State state)
+{
+	struct curve_params *cp = state->curveparams;
+	struct affine_point R[KEYGEN_BATCH];
+	gcry_mpi_t privs[KEYGEN_BATCH];
+	struct aes256cprng *cprng = NULL;
+	unsigned int i, j, m, publen, len = cp->order_len_bin;
+	char *seed, *buf;
+	bool rc = false;
 
-	if (!r) {
-		if (errno == ENOMEM) 
-			__warning("Cannot allocate memory for `bits` in ecc_keygen()");
-		return NULL;
+	bzero(kps, sizeof(ECC_KeyPair) * n);
+	if (!(seed = gcry_malloc_secure(CIPHER_KEY_SIZE + len))) {
+		__warning("Out of secure memory!");
+		return false;
 	}
+	buf = seed + CIPHER_KEY_SIZE;
 
-	gcry_randomize(r, bits, GCRY_VERY_STRONG_RANDOM);
-
-	if (!r) {
-		__warning("Failed to generate a random buffer of N bytes");
-		return NULL;
+	gcry_randomize(seed, CIPHER_KEY_SIZE, GCRY_VERY_STRONG_RANDOM);
+	cprng = aes256cprng_init(seed);
+	memset(seed, 0, CIPHER_KEY_SIZE);
+	if (!cprng) {
+		__warning("Cannot set up the random number generator for the private keys");
+		goto exit;
 	}
 
-	result = ecc_new_keypair_s(NULL, 0,  NULL, 0, state);
+	publen = ecc_public_key_size(state);
+	for (i = 0; i < n; i += m) {
+		m = (n - i < KEYGEN_BATCH) ? (n - i) : KEYGEN_BATCH;
+
+		for (j = i; j < i + m; j++) {
+			if ( (!(kps[j] = ecc_new_keypair_s(NULL, 0, NULL, 0, state))) || 
+					(!(kps[j]->pub = malloc(sizeof(char) * (publen + 1)))) ) {
+				__warning("Cannot allocate memory for the keypairs");
+				goto exit;
+			}
+			aes256cprng_fillbuf(cprng, buf, len);
+			privs[j - i] = kps[j]->priv = buf_to_exponent(buf, len, cp);
+		}
 
-	if (!result) {
-		__warning("Failed to generate empty keypair in ecc_keygen()!");
-		if (r)
-			free(r);
-		return NULL;
+		pointmul_base_batch(R, privs, m, &cp->dp);
+
+		for (j = i; j < i + m; j++) {
+			compress_to_string((char *)(kps[j]->pub), __format(state), 
+					&R[j - i], cp);
+			point_release(&R[j - i]);
+			((char *)(kps[j]->pub))[publen] = '\0';
+			/* Compact keys have always counted their NUL */
+			kps[j]->pub_bytes = publen;
+			if (__format(state) == DF_COMPACT)
+				kps[j]->pub_bytes++;
+		}
 	}
-
-	result->priv = hash_to_exponent(r, state->curveparams);
-
-	if (r) {
-		free(r);
-		r = NULL;
+	rc = true;
+
+exit:
+	if (!rc) {
+		for (i = 0; i < n; i++) {
+			if (kps[i]) {
+				free(kps[i]->pub);
+				ecc_free_keypair(kps[i]);
+				kps[i] = NULL;
+			}
+		}
 	}
+	if (cprng)
+		aes256cprng_done(cprng);
+	memset(buf, 0, len);
+	gcry_free(seed);
+	return rc;
+}
 
-	r = (char *)(malloc(sizeof(char) * (state->curveparams->pk_len_compact + 1)));
+ECC_KeyPair ecc_keygen(void *priv, ECC_State state)
+{
+	ECC_KeyPair result;
+	STATS_CALL(ECC_OP_KEYGEN, state);
 
-	if (!r) {
-		if (errno == ENOMEM)
-			__warning("Cannot allocate `r` again in ecc_keygen()");
+	if (priv != NULL)
+		return NULL;
+	if (!__verify_state(state)) {
+		__warning("Invalid state passed to ecc_keygen()");
 		return NULL;
 	}
 
-	ap = pointmul(&state->curveparams->dp.base, result->priv,
-		&state->curveparams->dp);
-
-	compress_to_string((char *)(r), DF_COMPACT, &ap, state->curveparams);
+	if (!__keygen(&result, 1, state))
+		return NULL;
+	return result;
+}
 
-	point_release(&ap);
+ECC_KeyPair *ecc_keygen_batch(unsigned int n, ECC_State state)
+{
+	ECC_KeyPair *result;
+	STATS_CALL(ECC_OP_KEYGEN, state);
 
-	result->pub = r;
-	r[state->curveparams->pk_len_compact] = '\0';
-	result->pub_bytes = (unsigned int)(state->curveparams->pk_len_compact + 1);
+	if ( (n == 0) || (!__verify_state(state)) ) {
+		__warning("Invalid arguments passed to ecc_keygen_batch()");
+		return NULL;
+	}
+	if (!(result = (ECC_KeyPair *)(malloc(sizeof(ECC_KeyPair) * (size_t)(n))))) {
+		__warning("Cannot allocate memory in ecc_keygen_batch()");
+		return NULL;
+	}
 
+	if (!__keygen(result, n, state)) {
+		free(result);
+		return NULL;
+	}
 	return result;
 }
 
@@ -364,48 +972,148 @@ const char *ecc_mpi_to_str(gcry_mpi_t key)
 	return (const char *)(buf);
 }
 
-ECC_Data ecc_decrypt(ECC_Data encrypted, ECC_KeyPair keypair, ECC_State state)
-{
-	ECC_Data rc = NULL;
-	int offset;
-	char *keybuf, *block;
-	struct aes256ctr *ac;
-	gcry_md_hd_t digest;
-	struct affine_point *R = NULL;
+/*
+ * Payloads are encrypted and MAC'ed CRYPT_CHUNK bytes at a time so that each
+ * chunk is hashed while it is still in the cache
+ */
+#define CRYPT_CHUNK 65536
 
-	if (!__verify_state(state)) {
-		__warning("Invalid state passed to ecc_decrypt()");
-		goto exit;
-	}
-	if (!__verify_keypair(keypair, true, false)) {
-		__warning("Invalid keypair passed to ecc_decrypt()");
-		goto exit;
-	}
+/*
+ * ECIES derives the AES-256 key followed by the HMAC-SHA256 key
+ */
+#define ECIES_KEYBYTES (CIPHER_KEY_SIZE + HMAC_KEY_SIZE)
 
-	/*
-	 * Take the first bits off buffer to get the curve info
-	 */
-	R = (struct affine_point *)(malloc(sizeof(struct affine_point)));
+int ecc_encrypted_size(unsigned int databytes, ECC_State state)
+{
+	unsigned long long size;
+
+	if (!__verify_state(state))
+		return -1;
+	size = (unsigned long long)(state->curveparams->pk_len_bin) + databytes + 
+		DEFAULT_MAC_LEN;
+	if (size > INT_MAX)
+		return -1;
+	return (int)(size);
+}
 
-	if (!R) {
-		if (errno == ENOMEM) 
-			__warning("Cannot allocate memory for `R` in ecc_decrypt()");
-		return NULL;
+int ecc_decrypted_size(unsigned int encbytes, ECC_State state)
+{
+	unsigned int overhead;
+
+	if (!__verify_state(state))
+		return -1;
+	overhead = state->curveparams->pk_len_bin + DEFAULT_MAC_LEN;
+	if (encbytes < overhead)
+		return -1;
+	return encbytes - overhead;
+}
+
+/**
+ * Compare two DEFAULT_MAC_LEN byte tags in constant time
+ */
+static bool __tag_equal(const void *a, const void *b)
+{
+	const unsigned char *x = (const unsigned char *)(a);
+	const unsigned char *y = (const unsigned char *)(b);
+	unsigned char diff = 0;
+	unsigned int i;
+
+	for (i = 0; i < DEFAULT_MAC_LEN; ++i)
+		diff |= x[i] ^ y[i];
+	return diff == 0;
+}
+
+/**
+ * Compare the MAC `tag` a ciphertext came with against `digest`, the HMAC 
+ * over the ciphertext, in constant time.  ecc_encrypt() of older releases
+ * MACed no data at all: `legacy` is that MAC when the state's 
+ * ECC_Options.legacy_mac asks for it, NULL otherwise
+ */
+static bool __check_mac(gcry_md_hd_t digest, gcry_md_hd_t legacy, 
+		const char *tag)
+{
+	bool valid, legacy_valid = false;
+
+	gcry_md_final(digest);
+	valid = __tag_equal(gcry_md_read(digest, 0), tag);
+	if (legacy) {
+		gcry_md_final(legacy);
+		legacy_valid = __tag_equal(gcry_md_read(legacy, 0), tag);
+	}
+	return valid || legacy_valid;
+}
+
+/**
+ * Set up the MACs __check_mac() compares against
+ */
+static bool __open_macs(gcry_md_hd_t *digest, gcry_md_hd_t *legacy, 
+		const char *mackey, ECC_State state)
+{
+	*legacy = NULL;
+	if (!(hmacsha256_init(digest, mackey, HMAC_KEY_SIZE))) {
+		__warning("Couldn't initialize HMAC-SHA256");
+		return false;
+	}
+	if ( (state->options) && (state->options->legacy_mac) &&
+			(!(hmacsha256_init(legacy, mackey, HMAC_KEY_SIZE))) ) {
+		__warning("Couldn't initialize HMAC-SHA256");
+		gcry_md_close(*digest);
+		*legacy = NULL;
+		return false;
+	}
+	return true;
+}
+
+static void __close_macs(gcry_md_hd_t digest, gcry_md_hd_t legacy)
+{
+	gcry_md_close(digest);
+	if (legacy)
+		gcry_md_close(legacy);
+}
+
+int ecc_decrypt_into(void *data, unsigned int databytes, void *out, 
+		unsigned int outbytes, ECC_KeyPair keypair, ECC_State state)
+{
+	int rc = -1, plainbytes;
+	unsigned int offset, c;
+	char *keybuf, *block;
+	struct aes256ctr *ac;
+	struct affine_point R;
+	gcry_md_hd_t digest, legacy;
+	STATS_CALL(ECC_OP_DECRYPT, state);
+
+	if (!__verify_state(state)) {
+		__warning("Invalid state passed to ecc_decrypt_into()");
+		goto exit;
+	}
+	if (!__verify_keypair(keypair, true, false)) {
+		__warning("Invalid keypair passed to ecc_decrypt_into()");
+		goto exit;
+	}
+	if ( (!data) || ((plainbytes = ecc_decrypted_size(databytes, state)) < 0) ) {
+		__warning("Invalid or truncated `data` argument passed to ecc_decrypt_into()");
+		goto exit;
+	}
+	if ( (!out) || (outbytes < (unsigned int)(plainbytes)) ) {
+		__warning("Output buffer passed to ecc_decrypt_into() is too small");
+		goto exit;
 	}
 
-	if (!decompress_from_string(R, (char *)(encrypted->data), DF_BIN, 
+	/*
+	 * Take the first bits off buffer to get the curve info
+	 */
+	if (!decompress_from_string(&R, (char *)(data), DF_BIN, 
 				state->curveparams)) {
-		__warning("Failed to decompress_from_string() in ecc_decrypt()");
+		__warning("Failed to decompress_from_string() in ecc_decrypt_into()");
 		goto exit;
 	}
 
-	/* Why only 64? */
-	if (!(keybuf = gcry_malloc_secure(64))) { 
+	if (!(keybuf = gcry_malloc_secure(ECIES_KEYBYTES))) { 
 		__warning("Out of secure memory!");
-		goto bailout;
+		goto release;
 	}
 
-	if (!ECIES_decryption(keybuf, R, keypair->priv, state->curveparams)) {
+	if (!ECIES_decryption(keybuf, &R, keypair->priv, state->curveparams)) {
 		__warning("ECIES_decryption() failed");
 		goto bailout;
 	}
@@ -414,47 +1122,162 @@ ECC_Data ecc_decrypt(ECC_Data encrypted, ECC_KeyPair keypair, ECC_State state)
 		__warning("Cannot initialize AES256-CTR");
 		goto bailout;
 	}
-
-	if (!(hmacsha256_init(&digest, keybuf + 32, HMAC_KEY_SIZE))) {
-		__warning("Couldn't initialize HMAC-SHA256");
+	if (!__open_macs(&digest, &legacy, keybuf + CIPHER_KEY_SIZE, state)) {
+		aes256ctr_done(ac);
 		goto bailout;
 	}
 
-	rc = ecc_new_data();
-	bzero(keybuf, 64);
-
 	/*
-	 * Decrypt the rest of the block (the actual encrypted data)
+	 * MAC and decrypt the rest of the block (the actual encrypted data) 
+	 * straight into `out` in one pass, a forged ciphertext is wiped again
 	 */
-	block = ((char *)(encrypted->data) + state->curveparams->pk_len_bin);
-	offset = (encrypted->datalen - state->curveparams->pk_len_bin);
-
-	gcry_md_write(digest, block, offset);
-
-	aes256ctr_dec(ac, block, offset);
+	block = (char *)(data) + state->curveparams->pk_len_bin;
+	for (offset = 0; offset < (unsigned int)(plainbytes); offset += c) {
+		c = plainbytes - offset;
+		if (c > CRYPT_CHUNK)
+			c = CRYPT_CHUNK;
+		gcry_md_write(digest, block + offset, c);
+		aes256ctr_crypt(ac, (char *)(out) + offset, block + offset, c);
+	}
 
 	/* aes256ctr_done() will also handle gcry_free()'ing the pointer */
 	aes256ctr_done(ac);
-	/* gcry_md_close() will also handle gcry_free()'ing the pointer */
-	gcry_md_close(digest);
+	if (__check_mac(digest, legacy, block + plainbytes)) {
+		rc = plainbytes;
+	}
+	else {
+		__warning(legacy ? "Integrity check failed in ecc_decrypt_into()" :
+				"Integrity check failed in ecc_decrypt_into(), data of releases before "
+				"the MAC fix needs ECC_Options.legacy_mac (legacy_mac=True in pyecc)");
+		bzero(out, plainbytes);
+	}
+	__close_macs(digest, legacy);
+
+	bailout:
+		bzero(keybuf, ECIES_KEYBYTES);
+		gcry_free(keybuf);
+	release:
+		point_release(&R);
+	exit:
+		return rc;
+}
+
+ECC_Data ecc_decrypt(ECC_Data encrypted, ECC_KeyPair keypair, ECC_State state)
+{
+	ECC_Data rc = NULL;
+	int plainbytes;
+	STATS_CALL(ECC_OP_DECRYPT, state);
+
+	if ( (!encrypted) || (!encrypted->data) || 
+			((plainbytes = ecc_decrypted_size(encrypted->datalen, state)) < 0) ) {
+		__warning("Invalid or truncated `encrypted` argument passed to ecc_decrypt()");
+		return NULL;
+	}
 
-	offset = offset - DEFAULT_MAC_LEN;
-	rc->data = (void *)(malloc(sizeof(char) * (offset + 1)));
+	if (!(rc = ecc_new_data()))
+		return NULL;
+	rc->data = (void *)(malloc(sizeof(char) * (plainbytes + 1)));
 	if (!rc->data) {
 		if (errno == ENOMEM)
 			__warning("Cannot allocate memory for `rc->data` in ecc_decrypt()");
 		goto bailout;
 	}
-	rc->datalen = offset;
-	memcpy(rc->data, block, offset);
 
-	((char *)rc->data)[offset] = '\0';
+	if (ecc_decrypt_into(encrypted->data, encrypted->datalen, rc->data, 
+				plainbytes, keypair, state) < 0)
+		goto bailout;
+
+	rc->datalen = plainbytes;
+	((char *)rc->data)[plainbytes] = '\0';
+	return rc;
 
 	bailout:
-		point_release(R);
-		free(R);
+		ecc_free_data(rc);
+		return NULL;
+}
+
+int ecc_encrypt_into(void *data, unsigned int databytes, void *out, 
+		unsigned int outbytes, ECC_KeyPair keypair, ECC_State state)
+{
+	int rc = -1, encbytes;
+	unsigned int offset, c;
+	struct point_table *P;
+	struct aes256ctr *ac;
+	char *keybuf, *block;
+	gcry_md_hd_t digest;
+	STATS_CALL(ECC_OP_ENCRYPT, state);
+
+	if ( (data == NULL) ) {
+		__warning("Invalid or empty `data` argument passed to ecc_encrypt_into()");
+		goto exit;
+	}
+	if (!__verify_keypair(keypair, false, true)) {
+		__warning("Invalid ECC_KeyPair object passed to ecc_encrypt_into()");
+		goto exit;
+	}
+	if ((encbytes = ecc_encrypted_size(databytes, state)) < 0) {
+		__warning("Invalid state or oversized `data` passed to ecc_encrypt_into()");
+		goto exit;
+	}
+	if ( (!out) || (outbytes < (unsigned int)(encbytes)) ) {
+		__warning("Output buffer passed to ecc_encrypt_into() is too small");
+		goto exit;
+	}
+
+	if (!(P = __keypair_table(keypair, state))) {
+		__warning("Invalid public key");
+		goto exit;
+	}
+
+	if (!(keybuf = gcry_malloc_secure(ECIES_KEYBYTES))) { 
+		__warning("Out of secure memory!");
+		goto exit;
+	}
+
+	/*
+	 * The output buffer is in three sections:
+	 *    - rbuffer
+	 *    - cipher
+	 *    - hmac
+	 */
+	__ecies_encrypt(keybuf, (char *)(out), P, state);
+
+	if (!(ac = aes256ctr_init(keybuf))) {
+		__warning("Cannot initialize AES256-CTR");
+		goto release;
+	}
+	if (!(hmacsha256_init(&digest, keybuf + CIPHER_KEY_SIZE, HMAC_KEY_SIZE))) {
+		__warning("Couldn't initialize HMAC-SHA256");
+		aes256ctr_done(ac);
+		goto release;
+	}
+
+	/*
+	 * Encrypt straight from `data` into place and MAC the ciphertext
+	 * the way the seccure utility does
+	 */
+	block = (char *)(out) + state->curveparams->pk_len_bin;
+	for (offset = 0; offset < databytes; offset += c) {
+		c = databytes - offset;
+		if (c > CRYPT_CHUNK)
+			c = CRYPT_CHUNK;
+		aes256ctr_crypt(ac, block + offset, (char *)(data) + offset, c);
+		gcry_md_write(digest, block + offset, c);
+	}
+	aes256ctr_done(ac);
+
+	gcry_md_final(digest);
+	memcpy(block + databytes, gcry_md_read(digest, 0), DEFAULT_MAC_LEN);
+	/*
+	 * Upon closing the hash digest, the memory gcry_md_read() returned
+	 * is freed as well
+	 */
+	gcry_md_close(digest);
+	rc = encbytes;
+
+	release:
+		bzero(keybuf, ECIES_KEYBYTES);
 		gcry_free(keybuf);
-		keybuf = NULL;
 	exit:
 		return rc;
 }
@@ -462,147 +1285,1394 @@ ECC_Data ecc_decrypt(ECC_Data encrypted, ECC_KeyPair keypair, ECC_State state)
 ECC_Data ecc_encrypt(void *data, int databytes, ECC_KeyPair keypair, ECC_State state)
 {
 	ECC_Data rc = NULL;
-	struct affine_point *P, *R;
+	int encbytes;
+	STATS_CALL(ECC_OP_ENCRYPT, state);
+
+	if ( (data == NULL) || (databytes < 0) ) {
+		__warning("Invalid or empty `data` argument passed to ecc_encrypt()");
+		return NULL;
+	}
+	if ((encbytes = ecc_encrypted_size(databytes, state)) < 0) {
+		__warning("Invalid state or oversized `data` passed to ecc_encrypt()");
+		return NULL;
+	}
+
+	if (!(rc = ecc_new_data()))
+		return NULL;
+	rc->data = (void *)(malloc(sizeof(char) * encbytes));
+	if (!rc->data) {
+		if (errno == ENOMEM) 
+			__warning("Cannot allocate memory for `rc->data` in ecc_encrypt()");
+		goto bailout;
+	}
+
+	if (ecc_encrypt_into(data, databytes, rc->data, encbytes, keypair, state) < 0)
+		goto bailout;
+
+	rc->datalen = encbytes;
+	return rc;
+
+	bailout:
+		ecc_free_data(rc);
+		return NULL;
+}
+
+/*
+ * Multi-recipient ciphertexts encrypt the payload once under a random 
+ * data key (32 bytes AES256-CTR, 32 bytes HMAC-SHA256) and carry one slot
+ * per recipient with that data key wrapped under the recipient's ECIES 
+ * key:
+ *    - count, 4 bytes big endian
+ *    - count slots: recipient id, R, wrapped data key, MAC of the wrapped 
+ *      data key
+ *    - cipher
+ *    - hmac
+ * The recipient id lets a recipient pick its slot without an ECIES
+ * decryption per slot.
+ */
+#define MULTI_COUNT_LEN 4
+#define MULTI_ID_LEN 8
+#define MULTI_KEY_LEN 64
+#define MULTI_BATCH 16
+
+static unsigned int __multi_slot_len(ECC_State state)
+{
+	return MULTI_ID_LEN + state->curveparams->pk_len_bin + MULTI_KEY_LEN + 
+		DEFAULT_MAC_LEN;
+}
+
+/*
+ * The recipient id of the public point P, the first MULTI_ID_LEN bytes of 
+ * a SHA-256 over the curve and P in compressed binary form
+ */
+static void __multi_id(char *id, const struct affine_point *P, 
+		ECC_State state)
+{
+	struct curve_params *cp = state->curveparams;
+	unsigned int namelen = strlen(cp->name);
+	char buf[namelen + cp->pk_len_bin];
+	char hash[gcry_md_get_algo_dlen(GCRY_MD_SHA256)];
+
+	memcpy(buf, cp->name, namelen);
+	compress_to_string(buf + namelen, DF_BIN, P, cp);
+	gcry_md_hash_buffer(GCRY_MD_SHA256, hash, buf, namelen + cp->pk_len_bin);
+	memcpy(id, hash, MULTI_ID_LEN);
+}
+
+/*
+ * En- or decrypt a 64 byte data key with the ECIES key `slotkey`, `tag` 
+ * gets the MAC of the wrapped side
+ */
+static bool __multi_wrap(const char *slotkey, const char *in, char *out, 
+		char *tag, bool encrypt)
+{
 	struct aes256ctr *ac;
-	char *readbuf;
-	char *keybuf = NULL;
-	char *md;
-	void *plaintext = NULL;
-	unsigned int offset = 0;
 	gcry_md_hd_t digest;
 
-	if ( (data == NULL) ) {
-		__warning("Invalid or empty `data` argument passed to ecc_verify()");
-		goto exit;
+	if (!(ac = aes256ctr_init(slotkey))) {
+		__warning("Cannot initialize AES256-CTR");
+		return false;
 	}
-	if (!__verify_keypair(keypair, false, true)) {
-		__warning("Invalid ECC_KeyPair object passed to ecc_verify()");
-		goto exit;
+	if (!(hmacsha256_init(&digest, slotkey + 32, HMAC_KEY_SIZE))) {
+		__warning("Couldn't initialize HMAC-SHA256");
+		aes256ctr_done(ac);
+		return false;
 	}
-	if (!__verify_state(state)) {
+	aes256ctr_crypt(ac, out, in, MULTI_KEY_LEN);
+	aes256ctr_done(ac);
+
+	gcry_md_write(digest, encrypt ? out : in, MULTI_KEY_LEN);
+	gcry_md_final(digest);
+	memcpy(tag, gcry_md_read(digest, 0), DEFAULT_MAC_LEN);
+	gcry_md_close(digest);
+	return true;
+}
+
+int ecc_encrypted_multi_size(unsigned int databytes, unsigned int recipients, 
+		ECC_State state)
+{
+	unsigned long long size;
+
+	if (!__verify_state(state))
+		return -1;
+	size = MULTI_COUNT_LEN + (unsigned long long)(recipients) * 
+		__multi_slot_len(state) + databytes + DEFAULT_MAC_LEN;
+	if (size > INT_MAX)
+		return -1;
+	return (int)(size);
+}
+
+ECC_Data ecc_encrypt_multi(void *data, unsigned int databytes, 
+		ECC_KeyPair *keypairs, unsigned int recipients, ECC_State state)
+{
+	ECC_Data rc = NULL;
+	const struct point_table *P[MULTI_BATCH];
+	struct affine_point R[MULTI_BATCH];
+	unsigned int i, j, n, offset, c, slotlen;
+	char *datakey, *keybuf, *slot, *block;
+	struct aes256ctr *ac;
+	gcry_md_hd_t digest;
+	int encbytes;
+	STATS_CALL(ECC_OP_MULTI, state);
+
+	if ( (data == NULL) || (keypairs == NULL) || (recipients == 0) ) {
+		__warning("Invalid or empty arguments passed to ecc_encrypt_multi()");
+		return NULL;
+	}
+	if ((encbytes = ecc_encrypted_multi_size(databytes, recipients, state)) < 0) {
 		__warning("Invalid or uninitialized ECC_State object");
-		goto exit;
+		return NULL;
+	}
+	for (i = 0; i < recipients; ++i) {
+		if (!__verify_keypair(keypairs[i], false, true)) {
+			__warning("Invalid ECC_KeyPair object passed to ecc_encrypt_multi()");
+			return NULL;
+		}
 	}
 
-	readbuf = (char *)(malloc(sizeof(char) * state->curveparams->pk_len_bin));
-	P = (struct affine_point *)(malloc(sizeof(struct affine_point)));
-	R = (struct affine_point *)(malloc(sizeof(struct affine_point)));
+	if (!(rc = ecc_new_data()))
+		return NULL;
+	rc->data = (void *)(malloc(sizeof(char) * encbytes));
+	if (!rc->data) {
+		if (errno == ENOMEM) 
+			__warning("Cannot allocate memory for `rc->data` in ecc_encrypt_multi()");
+		goto bailout;
+	}
 
-	if ( (!readbuf) || (!R) || (!P) ) {
-		if (errno == ENOMEM)
-			__warning("Cannot allocate memory for `readbuf`, `P`, `R` in ecc_encrypt()");
-		if (R)
-			free(R);
-		if (P)
-			free(P);
-		if (readbuf)
-			free(readbuf);
+	if (!(datakey = gcry_malloc_secure(MULTI_KEY_LEN * (MULTI_BATCH + 1)))) {
+		__warning("Out of secure memory!");
+		goto bailout;
+	}
+	keybuf = datakey + MULTI_KEY_LEN;
+	gcry_randomize(datakey, MULTI_KEY_LEN, GCRY_STRONG_RANDOM);
+
+	slotlen = __multi_slot_len(state);
+	block = (char *)(rc->data);
+	for (i = 0; i < MULTI_COUNT_LEN; ++i)
+		block[i] = (recipients >> (8 * (MULTI_COUNT_LEN - 1 - i))) & 0xff;
+
+	/*
+	 * The ECIES keys are derived MULTI_BATCH recipients at a time, so
+	 * that their scalar multiplications share one inversion
+	 */
+	for (i = 0; i < recipients; i += n) {
+		n = recipients - i;
+		if (n > MULTI_BATCH)
+			n = MULTI_BATCH;
+		for (j = 0; j < n; ++j) {
+			if (!(P[j] = __keypair_table(keypairs[i + j], state))) {
+				__warning("Invalid public key");
+				goto release;
+			}
+		}
+
+		ECIES_encryption_batch(keybuf, R, P, n, state->curveparams);
+		for (j = 0; j < n; ++j) {
+			slot = block + MULTI_COUNT_LEN + (i + j) * slotlen;
+			__multi_id(slot, &P[j]->p, state);
+			slot += MULTI_ID_LEN;
+			compress_to_string(slot, DF_BIN, &R[j], state->curveparams);
+			point_release(&R[j]);
+			slot += state->curveparams->pk_len_bin;
+			if (!__multi_wrap(keybuf + j * MULTI_KEY_LEN, datakey, slot, 
+						slot + MULTI_KEY_LEN, true)) {
+				for (++j; j < n; ++j)
+					point_release(&R[j]);
+				goto release;
+			}
+		}
+	}
+
+	if (!(ac = aes256ctr_init(datakey))) {
+		__warning("Cannot initialize AES256-CTR");
+		goto release;
+	}
+	if (!(hmacsha256_init(&digest, datakey + 32, HMAC_KEY_SIZE))) {
+		__warning("Couldn't initialize HMAC-SHA256");
+		aes256ctr_done(ac);
+		goto release;
+	}
+
+	block += MULTI_COUNT_LEN + recipients * slotlen;
+	for (offset = 0; offset < databytes; offset += c) {
+		c = databytes - offset;
+		if (c > CRYPT_CHUNK)
+			c = CRYPT_CHUNK;
+		aes256ctr_crypt(ac, block + offset, (char *)(data) + offset, c);
+		gcry_md_write(digest, block + offset, c);
+	}
+	aes256ctr_done(ac);
+
+	gcry_md_final(digest);
+	memcpy(block + databytes, gcry_md_read(digest, 0), DEFAULT_MAC_LEN);
+	gcry_md_close(digest);
+
+	bzero(datakey, MULTI_KEY_LEN * (MULTI_BATCH + 1));
+	gcry_free(datakey);
+	rc->datalen = encbytes;
+	return rc;
+
+	release:
+		bzero(datakey, MULTI_KEY_LEN * (MULTI_BATCH + 1));
+		gcry_free(datakey);
+	bailout:
+		ecc_free_data(rc);
+		return NULL;
+}
+
+ECC_Data ecc_decrypt_multi(void *data, unsigned int databytes, 
+		ECC_KeyPair keypair, ECC_State state)
+{
+	ECC_Data rc = NULL;
+	unsigned int i, recipients = 0, slotlen, plainbytes, offset, c;
+	char *block, *slot, *keybuf, *datakey = NULL;
+	char tag[DEFAULT_MAC_LEN], id[MULTI_ID_LEN];
+	struct affine_point R;
+	struct aes256ctr *ac;
+	gcry_md_hd_t digest;
+	STATS_CALL(ECC_OP_MULTI, state);
+
+	if (!__verify_state(state)) {
+		__warning("Invalid state passed to ecc_decrypt_multi()");
+		return NULL;
+	}
+	if (!__verify_keypair(keypair, true, false)) {
+		__warning("Invalid keypair passed to ecc_decrypt_multi()");
+		return NULL;
+	}
+
+	block = (char *)(data);
+	slotlen = __multi_slot_len(state);
+	if ( (data) && (databytes >= MULTI_COUNT_LEN) ) {
+		for (i = 0; i < MULTI_COUNT_LEN; ++i)
+			recipients = (recipients << 8) | (unsigned char)(block[i]);
+	}
+	if ( (!data) || (recipients == 0) || 
+			(recipients > (databytes - MULTI_COUNT_LEN) / slotlen) ||
+			(databytes - MULTI_COUNT_LEN - recipients * slotlen < DEFAULT_MAC_LEN) ) {
+		__warning("Invalid or truncated `data` argument passed to ecc_decrypt_multi()");
+		return NULL;
+	}
+	plainbytes = databytes - MULTI_COUNT_LEN - recipients * slotlen - 
+		DEFAULT_MAC_LEN;
+
+	if (!(keybuf = gcry_malloc_secure(2 * MULTI_KEY_LEN))) {
+		__warning("Out of secure memory!");
 		return NULL;
 	}
 
-	if (!decompress_from_string(P, (char *)keypair->pub, 
-			DF_COMPACT, state->curveparams)) {
-		__warning("Invalid public key");
-		goto exit;
+	/*
+	 * Find our slot, the one tagged with our id whose wrapped key carries
+	 * a valid MAC under the ECIES key our private key derives from its R.
+	 * Only slots with our id cost an ECIES decryption.
+	 */
+	R = pointmul_base(keypair->priv, &state->curveparams->dp);
+	__multi_id(id, &R, state);
+	point_release(&R);
+	for (i = 0; (i < recipients) && (!datakey); ++i) {
+		slot = block + MULTI_COUNT_LEN + i * slotlen;
+		if (memcmp(slot, id, MULTI_ID_LEN))
+			continue;
+		slot += MULTI_ID_LEN;
+		if (!decompress_from_string(&R, slot, DF_BIN, state->curveparams))
+			continue;
+		if (ECIES_decryption(keybuf, &R, keypair->priv, state->curveparams)) {
+			slot += state->curveparams->pk_len_bin;
+			if ( (__multi_wrap(keybuf, slot, keybuf + MULTI_KEY_LEN, tag, false)) &&
+					(__tag_equal(tag, slot + MULTI_KEY_LEN)) )
+				datakey = keybuf + MULTI_KEY_LEN;
+		}
+		point_release(&R);
+	}
+	if (!datakey) {
+		__warning("ecc_decrypt_multi() was not encrypted to this key");
+		goto release;
+	}
+
+	/*
+	 * Unlike single recipient ciphertexts there are no old MAC-less 
+	 * ones around, check it before decrypting anything
+	 */
+	block += MULTI_COUNT_LEN + recipients * slotlen;
+	if (!(hmacsha256_init(&digest, datakey + 32, HMAC_KEY_SIZE))) {
+		__warning("Couldn't initialize HMAC-SHA256");
+		goto release;
+	}
+	gcry_md_write(digest, block, plainbytes);
+	if (!__check_mac(digest, NULL, block + plainbytes)) {
+		__warning("Integrity check failed in ecc_decrypt_multi()");
+		gcry_md_close(digest);
+		goto release;
+	}
+	gcry_md_close(digest);
+
+	if (!(rc = ecc_new_data()))
+		goto release;
+	rc->data = (void *)(malloc(sizeof(char) * (plainbytes + 1)));
+	if (!rc->data) {
+		if (errno == ENOMEM)
+			__warning("Cannot allocate memory for `rc->data` in ecc_decrypt_multi()");
+		goto bailout;
+	}
+	if (!(ac = aes256ctr_init(datakey))) {
+		__warning("Cannot initialize AES256-CTR");
+		goto bailout;
+	}
+	for (offset = 0; offset < plainbytes; offset += c) {
+		c = plainbytes - offset;
+		if (c > CRYPT_CHUNK)
+			c = CRYPT_CHUNK;
+		aes256ctr_crypt(ac, (char *)(rc->data) + offset, block + offset, c);
+	}
+	aes256ctr_done(ac);
+
+	rc->datalen = plainbytes;
+	((char *)rc->data)[plainbytes] = '\0';
+	goto release;
+
+	bailout:
+		ecc_free_data(rc);
+		rc = NULL;
+	release:
+		bzero(keybuf, 2 * MULTI_KEY_LEN);
+		gcry_free(keybuf);
+		return rc;
+}
+
+/*
+ * The incremental counterpart of ecc_encrypt_into()/ecc_decrypt_into(), 
+ * `header` holds the ephemeral point: pending output when encrypting, 
+ * collected input when decrypting.  While decrypting the last `trailer`
+ * bytes seen are held back in `tail` since they might turn out to be the
+ * MAC.  Signcryption streams carry the signing (or verification) key in
+ * `sigkey`, their digest hashes the plaintext and their trailer is the
+ * encrypted signature.
+ */
+struct _ECC_Stream {
+	bool encrypt;
+	ECC_KeyPair keypair;
+	ECC_KeyPair sigkey;
+	ECC_State state;
+	struct aes256ctr *ac;
+	gcry_md_hd_t digest, legacy;
+	char *header;
+	unsigned int headerlen;
+	char *tail;
+	unsigned int taillen, trailer;
+};
+
+static ECC_Stream __new_stream(bool encrypt, ECC_KeyPair keypair, 
+		ECC_KeyPair sigkey, ECC_State state)
+{
+	struct curve_params *cp;
+	ECC_Stream stream;
+
+	if (!__verify_state(state)) {
+		__warning("Invalid or uninitialized ECC_State object");
+		return NULL;
+	}
+	if (!__verify_keypair(keypair, !encrypt, encrypt)) {
+		__warning("Invalid ECC_KeyPair object passed to ecc_encrypt_init()/ecc_decrypt_init()");
+		return NULL;
+	}
+	if ( (sigkey) && (!__verify_keypair(sigkey, encrypt, !encrypt)) ) {
+		__warning("Invalid ECC_KeyPair object passed to ecc_signcrypt_init()/ecc_veridec_init()");
+		return NULL;
+	}
+
+	cp = state->curveparams;
+	stream = (ECC_Stream)(malloc(sizeof(struct _ECC_Stream)));
+	if (stream)
+		stream->trailer = sigkey ? cp->sig_len_bin : DEFAULT_MAC_LEN;
+	if ( (!stream) || (!(stream->header = malloc(cp->pk_len_bin))) ) {
+		if (errno == ENOMEM)
+			__warning("Cannot allocate memory for an ECC_Stream");
+		free(stream);
+		return NULL;
+	}
+	if (!(stream->tail = malloc(stream->trailer))) {
+		__warning("Cannot allocate memory for an ECC_Stream");
+		free(stream->header);
+		free(stream);
+		return NULL;
+	}
+
+	stream->encrypt = encrypt;
+	stream->keypair = keypair;
+	stream->sigkey = sigkey;
+	stream->state = state;
+	stream->ac = NULL;
+	stream->digest = NULL;
+	stream->legacy = NULL;
+	stream->headerlen = 0;
+	stream->taillen = 0;
+	return stream;
+}
+
+/*
+ * Derive the AES and HMAC keys, from the public key and a fresh ephemeral
+ * one when encrypting, from the private key and the collected header when
+ * decrypting
+ */
+static bool __stream_keys(ECC_Stream stream)
+{
+	struct curve_params *cp = stream->state->curveparams;
+	struct point_table *P;
+	struct affine_point R;
+	bool rc = false;
+	char *keybuf;
+
+	if (!(keybuf = gcry_malloc_secure(ECIES_KEYBYTES))) { 
+		__warning("Out of secure memory!");
+		return false;
+	}
+
+	if (stream->encrypt) {
+		if (!(P = __keypair_table(stream->keypair, stream->state))) {
+			__warning("Invalid public key");
+			goto bailout;
+		}
+		__ecies_encrypt(keybuf, stream->header, P, stream->state);
+		stream->headerlen = cp->pk_len_bin;
+	}
+	else {
+		if (!decompress_from_string(&R, stream->header, DF_BIN, cp)) {
+			__warning("Failed to decompress_from_string() in ecc_decrypt_update()");
+			goto bailout;
+		}
+		if (!ECIES_decryption(keybuf, &R, stream->keypair->priv, cp)) {
+			__warning("ECIES_decryption() failed");
+			point_release(&R);
+			goto bailout;
+		}
+		point_release(&R);
+	}
+
+	if (!(stream->ac = aes256ctr_init(keybuf))) {
+		__warning("Cannot initialize AES256-CTR");
+		goto bailout;
+	}
+	if ( (stream->encrypt) && (!stream->sigkey) &&
+			(!(hmacsha256_init(&stream->digest, keybuf + CIPHER_KEY_SIZE, HMAC_KEY_SIZE))) ) {
+		__warning("Couldn't initialize HMAC-SHA256");
+		stream->digest = NULL;
+		goto bailout;
+	}
+	if ( (!stream->encrypt) && (!stream->sigkey) &&
+			(!__open_macs(&stream->digest, &stream->legacy, keybuf + CIPHER_KEY_SIZE, 
+				stream->state)) ) {
+		stream->digest = NULL;
+		goto bailout;
+	}
+	if ( (stream->sigkey) && (gcry_err_code(gcry_md_open(&stream->digest, 
+					GCRY_MD_SHA512, GCRY_MD_FLAG_SECURE))) ) {
+		__warning("Couldn't initialize SHA512");
+		stream->digest = NULL;
+		goto bailout;
+	}
+	rc = true;
+
+	bailout:
+		bzero(keybuf, ECIES_KEYBYTES);
+		gcry_free(keybuf);
+		return rc;
+}
+
+ECC_Stream ecc_encrypt_init(ECC_KeyPair keypair, ECC_State state)
+{
+	ECC_Stream stream;
+	STATS_CALL(ECC_OP_STREAM, state);
+
+	stream = __new_stream(true, keypair, NULL, state);
+	if ( (stream) && (!__stream_keys(stream)) ) {
+		ecc_free_stream(stream);
+		return NULL;
+	}
+	return stream;
+}
+
+ECC_Stream ecc_decrypt_init(ECC_KeyPair keypair, ECC_State state)
+{
+	STATS_CALL(ECC_OP_STREAM, state);
+	return __new_stream(false, keypair, NULL, state);
+}
+
+/*
+ * Hand out the header the first time through
+ */
+static unsigned int __stream_header(ECC_Stream stream, char *out)
+{
+	unsigned int c = stream->headerlen;
+
+	memcpy(out, stream->header, c);
+	stream->headerlen = 0;
+	return c;
+}
+
+int ecc_encrypt_update(ECC_Stream stream, void *data, unsigned int databytes, 
+		void *out, unsigned int outbytes)
+{
+	unsigned int offset, c, written;
+	STATS_CALL(ECC_OP_STREAM, stream ? stream->state : NULL);
+
+	if ( (!stream) || (!stream->encrypt) || (!stream->ac) || 
+			((databytes) && (!data)) ) {
+		__warning("Invalid arguments passed to ecc_encrypt_update()");
+		return -1;
+	}
+	if (databytes > INT_MAX - stream->headerlen) {
+		__warning("Oversized `data` passed to ecc_encrypt_update()");
+		return -1;
+	}
+	if (outbytes < databytes + stream->headerlen) {
+		__warning("Output buffer passed to ecc_encrypt_update() is too small");
+		return -1;
+	}
+
+	written = __stream_header(stream, (char *)(out));
+	out = (char *)(out) + written;
+
+	for (offset = 0; offset < databytes; offset += c) {
+		c = databytes - offset;
+		if (c > CRYPT_CHUNK)
+			c = CRYPT_CHUNK;
+		if (stream->sigkey)
+			gcry_md_write(stream->digest, (char *)(data) + offset, c);
+		aes256ctr_crypt(stream->ac, (char *)(out) + offset, (char *)(data) + offset, c);
+		if (!stream->sigkey)
+			gcry_md_write(stream->digest, (char *)(out) + offset, c);
+	}
+	return written + databytes;
+}
+
+int ecc_encrypt_final(ECC_Stream stream, void *out, unsigned int outbytes)
+{
+	unsigned int written;
+	STATS_CALL(ECC_OP_STREAM, stream ? stream->state : NULL);
+
+	if ( (!stream) || (!stream->encrypt) || (stream->sigkey) || (!stream->ac) ) {
+		__warning("Invalid or finished ECC_Stream passed to ecc_encrypt_final()");
+		return -1;
+	}
+	if (outbytes < stream->headerlen + DEFAULT_MAC_LEN) {
+		__warning("Output buffer passed to ecc_encrypt_final() is too small");
+		return -1;
+	}
+
+	written = __stream_header(stream, (char *)(out));
+	gcry_md_final(stream->digest);
+	memcpy((char *)(out) + written, gcry_md_read(stream->digest, 0), DEFAULT_MAC_LEN);
+
+	aes256ctr_done(stream->ac);
+	stream->ac = NULL;
+	return written + DEFAULT_MAC_LEN;
+}
+
+int ecc_decrypt_update(ECC_Stream stream, void *data, unsigned int databytes, 
+		void *out, unsigned int outbytes)
+{
+	unsigned int pk_len = 0, c, emit;
+	char *in = (char *)(data);
+	STATS_CALL(ECC_OP_STREAM, stream ? stream->state : NULL);
+
+	if ( (!stream) || (stream->encrypt) || ((databytes) && (!data)) ) {
+		__warning("Invalid arguments passed to ecc_decrypt_update()");
+		return -1;
+	}
+	if (databytes > INT_MAX) {
+		__warning("Oversized `data` passed to ecc_decrypt_update()");
+		return -1;
+	}
+	if (outbytes < databytes) {
+		__warning("Output buffer passed to ecc_decrypt_update() is too small");
+		return -1;
+	}
+
+	/*
+	 * Collect the ephemeral point first, the keys follow from it
+	 */
+	if (!stream->ac) {
+		pk_len = stream->state->curveparams->pk_len_bin;
+		c = pk_len - stream->headerlen;
+		if (c > databytes)
+			c = databytes;
+		memcpy(stream->header + stream->headerlen, in, c);
+		stream->headerlen += c;
+		in += c;
+		databytes -= c;
+
+		if (stream->headerlen < pk_len)
+			return 0;
+		if (!__stream_keys(stream))
+			return -1;
+	}
+
+	if (stream->taillen + databytes <= stream->trailer) {
+		memcpy(stream->tail + stream->taillen, in, databytes);
+		stream->taillen += databytes;
+		return 0;
+	}
+
+	/*
+	 * Everything but the last `trailer` bytes is ciphertext, the held 
+	 * back tail goes first.  The MAC covers the ciphertext, the signature
+	 * of a signcrypted stream the plaintext
+	 */
+	emit = stream->taillen + databytes - stream->trailer;
+	c = (stream->taillen < emit) ? stream->taillen : emit;
+	if ( (stream->digest) && (!stream->sigkey) ) {
+		gcry_md_write(stream->digest, stream->tail, c);
+		gcry_md_write(stream->digest, in, emit - c);
+	}
+	aes256ctr_crypt(stream->ac, (char *)(out), stream->tail, c);
+	memmove(stream->tail, stream->tail + c, stream->taillen - c);
+	stream->taillen -= c;
+
+	aes256ctr_crypt(stream->ac, (char *)(out) + c, in, emit - c);
+	in += emit - c;
+	databytes -= emit - c;
+	if ( (stream->digest) && (stream->sigkey) )
+		gcry_md_write(stream->digest, (char *)(out), emit);
+
+	memcpy(stream->tail + stream->taillen, in, databytes);
+	stream->taillen += databytes;
+	return emit;
+}
+
+bool ecc_decrypt_final(ECC_Stream stream)
+{
+	STATS_CALL(ECC_OP_STREAM, stream ? stream->state : NULL);
+
+	if ( (!stream) || (stream->encrypt) || (stream->sigkey) ) {
+		__warning("Invalid ECC_Stream passed to ecc_decrypt_final()");
+		return false;
+	}
+	if ( (!stream->ac) || (stream->taillen < stream->trailer) ) {
+		__warning("Truncated ciphertext passed to ecc_decrypt_final()");
+		return false;
+	}
+	if (!stream->digest) {
+		__warning("The MAC cannot be checked after ecc_decrypt_seek()");
+		return false;
+	}
+	if (!__check_mac(stream->digest, stream->legacy, stream->tail)) {
+		__warning(stream->legacy ? "Integrity check failed in ecc_decrypt_final()" :
+				"Integrity check failed in ecc_decrypt_final(), data of releases before "
+				"the MAC fix needs ECC_Options.legacy_mac (legacy_mac=True in pyecc)");
+		return false;
+	}
+	return true;
+}
+
+bool ecc_decrypt_seek(ECC_Stream stream, unsigned long long offset)
+{
+	STATS_CALL(ECC_OP_STREAM, stream ? stream->state : NULL);
+
+	if ( (!stream) || (stream->encrypt) || (stream->sigkey) || (!stream->ac) ) {
+		__warning("Invalid or headerless ECC_Stream passed to ecc_decrypt_seek()");
+		return false;
+	}
+	aes256ctr_seek(stream->ac, offset);
+	stream->taillen = 0;
+	if (stream->digest) {
+		__close_macs(stream->digest, stream->legacy);
+		stream->digest = NULL;
+		stream->legacy = NULL;
+	}
+	return true;
+}
+
+void ecc_free_stream(ECC_Stream stream)
+{
+	if (stream == NULL)
+		return;
+	if (stream->ac)
+		aes256ctr_done(stream->ac);
+	if (stream->digest)
+		__close_macs(stream->digest, stream->legacy);
+	free(stream->header);
+	bzero(stream->tail, stream->trailer);
+	free(stream->tail);
+	bzero(stream, sizeof(struct _ECC_Stream));
+	free(stream);
+}
+
+/*
+ * The segmented format, see aes256ctr.h.  An ::ECC_Segments only keeps the
+ * keys, every call sets up a cipher and a MAC of its own so that the 
+ * segments can be worked on in any order and from several threads at once.
+ */
+struct _ECC_Segments {
+	bool encrypt;
+	ECC_State state;
+	unsigned int seglen;
+	char *keybuf;
+};
+
+int ecc_segments_header_size(ECC_State state)
+{
+	if (!__verify_state(state))
+		return -1;
+	return state->curveparams->pk_len_bin + SEGMENT_HEADER_LEN;
+}
+
+static ECC_Segments __new_segments(bool encrypt, unsigned int seglen, 
+		ECC_State state)
+{
+	ECC_Segments segments = (ECC_Segments)(malloc(sizeof(struct _ECC_Segments)));
+
+	if (!segments) {
+		__warning("Cannot allocate memory for an ECC_Segments");
+		return NULL;
+	}
+	if (!(segments->keybuf = gcry_malloc_secure(ECIES_KEYBYTES))) {
+		__warning("Out of secure memory!");
+		free(segments);
+		return NULL;
+	}
+	segments->encrypt = encrypt;
+	segments->state = state;
+	segments->seglen = seglen;
+	return segments;
+}
+
+ECC_Segments ecc_encrypt_segments_init(unsigned int seglen, void *header, 
+		unsigned int headerbytes, ECC_KeyPair keypair, ECC_State state)
+{
+	ECC_Segments segments;
+	struct point_table *P;
+	char *hdr = (char *)(header);
+	int i;
+	STATS_CALL(ECC_OP_STREAM, state);
+
+	if (!__verify_state(state)) {
+		__warning("Invalid state passed to ecc_encrypt_segments_init()");
+		return NULL;
+	}
+	if (!__verify_keypair(keypair, false, true)) {
+		__warning("Invalid keypair passed to ecc_encrypt_segments_init()");
+		return NULL;
+	}
+	if (seglen == 0)
+		seglen = ECC_SEGMENT_SIZE;
+	if ( (seglen > SEGMENT_SIZE_MAX) || (seglen % CIPHER_BLOCK_SIZE) ) {
+		__warning("Invalid segment length passed to ecc_encrypt_segments_init()");
+		return NULL;
+	}
+	if ( (!header) || (headerbytes < (unsigned int)(ecc_segments_header_size(state))) ) {
+		__warning("Header buffer passed to ecc_encrypt_segments_init() is too small");
+		return NULL;
+	}
+	if (!(P = __keypair_table(keypair, state))) {
+		__warning("Invalid public key");
+		return NULL;
+	}
+	if (!(segments = __new_segments(true, seglen, state)))
+		return NULL;
+
+	__ecies_encrypt(segments->keybuf, hdr, P, state);
+	hdr += state->curveparams->pk_len_bin;
+	for (i = 0; i < SEGMENT_HEADER_LEN; ++i)
+		hdr[i] = seglen >> (8 * (SEGMENT_HEADER_LEN - 1 - i));
+	return segments;
+}
+
+ECC_Segments ecc_decrypt_segments_init(void *header, unsigned int headerbytes, 
+		ECC_KeyPair keypair, ECC_State state)
+{
+	ECC_Segments segments;
+	struct affine_point R;
+	unsigned char *hdr;
+	unsigned int seglen = 0;
+	bool rc;
+	int i;
+	STATS_CALL(ECC_OP_STREAM, state);
+
+	if (!__verify_state(state)) {
+		__warning("Invalid state passed to ecc_decrypt_segments_init()");
+		return NULL;
+	}
+	if (!__verify_keypair(keypair, true, false)) {
+		__warning("Invalid keypair passed to ecc_decrypt_segments_init()");
+		return NULL;
+	}
+	if ( (!header) || (headerbytes < (unsigned int)(ecc_segments_header_size(state))) ) {
+		__warning("Truncated header passed to ecc_decrypt_segments_init()");
+		return NULL;
+	}
+
+	hdr = (unsigned char *)(header) + state->curveparams->pk_len_bin;
+	for (i = 0; i < SEGMENT_HEADER_LEN; ++i)
+		seglen = (seglen << 8) | hdr[i];
+	if ( (!seglen) || (seglen > SEGMENT_SIZE_MAX) || (seglen % CIPHER_BLOCK_SIZE) ) {
+		__warning("Inconsistent header passed to ecc_decrypt_segments_init()");
+		return NULL;
+	}
+
+	if (!decompress_from_string(&R, (char *)(header), DF_BIN, state->curveparams)) {
+		__warning("Failed to decompress_from_string() in ecc_decrypt_segments_init()");
+		return NULL;
+	}
+	if (!(segments = __new_segments(false, seglen, state))) {
+		point_release(&R);
+		return NULL;
+	}
+	rc = ECIES_decryption(segments->keybuf, &R, keypair->priv, state->curveparams);
+	point_release(&R);
+	if (!rc) {
+		__warning("ECIES_decryption() failed");
+		ecc_free_segments(segments);
+		return NULL;
+	}
+	return segments;
+}
+
+unsigned int ecc_segment_length(ECC_Segments segments)
+{
+	if (segments == NULL)
+		return 0;
+	return segments->seglen;
+}
+
+/*
+ * Set up the cipher, positioned at segment `index`, and the MAC of one call
+ */
+static bool __segment_open(ECC_Segments segments, unsigned long long index, 
+		struct aes256ctr **ac, gcry_md_hd_t *mh)
+{
+	if (index > ULLONG_MAX / segments->seglen) {
+		__warning("Segment index out of range");
+		return false;
+	}
+	if (!(*ac = aes256ctr_init(segments->keybuf))) {
+		__warning("Cannot initialize AES256-CTR");
+		return false;
+	}
+	if (!hmacsha256_init(mh, segments->keybuf + CIPHER_KEY_SIZE, HMAC_KEY_SIZE)) {
+		__warning("Couldn't initialize HMAC-SHA256");
+		aes256ctr_done(*ac);
+		return false;
+	}
+	aes256ctr_seek(*ac, index * segments->seglen);
+	return true;
+}
+
+int ecc_encrypt_segment(ECC_Segments segments, unsigned long long index, 
+		void *data, unsigned int databytes, void *out, unsigned int outbytes)
+{
+	struct aes256ctr *ac;
+	gcry_md_hd_t mh;
+	STATS_CALL(ECC_OP_STREAM, segments ? segments->state : NULL);
+
+	if ( (!segments) || (!segments->encrypt) || (!data) || (!out) || 
+			(databytes == 0) || (databytes > segments->seglen) ) {
+		__warning("Invalid arguments passed to ecc_encrypt_segment()");
+		return -1;
+	}
+	if (outbytes < databytes + DEFAULT_MAC_LEN) {
+		__warning("Output buffer passed to ecc_encrypt_segment() is too small");
+		return -1;
+	}
+	if (!__segment_open(segments, index, &ac, &mh))
+		return -1;
+
+	aes256ctr_crypt(ac, (char *)(out), (char *)(data), databytes);
+	hmacsha256_segment(mh, SEGMENT_TAG, segments->seglen, index, 
+			(char *)(out), databytes);
+	memcpy((char *)(out) + databytes, gcry_md_read(mh, 0), DEFAULT_MAC_LEN);
+
+	aes256ctr_done(ac);
+	gcry_md_close(mh);
+	return databytes + DEFAULT_MAC_LEN;
+}
+
+int ecc_decrypt_segment(ECC_Segments segments, unsigned long long index, 
+		void *data, unsigned int databytes, void *out, unsigned int outbytes)
+{
+	struct aes256ctr *ac;
+	gcry_md_hd_t mh;
+	unsigned int plainbytes;
+	int rc = -1;
+	STATS_CALL(ECC_OP_STREAM, segments ? segments->state : NULL);
+
+	if ( (!segments) || (segments->encrypt) || (!data) || (!out) || 
+			(databytes <= DEFAULT_MAC_LEN) || 
+			(databytes - DEFAULT_MAC_LEN > segments->seglen) ) {
+		__warning("Invalid or truncated segment passed to ecc_decrypt_segment()");
+		return -1;
+	}
+	plainbytes = databytes - DEFAULT_MAC_LEN;
+	if (outbytes < plainbytes) {
+		__warning("Output buffer passed to ecc_decrypt_segment() is too small");
+		return -1;
+	}
+	if (!__segment_open(segments, index, &ac, &mh))
+		return -1;
+
+	hmacsha256_segment(mh, SEGMENT_TAG, segments->seglen, index, 
+			(char *)(data), plainbytes);
+	if (__tag_equal(gcry_md_read(mh, 0), (char *)(data) + plainbytes)) {
+		aes256ctr_crypt(ac, (char *)(out), (char *)(data), plainbytes);
+		rc = plainbytes;
+	}
+	else
+		__warning("Integrity check failed in ecc_decrypt_segment()");
+
+	aes256ctr_done(ac);
+	gcry_md_close(mh);
+	return rc;
+}
+
+/*
+ * The final tag over `count` segments, left in `mh`
+ */
+static bool __segments_tag(ECC_Segments segments, unsigned long long count, 
+		gcry_md_hd_t *mh)
+{
+	if (!hmacsha256_init(mh, segments->keybuf + CIPHER_KEY_SIZE, HMAC_KEY_SIZE)) {
+		__warning("Couldn't initialize HMAC-SHA256");
+		return false;
+	}
+	hmacsha256_segment(*mh, SEGMENT_END_TAG, segments->seglen, count, NULL, 0);
+	return true;
+}
+
+int ecc_encrypt_segments_final(ECC_Segments segments, unsigned long long count, 
+		void *out, unsigned int outbytes)
+{
+	gcry_md_hd_t mh;
+	STATS_CALL(ECC_OP_STREAM, segments ? segments->state : NULL);
+
+	if ( (!segments) || (!segments->encrypt) || (!out) ) {
+		__warning("Invalid arguments passed to ecc_encrypt_segments_final()");
+		return -1;
+	}
+	if (outbytes < DEFAULT_MAC_LEN) {
+		__warning("Output buffer passed to ecc_encrypt_segments_final() is too small");
+		return -1;
+	}
+	if (!__segments_tag(segments, count, &mh))
+		return -1;
+	memcpy(out, gcry_md_read(mh, 0), DEFAULT_MAC_LEN);
+	gcry_md_close(mh);
+	return DEFAULT_MAC_LEN;
+}
+
+bool ecc_decrypt_segments_final(ECC_Segments segments, unsigned long long count, 
+		void *tag, unsigned int tagbytes)
+{
+	gcry_md_hd_t mh;
+	bool rc;
+	STATS_CALL(ECC_OP_STREAM, segments ? segments->state : NULL);
+
+	if ( (!segments) || (segments->encrypt) || (!tag) || 
+			(tagbytes != DEFAULT_MAC_LEN) ) {
+		__warning("Invalid or truncated tag passed to ecc_decrypt_segments_final()");
+		return false;
+	}
+	if (!__segments_tag(segments, count, &mh))
+		return false;
+	if (!(rc = __tag_equal(gcry_md_read(mh, 0), tag)))
+		__warning("Integrity check failed in ecc_decrypt_segments_final()");
+	gcry_md_close(mh);
+	return rc;
+}
+
+void ecc_free_segments(ECC_Segments segments)
+{
+	if (segments == NULL)
+		return;
+	bzero(segments->keybuf, ECIES_KEYBYTES);
+	gcry_free(segments->keybuf);
+	bzero(segments, sizeof(struct _ECC_Segments));
+	free(segments);
+}
+
+/*
+ * Signcryption, the format of seccure-signcrypt with both keys on the
+ * state's curve:
+ *    - rbuffer
+ *    - cipher
+ *    - the binary signature of the SHA512 of the plaintext, encrypted with
+ *      the same AES256-CTR stream
+ * The signature stands in for the MAC.  Hashing and encryption go through
+ * the payload together, CRYPT_CHUNK bytes at a time.
+ */
+int ecc_signcrypted_size(unsigned int databytes, ECC_State state)
+{
+	unsigned long long size;
+
+	if (!__verify_state(state))
+		return -1;
+	size = (unsigned long long)(state->curveparams->pk_len_bin) + databytes + 
+		state->curveparams->sig_len_bin;
+	if (size > INT_MAX)
+		return -1;
+	return (int)(size);
+}
+
+int ecc_veridecrypted_size(unsigned int encbytes, ECC_State state)
+{
+	unsigned int overhead;
+
+	if (!__verify_state(state))
+		return -1;
+	overhead = state->curveparams->pk_len_bin + state->curveparams->sig_len_bin;
+	if (encbytes < overhead)
+		return -1;
+	return encbytes - overhead;
+}
+
+int ecc_signcrypt_into(void *data, unsigned int databytes, void *out, 
+		unsigned int outbytes, ECC_KeyPair keypair, ECC_KeyPair peer, 
+		ECC_State state)
+{
+	int rc = -1, encbytes;
+	unsigned int offset, c;
+	struct curve_params *cp;
+	struct point_table *P;
+	struct aes256ctr *ac;
+	char *keybuf, *block;
+	gcry_md_hd_t digest;
+	gcry_mpi_t signature;
+	STATS_CALL(ECC_OP_SIGNCRYPT, state);
+
+	if ( (data == NULL) && (databytes) ) {
+		__warning("Invalid `data` argument passed to ecc_signcrypt_into()");
+		goto exit;
+	}
+	if ( (!__verify_keypair(keypair, true, false)) || 
+			(!__verify_keypair(peer, false, true)) ) {
+		__warning("Invalid ECC_KeyPair object passed to ecc_signcrypt_into()");
+		goto exit;
+	}
+	if ((encbytes = ecc_signcrypted_size(databytes, state)) < 0) {
+		__warning("Invalid state or oversized `data` passed to ecc_signcrypt_into()");
+		goto exit;
+	}
+	if ( (!out) || (outbytes < (unsigned int)(encbytes)) ) {
+		__warning("Output buffer passed to ecc_signcrypt_into() is too small");
+		goto exit;
+	}
+
+	cp = state->curveparams;
+	if (!(P = __keypair_table(peer, state))) {
+		__warning("Invalid public key");
+		goto exit;
+	}
+
+	if (!(keybuf = gcry_malloc_secure(ECIES_KEYBYTES))) { 
+		__warning("Out of secure memory!");
+		goto exit;
+	}
+
+	__ecies_encrypt(keybuf, (char *)(out), P, state);
+
+	if (!(ac = aes256ctr_init(keybuf))) {
+		__warning("Cannot initialize AES256-CTR");
+		goto release;
+	}
+	if (gcry_err_code(gcry_md_open(&digest, GCRY_MD_SHA512, GCRY_MD_FLAG_SECURE))) {
+		__warning("Couldn't initialize SHA512");
+		aes256ctr_done(ac);
+		goto release;
+	}
+
+	block = (char *)(out) + cp->pk_len_bin;
+	for (offset = 0; offset < databytes; offset += c) {
+		c = databytes - offset;
+		if (c > CRYPT_CHUNK)
+			c = CRYPT_CHUNK;
+		gcry_md_write(digest, (char *)(data) + offset, c);
+		aes256ctr_crypt(ac, block + offset, (char *)(data) + offset, c);
+	}
+
+	gcry_md_final(digest);
+	signature = ECDSA_sign((char *)(gcry_md_read(digest, 0)), keypair->priv, cp);
+	gcry_md_close(digest);
+
+	serialize_mpi(block + databytes, cp->sig_len_bin, DF_BIN, signature);
+	aes256ctr_enc(ac, block + databytes, cp->sig_len_bin);
+	gcry_mpi_release(signature);
+	aes256ctr_done(ac);
+	rc = encbytes;
+
+	release:
+		bzero(keybuf, ECIES_KEYBYTES);
+		gcry_free(keybuf);
+	exit:
+		return rc;
+}
+
+ECC_Data ecc_signcrypt(void *data, unsigned int databytes, ECC_KeyPair keypair, 
+		ECC_KeyPair peer, ECC_State state)
+{
+	ECC_Data rc = NULL;
+	int encbytes;
+	STATS_CALL(ECC_OP_SIGNCRYPT, state);
+
+	if ((encbytes = ecc_signcrypted_size(databytes, state)) < 0) {
+		__warning("Invalid state or oversized `data` passed to ecc_signcrypt()");
+		return NULL;
+	}
+
+	if (!(rc = ecc_new_data()))
+		return NULL;
+	rc->data = (void *)(malloc(sizeof(char) * encbytes));
+	if (!rc->data) {
+		if (errno == ENOMEM) 
+			__warning("Cannot allocate memory for `rc->data` in ecc_signcrypt()");
+		goto bailout;
+	}
+
+	if (ecc_signcrypt_into(data, databytes, rc->data, encbytes, keypair, peer, 
+				state) < 0)
+		goto bailout;
+
+	rc->datalen = encbytes;
+	return rc;
+
+	bailout:
+		ecc_free_data(rc);
+		return NULL;
+}
+
+/*
+ * Check the decrypted `signature` of the plaintext hashed into `digest`
+ * against the peer's public key
+ */
+static bool __veridec_check(gcry_md_hd_t digest, char *signature, 
+		ECC_KeyPair peer, ECC_State state)
+{
+	struct curve_params *cp = state->curveparams;
+	struct point_table *Q;
+	gcry_mpi_t sig;
+	bool rc;
+
+	if (!(Q = __keypair_table(peer, state))) {
+		__warning("Invalid public key");
+		return false;
+	}
+	if (!deserialize_mpi(&sig, DF_BIN, signature, cp->sig_len_bin))
+		return false;
+	gcry_md_final(digest);
+	rc = ECDSA_verify_table((char *)(gcry_md_read(digest, 0)), Q, sig, cp);
+	gcry_mpi_release(sig);
+	return rc;
+}
+
+int ecc_veridec_into(void *data, unsigned int databytes, void *out, 
+		unsigned int outbytes, ECC_KeyPair keypair, ECC_KeyPair peer,
+		ECC_State state)
+{
+	int rc = -1, plainbytes;
+	unsigned int offset, c;
+	struct curve_params *cp;
+	char *keybuf, *block;
+	struct aes256ctr *ac;
+	struct affine_point R;
+	gcry_md_hd_t digest;
+	STATS_CALL(ECC_OP_SIGNCRYPT, state);
+
+	if ( (!__verify_keypair(keypair, true, false)) || 
+			(!__verify_keypair(peer, false, true)) ) {
+		__warning("Invalid ECC_KeyPair object passed to ecc_veridec_into()");
+		goto exit;
+	}
+	if ( (!data) || ((plainbytes = ecc_veridecrypted_size(databytes, state)) < 0) ) {
+		__warning("Invalid or truncated `data` argument passed to ecc_veridec_into()");
+		goto exit;
+	}
+	if ( (!out) && (plainbytes) ) {
+		__warning("Invalid output buffer passed to ecc_veridec_into()");
+		goto exit;
+	}
+	if (outbytes < (unsigned int)(plainbytes)) {
+		__warning("Output buffer passed to ecc_veridec_into() is too small");
+		goto exit;
+	}
+
+	cp = state->curveparams;
+	if (!decompress_from_string(&R, (char *)(data), DF_BIN, cp)) {
+		__warning("Failed to decompress_from_string() in ecc_veridec_into()");
+		goto exit;
+	}
+
+	if (!(keybuf = gcry_malloc_secure(ECIES_KEYBYTES + cp->sig_len_bin))) { 
+		__warning("Out of secure memory!");
+		goto release;
+	}
+
+	if (!ECIES_decryption(keybuf, &R, keypair->priv, cp)) {
+		__warning("ECIES_decryption() failed");
+		goto bailout;
+	}
+
+	if (!(ac = aes256ctr_init(keybuf))) {
+		__warning("Cannot initialize AES256-CTR");
+		goto bailout;
+	}
+	if (gcry_err_code(gcry_md_open(&digest, GCRY_MD_SHA512, GCRY_MD_FLAG_SECURE))) {
+		__warning("Couldn't initialize SHA512");
+		aes256ctr_done(ac);
+		goto bailout;
+	}
+
+	block = (char *)(data) + cp->pk_len_bin;
+	for (offset = 0; offset < (unsigned int)(plainbytes); offset += c) {
+		c = plainbytes - offset;
+		if (c > CRYPT_CHUNK)
+			c = CRYPT_CHUNK;
+		aes256ctr_crypt(ac, (char *)(out) + offset, block + offset, c);
+		gcry_md_write(digest, (char *)(out) + offset, c);
+	}
+
+	/* The signature is decrypted in secure memory, behind the keys */
+	aes256ctr_crypt(ac, keybuf + ECIES_KEYBYTES, block + plainbytes, cp->sig_len_bin);
+	aes256ctr_done(ac);
+
+	if (__veridec_check(digest, keybuf + ECIES_KEYBYTES, peer, state))
+		rc = plainbytes;
+	else {
+		__warning("Invalid signature in ecc_veridec_into(), message forged");
+		bzero(out, plainbytes);
+	}
+	gcry_md_close(digest);
+
+	bailout:
+		bzero(keybuf, ECIES_KEYBYTES + cp->sig_len_bin);
+		gcry_free(keybuf);
+	release:
+		point_release(&R);
+	exit:
+		return rc;
+}
+
+ECC_Data ecc_veridec(void *data, unsigned int databytes, ECC_KeyPair keypair, 
+		ECC_KeyPair peer, ECC_State state)
+{
+	ECC_Data rc = NULL;
+	int plainbytes;
+	STATS_CALL(ECC_OP_SIGNCRYPT, state);
+
+	if ( (!data) || 
+			((plainbytes = ecc_veridecrypted_size(databytes, state)) < 0) ) {
+		__warning("Invalid or truncated `data` argument passed to ecc_veridec()");
+		return NULL;
 	}
 
-	/* Why only 64? */
-	if (!(keybuf = gcry_malloc_secure(64))) { 
-		__warning("Out of secure memory!");
-		goto exit;
+	if (!(rc = ecc_new_data()))
+		return NULL;
+	rc->data = (void *)(malloc(sizeof(char) * (plainbytes + 1)));
+	if (!rc->data) {
+		if (errno == ENOMEM)
+			__warning("Cannot allocate memory for `rc->data` in ecc_veridec()");
+		goto bailout;
 	}
-	*R = ECIES_encryption(keybuf, P, state->curveparams);
-	compress_to_string(readbuf, DF_BIN, R, state->curveparams);
 
-	if (!(ac = aes256ctr_init(keybuf))) {
-		__warning("Cannot initialize AES256-CTR");
-		goto release;
-	}
-	if (!(hmacsha256_init(&digest, keybuf + 32, HMAC_KEY_SIZE))) {
-		__warning("Couldn't initialize HMAC-SHA256");
-		goto release;
-	}
+	if (ecc_veridec_into(data, databytes, rc->data, plainbytes, keypair, peer, 
+				state) < 0)
+		goto bailout;
 
-	rc = ecc_new_data();
-	/*
-	 * The data buffer should be in three sections:
-	 *    - rbuffer
-	 *    - cipher
-	 *    - hmac
-	 */
-	rc->data = (void *)(malloc( 
-			(sizeof(char) * state->curveparams->pk_len_bin) + 
-			(sizeof(char) * databytes) +
-			(sizeof(char) * DEFAULT_MAC_LEN)));
+	rc->datalen = plainbytes;
+	((char *)rc->data)[plainbytes] = '\0';
+	return rc;
 
-	if (!rc->data) {
-		if (errno == ENOMEM) 
-			__warning("Cannot allocate memory for `rc->data` in ecc_encrypt()");
+	bailout:
 		ecc_free_data(rc);
-		goto release;
-	}
+		return NULL;
+}
 
-	plaintext = (void *)(malloc(sizeof(char) * databytes));
+ECC_Stream ecc_signcrypt_init(ECC_KeyPair keypair, ECC_KeyPair peer, 
+		ECC_State state)
+{
+	ECC_Stream stream;
+	STATS_CALL(ECC_OP_STREAM, state);
 
-	if (!plaintext) {
-		if (errno == ENOMEM)
-			__warning("Cannot allocate memory for `plaintext` in ecc_encrypt()");
-		ecc_free_data(rc);
-		goto release;
+	stream = __new_stream(true, peer, keypair, state);
+	if ( (stream) && (!__stream_keys(stream)) ) {
+		ecc_free_stream(stream);
+		return NULL;
 	}
-	memcpy(plaintext, data, databytes);
-
-	aes256ctr_enc(ac, plaintext, databytes);
-	aes256ctr_done(ac);
+	return stream;
+}
 
-	gcry_md_final(digest);
-	md = (char *)(gcry_md_read(digest, 0));
+ECC_Stream ecc_veridec_init(ECC_KeyPair keypair, ECC_KeyPair peer, 
+		ECC_State state)
+{
+	STATS_CALL(ECC_OP_STREAM, state);
+	return __new_stream(false, keypair, peer, state);
+}
 
-	/* 
-	 * Overlay the three segments for the data buffer via memcpy(3)
-	 */
-	memcpy(rc->data, readbuf, state->curveparams->pk_len_bin);
-	offset = state->curveparams->pk_len_bin;
-	
-	memcpy((char *)(rc->data) + offset, plaintext, databytes);
-	offset += databytes;
+int ecc_signcrypt_final(ECC_Stream stream, void *out, unsigned int outbytes)
+{
+	struct curve_params *cp;
+	gcry_mpi_t signature;
+	unsigned int written;
+	char *trailer;
+	STATS_CALL(ECC_OP_STREAM, stream ? stream->state : NULL);
+
+	if ( (!stream) || (!stream->encrypt) || (!stream->sigkey) || (!stream->ac) ) {
+		__warning("Invalid or finished ECC_Stream passed to ecc_signcrypt_final()");
+		return -1;
+	}
+	cp = stream->state->curveparams;
+	if (outbytes < stream->headerlen + cp->sig_len_bin) {
+		__warning("Output buffer passed to ecc_signcrypt_final() is too small");
+		return -1;
+	}
 
-	memcpy((char *)(rc->data) + offset, md, DEFAULT_MAC_LEN);
-	offset += DEFAULT_MAC_LEN;
+	written = __stream_header(stream, (char *)(out));
+	trailer = (char *)(out) + written;
+	gcry_md_final(stream->digest);
+	signature = ECDSA_sign((char *)(gcry_md_read(stream->digest, 0)), 
+			stream->sigkey->priv, cp);
+	serialize_mpi(trailer, cp->sig_len_bin, DF_BIN, signature);
+	aes256ctr_enc(stream->ac, trailer, cp->sig_len_bin);
+	gcry_mpi_release(signature);
+
+	aes256ctr_done(stream->ac);
+	stream->ac = NULL;
+	return written + cp->sig_len_bin;
+}
 
-	rc->datalen = offset;
+bool ecc_veridec_final(ECC_Stream stream)
+{
+	STATS_CALL(ECC_OP_STREAM, stream ? stream->state : NULL);
 
-	free(plaintext);
-	/*
-	 * Upon closing the hash digest, the `md` pointer should also
-	 * be freed
-	 */
-	gcry_md_close(digest);
+	if ( (!stream) || (stream->encrypt) || (!stream->sigkey) ) {
+		__warning("Invalid ECC_Stream passed to ecc_veridec_final()");
+		return false;
+	}
+	if ( (!stream->ac) || (stream->taillen < stream->trailer) ) {
+		__warning("Truncated ciphertext passed to ecc_veridec_final()");
+		return false;
+	}
 
-	release:
-		gcry_free(keybuf);
-		point_release(P);
-		point_release(R);
-		free(P);
-		free(R);
-		free(readbuf);
-	exit:
-		return rc;
+	aes256ctr_dec(stream->ac, stream->tail, stream->trailer);
+	aes256ctr_done(stream->ac);
+	stream->ac = NULL;
+	if (!__veridec_check(stream->digest, stream->tail, stream->sigkey, 
+				stream->state)) {
+		__warning("Invalid signature in ecc_veridec_final(), message forged");
+		return false;
+	}
+	return true;
 }
 
-ECC_Data ecc_sign(char *data, ECC_KeyPair keypair, ECC_State state)
+ECC_Data ecc_sign_digest(const char *digest, ECC_KeyPair keypair, ECC_State state)
 {
 	ECC_Data rc = NULL;
-	gcry_md_hd_t digest;
-	gcry_error_t err = 0;
 	gcry_mpi_t signature = NULL;
-	char *digest_buf, *serialized;
+	char *serialized;
+	int siglen;
+	STATS_CALL(ECC_OP_SIGN, state);
 
 	/* 
 	 * Preliminary argument checks, just for sanity of the library 
 	 */
-	if (!data) {
-		__warning("Invalid or empty `data` argument passed to ecc_sign()");
+	if (!digest) {
+		__warning("Invalid or empty `digest` argument passed to ecc_sign_digest()");
 		goto exit;
 	}
 	if (!__verify_keypair(keypair, true, false)) {
@@ -614,37 +2684,16 @@ ECC_Data ecc_sign(char *data, ECC_KeyPair keypair, ECC_State state)
 		goto exit;
 	}
 
-	/*
-	 * Open up message digest for the signing
-	 */
-	err = gcry_md_open(&digest, GCRY_MD_SHA512, 0);
-	if (gcry_err_code(err)) {
-		__gwarning("Failed to initialize SHA-512 message digest", err);
-		goto bailout;
-	}
-
-	/*
-	 * Write our data into the message digest buffer for gcrypt
-	 */
-	gcry_md_write(digest, data, strlen(data));
-	gcry_md_final(digest);
-	digest_buf = (char *)(gcry_md_read(digest, 0));
-
-	if (digest_buf == NULL) {
-		__warning("Digest buffer was NULL");
-		goto bailout;
-	}
-
-	signature = ECDSA_sign(digest_buf, keypair->priv, state->curveparams);
+	signature = ECDSA_sign(digest, keypair->priv, state->curveparams);
 
 	if (signature == NULL) {
 		__warning("ECDSA_sign() returned a NULL signature");
-		goto bailout;
+		goto exit;
 	}
 
+	siglen = ecc_signature_size(state);
 	rc = ecc_new_data();
-	serialized = (char *)(malloc(sizeof(char) * 
-			(1 + state->curveparams->sig_len_compact)));
+	serialized = (char *)(malloc(sizeof(char) * (1 + siglen)));
 
 	if (!serialized) {
 		if (errno == ENOMEM)
@@ -654,36 +2703,104 @@ ECC_Data ecc_sign(char *data, ECC_KeyPair keypair, ECC_State state)
 		goto bailout;
 	}
 
-	serialize_mpi(serialized, state->curveparams->sig_len_compact, 
-			DF_COMPACT, signature);
-	serialized[state->curveparams->sig_len_compact] = '\0';
+	serialize_mpi(serialized, siglen, __format(state), signature);
+	serialized[siglen] = '\0';
 	rc->data = serialized;
+	rc->datalen = siglen;
 	
 	bailout:
 		gcry_mpi_release(signature);
-		gcry_md_close(digest);
 	exit:
 		return rc;
 }
 
-bool ecc_verify(char *data, char *signature, ECC_KeyPair keypair, ECC_State state)
+ECC_Data ecc_sign_s(void *data, unsigned int databytes, ECC_KeyPair keypair, 
+		ECC_State state)
+{
+	char digest[ECC_DIGEST_LEN];
+	STATS_CALL(ECC_OP_SIGN, state);
+
+	if (!data) {
+		__warning("Invalid or empty `data` argument passed to ecc_sign()");
+		return NULL;
+	}
+
+	/*
+	 * One-shot hashing, no need for a digest handle of our own
+	 */
+	gcry_md_hash_buffer(GCRY_MD_SHA512, digest, data, databytes);
+	return ecc_sign_digest(digest, keypair, state);
+}
+
+ECC_Data ecc_sign(char *data, ECC_KeyPair keypair, ECC_State state)
+{
+	STATS_CALL(ECC_OP_SIGN, state);
+	if (!data) {
+		__warning("Invalid or empty `data` argument passed to ecc_sign()");
+		return NULL;
+	}
+	return ecc_sign_s(data, strlen(data), keypair, state);
+}
+
+/*
+ * The signature as an MPI, NULL if it is no signature in the state's format
+ */
+static gcry_mpi_t __deserialize_sig(const char *signature, unsigned int siglen, 
+		ECC_State state)
+{
+	gcry_mpi_t sig;
+
+	if ( (signature == NULL) || (siglen == 0) )
+		return NULL;
+	if ( (__format(state) == DF_BIN) && 
+			(siglen != state->curveparams->sig_len_bin) )
+		return NULL;
+	if (!deserialize_mpi_public(&sig, __format(state), signature, siglen))
+		return NULL;
+	return sig;
+}
+
+/*
+ * How many bytes of `signature` ecc_verify() and friends look at
+ */
+static unsigned int __signature_len(const char *signature, ECC_State state)
+{
+	if (signature == NULL)
+		return 0;
+	if (__format(state) == DF_BIN)
+		return state->curveparams->sig_len_bin;
+	return strlen(signature);
+}
+
+bool ecc_verify_digest(const char *digest, char *signature, ECC_KeyPair keypair, 
+		ECC_State state)
+{
+	STATS_CALL(ECC_OP_VERIFY, state);
+	if (!__verify_state(state)) {
+		__warning("Invalid or uninitialized ECC_State object");
+		return false;
+	}
+	return ecc_verify_digest_s(digest, signature, 
+			__signature_len(signature, state), keypair, state);
+}
+
+bool ecc_verify_digest_s(const char *digest, const char *signature, 
+		unsigned int siglen, ECC_KeyPair keypair, ECC_State state)
 {
 	bool rc = false;
-	struct affine_point _ap;
-	gcry_error_t err = 0;
+	struct point_table *pt;
 	gcry_mpi_t deserialized_sig;
-	gcry_md_hd_t digest;
-	char *digest_buf = NULL;
 	int result = 0;
+	STATS_CALL(ECC_OP_VERIFY, state);
 
 	/*
 	 * Preliminary argument checks, just for sanity of the library
 	 */
-	if ( (data == NULL) ) {
-		__warning("Invalid or empty `data` argument passed to ecc_verify()");
+	if ( (digest == NULL) ) {
+		__warning("Invalid or empty `digest` argument passed to ecc_verify_digest()");
 		goto exit;
 	}
-	if ( (signature == NULL) || (strlen(signature) == 0) ) {
+	if ( (signature == NULL) || (siglen == 0) ) {
 		__warning("Invalid or empty `signature` argument passed to ecc_verify()");
 		goto exit;
 	}
@@ -697,33 +2814,17 @@ bool ecc_verify(char *data, char *signature, ECC_KeyPair keypair, ECC_State stat
 		goto exit;
 	}
 
-	if (!decompress_from_string(&_ap, keypair->pub, DF_COMPACT, 
-			state->curveparams)) {
+	if (!(pt = __keypair_table(keypair, state))) {
 		__warning("Your public key appears invalid");
 		goto exit;
 	}
 
-	err = gcry_md_open(&digest, GCRY_MD_SHA512, 0);
-	if (gcry_err_code(err)) {
-		__gwarning("Failed to initialize SHA-512 message digest", err);
-		goto bailout;
-	}
-
-	/*
-	 * Write our data into the message digest buffer for gcrypt
-	 */
-	gcry_md_write(digest, data, strlen(data));
-	gcry_md_final(digest);
-	digest_buf = (char *)(gcry_md_read(digest, 0));
-
-	result = deserialize_mpi(&deserialized_sig, DF_COMPACT, signature, 
-						strlen(signature));
-	if (!result) {
+	if (!(deserialized_sig = __deserialize_sig(signature, siglen, state))) {
 		__warning("Failed to deserialize the signature");
-		goto bailout;
+		goto exit;
 	}
 
-	result = ECDSA_verify(digest_buf, &_ap, deserialized_sig, state->curveparams);
+	result = ECDSA_verify_table(digest, pt, deserialized_sig, state->curveparams);
 	if (result)
 		rc = true;
 	/*
@@ -737,16 +2838,203 @@ bool ecc_verify(char *data, char *signature, ECC_KeyPair keypair, ECC_State stat
 	 */
 	gcry_mpi_release(deserialized_sig);
 
-	bailout:
-		point_release(&_ap);
-		gcry_md_close(digest);
 	exit:
 		return rc;
 }
 
+bool ecc_verify_s(void *data, unsigned int databytes, char *signature, 
+		ECC_KeyPair keypair, ECC_State state)
+{
+	char digest[ECC_DIGEST_LEN];
+	STATS_CALL(ECC_OP_VERIFY, state);
+
+	if ( (data == NULL) ) {
+		__warning("Invalid or empty `data` argument passed to ecc_verify()");
+		return false;
+	}
+
+	gcry_md_hash_buffer(GCRY_MD_SHA512, digest, data, databytes);
+	return ecc_verify_digest(digest, signature, keypair, state);
+}
+
+bool ecc_verify(char *data, char *signature, ECC_KeyPair keypair, ECC_State state)
+{
+	STATS_CALL(ECC_OP_VERIFY, state);
+	if ( (data == NULL) ) {
+		__warning("Invalid or empty `data` argument passed to ecc_verify()");
+		return false;
+	}
+	return ecc_verify_s(data, strlen(data), signature, keypair, state);
+}
+
+bool ecc_verify_batch(char **messages, unsigned int *lengths, char **signatures,
+		ECC_KeyPair *keypairs, unsigned int n, bool *results, ECC_State state)
+{
+	bool rc = false;
+	gcry_error_t err = 0;
+	gcry_md_hd_t digest;
+	char *digests = NULL;
+	struct point_table **tables = NULL;
+	gcry_mpi_t *sigs = NULL;
+	int *valid = NULL;
+	unsigned int i;
+	STATS_CALL(ECC_OP_VERIFY_BATCH, state);
+
+	if (n == 0)
+		return true;
+	if (results) {
+		for (i = 0; i < n; ++i)
+			results[i] = false;
+	}
+	if ( (messages == NULL) || (signatures == NULL) || (keypairs == NULL) ) {
+		__warning("Invalid or empty arrays passed to ecc_verify_batch()");
+		goto exit;
+	}
+	if (!__verify_state(state)) {
+		__warning("Invalid or uninitialized ECC_State object");
+		goto exit;
+	}
+
+	digests = (char *)(malloc(sizeof(char) * 64 * n));
+	tables = (struct point_table **)(malloc(sizeof(struct point_table *) * n));
+	sigs = (gcry_mpi_t *)(calloc(n, sizeof(gcry_mpi_t)));
+	valid = (int *)(malloc(sizeof(int) * n));
+
+	if ( (!digests) || (!tables) || (!sigs) || (!valid) ) {
+		if (errno == ENOMEM)
+			__warning("Cannot allocate memory for the batch in ecc_verify_batch()");
+		goto release;
+	}
+
+	err = gcry_md_open(&digest, GCRY_MD_SHA512, 0);
+	if (gcry_err_code(err)) {
+		__gwarning("Failed to initialize SHA-512 message digest", err);
+		goto release;
+	}
+
+	/*
+	 * One digest context is reset between messages, the public keys come
+	 * out of the tables cached in their ::ECC_KeyPair objects
+	 */
+	for (i = 0; i < n; ++i) {
+		if ( (messages[i] == NULL) || (signatures[i] == NULL) ) 
+			continue;
+		if (!__verify_keypair(keypairs[i], false, true))
+			continue;
+		if (!(tables[i] = __keypair_table(keypairs[i], state)))
+			continue;
+
+		gcry_md_reset(digest);
+		gcry_md_write(digest, messages[i], 
+				lengths ? lengths[i] : strlen(messages[i]));
+		gcry_md_final(digest);
+		memcpy(digests + 64 * i, gcry_md_read(digest, 0), 64);
+
+		sigs[i] = __deserialize_sig(signatures[i], 
+				__signature_len(signatures[i], state), state);
+	}
+	gcry_md_close(digest);
+
+	if (ECDSA_verify_batch(valid, digests, 
+			(const struct point_table *const *)(tables), sigs, n, 
+			state->curveparams) == n)
+		rc = true;
+	if (results) {
+		for (i = 0; i < n; ++i)
+			results[i] = valid[i] ? true : false;
+	}
+
+	release:
+		if (sigs) {
+			for (i = 0; i < n; ++i) {
+				if (sigs[i])
+					gcry_mpi_release(sigs[i]);
+			}
+		}
+		free(digests);
+		free(tables);
+		free(sigs);
+		free(valid);
+	exit:
+		return rc;
+}
+
+/*
+ * Identify the (our key, peer key) pair for the DH cache
+ */
+static bool __dh_id(char *id, ECC_KeyPair ours, ECC_KeyPair peer, 
+		ECC_State state)
+{
+	struct curve_params *cp = state->curveparams;
+	unsigned int namelen = strlen(cp->name), publen = peer->pub_bytes;
+	char *buf;
+
+	/* Compact keys from ecc_keygen() count their terminating NUL */
+	if ( (__format(state) == DF_COMPACT) && (publen > 0) && 
+			(((char *)(peer->pub))[publen - 1] == '\0') )
+		publen--;
+
+	if (!(buf = gcry_malloc_secure(namelen + cp->order_len_bin + publen))) {
+		__warning("Out of secure memory!");
+		return false;
+	}
+	memcpy(buf, cp->name, namelen);
+	serialize_mpi(buf + namelen, cp->order_len_bin, DF_BIN, ours->priv);
+	memcpy(buf + namelen + cp->order_len_bin, peer->pub, publen);
+	gcry_md_hash_buffer(GCRY_MD_SHA256, id, buf, 
+			namelen + cp->order_len_bin + publen);
+	bzero(buf, namelen + cp->order_len_bin + publen);
+	gcry_free(buf);
+	return true;
+}
+
+bool ecc_dh(ECC_KeyPair ours, ECC_KeyPair peer, char *key, ECC_State state)
+{
+	struct point_table *P;
+	char id[DH_ID_LEN];
+	bool cached;
+	STATS_CALL(ECC_OP_DH, state);
+
+	if (!__verify_state(state)) {
+		__warning("Invalid state passed to ecc_dh()");
+		return false;
+	}
+	if (!__verify_keypair(ours, true, false)) {
+		__warning("Invalid ECC_KeyPair for our side passed to ecc_dh()");
+		return false;
+	}
+	if (!__verify_keypair(peer, false, true)) {
+		__warning("Invalid ECC_KeyPair for the peer passed to ecc_dh()");
+		return false;
+	}
+	if (key == NULL) {
+		__warning("Invalid `key` argument passed to ecc_dh()");
+		return false;
+	}
+
+	cached = (state->dh_cache) && 
+			(__dh_id(id, ours, peer, state));
+	if ( (cached) && (__dh_cache_get(state->dh_cache, id, key)) )
+		return true;
+
+	if (!(P = __keypair_table(peer, state))) {
+		__warning("Invalid public key");
+		return false;
+	}
+	if (!DH_step2_table(key, P, ours->priv, state->curveparams)) {
+		__warning("The peer's public key failed validation in ecc_dh()");
+		return false;
+	}
+
+	if (cached)
+		__dh_cache_put(state->dh_cache, id, key);
+	return true;
+}
+
 char *ecc_serialize_private_key(ECC_KeyPair kp, ECC_State state)
 {
 	char *buf = NULL;
+	int len;
 
 	if (!__verify_keypair(kp, true, false)) {
 		__warning("Invalid KeyPair passed to ecc_serialize_private_key()");
@@ -757,10 +3045,57 @@ char *ecc_serialize_private_key(ECC_KeyPair kp, ECC_State state)
 		return NULL;
 	}
 
-	buf = (char *)malloc(sizeof(char) * 
-			(1 + state->curveparams->pk_len_compact));
-	serialize_mpi(buf, state->curveparams->pk_len_compact, 
-			DF_COMPACT, kp->priv);
-	buf[state->curveparams->pk_len_compact] = '\0';
+	len = ecc_private_key_size(state);
+	buf = (char *)malloc(sizeof(char) * (1 + len));
+	if (!buf)
+		return NULL;
+	serialize_mpi(buf, len, __format(state), kp->priv);
+	buf[len] = '\0';
 	return buf;
 }
+
+int ecc_public_key_size(ECC_State state)
+{
+	if (!__verify_state(state))
+		return -1;
+	if (__format(state) == DF_BIN)
+		return state->curveparams->pk_len_bin;
+	return state->curveparams->pk_len_compact;
+}
+
+int ecc_private_key_size(ECC_State state)
+{
+	if (!__verify_state(state))
+		return -1;
+	if (__format(state) == DF_BIN)
+		return state->curveparams->order_len_bin;
+	return state->curveparams->pk_len_compact;
+}
+
+int ecc_signature_size(ECC_State state)
+{
+	if (!__verify_state(state))
+		return -1;
+	if (__format(state) == DF_BIN)
+		return state->curveparams->sig_len_bin;
+	return state->curveparams->sig_len_compact;
+}
+
+bool ecc_get_stats(ECC_State state, ECC_Stats stats)
+{
+#ifdef ECC_STATS
+	if ( (state == NULL) || (stats == NULL) )
+		return false;
+	memcpy(stats, &state->stats, sizeof(struct _ECC_Stats));
+	return true;
+#else
+	return false;
+#endif
+}
+
+void ecc_reset_stats(ECC_State state)
+{
+	if (state == NULL)
+		return;
+	bzero(&state->stats, sizeof(struct _ECC_Stats));
+}
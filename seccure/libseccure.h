@@ -36,6 +36,63 @@
 
 #define DEFAULT_MAC_LEN 10
 
+/**
+ * Length of the SHA-512 digest ecc_sign_digest() and ecc_verify_digest() 
+ * expect
+ */
+#define ECC_DIGEST_LEN 64
+
+/**
+ * Upper bound on ECC_Options.ephemerals, the ephemeral keys are kept in 
+ * libgcrypt's secure memory
+ */
+#define ECC_EPHEMERALS_MAX 64
+
+/**
+ * Length of the session key ecc_dh() derives, the first half is the 
+ * established key and the second the verification key of seccure-dh
+ */
+#define ECC_DH_KEY_LEN 64
+
+/**
+ * Default plaintext bytes per segment of the segmented format, the one 
+ * seccure-encrypt -x writes
+ */
+#define ECC_SEGMENT_SIZE (1 << 20)
+
+/**
+ * Upper bound on ECC_Options.dh_cache, the cached session keys are kept in
+ * libgcrypt's secure memory
+ */
+#define ECC_DH_CACHE_MAX 64
+
+/**
+ * Thread safety:
+ *
+ * libgcrypt is set up exactly once per process by whichever ecc_new_state()
+ * call comes first, ecc_new_state() and ecc_free_state() may be called from
+ * any number of threads at the same time.
+ *
+ * Curve data is loaded once and shared read-only.  Apart from its
+ * statistics, which are updated atomically, an ::ECC_State does not change
+ * after ecc_new_state(), so one state can be used by several threads until
+ * it is freed; its pool of ECIES ephemeral keys and its DH session key
+ * cache, if any, do their own locking.  ecc_reset_stats() is the exception:
+ * it simply zeroes the counters and must not race with other calls on the
+ * same state.  An ::ECC_KeyPair may likewise be shared as long as nobody
+ * modifies it, the decoded public key it caches on first use is published
+ * atomically.
+ *
+ * All scratch space a computation needs is private to the call.  Results
+ * are either freshly allocated ::ECC_Data objects or, for the *_into()
+ * functions and streams, written to buffers the caller provides and has to
+ * keep to one thread at a time.  An ::ECC_Stream is never to be used by two
+ * threads at once, an ::ECC_Segments only holds keys and can be.
+ *
+ * Freeing a state or keypair while another thread still uses it is, of
+ * course, not safe.
+ */
+
 /**
  * ::ECC_KeyPair denotes a structure to hold the public/private
  * keys necessary for ECC sign/verify/encrypt and decrypting.
@@ -44,6 +101,8 @@ struct _ECC_KeyPair {
 	gcry_mpi_t priv;
 	void *pub;
 	unsigned int pub_bytes;
+	struct point_table *pub_table; /*!< decoded "pub", filled in once on first use, "pub" must not change afterwards */
+	const char *pub_curve; /*!< name of the curve "pub_table" was decoded for, the keypair is bound to it */
 };
 typedef struct _ECC_KeyPair* ECC_KeyPair;
 
@@ -56,23 +115,92 @@ struct _ECC_Data {
 };
 typedef struct _ECC_Data* ECC_Data;
 
+/**
+ * ::ECC_Stream is the opaque state of an incremental encryption or 
+ * decryption, see ecc_encrypt_init(), ecc_decrypt_init(), ecc_signcrypt_init()
+ * and ecc_veridec_init()
+ */
+typedef struct _ECC_Stream* ECC_Stream;
+
+/**
+ * ::ECC_Segments holds the keys of a ciphertext in the segmented format,
+ * see ecc_encrypt_segments_init() and ecc_decrypt_segments_init()
+ */
+typedef struct _ECC_Segments* ECC_Segments;
+
+/**
+ * ::ECC_Format is how keys and signatures are passed in and out of the
+ * library
+ */
+typedef enum {
+	ECC_FORMAT_COMPACT = 0, /*!< the printable base-90 strings the seccure utility uses */
+	ECC_FORMAT_BINARY /*!< fixed size big endian binary, see ecc_public_key_size() and friends */
+} ECC_Format;
+
 /**
  * ::ECC_Options is a container for options some ecc_ functions
  *
  */
 struct _ECC_Options {
-	char *curve; /*!< curve will be defaulted to ::DEFAULT_CURVE by ecc_new_options() */
+	char *curve; /*!< curve will be defaulted to ::DEFAULT_CURVE by ecc_new_options(), only ecc_new_state() reads it, use ECC_State.curve afterwards */
 	bool secure_random; /*!< secure_random enables libgcrypt's secure random number generator, default true */
+	unsigned int ephemerals; /*!< number of ECIES ephemeral keys a background thread keeps precomputed for encryption (at most ::ECC_EPHEMERALS_MAX), default 0 disables the pool */
+	unsigned int dh_cache; /*!< number of ecc_dh() session keys to cache (at most ::ECC_DH_CACHE_MAX), default 0 disables the cache */
+	ECC_Format format; /*!< format of the keys and signatures going in and out, keypairs have to be used with states of the format they were created with, default ::ECC_FORMAT_COMPACT */
+	bool legacy_mac; /*!< also accept ciphertexts whose MAC covers no data at all, as ecc_encrypt() of older releases wrote them; those cannot be told from tampered ones, default false */
+	unsigned int secmem_size; /*!< bytes of libgcrypt's secure memory pool that hold private keys, nonces and session keys; the pool is set up once per process, by the first state, default 0 leaves it at libgcrypt's minimum of 16K */
 }; 
 typedef struct _ECC_Options* ECC_Options;
 
+/**
+ * ::ECC_Op names the groups of public calls ::ECC_Stats times, a call
+ * made from inside another public call is booked to the outer one
+ */
+typedef enum {
+	ECC_OP_KEYGEN = 0, /*!< ecc_keygen(), ecc_keygen_batch() */
+	ECC_OP_ENCRYPT, /*!< ecc_encrypt(), ecc_encrypt_into() */
+	ECC_OP_DECRYPT, /*!< ecc_decrypt(), ecc_decrypt_into() */
+	ECC_OP_MULTI, /*!< ecc_encrypt_multi(), ecc_decrypt_multi() */
+	ECC_OP_STREAM, /*!< ecc_encrypt_init(), ecc_decrypt_init() and the update/final/seek calls of the stream, the segmented format calls */
+	ECC_OP_SIGN, /*!< ecc_sign(), ecc_sign_s(), ecc_sign_digest() */
+	ECC_OP_VERIFY, /*!< ecc_verify(), ecc_verify_s(), ecc_verify_digest() and ecc_verify_digest_s() */
+	ECC_OP_VERIFY_BATCH, /*!< ecc_verify_batch() */
+	ECC_OP_DH, /*!< ecc_dh() */
+	ECC_OP_SIGNCRYPT, /*!< ecc_signcrypt(), ecc_signcrypt_into(), ecc_veridec(), ecc_veridec_into(), their streams count as ::ECC_OP_STREAM */
+	ECC_OP_MAX
+} ECC_Op;
+
+/**
+ * ::ECC_Stats are the instrumentation counters of an ::ECC_State, only
+ * kept when libseccure is built with -DECC_STATS, see ecc_get_stats()
+ *
+ * Work done by the background thread of the ephemeral key pool is not
+ * booked to any state.
+ */
+struct _ECC_Stats {
+	unsigned long long invm; /*!< modular inversions */
+	unsigned long long mulm; /*!< modular multiplications, MPI and native field ones */
+	unsigned long long pointmul_fixed; /*!< scalar multiplications of the base point */
+	unsigned long long pointmul_variable; /*!< scalar multiplications of any other point */
+	unsigned long long pointmul_dual; /*!< u1 G + u2 Q multiplications of signature verification */
+	unsigned long long decompress; /*!< public point decompressions */
+	unsigned long long secmem; /*!< allocations from libgcrypt's secure memory */
+	unsigned long long calls[ECC_OP_MAX]; /*!< public calls per ::ECC_Op */
+	unsigned long long nsec[ECC_OP_MAX]; /*!< cumulative wall clock nanoseconds of those calls */
+};
+typedef struct _ECC_Stats* ECC_Stats;
+
 /**
  * ::ECC_State is a bag of useful bits for maintaining cross-function state
  */
 struct _ECC_State {
 	bool gcrypt_init;
 	ECC_Options options;
-	struct curve_params *curveparams;
+	struct curve_params *curveparams; /*!< borrowed from the process wide curve registry, shared with other states */
+	char *curve; /*!< canonical name of the curve, the state's own copy, NULL if ECC_Options.curve is unknown */
+	struct ephemeral_pool *ephemerals; /*!< precomputed ECIES ephemeral keys if ECC_Options.ephemerals asked for them */
+	struct dh_cache *dh_cache; /*!< recently derived ecc_dh() session keys if ECC_Options.dh_cache asked for them */
+	struct _ECC_Stats stats; /*!< updated atomically, read it through ecc_get_stats() */
 };
 typedef struct _ECC_State* ECC_State;
 
@@ -84,7 +212,8 @@ typedef struct _ECC_State* ECC_State;
  * representation along the way, calling strlen() on both of them.
  *
  * If you do not want strlen() to be called, use ecc_new_keypair_s() and 
- * specify a custom length for the respective keys
+ * specify a custom length for the respective keys, as binary keys 
+ * (::ECC_FORMAT_BINARY) have to
  */
 ECC_KeyPair ecc_new_keypair(char *pubkey, char *privkey, ECC_State state);
 
@@ -138,6 +267,21 @@ void ecc_free_state(ECC_State state);
  */
 ECC_KeyPair ecc_keygen(void *priv, ECC_State state);
 
+/**
+ * Generate n random key pairs at once
+ *
+ * A single seed from libgcrypt's strong entropy pool is expanded into all
+ * n private keys and the public keys are computed in batches that share
+ * their modular inversion, which makes this much cheaper per key than n
+ * ecc_keygen() calls.
+ *
+ * @return Array of n ::ECC_KeyPair objects or NULL, release every keypair
+ * (and its "pub" member) like one from ecc_keygen(), then the array with free()
+ * @param n Number of keypairs, more than 0
+ * @param state ::ECC_State object
+ */
+ECC_KeyPair *ecc_keygen_batch(unsigned int n, ECC_State state);
+
 
 /**
  * Return an allocated buffer with an GCRYMPI_FMT_HEX formatted
@@ -149,8 +293,34 @@ ECC_KeyPair ecc_keygen(void *priv, ECC_State state);
  */
 const char *ecc_mpi_to_str(gcry_mpi_t key);
 
+/**
+ * Serialize the private key in the state's ECC_Options.format, compact
+ * keys are NUL terminated, binary ones ecc_private_key_size() bytes
+ *
+ * @return Allocated buffer
+ */
 char *ecc_serialize_private_key(ECC_KeyPair kp, ECC_State state);
 
+/**
+ * Size of a public key in the state's ECC_Options.format, not counting
+ * the NUL compact keys carry
+ *
+ * @return The number of bytes, -1 if the state is invalid
+ */
+int ecc_public_key_size(ECC_State state);
+
+/**
+ * Size of a private key in the state's ECC_Options.format, like
+ * ecc_public_key_size()
+ */
+int ecc_private_key_size(ECC_State state);
+
+/**
+ * Size of a signature in the state's ECC_Options.format, like
+ * ecc_public_key_size(); binary signatures are always this long
+ */
+int ecc_signature_size(ECC_State state);
+
 
 /**
  * Encrypt the specified block of data using the public key specified
@@ -161,12 +331,342 @@ ECC_Data ecc_encrypt(void *data, int databytes, ECC_KeyPair keypair, ECC_State s
 
 
 /**
- * Decrypt the specied block of data using the private key specified
+ * Decrypt the specied block of data using the private key specified, 
+ * the ::ECC_Data passed in is not modified
  *
- * @return An allocated buffer with the decrypted data
+ * @return An allocated buffer with the decrypted data, NULL if the MAC 
+ *  does not check out
  */
 ECC_Data ecc_decrypt(ECC_Data encrypted, ECC_KeyPair keypair, ECC_State state);
 
+/**
+ * Size of the ecc_encrypt() output for databytes of plaintext
+ *
+ * @return The number of bytes, -1 if the state is invalid or the size 
+ *  does not fit an int
+ */
+int ecc_encrypted_size(unsigned int databytes, ECC_State state);
+
+/**
+ * Size of the plaintext in encbytes of ecc_encrypt() output
+ *
+ * @return The number of bytes, -1 if the state is invalid or encbytes is 
+ *  too short to be a ciphertext
+ */
+int ecc_decrypted_size(unsigned int encbytes, ECC_State state);
+
+/**
+ * Encrypt the specified block of data straight into `out`, which has to
+ * hold at least ecc_encrypted_size() bytes and must not overlap `data`
+ *
+ * @return The number of bytes written to `out`, -1 on failure
+ */
+int ecc_encrypt_into(void *data, unsigned int databytes, void *out, 
+	unsigned int outbytes, ECC_KeyPair keypair, ECC_State state);
+
+/**
+ * Decrypt the specified block of data straight into `out`, which has to 
+ * hold at least ecc_decrypted_size() bytes and must not overlap `data`,
+ * `data` is not modified.  The MAC is checked, `out` is zeroed again if
+ * the data was tampered with.
+ *
+ * @return The number of bytes written to `out`, -1 on failure
+ */
+int ecc_decrypt_into(void *data, unsigned int databytes, void *out, 
+	unsigned int outbytes, ECC_KeyPair keypair, ECC_State state);
+
+/**
+ * Size of the ecc_encrypt_multi() output for databytes of plaintext and
+ * the given number of recipients
+ *
+ * @return The number of bytes, -1 if the state is invalid or the size 
+ *  does not fit an int
+ */
+int ecc_encrypted_multi_size(unsigned int databytes, unsigned int recipients, 
+	ECC_State state);
+
+/**
+ * Encrypt the specified block of data once for all of the public keys in 
+ * `keypairs`, each recipient only adds a small fixed size slot to the 
+ * output
+ *
+ * Every slot is tagged with a short id of its recipient's public key, so
+ * anyone who holds that public key can tell it is among the recipients.
+ *
+ * @return An allocated buffer with the encrypted data, to be decrypted 
+ *  with ecc_decrypt_multi()
+ */
+ECC_Data ecc_encrypt_multi(void *data, unsigned int databytes, 
+	ECC_KeyPair *keypairs, unsigned int recipients, ECC_State state);
+
+/**
+ * Decrypt ecc_encrypt_multi() output with the private key specified
+ *
+ * The slot is picked by the recipient id, this costs one fixed-base and
+ * one ECIES scalar multiplication no matter how many recipients there are
+ *
+ * @return An allocated buffer with the decrypted data, NULL if the key is
+ *  not one of the recipients or the data does not check out
+ */
+ECC_Data ecc_decrypt_multi(void *data, unsigned int databytes, 
+	ECC_KeyPair keypair, ECC_State state);
+
+/**
+ * Start encrypting a stream of data with the public key specified, the
+ * output is the same as ecc_encrypt() produces for all of the data at once
+ *
+ * @return An allocated ::ECC_Stream to be released with ecc_free_stream()
+ */
+ECC_Stream ecc_encrypt_init(ECC_KeyPair keypair, ECC_State state);
+
+/**
+ * Encrypt the next block of data into `out`, which has to hold at least
+ * databytes + ecc_encrypted_size(0, state) bytes
+ *
+ * @return The number of bytes written to `out`, -1 on failure
+ */
+int ecc_encrypt_update(ECC_Stream stream, void *data, unsigned int databytes, 
+	void *out, unsigned int outbytes);
+
+/**
+ * Finish the stream, writing the MAC to `out`, which has to hold at least
+ * ecc_encrypted_size(0, state) bytes
+ *
+ * @return The number of bytes written to `out`, -1 on failure
+ */
+int ecc_encrypt_final(ECC_Stream stream, void *out, unsigned int outbytes);
+
+/**
+ * Start decrypting a stream of ecc_encrypt() output with the private key
+ * specified
+ *
+ * @return An allocated ::ECC_Stream to be released with ecc_free_stream()
+ */
+ECC_Stream ecc_decrypt_init(ECC_KeyPair keypair, ECC_State state);
+
+/**
+ * Decrypt the next block of data into `out`, which has to hold at least
+ * databytes bytes, the last few bytes seen are held back until it is known
+ * they are not the MAC
+ *
+ * @return The number of bytes written to `out`, -1 on failure
+ */
+int ecc_decrypt_update(ECC_Stream stream, void *data, unsigned int databytes, 
+	void *out, unsigned int outbytes);
+
+/**
+ * Finish the stream and check the MAC, the plaintext ecc_decrypt_update()
+ * wrote out must not be trusted unless this succeeds
+ *
+ * @return false if the ciphertext was truncated or the MAC does not check out
+ */
+bool ecc_decrypt_final(ECC_Stream stream);
+
+/**
+ * Jump to byte `offset` of the plaintext, the following ecc_decrypt_update()
+ * calls take the ciphertext from `offset` bytes past the header on.  The
+ * header has to have been passed in already, bytes held back are dropped.
+ *
+ * @warning Nothing ecc_decrypt_update() returns after a seek is ever
+ *  authenticated.  The MAC covers the whole ciphertext, so it cannot be
+ *  checked anymore and ecc_decrypt_final() fails; tampered ciphertext
+ *  decrypts to tampered plaintext without notice.  Random access to data
+ *  that has to be trusted takes the segmented format instead, see
+ *  ecc_decrypt_segments_init()
+ *
+ * @return false if the stream has not seen the header yet
+ */
+bool ecc_decrypt_seek(ECC_Stream stream, unsigned long long offset);
+
+/**
+ * Free and release an ::ECC_Stream
+ */
+void ecc_free_stream(ECC_Stream stream);
+
+/**
+ * Segmented encryption, the format of seccure-encrypt -x with a MAC of
+ * ::DEFAULT_MAC_LEN bytes:
+ *
+ *    header | C_0 | MAC_0 | ... | C_n-1 | MAC_n-1 | final tag
+ *
+ * Every segment but the last holds ecc_segment_length() bytes of plaintext
+ * and has a MAC of its own, so segment i, found at byte
+ * ecc_segments_header_size() + i * (ecc_segment_length() + ::DEFAULT_MAC_LEN)
+ * of the ciphertext, can be encrypted or decrypted and checked on its own,
+ * in any order and from several threads at once.  The final tag covers
+ * the number of segments.
+ *
+ * @return The size of the header, -1 if the state is invalid
+ */
+int ecc_segments_header_size(ECC_State state);
+
+/**
+ * Start a segmented encryption to the public key specified, writing the
+ * header into `header`
+ *
+ * @param seglen Plaintext bytes per segment, a multiple of 16 up to 4M, 0 
+ *  for ::ECC_SEGMENT_SIZE
+ * @param header Buffer of at least ecc_segments_header_size() bytes
+ * @return An allocated ::ECC_Segments to be released with ecc_free_segments()
+ */
+ECC_Segments ecc_encrypt_segments_init(unsigned int seglen, void *header, 
+	unsigned int headerbytes, ECC_KeyPair keypair, ECC_State state);
+
+/**
+ * Start decrypting a segmented ciphertext with the private key specified
+ *
+ * @param header The first ecc_segments_header_size() bytes of the ciphertext
+ * @return An allocated ::ECC_Segments, NULL if the header is malformed
+ */
+ECC_Segments ecc_decrypt_segments_init(void *header, unsigned int headerbytes, 
+	ECC_KeyPair keypair, ECC_State state);
+
+/**
+ * Plaintext bytes in every segment but the last
+ */
+unsigned int ecc_segment_length(ECC_Segments segments);
+
+/**
+ * Encrypt segment `index`, 1 to ecc_segment_length() bytes of plaintext,
+ * into `out` followed by its MAC
+ *
+ * @return The number of bytes written, databytes + ::DEFAULT_MAC_LEN, -1 
+ *  on failure
+ */
+int ecc_encrypt_segment(ECC_Segments segments, unsigned long long index, 
+	void *data, unsigned int databytes, void *out, unsigned int outbytes);
+
+/**
+ * Check the MAC of segment `index`, its ciphertext and MAC as 
+ * ecc_encrypt_segment() wrote them, and decrypt it into `out`, which is
+ * left alone unless the MAC checks out
+ *
+ * @return The number of plaintext bytes, -1 if the segment is forged or 
+ *  the arguments are invalid
+ */
+int ecc_decrypt_segment(ECC_Segments segments, unsigned long long index, 
+	void *data, unsigned int databytes, void *out, unsigned int outbytes);
+
+/**
+ * Write the final tag of a ciphertext of `count` segments, 
+ * ::DEFAULT_MAC_LEN bytes
+ *
+ * @return The number of bytes written, -1 on failure
+ */
+int ecc_encrypt_segments_final(ECC_Segments segments, unsigned long long count, 
+	void *out, unsigned int outbytes);
+
+/**
+ * Check the final tag of a ciphertext of `count` segments, without it a
+ * ciphertext cut short at a segment boundary goes unnoticed
+ *
+ * @return false if the tag does not check out
+ */
+bool ecc_decrypt_segments_final(ECC_Segments segments, unsigned long long count, 
+	void *tag, unsigned int tagbytes);
+
+/**
+ * Free and release an ::ECC_Segments
+ */
+void ecc_free_segments(ECC_Segments segments);
+
+/**
+ * Size of the ecc_signcrypt() output for databytes of plaintext
+ *
+ * @return The number of bytes, -1 if the state is invalid or the size 
+ *  does not fit an int
+ */
+int ecc_signcrypted_size(unsigned int databytes, ECC_State state);
+
+/**
+ * Size of the plaintext in encbytes of ecc_signcrypt() output
+ *
+ * @return The number of bytes, -1 if the state is invalid or encbytes is 
+ *  too short to be a signcrypted message
+ */
+int ecc_veridecrypted_size(unsigned int encbytes, ECC_State state);
+
+/**
+ * Sign the specified block of data with our private key in `keypair` and
+ * encrypt it to the public key in `peer` in a single pass over the data.
+ * The output is what seccure-signcrypt writes when both keys are on the
+ * state's curve, `out` has to hold at least ecc_signcrypted_size() bytes
+ * and must not overlap `data`
+ *
+ * @return The number of bytes written to `out`, -1 on failure
+ */
+int ecc_signcrypt_into(void *data, unsigned int databytes, void *out, 
+	unsigned int outbytes, ECC_KeyPair keypair, ECC_KeyPair peer, 
+	ECC_State state);
+
+/**
+ * ecc_signcrypt_into() into an allocated buffer
+ *
+ * @return An allocated buffer with the signcrypted data
+ */
+ECC_Data ecc_signcrypt(void *data, unsigned int databytes, ECC_KeyPair keypair, 
+	ECC_KeyPair peer, ECC_State state);
+
+/**
+ * Decrypt ecc_signcrypt() output with our private key in `keypair` and 
+ * verify the signature in it against the public key in `peer`, `out` has 
+ * to hold at least ecc_veridecrypted_size() bytes and must not overlap 
+ * `data`.  If the signature does not check out the plaintext written so
+ * far is wiped from `out` again
+ *
+ * @return The number of bytes written to `out`, -1 on failure or if the
+ *  message is forged
+ */
+int ecc_veridec_into(void *data, unsigned int databytes, void *out, 
+	unsigned int outbytes, ECC_KeyPair keypair, ECC_KeyPair peer,
+	ECC_State state);
+
+/**
+ * ecc_veridec_into() into an allocated buffer
+ *
+ * @return An allocated buffer with the verified plaintext, NULL on failure
+ *  or if the message is forged
+ */
+ECC_Data ecc_veridec(void *data, unsigned int databytes, ECC_KeyPair keypair, 
+	ECC_KeyPair peer, ECC_State state);
+
+/**
+ * Start signcrypting a stream of data, signed with our private key in
+ * `keypair` and encrypted to the public key in `peer`.  The stream is fed
+ * with ecc_encrypt_update() and finished with ecc_signcrypt_final(), the
+ * output is the same as ecc_signcrypt() produces for all of the data
+ *
+ * @return An allocated ::ECC_Stream to be released with ecc_free_stream()
+ */
+ECC_Stream ecc_signcrypt_init(ECC_KeyPair keypair, ECC_KeyPair peer, 
+	ECC_State state);
+
+/**
+ * Finish a signcryption stream, writing the encrypted signature to `out`,
+ * which has to hold at least ecc_signcrypted_size(0, state) bytes
+ *
+ * @return The number of bytes written to `out`, -1 on failure
+ */
+int ecc_signcrypt_final(ECC_Stream stream, void *out, unsigned int outbytes);
+
+/**
+ * Start decrypting a stream of ecc_signcrypt() output with our private key
+ * in `keypair`, verifying it against the public key in `peer`.  The stream
+ * is fed with ecc_decrypt_update() and finished with ecc_veridec_final(), 
+ * the plaintext it hands out is unverified until then
+ *
+ * @return An allocated ::ECC_Stream to be released with ecc_free_stream()
+ */
+ECC_Stream ecc_veridec_init(ECC_KeyPair keypair, ECC_KeyPair peer, 
+	ECC_State state);
+
+/**
+ * Finish a veridec stream and check the signature
+ *
+ * @return false if the ciphertext was truncated or the message is forged
+ */
+bool ecc_veridec_final(ECC_Stream stream);
+
 
 /**
  * Sign the specified block of data using the private key specified
@@ -179,16 +679,109 @@ ECC_Data ecc_decrypt(ECC_Data encrypted, ECC_KeyPair keypair, ECC_State state);
  */
 ECC_Data ecc_sign(char *data, ECC_KeyPair keypair, ECC_State state);
 
+/**
+ * Sign the specified block of data of databytes bytes, it may contain
+ * NUL bytes
+ *
+ * @return An allocated buffer with the signature of the data block
+ */
+ECC_Data ecc_sign_s(void *data, unsigned int databytes, ECC_KeyPair keypair, 
+	ECC_State state);
+
+/**
+ * Sign a precomputed SHA-512 digest of the data, ecc_sign() is the same
+ * as hashing the data and calling ecc_sign_digest()
+ *
+ * @return An allocated buffer with the signature in the state's 
+ *  ECC_Options.format
+ * @param digest ::ECC_DIGEST_LEN bytes of SHA-512 digest
+ */
+ECC_Data ecc_sign_digest(const char *digest, ECC_KeyPair keypair, ECC_State state);
+
 
 /**
  * Verify the signature of the data block using the specified public key
  *
  * @return True/False
  * @param data An allocated buffer against which to verify the signature
- * @param signature The ECC generated signature 
+ * @param signature The ECC generated signature, a NUL terminated string or 
+ *  ecc_signature_size() bytes with ::ECC_FORMAT_BINARY
  * @param keypair ::ECC_KeyPair object (only needs the "pub" member to contain data)
  * @param state ::ECC_State object
  */
 bool ecc_verify(char *data, char *signature, ECC_KeyPair keypair, ECC_State state);
 
+/**
+ * Verify the signature of the data block of databytes bytes, it may 
+ * contain NUL bytes
+ *
+ * @return True/False
+ */
+bool ecc_verify_s(void *data, unsigned int databytes, char *signature, 
+	ECC_KeyPair keypair, ECC_State state);
+
+/**
+ * Verify the signature against a precomputed SHA-512 digest of the data
+ *
+ * @return True/False
+ * @param digest ::ECC_DIGEST_LEN bytes of SHA-512 digest
+ */
+bool ecc_verify_digest(const char *digest, char *signature, ECC_KeyPair keypair, 
+	ECC_State state);
+
+/**
+ * ecc_verify_digest() with an explicit signature length, which has to be
+ * ecc_signature_size() with ::ECC_FORMAT_BINARY
+ *
+ * @return True/False
+ */
+bool ecc_verify_digest_s(const char *digest, const char *signature, 
+	unsigned int siglen, ECC_KeyPair keypair, ECC_State state);
+
+/**
+ * Verify n signatures at once, sharing the digest context and the modular
+ * inversions between the elements of the batch
+ *
+ * @return True if every signature in the batch verified
+ * @param messages Array of n buffers against which to verify the signatures
+ * @param lengths Array of n buffer lengths, or NULL to call strlen() on each message
+ * @param signatures Array of n ECC generated signatures like ecc_verify() takes
+ * @param keypairs Array of n ::ECC_KeyPair objects (only need the "pub" member)
+ * @param n Number of entries in the batch
+ * @param results Array receiving the outcome of every single verification, may be NULL
+ * @param state ::ECC_State object
+ */
+bool ecc_verify_batch(char **messages, unsigned int *lengths, char **signatures,
+	ECC_KeyPair *keypairs, unsigned int n, bool *results, ECC_State state);
+
+/**
+ * Elliptic curve Diffie-Hellman between our private key and the peer's 
+ * public key, use ecc_keygen() for ephemeral keys.  With 
+ * ECC_Options.dh_cache set, a pair of keys seen recently skips the key 
+ * validation and the scalar multiplication.
+ *
+ * @return True if `key` received the ::ECC_DH_KEY_LEN byte session key
+ * @param ours ::ECC_KeyPair with the "priv" member
+ * @param peer ::ECC_KeyPair with the "pub" member
+ * @param key Buffer of at least ::ECC_DH_KEY_LEN bytes
+ * @param state ::ECC_State object
+ */
+bool ecc_dh(ECC_KeyPair ours, ECC_KeyPair peer, char *key, ECC_State state);
+
+/**
+ * Copy the instrumentation counters of the state, the calls of other 
+ * threads on the same state may still be running and show up partially
+ *
+ * @return False if libseccure was built without -DECC_STATS
+ * @param state ::ECC_State object
+ * @param stats Receives the counters
+ */
+bool ecc_get_stats(ECC_State state, ECC_Stats stats);
+
+/**
+ * Zero the instrumentation counters of the state, this is not atomic and
+ * no other thread may use the state meanwhile
+ */
+void ecc_reset_stats(ECC_State state);
+
 #endif
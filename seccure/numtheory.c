@@ -41,17 +41,21 @@
 #include <gcrypt.h>
 
 #include "numtheory.h"
+#include "stats.h"
 
 /******************************************************************************/
 
+/* The square roots below only ever decompress public points, so their
+   temporaries stay out of secure memory                                  */
+
 /* Fact 2.146(i) in the "Handbook of Applied Cryptography"                    */
 int mod_issquare(const gcry_mpi_t a, const gcry_mpi_t p) 
 {
   if (gcry_mpi_cmp_ui(a, 0)) {
     gcry_mpi_t p1, p2;
     int res;
-    p1 = gcry_mpi_snew(0);
-    p2 = gcry_mpi_snew(0);
+    p1 = gcry_mpi_new(0);
+    p2 = gcry_mpi_new(0);
     gcry_mpi_rshift(p1, p, 1);
     gcry_mpi_powm(p2, a, p1, p);
     res = ! gcry_mpi_cmp_ui(p2, 1);
@@ -74,23 +78,23 @@ int mod_root(gcry_mpi_t x, const gcry_mpi_t a, const gcry_mpi_t p)
   }
   if (! mod_issquare(a, p))
     return 0;
-  h = gcry_mpi_snew(0);
-  n = gcry_mpi_snew(0);
+  h = gcry_mpi_new(0);
+  n = gcry_mpi_new(0);
   gcry_mpi_set_ui(n, 2);
   while (mod_issquare(n, p))
     gcry_mpi_add_ui(n, n, 1);
-  q = gcry_mpi_snew(0);
+  q = gcry_mpi_new(0);
   gcry_mpi_sub_ui(q, p, 1);
   for(r = 0; ! gcry_mpi_test_bit(q, r); r++);
   gcry_mpi_rshift(q, q, r);
-  y = gcry_mpi_snew(0);
+  y = gcry_mpi_new(0);
   gcry_mpi_powm(y, n, q, p);
-  b = gcry_mpi_snew(0);
+  b = gcry_mpi_new(0);
   gcry_mpi_rshift(h, q, 1);
   gcry_mpi_powm(b, a, h, p);
   gcry_mpi_mulm(x, a, b, p);
   gcry_mpi_mulm(b, b, x, p);
-  t = gcry_mpi_snew(0);
+  t = gcry_mpi_new(0);
   while (gcry_mpi_cmp_ui(b, 1)) {
     gcry_mpi_mulm(h, b, b, p);
     for(m = 1; gcry_mpi_cmp_ui(h, 1); m++)
@@ -111,3 +115,92 @@ int mod_root(gcry_mpi_t x, const gcry_mpi_t a, const gcry_mpi_t p)
   gcry_mpi_release(t);
   return 1;
 }
+
+/******************************************************************************/
+
+/* Square roots modulo a prime that is used over and over again (the field
+   prime of a curve) with the strategy and its constants picked just once  */
+void root_params_init(struct root_params *rp, const gcry_mpi_t p)
+{
+  gcry_mpi_t n;
+  rp->e = gcry_mpi_new(0);
+  rp->y = NULL;
+  if (gcry_mpi_test_bit(p, 1)) {
+    rp->type = ROOT_3MOD4;
+    rp->r = 1;
+    gcry_mpi_add_ui(rp->e, p, 1);
+    gcry_mpi_rshift(rp->e, rp->e, 2);
+    return;
+  }
+  rp->type = ROOT_TONELLI;
+  gcry_mpi_sub_ui(rp->e, p, 1);
+  for(rp->r = 0; ! gcry_mpi_test_bit(rp->e, rp->r); rp->r++);
+  gcry_mpi_rshift(rp->e, rp->e, rp->r);
+  n = gcry_mpi_new(0);
+  gcry_mpi_set_ui(n, 2);
+  while (mod_issquare(n, p))
+    gcry_mpi_add_ui(n, n, 1);
+  rp->y = gcry_mpi_new(0);
+  gcry_mpi_powm(rp->y, n, rp->e, p);
+  gcry_mpi_rshift(rp->e, rp->e, 1);
+  gcry_mpi_release(n);
+}
+
+void root_params_release(struct root_params *rp)
+{
+  gcry_mpi_release(rp->e);
+  if (rp->y)
+    gcry_mpi_release(rp->y);
+}
+
+/* Like mod_root(), but with the constants of rp.  For p = 3 (mod 4) the root
+   is a^((p + 1)/4) if there is one at all, otherwise the Tonelli-Shanks
+   iteration above starts from the cached n^q and notices a non-square
+   itself instead of paying for mod_issquare() first.                       */
+int mod_root_fast(gcry_mpi_t x, const gcry_mpi_t a, const gcry_mpi_t p,
+		  const struct root_params *rp)
+{
+  gcry_mpi_t h, y, b, t;
+  int r, m, res = 1;
+  if (! gcry_mpi_cmp_ui(a, 0)) {
+    gcry_mpi_set_ui(x, 0);
+    return 1;
+  }
+  h = gcry_mpi_new(0);
+  if (rp->type == ROOT_3MOD4) {
+    gcry_mpi_powm(x, a, rp->e, p);
+    gcry_mpi_mulm(h, x, x, p);
+    res = ! gcry_mpi_cmp(h, a);
+    gcry_mpi_release(h);
+    return res;
+  }
+  y = gcry_mpi_new(0);
+  b = gcry_mpi_new(0);
+  t = gcry_mpi_new(0);
+  gcry_mpi_set(y, rp->y);
+  gcry_mpi_powm(b, a, rp->e, p);
+  gcry_mpi_mulm(x, a, b, p);
+  gcry_mpi_mulm(b, b, x, p);
+  r = rp->r;
+  while (gcry_mpi_cmp_ui(b, 1)) {
+    gcry_mpi_mulm(h, b, b, p);
+    for(m = 1; gcry_mpi_cmp_ui(h, 1); m++)
+      gcry_mpi_mulm(h, h, h, p);
+    if (m >= r) {
+      res = 0;
+      break;
+    }
+    gcry_mpi_set_ui(h, 0);
+    gcry_mpi_set_bit(h, r - m - 1);
+    gcry_mpi_powm(t, y, h, p);
+    gcry_mpi_mulm(y, t, t, p);
+    r = m;
+    gcry_mpi_mulm(x, x, t, p);
+    gcry_mpi_mulm(b, b, y, p);
+  }
+  gcry_mpi_release(h);
+  gcry_mpi_release(y);
+  gcry_mpi_release(b);
+  gcry_mpi_release(t);
+  return res;
+}
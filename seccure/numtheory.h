@@ -46,4 +46,20 @@
 int mod_issquare(const gcry_mpi_t a, const gcry_mpi_t p);
 int mod_root(gcry_mpi_t x, const gcry_mpi_t a, const gcry_mpi_t p);
 
+/* Strategies of mod_root_fast(), root_params_init() picks one per prime   */
+#define ROOT_TONELLI 0
+#define ROOT_3MOD4   1
+
+/* e is (p + 1)/4 for ROOT_3MOD4.  Otherwise p - 1 = 2^r q with q odd,
+   e is (q - 1)/2 and y is n^q for a fixed non-square n.                    */
+struct root_params {
+  int type, r;
+  gcry_mpi_t e, y;
+};
+
+void root_params_init(struct root_params *rp, const gcry_mpi_t p);
+void root_params_release(struct root_params *rp);
+int mod_root_fast(gcry_mpi_t x, const gcry_mpi_t a, const gcry_mpi_t p,
+		  const struct root_params *rp);
+
 #endif /* INC_NUMTHEORY_H */
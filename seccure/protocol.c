@@ -48,6 +48,7 @@
 #include "serialize.h"
 #include "aes256ctr.h"
 #include "protocol.h"
+#include "stats.h"
 
 /******************************************************************************/
 
@@ -77,6 +78,7 @@ gcry_mpi_t hash_to_exponent(const char *hash, const struct curve_params *cp)
   }
   if (!(cprng = aes256cprng_init(hash))) {
     fprintf(stderr, "aes256cprng_init() failed in hash_to_exponent()\n");
+    gcry_free(buf);
     return NULL;
   }
   aes256cprng_fillbuf(cprng, buf, len);
@@ -107,7 +109,7 @@ void compress_to_string(char *buf, enum disp_format df,
   int outlen = (df == DF_COMPACT) ? cp->pk_len_compact : cp->pk_len_bin;
   if (point_compress(P)) {
     gcry_mpi_t x;
-    x = gcry_mpi_snew(0);
+    x = gcry_mpi_new(0);
     gcry_mpi_add(x, P->x, cp->dp.m);
     serialize_mpi(buf, outlen, df, x);
     gcry_mpi_release(x);
@@ -123,7 +125,7 @@ int decompress_from_string(struct affine_point *P, const char *buf,
   int inlen = (df == DF_COMPACT) ? cp->pk_len_compact : cp->pk_len_bin;
   int res;
   assert(! (df == DF_COMPACT && strlen(buf) != inlen));
-  if ((res = deserialize_mpi(&x, df, buf, inlen))) {
+  if ((res = deserialize_mpi_public(&x, df, buf, inlen))) {
 	res = mixin_key_and_curve(P, x, cp);
   }
   gcry_mpi_release(x);
@@ -213,7 +215,7 @@ gcry_mpi_t ECDSA_sign(const char *msg, const gcry_mpi_t d,
 #else
   k = get_random_exponent(cp);
 #endif
-  p1 = pointmul(&cp->dp.base, k, &cp->dp);
+  p1 = pointmul_base(k, &cp->dp);
   gcry_mpi_mod(r, p1.x, cp->dp.order);
   point_release(&p1);
   if (! gcry_mpi_cmp_ui(r, 0)) {
@@ -240,11 +242,13 @@ gcry_mpi_t ECDSA_sign(const char *msg, const gcry_mpi_t d,
   return s;
 }
 
-int ECDSA_verify(const char *msg, const struct affine_point *Q,
-		 const gcry_mpi_t sig, const struct curve_params *cp)
+/* Q is multiplied through its precomputed table qt if there is one        */
+static int ecdsa_verify(const char *msg, const struct affine_point *Q,
+			const struct point_table *qt, const gcry_mpi_t sig,
+			const struct curve_params *cp)
 {
-  gcry_mpi_t e, r, s;
-  struct affine_point X1, X2;
+  gcry_mpi_t e, u, r, s;
+  struct affine_point X;
   int res = 0;
   r = gcry_mpi_new(0);
   s = gcry_mpi_new(0);
@@ -256,23 +260,133 @@ int ECDSA_verify(const char *msg, const struct affine_point *Q,
   gcry_mpi_mod(e, e, cp->dp.order);
   gcry_mpi_invm(s, s, cp->dp.order);
   gcry_mpi_mulm(e, e, s, cp->dp.order);
-  X1 = pointmul(&cp->dp.base, e, &cp->dp);
-  gcry_mpi_mulm(e, r, s, cp->dp.order);
-  X2 = pointmul(Q, e, &cp->dp);
-  point_add(&X1, &X2, &cp->dp);
+  u = gcry_mpi_new(0);
+  gcry_mpi_mulm(u, r, s, cp->dp.order);
+  if (qt)
+    X = pointmul_dual_table(e, qt, u, &cp->dp);
+  else
+    X = pointmul_dual(e, Q, u, &cp->dp);
   gcry_mpi_release(e);
-  if (! point_is_zero(&X1)) {
-    gcry_mpi_mod(s, X1.x, cp->dp.order);
+  gcry_mpi_release(u);
+  if (! point_is_zero(&X)) {
+    gcry_mpi_mod(s, X.x, cp->dp.order);
     res = ! gcry_mpi_cmp(s, r);
   }
-  point_release(&X1);
-  point_release(&X2);
+  point_release(&X);
  end:
   gcry_mpi_release(r);
   gcry_mpi_release(s);
   return res;
 }
 
+int ECDSA_verify(const char *msg, const struct affine_point *Q,
+		 const gcry_mpi_t sig, const struct curve_params *cp)
+{
+  return ecdsa_verify(msg, Q, NULL, sig, cp);
+}
+
+int ECDSA_verify_table(const char *msg, const struct point_table *qt,
+		       const gcry_mpi_t sig, const struct curve_params *cp)
+{
+  return ecdsa_verify(msg, &qt->p, qt, sig, cp);
+}
+
+/******************************************************************************/
+
+/* Verifies up to ECDSA_BATCH signatures at a time: the n inversions of s
+   are traded for a single one (Section 2.2.2 in the "Guide to Elliptic
+   Curve Cryptography") and the points u1 G + u2 Q share one more when
+   they are brought back to affine coordinates.  An ECDSA signature only
+   carries x(R) mod n, so there is no combined equation that would check
+   the whole batch at once; every result is still decided on its own.     */
+
+#define ECDSA_BATCH 32    /* at most POINT_BATCH_MAX */
+
+static int ECDSA_verify_chunk(int *res, const char *msgs, 
+			      const struct point_table *const *Q,
+			      const gcry_mpi_t *sig, int n,
+			      const struct curve_params *cp)
+{
+  gcry_mpi_t e, h, r[n], s[n], c[n], u1[n], u2[n];
+  const struct point_table *q[n];
+  struct affine_point X[n];
+  int idx[n], i, m, valid = 0;
+
+  for(i = m = 0; i < n; i++) {
+    res[i] = 0;
+    if (! sig[i])
+      continue;
+    r[m] = gcry_mpi_new(0);
+    s[m] = gcry_mpi_new(0);
+    gcry_mpi_div(s[m], r[m], sig[i], cp->dp.order, 0);
+    if (gcry_mpi_cmp_ui(s[m], 0) <= 0 || gcry_mpi_cmp(s[m], cp->dp.order) >= 0 ||
+	gcry_mpi_cmp_ui(r[m], 0) <= 0 || gcry_mpi_cmp(r[m], cp->dp.order) >= 0) {
+      gcry_mpi_release(r[m]);
+      gcry_mpi_release(s[m]);
+      continue;
+    }
+    idx[m++] = i;
+  }
+  if (! m)
+    return 0;
+
+  for(i = 0; i < m; i++) {
+    c[i] = gcry_mpi_new(0);
+    if (i)
+      gcry_mpi_mulm(c[i], c[i - 1], s[i], cp->dp.order);
+    else
+      gcry_mpi_set(c[i], s[i]);
+  }
+  h = gcry_mpi_new(0);
+  gcry_mpi_invm(h, c[m - 1], cp->dp.order);
+  for(i = m - 1; i > 0; i--) {
+    gcry_mpi_mulm(c[i], h, c[i - 1], cp->dp.order);
+    gcry_mpi_mulm(h, h, s[i], cp->dp.order);
+    gcry_mpi_swap(s[i], c[i]);
+  }
+  gcry_mpi_swap(s[0], h);
+
+  for(i = 0; i < m; i++) {
+    gcry_mpi_scan(&e, GCRYMPI_FMT_USG, msgs + 64 * idx[i], 64, NULL);
+    gcry_mpi_mod(e, e, cp->dp.order);
+    u1[i] = e;
+    gcry_mpi_mulm(u1[i], e, s[i], cp->dp.order);
+    u2[i] = gcry_mpi_new(0);
+    gcry_mpi_mulm(u2[i], r[i], s[i], cp->dp.order);
+    q[i] = Q[idx[i]];
+  }
+  pointmul_dual_batch(X, u1, q, u2, m, &cp->dp);
+
+  for(i = 0; i < m; i++) {
+    if (! point_is_zero(&X[i])) {
+      gcry_mpi_mod(s[i], X[i].x, cp->dp.order);
+      valid += res[idx[i]] = ! gcry_mpi_cmp(s[i], r[i]);
+    }
+    point_release(&X[i]);
+    gcry_mpi_release(r[i]);
+    gcry_mpi_release(s[i]);
+    gcry_mpi_release(c[i]);
+    gcry_mpi_release(u1[i]);
+    gcry_mpi_release(u2[i]);
+  }
+  gcry_mpi_release(h);
+  return valid;
+}
+
+/* msgs holds n consecutive 64 byte digests, a NULL entry in sig simply
+   fails.  Returns the number of valid signatures, res[i] is set to 1 for
+   every signature that verified and to 0 otherwise.                     */
+int ECDSA_verify_batch(int *res, const char *msgs,
+		       const struct point_table *const *Q, const gcry_mpi_t *sig,
+		       int n, const struct curve_params *cp)
+{
+  int i, valid = 0;
+  for(i = 0; i < n; i += ECDSA_BATCH)
+    valid += ECDSA_verify_chunk(res + i, msgs + 64 * i, Q + i, sig + i,
+				n - i < ECDSA_BATCH ? n - i : ECDSA_BATCH, cp);
+  return valid;
+}
+
 /******************************************************************************/
 
 /* Algorithms 4.42 and 4.43 in the "Guide to Elliptic Curve Cryptography"     */
@@ -291,17 +405,23 @@ static void ECIES_KDF(char *key, const gcry_mpi_t Zx,
   gcry_free(buf);
 }
 
-struct affine_point ECIES_encryption(char *key, const struct affine_point *Q, 
-				     const struct curve_params *cp)
+static struct affine_point ecies_encryption(char *key, 
+					    const struct affine_point *Q,
+					    const struct point_table *qt,
+					    const struct curve_params *cp)
 {
   struct affine_point Z, R;
-  gcry_mpi_t k;
+  gcry_mpi_t k, h;
  Step1:
   k = get_random_exponent(cp);
-  R = pointmul(&cp->dp.base, k, &cp->dp);
-  gcry_mpi_mul_ui(k, k, cp->dp.cofactor);
-  Z = pointmul(Q, k, &cp->dp);
+  h = gcry_mpi_snew(0);
+  gcry_mpi_mul_ui(h, k, cp->dp.cofactor);
+  if (qt)
+    pointmul_base_pair_table(&R, &Z, k, qt, h, &cp->dp);
+  else
+    pointmul_base_pair(&R, &Z, k, Q, h, &cp->dp);
   gcry_mpi_release(k);
+  gcry_mpi_release(h);
   if (point_is_zero(&Z)) {
     point_release(&R);
     point_release(&Z);
@@ -312,6 +432,91 @@ struct affine_point ECIES_encryption(char *key, const struct affine_point *Q,
   return R;
 }
 
+struct affine_point ECIES_encryption(char *key, const struct affine_point *Q, 
+				     const struct curve_params *cp)
+{
+  return ecies_encryption(key, Q, NULL, cp);
+}
+
+struct affine_point ECIES_encryption_table(char *key, 
+					   const struct point_table *qt,
+					   const struct curve_params *cp)
+{
+  return ecies_encryption(key, &qt->p, qt, cp);
+}
+
+/* The k[i] G and the k[i] Q[i] of up to ECIES_BATCH recipients come out
+   of one pointmul_base_pair_batch(), which normalizes 2n points at once.  */
+
+#define ECIES_BATCH (POINT_BATCH_MAX / 2)
+
+static void ECIES_encryption_chunk(char *key, struct affine_point *R,
+				   const struct point_table *const *qt, int n,
+				   const struct curve_params *cp)
+{
+  struct affine_point Z[n];
+  gcry_mpi_t k[n], h[n];
+  int i;
+  for(i = 0; i < n; i++) {
+    k[i] = get_random_exponent(cp);
+    h[i] = gcry_mpi_snew(0);
+    gcry_mpi_mul_ui(h[i], k[i], cp->dp.cofactor);
+  }
+  pointmul_base_pair_batch(R, Z, k, qt, h, n, &cp->dp);
+  for(i = 0; i < n; i++) {
+    gcry_mpi_release(k[i]);
+    gcry_mpi_release(h[i]);
+    if (point_is_zero(&Z[i])) {
+      point_release(&R[i]);
+      R[i] = ecies_encryption(key + 64 * i, &qt[i]->p, qt[i], cp);
+    }
+    else
+      ECIES_KDF(key + 64 * i, Z[i].x, &R[i], cp->elem_len_bin);
+    point_release(&Z[i]);
+  }
+}
+
+/* ECIES_encryption_table() for n recipients, the 64 byte key for qt[i]
+   goes to key + 64 i                                                       */
+void ECIES_encryption_batch(char *key, struct affine_point *R,
+			    const struct point_table *const *qt, int n,
+			    const struct curve_params *cp)
+{
+  int i;
+  for(i = 0; i < n; i += ECIES_BATCH)
+    ECIES_encryption_chunk(key + 64 * i, R + i, qt + i,
+			   n - i < ECIES_BATCH ? n - i : ECIES_BATCH, cp);
+}
+
+/* The ephemeral half of ECIES_encryption(), it depends on neither the
+   message nor the recipient and can be computed ahead of time */
+gcry_mpi_t ECIES_ephemeral(struct affine_point *R, const struct curve_params *cp)
+{
+  gcry_mpi_t k = get_random_exponent(cp);
+  *R = pointmul_base(k, &cp->dp);
+  return k;
+}
+
+/* ECIES_encryption_table() with an ephemeral key from ECIES_ephemeral(),
+   returns 0 if it does not work out for this recipient */
+int ECIES_encryption_ephemeral(char *key, const gcry_mpi_t k, 
+			       const struct affine_point *R,
+			       const struct point_table *qt,
+			       const struct curve_params *cp)
+{
+  struct affine_point Z;
+  gcry_mpi_t h;
+  int res;
+  h = gcry_mpi_snew(0);
+  gcry_mpi_mul_ui(h, k, cp->dp.cofactor);
+  Z = pointmul_table(qt, h, &cp->dp);
+  gcry_mpi_release(h);
+  if ((res = ! point_is_zero(&Z)))
+    ECIES_KDF(key, Z.x, R, cp->elem_len_bin);
+  point_release(&Z);
+  return res;
+}
+
 int ECIES_decryption(char *key, const struct affine_point *R,
 		     const gcry_mpi_t d, const struct curve_params *cp)
 {
@@ -349,7 +554,7 @@ gcry_mpi_t DH_step1(struct affine_point *A, const struct curve_params *cp)
 {
   gcry_mpi_t a;
   a = get_random_exponent(cp);
-  *A = pointmul(&cp->dp.base, a, &cp->dp);
+  *A = pointmul_base(a, &cp->dp);
   return a;
 }
 
@@ -364,3 +569,16 @@ int DH_step2(char *key, const struct affine_point *B, const gcry_mpi_t exp,
   point_release(&P);
   return 1;
 }
+
+/* DH_step2() against a peer key that is used over and over again          */
+int DH_step2_table(char *key, const struct point_table *qt, 
+		   const gcry_mpi_t exp, const struct curve_params *cp)
+{
+  struct affine_point P;
+  if (! full_key_validation(&qt->p, &cp->dp))
+    return 0;
+  P = pointmul_table(qt, exp, &cp->dp);
+  DH_KDF(key, &P, cp->elem_len_bin);
+  point_release(&P);
+  return 1;
+}
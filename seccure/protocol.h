@@ -61,14 +61,32 @@ gcry_mpi_t ECDSA_sign(const char *msg, const gcry_mpi_t d,
 		      const struct curve_params *cp);
 int ECDSA_verify(const char *msg, const struct affine_point *Q, 
 		 const gcry_mpi_t sig, const struct curve_params *cp);
+int ECDSA_verify_table(const char *msg, const struct point_table *qt,
+		       const gcry_mpi_t sig, const struct curve_params *cp);
+int ECDSA_verify_batch(int *res, const char *msgs,
+		       const struct point_table *const *Q, const gcry_mpi_t *sig,
+		       int n, const struct curve_params *cp);
 
 struct affine_point ECIES_encryption(char *key, const struct affine_point *Q, 
 				     const struct curve_params *cp);
+struct affine_point ECIES_encryption_table(char *key, 
+					   const struct point_table *qt,
+					   const struct curve_params *cp);
+void ECIES_encryption_batch(char *key, struct affine_point *R,
+			    const struct point_table *const *qt, int n,
+			    const struct curve_params *cp);
+gcry_mpi_t ECIES_ephemeral(struct affine_point *R, const struct curve_params *cp);
+int ECIES_encryption_ephemeral(char *key, const gcry_mpi_t k, 
+			       const struct affine_point *R,
+			       const struct point_table *qt,
+			       const struct curve_params *cp);
 int ECIES_decryption(char *key, const struct affine_point *R, 
 		     const gcry_mpi_t d, const struct curve_params *cp);
 
 gcry_mpi_t DH_step1(struct affine_point *A, const struct curve_params *cp);
 int DH_step2(char *key, const struct affine_point *B, const gcry_mpi_t exp, 
 	     const struct curve_params *cp);
+int DH_step2_table(char *key, const struct point_table *qt, 
+		   const gcry_mpi_t exp, const struct curve_params *cp);
 
 #endif /* INC_PROTOCOL_H */
@@ -45,7 +45,10 @@
 #include <assert.h>
 #include <termios.h>
 #include <getopt.h>
+#include <poll.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include <gcrypt.h>
 
 #include "curves.h"
@@ -59,6 +62,13 @@
 
 #define COPYBUF_SIZE (1 << 20)
 
+/* Room for the keys of SEGMENT_THREADS_MAX segment workers, about 3K each */
+#define SECMEM_SIZE (64 << 10)
+
+#define SEGMENT_SIZE COPYBUF_SIZE
+#define SEGMENT_THREADS_MAX 16
+#define SEGMENTS_PER_THREAD 2
+
 int opt_help = 0;
 int opt_verbose = 0;
 int opt_quiet = 0;
@@ -67,6 +77,9 @@ int opt_sigbin = 0;
 int opt_sigappend = 0;
 int opt_maclen = -1;
 int opt_dblprompt = 0;
+int opt_segmented = 0;
+int opt_batch = 0;
+int opt_threads = 0;
 char *opt_infile = NULL;
 char *opt_outfile = NULL;
 char *opt_curve = NULL;
@@ -165,11 +178,72 @@ int read_block(int fd, char *buf, int len)
   return 1;
 }
 
+/* Regular files are mapped instead of read() through the copy buffer, the
+   loops then work straight off the mapping and find the tail at its end */
+struct mapping {
+  char *base;
+  size_t len;
+  char *data;
+  size_t datalen;
+};
+
+int map_input(int fd, struct mapping *m)
+{
+  long page = sysconf(_SC_PAGESIZE);
+  struct stat st;
+  off_t pos, start;
+
+  if (fstat(fd, &st) || ! S_ISREG(st.st_mode) || page <= 0)
+    return 0;
+  if ((pos = lseek(fd, 0, SEEK_CUR)) < 0 || pos >= st.st_size)
+    return 0;
+  start = pos - pos % page;
+  if ((unsigned long long)(st.st_size - start) > (size_t)(-1))
+    return 0;
+  m->len = st.st_size - start;
+  m->base = mmap(NULL, m->len, PROT_READ, MAP_PRIVATE, fd, start);
+  if (m->base == MAP_FAILED)
+    return 0;
+  madvise(m->base, m->len, MADV_SEQUENTIAL);
+  m->data = m->base + (pos - start);
+  m->datalen = st.st_size - pos;
+  return 1;
+}
+
+/* Leaves fd at EOF, as the read() loops do */
+void unmap_input(int fd, struct mapping *m)
+{
+  munmap(m->base, m->len);
+  lseek(fd, 0, SEEK_END);
+}
+
+void mapped_crypt_loop(int fdout, struct aes256ctr *ac, gcry_md_hd_t *mh_pre, 
+		       gcry_md_hd_t *mh_post, const char *in, size_t len)
+{
+  char buf[COPYBUF_SIZE];
+  size_t c;
+  for(; len; in += c, len -= c) {
+    c = len < COPYBUF_SIZE ? len : COPYBUF_SIZE;
+    if (mh_pre)
+      gcry_md_write(*mh_pre, in, c);
+    aes256ctr_crypt(ac, buf, in, c);
+    if (mh_post)
+      gcry_md_write(*mh_post, buf, c);
+    write_block(fdout, buf, c);
+  }
+}
+
 void encryption_loop(int fdin, int fdout, struct aes256ctr *ac,
 		     gcry_md_hd_t *mh_pre, gcry_md_hd_t *mh_post)
 {
   char buf[COPYBUF_SIZE];
+  struct mapping m;
   ssize_t c;
+  if (map_input(fdin, &m)) {
+    mapped_crypt_loop(fdout, ac, mh_pre, mh_post, m.data, m.datalen);
+    unmap_input(fdin, &m);
+    return;
+  }
   while ((c = read(fdin, buf, COPYBUF_SIZE)) > 0) {
     if (mh_pre)
       gcry_md_write(*mh_pre, buf, c);
@@ -187,7 +261,16 @@ void decryption_loop(int fdin, int fdout, struct aes256ctr *ac,
 		     char *tail, int taillen)
 {
   char buf[COPYBUF_SIZE];
+  struct mapping m;
   ssize_t c;
+  if (map_input(fdin, &m)) {
+    if (m.datalen < taillen)
+      fatal("Input too short");
+    mapped_crypt_loop(fdout, ac, mh_pre, mh_post, m.data, m.datalen - taillen);
+    memcpy(tail, m.data + m.datalen - taillen, taillen);
+    unmap_input(fdin, &m);
+    return;
+  }
   if (! read_block(fdin, buf, taillen))
     fatal("Input too short");
   while ((c = read(fdin, buf + taillen, COPYBUF_SIZE - taillen)) > 0) {
@@ -208,7 +291,22 @@ void verisign_loop(int fdin, int fdout, gcry_md_hd_t *mh,
 		   char *tail, int taillen, int copyflag)
 {
   char buf[COPYBUF_SIZE];
+  struct mapping m;
   ssize_t c;
+  if (map_input(fdin, &m)) {
+    size_t len, off;
+    if (m.datalen < taillen)
+      fatal("Input too short");
+    len = m.datalen - taillen;
+    gcry_md_write(*mh, m.data, len);
+    for(off = 0; copyflag && off < len; off += c) {
+      c = len - off < COPYBUF_SIZE ? len - off : COPYBUF_SIZE;
+      write_block(fdout, m.data + off, c);
+    }
+    memcpy(tail, m.data + len, taillen);
+    unmap_input(fdin, &m);
+    return;
+  }
   if (! read_block(fdin, buf, taillen))
     fatal("Input too short");
   while((c = read(fdin, buf + taillen, COPYBUF_SIZE - taillen)) > 0) {
@@ -224,6 +322,261 @@ void verisign_loop(int fdin, int fdout, gcry_md_hd_t *mh,
 
 /******************************************************************************/
 
+/* The segmented (-x) format, described in aes256ctr.h, is shared with
+   ecc_encrypt_segments_init() and friends of the library */
+
+struct segment_job {
+  char *buf;
+  int seglen, maclen;
+  unsigned long long first;
+  int count, lastlen;
+  int decrypt;
+  char *bad;
+  int next;
+};
+
+struct segment_worker {
+  struct aes256ctr *ac;
+  gcry_md_hd_t mh;
+  struct segment_job *job;
+  pthread_t thread;
+};
+
+int read_full(int fd, char *buf, int len)
+{
+  ssize_t c;
+  int done = 0;
+  while(done < len) {
+    if ((c = read(fd, buf + done, len - done)) < 0)
+      fatal_errno("Read error", errno);
+    if (c == 0)
+      break;
+    done += c;
+  }
+  return done;
+}
+
+void *segment_thread(void *arg)
+{
+  struct segment_worker *w = arg;
+  struct segment_job *job = w->job;
+  int s;
+
+  while ((s = __sync_fetch_and_add(&job->next, 1)) < job->count) {
+    char *seg = job->buf + (size_t)s * (job->seglen + job->maclen);
+    int len = (s == job->count - 1) ? job->lastlen : job->seglen;
+    unsigned long long idx = job->first + s;
+
+    if (job->decrypt) {
+      hmacsha256_segment(w->mh, SEGMENT_TAG, job->seglen, idx, seg, len);
+      if ((job->bad[s] = !! memcmp(gcry_md_read(w->mh, 0), seg + len, job->maclen)))
+	continue;
+    }
+    aes256ctr_seek(w->ac, idx * job->seglen);
+    aes256ctr_enc(w->ac, seg, len);
+    if (! job->decrypt) {
+      hmacsha256_segment(w->mh, SEGMENT_TAG, job->seglen, idx, seg, len);
+      memcpy(seg + len, gcry_md_read(w->mh, 0), job->maclen);
+    }
+  }
+  return NULL;
+}
+
+int segment_threads(void)
+{
+  long n = opt_threads;
+  if (n <= 0)
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1)
+    n = 1;
+  if (n > SEGMENT_THREADS_MAX)
+    n = SEGMENT_THREADS_MAX;
+  return n;
+}
+
+/* Settles for fewer workers if secure memory runs out */
+struct segment_worker *segment_workers_init(const char *keybuf, int *threads)
+{
+  struct segment_worker *w;
+  int i;
+
+  if (! (w = malloc(*threads * sizeof(struct segment_worker))))
+    fatal("Out of memory");
+  for(i = 0; i < *threads; i++) {
+    if (! (w[i].ac = aes256ctr_init(keybuf)))
+      break;
+    if (! hmacsha256_init(&w[i].mh, keybuf + 32, HMAC_KEY_SIZE)) {
+      aes256ctr_done(w[i].ac);
+      break;
+    }
+  }
+  if (! i)
+    fatal("Cannot initialize AES256-CTR and HMAC-SHA256");
+  if (i < *threads) {
+    fprintf(stderr, "Out of secure memory, using %d threads.\n", i);
+    *threads = i;
+  }
+  return w;
+}
+
+void segment_workers_done(struct segment_worker *w, int threads)
+{
+  int i;
+  for(i = 0; i < threads; i++) {
+    aes256ctr_done(w[i].ac);
+    gcry_md_close(w[i].mh);
+  }
+  free(w);
+}
+
+/* The calling thread is worker 0 */
+void segment_run(struct segment_worker *w, int threads, struct segment_job *job)
+{
+  int i, err;
+
+  if (threads > job->count)
+    threads = job->count;
+  job->next = 0;
+  for(i = 0; i < threads; i++)
+    w[i].job = job;
+  for(i = 1; i < threads; i++)
+    if ((err = pthread_create(&w[i].thread, NULL, segment_thread, &w[i])))
+      fatal_errno("Cannot start worker thread", err);
+  if (threads)
+    segment_thread(&w[0]);
+  for(i = 1; i < threads; i++)
+    pthread_join(w[i].thread, NULL);
+}
+
+void segment_encryption_loop(int fdin, int fdout, const char *keybuf, 
+			     int maclen)
+{
+  int threads = segment_threads(), batch = threads * SEGMENTS_PER_THREAD;
+  int stride = SEGMENT_SIZE + maclen, eof = 0, c, i;
+  struct segment_worker *w = segment_workers_init(keybuf, &threads);
+  unsigned char hdr[SEGMENT_HEADER_LEN];
+  struct segment_job job;
+
+  for(i = 0; i < SEGMENT_HEADER_LEN; i++)
+    hdr[i] = SEGMENT_SIZE >> (8 * (SEGMENT_HEADER_LEN - 1 - i));
+  write_block(fdout, (char *)hdr, SEGMENT_HEADER_LEN);
+
+  memset(&job, 0, sizeof(job));
+  if (! (job.buf = malloc((size_t)batch * stride)))
+    fatal("Out of memory");
+  job.seglen = SEGMENT_SIZE;
+  job.maclen = maclen;
+
+  while (! eof) {
+    job.count = 0;
+    job.lastlen = SEGMENT_SIZE;
+    while (job.count < batch && ! eof) {
+      c = read_full(fdin, job.buf + (size_t)job.count * stride, SEGMENT_SIZE);
+      if (c < SEGMENT_SIZE)
+	eof = 1;
+      if (c) {
+	job.lastlen = c;
+	job.count++;
+      }
+    }
+    segment_run(w, threads, &job);
+    if (job.count)
+      write_block(fdout, job.buf, (job.count - 1) * stride + job.lastlen + maclen);
+    job.first += job.count;
+  }
+
+  hmacsha256_segment(w[0].mh, SEGMENT_END_TAG, SEGMENT_SIZE, job.first, NULL, 0);
+  write_block(fdout, (char *)gcry_md_read(w[0].mh, 0), maclen);
+
+  free(job.buf);
+  segment_workers_done(w, threads);
+}
+
+/* Returns 1 if all of the segments and the final tag check out, the
+   plaintext of the segments before a forged one has been written by then */
+int segment_decryption_loop(int fdin, int fdout, const char *keybuf, 
+			    int maclen)
+{
+  int threads = segment_threads(), batch = threads * SEGMENTS_PER_THREAD;
+  unsigned char hdr[SEGMENT_HEADER_LEN];
+  struct segment_worker *w;
+  struct segment_job job;
+  int stride, size, have, body, res = 0, i;
+  unsigned int seglen = 0;
+
+  if (! read_block(fdin, (char *)hdr, SEGMENT_HEADER_LEN)) {
+    print_quiet("Abort: Inconsistent header (too short).\n", 1);
+    return 0;
+  }
+  for(i = 0; i < SEGMENT_HEADER_LEN; i++)
+    seglen = (seglen << 8) | hdr[i];
+  if (! seglen || seglen > SEGMENT_SIZE_MAX || seglen % CIPHER_BLOCK_SIZE) {
+    print_quiet("Abort: Inconsistent header.\n", 1);
+    return 0;
+  }
+  memset(&job, 0, sizeof(job));
+  job.seglen = seglen;
+  job.maclen = maclen;
+  job.decrypt = 1;
+  stride = job.seglen + maclen;
+  size = batch * stride + maclen;
+  if (! (job.buf = malloc(size)) || ! (job.bad = malloc(batch)))
+    fatal("Out of memory");
+  w = segment_workers_init(keybuf, &threads);
+
+  for(have = 0;;) {
+    int c = read_full(fdin, job.buf + have, size - have);
+    have += c;
+
+    /* The last maclen bytes might be the final tag, keep them around
+       until the input is known to go on */
+    if (have == size) {
+      job.count = batch;
+      job.lastlen = job.seglen;
+    }
+    else {
+      if ((body = have - maclen) < 0)
+	break;
+      job.count = (body + stride - 1) / stride;
+      job.lastlen = body - (job.count - 1) * stride - maclen;
+      if (job.count && job.lastlen <= 0)
+	break;
+    }
+
+    segment_run(w, threads, &job);
+    for(i = 0; i < job.count && ! job.bad[i]; i++)
+      write_block(fdout, job.buf + (size_t)i * stride, 
+		  i == job.count - 1 ? job.lastlen : job.seglen);
+    job.first += i;
+    if (i < job.count)
+      break;
+
+    if (have < size) {
+      hmacsha256_segment(w[0].mh, SEGMENT_END_TAG, job.seglen, job.first, NULL, 0);
+      res = ! memcmp(gcry_md_read(w[0].mh, 0), job.buf + have - maclen, maclen);
+      break;
+    }
+    memmove(job.buf, job.buf + have - maclen, maclen);
+    have = maclen;
+  }
+
+  if (opt_verbose) {
+    print_quiet("SEGMENTS: ", 0);
+    fprintf(stderr, "%llu of %d bytes\n", job.first, job.seglen);
+  }
+  if (res)
+    print_quiet("Integrity check successful, message unforged!\n", 0);
+  else
+    print_quiet("Integrity check failed, message forged!\n", 1);
+
+  free(job.buf);
+  free(job.bad);
+  segment_workers_done(w, threads);
+  return res;
+}
+
+/******************************************************************************/
+
 void do_read_passphrase(char *hash, const struct termios *err_tios)
 {
   gcry_error_t err;
@@ -328,7 +681,7 @@ void app_print_public_key(void)
 		read_passphrase(privkey, "private key");
 		d = hash_to_exponent(privkey, cp);
 		gcry_free(privkey);
-		P = pointmul(&cp->dp.base, d, &cp->dp);
+		P = pointmul_base(d, &cp->dp);
 		gcry_mpi_release(d);
 
 		compress_to_string(pubkey, DF_COMPACT, &P, cp);
@@ -352,6 +705,8 @@ void app_encrypt(const char *pubkey)
 		opt_maclen = DEFAULT_MAC_LEN;
 		fprintf(stderr, "Assuming MAC length of %d bits.\n", 8 * DEFAULT_MAC_LEN);
 	}
+	if (opt_segmented && ! opt_maclen)
+		fatal("The segmented format needs a MAC");
 
 	if (opt_curve) {
 		if (! (cp = curve_by_name(opt_curve)))
@@ -398,34 +753,44 @@ void app_encrypt(const char *pubkey)
 			fprintf(stderr, "\n");
 		}
 
-		if (! (ac = aes256ctr_init(keybuf)))
-			fatal("Cannot initialize AES256-CTR");
-		if (opt_maclen && ! hmacsha256_init(&mh, keybuf + 32, HMAC_KEY_SIZE))
-			fatal("Cannot initialize HMAC-SHA256");
-		gcry_free(keybuf);
-
-		if (isatty(opt_fdin))
-			print_quiet("Go ahead and type your message ...\n", 0);
+		if (opt_segmented) {
+			if (isatty(opt_fdin))
+				print_quiet("Go ahead and type your message ...\n", 0);
 
-		write_block(opt_fdout, rbuf, cp->pk_len_bin);
-		encryption_loop(opt_fdin, opt_fdout, ac, NULL, opt_maclen ? &mh : NULL);
-
-		aes256ctr_done(ac);
-
-		if (opt_maclen) {
-			gcry_md_final(mh);
-			md = (char*)gcry_md_read(mh, 0);
+			write_block(opt_fdout, rbuf, cp->pk_len_bin);
+			segment_encryption_loop(opt_fdin, opt_fdout, keybuf, opt_maclen);
+			gcry_free(keybuf);
+		}
+		else {
+			if (! (ac = aes256ctr_init(keybuf)))
+				fatal("Cannot initialize AES256-CTR");
+			if (opt_maclen && ! hmacsha256_init(&mh, keybuf + 32, HMAC_KEY_SIZE))
+				fatal("Cannot initialize HMAC-SHA256");
+			gcry_free(keybuf);
+
+			if (isatty(opt_fdin))
+				print_quiet("Go ahead and type your message ...\n", 0);
+
+			write_block(opt_fdout, rbuf, cp->pk_len_bin);
+			encryption_loop(opt_fdin, opt_fdout, ac, NULL, opt_maclen ? &mh : NULL);
+
+			aes256ctr_done(ac);
+
+			if (opt_maclen) {
+				gcry_md_final(mh);
+				md = (char*)gcry_md_read(mh, 0);
+
+				if (opt_verbose) {
+					int i;
+					print_quiet("HMAC: ", 0); 
+					for(i = 0; i < opt_maclen; i++)
+						fprintf(stderr, "%02x", (unsigned char)md[i]);
+					fprintf(stderr, "\n");
+				}
 
-			if (opt_verbose) {
-				int i;
-				print_quiet("HMAC: ", 0); 
-				for(i = 0; i < opt_maclen; i++)
-					fprintf(stderr, "%02x", (unsigned char)md[i]);
-				fprintf(stderr, "\n");
+				write_block(opt_fdout, md, opt_maclen);
+				gcry_md_close(mh);
 			}
-
-			write_block(opt_fdout, md, opt_maclen);
-			gcry_md_close(mh);
 		}
 	}
 	else
@@ -443,6 +808,8 @@ int app_decrypt(void)
 		opt_maclen = DEFAULT_MAC_LEN;
 		fprintf(stderr, "Assuming MAC length of %d bits.\n", 8 * DEFAULT_MAC_LEN);
 	}
+	if (opt_segmented && ! opt_maclen)
+		fatal("The segmented format needs a MAC");
 
 	if (! opt_curve) {
 		opt_curve = DEFAULT_CURVE;
@@ -493,44 +860,51 @@ int app_decrypt(void)
 						fprintf(stderr, "\n");
 					}
 
-					if (! (ac = aes256ctr_init(keybuf)))
-						fatal("Cannot initialize AES256-CTR");
-					if (opt_maclen && ! hmacsha256_init(&mh, keybuf + 32, HMAC_KEY_SIZE))
-						fatal("Cannot initialize HMAC-SHA256");
-					memset(keybuf, 0x00, 64);
-
-					decryption_loop(opt_fdin, opt_fdout, ac, opt_maclen ? &mh : NULL, 
-								NULL, mdbuf, opt_maclen);
-
-					aes256ctr_done(ac);
-
-					if (opt_maclen) {
-						gcry_md_final(mh);
-						md = (char*)gcry_md_read(mh, 0);
-
-						if (opt_verbose) {
-							int i;
-							print_quiet("HMAC1: ", 0); 
-							for(i = 0; i < opt_maclen; i++)
-								fprintf(stderr, "%02x", (unsigned char)md[i]);
-							fprintf(stderr, "\n");
-							print_quiet("HMAC2: ", 0); 
-							for(i = 0; i < opt_maclen; i++)
-								fprintf(stderr, "%02x", (unsigned char)mdbuf[i]);
-							fprintf(stderr, "\n");
-						}
-
-						if ((res = ! memcmp(mdbuf, md, opt_maclen)))
-							print_quiet("Integrity check successful, message unforged!\n", 0);
-						else
-							print_quiet("Integrity check failed, message forged!\n", 1);
-
-						gcry_md_close(mh);
+					if (opt_segmented) {
+						res = segment_decryption_loop(opt_fdin, opt_fdout, keybuf, 
+									      opt_maclen);
+						memset(keybuf, 0x00, 64);
 					}
 					else {
-						res = 1;
-						print_quiet("Warning: No MAC available, message integrity cannot "
-								"be verified!\n", 0);
+						if (! (ac = aes256ctr_init(keybuf)))
+							fatal("Cannot initialize AES256-CTR");
+						if (opt_maclen && ! hmacsha256_init(&mh, keybuf + 32, HMAC_KEY_SIZE))
+							fatal("Cannot initialize HMAC-SHA256");
+						memset(keybuf, 0x00, 64);
+
+						decryption_loop(opt_fdin, opt_fdout, ac, opt_maclen ? &mh : NULL, 
+									NULL, mdbuf, opt_maclen);
+
+						aes256ctr_done(ac);
+
+						if (opt_maclen) {
+							gcry_md_final(mh);
+							md = (char*)gcry_md_read(mh, 0);
+
+							if (opt_verbose) {
+								int i;
+								print_quiet("HMAC1: ", 0); 
+								for(i = 0; i < opt_maclen; i++)
+									fprintf(stderr, "%02x", (unsigned char)md[i]);
+								fprintf(stderr, "\n");
+								print_quiet("HMAC2: ", 0); 
+								for(i = 0; i < opt_maclen; i++)
+									fprintf(stderr, "%02x", (unsigned char)mdbuf[i]);
+								fprintf(stderr, "\n");
+							}
+
+							if ((res = ! memcmp(mdbuf, md, opt_maclen)))
+								print_quiet("Integrity check successful, message unforged!\n", 0);
+							else
+								print_quiet("Integrity check failed, message forged!\n", 1);
+
+							gcry_md_close(mh);
+						}
+						else {
+							res = 1;
+							print_quiet("Warning: No MAC available, message integrity cannot "
+									"be verified!\n", 0);
+						}
 					}
 				}
 				else
@@ -756,13 +1130,13 @@ int app_verify(const char *pubkey, const char *sig)
 				goto error;
 			}
 			else
-				if (! deserialize_mpi(&s, DF_COMPACT, sig, cp->sig_len_compact)) {
+				if (! deserialize_mpi_public(&s, DF_COMPACT, sig, cp->sig_len_compact)) {
 					print_quiet("Invalid signature (inconsistent structure)!\n", 1);
 					goto error; 
 				}
 		}
 		else
-			assert(deserialize_mpi(&s, DF_BIN, sigbuf.bin, cp->sig_len_bin));
+			assert(deserialize_mpi_public(&s, DF_BIN, sigbuf.bin, cp->sig_len_bin));
 
 		if ((res = ECDSA_verify(md, &Q, s, cp)))
 			print_quiet("Signature successfully verified!\n", 0);
@@ -1110,6 +1484,577 @@ void app_dh(void)
 
 /******************************************************************************/
 
+/* Batch (-B) mode: a single process works through a stream of requests,
+   one per input line, with the key, the curve and the worker threads set
+   up only once.  A request is the name of the file to work on, followed
+   by a tab and the output file (encrypt, decrypt) or the signature
+   (verify).  Every request gets one line on the output, in the order of
+   the requests, as soon as the requests already read are done:
+
+     ok TAB infile [TAB signature]
+     failed TAB infile TAB reason
+
+   The files are in the plain (non-segmented) format.  Decryption checks
+   the MAC before it creates the output file, forged messages leave
+   nothing behind */
+
+#define BATCH_ITEMS_PER_THREAD 16
+#define BATCH_REASON_LEN 128
+
+enum batch_op { BATCH_ENCRYPT, BATCH_DECRYPT, BATCH_SIGN, BATCH_VERIFY };
+
+struct batch_item {
+  char *line, *infile, *arg;
+  const char *err;
+  int errnum;
+  char *sig;
+};
+
+struct batch_job {
+  enum batch_op op;
+  const struct curve_params *cp;
+  const struct point_table *qt;
+  gcry_mpi_t d;
+  struct batch_item *items;
+  int count, next;
+};
+
+struct batch_worker {
+  struct batch_job *job;
+  char *buf;
+  pthread_t thread;
+};
+
+struct batch_reader {
+  int fd, eof;
+  char *buf;
+  size_t start, end, size;
+};
+
+/* Returns the next line without its line break as a malloc()ed string, or
+   NULL at the end of the input.  Unless wait is set it also returns NULL
+   when it would have to block for the rest of a line */
+char *batch_getline(struct batch_reader *r, int wait)
+{
+  struct pollfd pfd;
+  char *nl, *line;
+  size_t len;
+  ssize_t c;
+
+  for(;;) {
+    nl = memchr(r->buf + r->start, '\n', r->end - r->start);
+    if (nl || (r->eof && r->start < r->end)) {
+      len = (nl ? nl : r->buf + r->end) - (r->buf + r->start);
+      if (! (line = malloc(len + 1)))
+	fatal("Out of memory");
+      memcpy(line, r->buf + r->start, len);
+      line[len] = 0;
+      line[strcspn(line, "\r")] = 0;
+      r->start += nl ? len + 1 : len;
+      return line;
+    }
+    if (r->eof)
+      return NULL;
+    if (! wait) {
+      pfd.fd = r->fd;
+      pfd.events = POLLIN;
+      if (poll(&pfd, 1, 0) <= 0)
+	return NULL;
+    }
+    if (r->start) {
+      memmove(r->buf, r->buf + r->start, r->end - r->start);
+      r->end -= r->start;
+      r->start = 0;
+    }
+    if (r->end == r->size) {
+      r->size = r->size ? 2 * r->size : 4096;
+      if (! (r->buf = realloc(r->buf, r->size)))
+	fatal("Out of memory");
+    }
+    if ((c = read(r->fd, r->buf + r->end, r->size - r->end)) < 0)
+      fatal_errno("Read error", errno);
+    if (c == 0)
+      r->eof = 1;
+    r->end += c;
+  }
+}
+
+void batch_fail(struct batch_item *it, const char *msg, int err)
+{
+  it->err = msg;
+  it->errnum = err;
+}
+
+/* Maps the file, or reads it whole where that is not possible; returns 0
+   or an errno value */
+int batch_load(const char *path, struct mapping *m, char **buf, 
+	       const char **data, size_t *len)
+{
+  size_t size = 0, cap = 0;
+  ssize_t c;
+  int fd, err;
+  char *p;
+
+  m->base = NULL;
+  *buf = NULL;
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return errno;
+  if (map_input(fd, m)) {
+    close(fd);
+    *data = m->data;
+    *len = m->datalen;
+    return 0;
+  }
+  m->base = NULL;
+  for(;;) {
+    if (size == cap) {
+      cap = cap ? 2 * cap : COPYBUF_SIZE;
+      if (! (p = realloc(*buf, cap))) {
+	err = ENOMEM;
+	goto fail;
+      }
+      *buf = p;
+    }
+    if ((c = read(fd, *buf + size, cap - size)) < 0) {
+      err = errno;
+      goto fail;
+    }
+    if (c == 0)
+      break;
+    size += c;
+  }
+  close(fd);
+  *data = *buf;
+  *len = size;
+  return 0;
+
+ fail:
+  free(*buf);
+  *buf = NULL;
+  close(fd);
+  return err;
+}
+
+void batch_unload(struct mapping *m, char *buf)
+{
+  if (m->base)
+    munmap(m->base, m->len);
+  free(buf);
+}
+
+int batch_write(int fd, const char *buf, size_t len)
+{
+  ssize_t c;
+  for(; len; buf += c, len -= c)
+    if ((c = write(fd, buf, len)) < 0)
+      return 0;
+  return 1;
+}
+
+/* Runs the body through the cipher and, if mh is given, the MAC that comes
+   before (decryption) or after it (encryption) into fd */
+int batch_crypt(int fd, struct aes256ctr *ac, gcry_md_hd_t *mh, int decrypt,
+		char *buf, const char *in, size_t len)
+{
+  size_t c;
+  for(; len; in += c, len -= c) {
+    c = len < COPYBUF_SIZE ? len : COPYBUF_SIZE;
+    if (mh && decrypt)
+      gcry_md_write(*mh, in, c);
+    aes256ctr_crypt(ac, buf, in, c);
+    if (mh && ! decrypt)
+      gcry_md_write(*mh, buf, c);
+    if (! batch_write(fd, buf, c))
+      return 0;
+  }
+  return 1;
+}
+
+void batch_encrypt(struct batch_worker *w, struct batch_item *it)
+{
+  const struct curve_params *cp = w->job->cp;
+  char rbuf[cp->pk_len_bin], *keybuf, *inbuf;
+  struct aes256ctr *ac;
+  struct affine_point R;
+  struct mapping m;
+  gcry_md_hd_t mh = NULL;
+  const char *in;
+  size_t len;
+  int fd, err;
+
+  if (! it->arg) {
+    batch_fail(it, "No output file", 0);
+    return;
+  }
+  if ((err = batch_load(it->infile, &m, &inbuf, &in, &len))) {
+    batch_fail(it, "Cannot open input file", err);
+    return;
+  }
+  if (! (keybuf = gcry_malloc_secure(64))) {
+    batch_fail(it, "Out of secure memory", 0);
+    goto unload;
+  }
+  R = ECIES_encryption_table(keybuf, w->job->qt, cp);
+  compress_to_string(rbuf, DF_BIN, &R, cp);
+  point_release(&R);
+
+  if (! (ac = aes256ctr_init(keybuf))) {
+    batch_fail(it, "Cannot initialize AES256-CTR", 0);
+    goto free_key;
+  }
+  if (opt_maclen && ! hmacsha256_init(&mh, keybuf + 32, HMAC_KEY_SIZE)) {
+    batch_fail(it, "Cannot initialize HMAC-SHA256", 0);
+    goto free_ac;
+  }
+  if ((fd = open(it->arg, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    batch_fail(it, "Cannot open output file", errno);
+    goto free_mh;
+  }
+  if (! batch_write(fd, rbuf, cp->pk_len_bin) ||
+      ! batch_crypt(fd, ac, opt_maclen ? &mh : NULL, 0, w->buf, in, len))
+    batch_fail(it, "Write error", errno);
+  else if (opt_maclen) {
+    gcry_md_final(mh);
+    if (! batch_write(fd, (char *)gcry_md_read(mh, 0), opt_maclen))
+      batch_fail(it, "Write error", errno);
+  }
+  if (close(fd) && ! it->err)
+    batch_fail(it, "Cannot close output file", errno);
+
+ free_mh:
+  if (opt_maclen)
+    gcry_md_close(mh);
+ free_ac:
+  aes256ctr_done(ac);
+ free_key:
+  gcry_free(keybuf);
+ unload:
+  batch_unload(&m, inbuf);
+}
+
+void batch_decrypt(struct batch_worker *w, struct batch_item *it)
+{
+  const struct curve_params *cp = w->job->cp;
+  char *keybuf, *inbuf;
+  struct aes256ctr *ac;
+  struct affine_point R;
+  struct mapping m;
+  gcry_md_hd_t mh = NULL;
+  const char *in;
+  size_t len;
+  int fd, err;
+
+  if (! it->arg) {
+    batch_fail(it, "No output file", 0);
+    return;
+  }
+  if ((err = batch_load(it->infile, &m, &inbuf, &in, &len))) {
+    batch_fail(it, "Cannot open input file", err);
+    return;
+  }
+  if (len < cp->pk_len_bin + opt_maclen) {
+    batch_fail(it, "Inconsistent header (too short)", 0);
+    goto unload;
+  }
+  if (! decompress_from_string(&R, in, DF_BIN, cp)) {
+    batch_fail(it, "Inconsistent header", 0);
+    goto unload;
+  }
+  if (! (keybuf = gcry_malloc_secure(64))) {
+    batch_fail(it, "Out of secure memory", 0);
+    goto free_R;
+  }
+  if (! ECIES_decryption(keybuf, &R, w->job->d, cp)) {
+    batch_fail(it, "Inconsistent header", 0);
+    goto free_key;
+  }
+  in += cp->pk_len_bin;
+  len -= cp->pk_len_bin + opt_maclen;
+
+  if (opt_maclen) {
+    if (! hmacsha256_init(&mh, keybuf + 32, HMAC_KEY_SIZE)) {
+      batch_fail(it, "Cannot initialize HMAC-SHA256", 0);
+      goto free_key;
+    }
+    gcry_md_write(mh, in, len);
+    gcry_md_final(mh);
+    err = memcmp(gcry_md_read(mh, 0), in + len, opt_maclen);
+    gcry_md_close(mh);
+    if (err) {
+      batch_fail(it, "Integrity check failed, message forged", 0);
+      goto free_key;
+    }
+  }
+  if (! (ac = aes256ctr_init(keybuf))) {
+    batch_fail(it, "Cannot initialize AES256-CTR", 0);
+    goto free_key;
+  }
+  if ((fd = open(it->arg, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+    batch_fail(it, "Cannot open output file", errno);
+  else {
+    if (! batch_crypt(fd, ac, NULL, 1, w->buf, in, len))
+      batch_fail(it, "Write error", errno);
+    if (close(fd) && ! it->err)
+      batch_fail(it, "Cannot close output file", errno);
+  }
+  aes256ctr_done(ac);
+
+ free_key:
+  gcry_free(keybuf);
+ free_R:
+  point_release(&R);
+ unload:
+  batch_unload(&m, inbuf);
+}
+
+void batch_sign(struct batch_worker *w, struct batch_item *it)
+{
+  const struct curve_params *cp = w->job->cp;
+  char md[64], *inbuf;
+  struct mapping m;
+  const char *in;
+  gcry_mpi_t sig;
+  size_t len;
+  int err;
+
+  if ((err = batch_load(it->infile, &m, &inbuf, &in, &len))) {
+    batch_fail(it, "Cannot open input file", err);
+    return;
+  }
+  gcry_md_hash_buffer(GCRY_MD_SHA512, md, in, len);
+  batch_unload(&m, inbuf);
+
+  if (! (it->sig = malloc(cp->sig_len_compact + 1))) {
+    batch_fail(it, "Out of memory", 0);
+    return;
+  }
+  sig = ECDSA_sign(md, w->job->d, cp);
+  serialize_mpi(it->sig, cp->sig_len_compact, DF_COMPACT, sig);
+  it->sig[cp->sig_len_compact] = 0;
+  gcry_mpi_release(sig);
+}
+
+void batch_verify(struct batch_worker *w, struct batch_item *it)
+{
+  const struct curve_params *cp = w->job->cp;
+  char md[64], *inbuf;
+  struct mapping m;
+  const char *in;
+  gcry_mpi_t s;
+  size_t len;
+  int err;
+
+  if (! it->arg) {
+    batch_fail(it, "No signature", 0);
+    return;
+  }
+  if (strlen(it->arg) != cp->sig_len_compact) {
+    batch_fail(it, "Invalid signature (wrong length)", 0);
+    return;
+  }
+  if (! deserialize_mpi_public(&s, DF_COMPACT, it->arg, cp->sig_len_compact)) {
+    batch_fail(it, "Invalid signature (inconsistent structure)", 0);
+    return;
+  }
+  if ((err = batch_load(it->infile, &m, &inbuf, &in, &len)))
+    batch_fail(it, "Cannot open input file", err);
+  else {
+    gcry_md_hash_buffer(GCRY_MD_SHA512, md, in, len);
+    batch_unload(&m, inbuf);
+    if (! ECDSA_verify_table(md, w->job->qt, s, cp))
+      batch_fail(it, "Invalid signature, message forged", 0);
+  }
+  gcry_mpi_release(s);
+}
+
+void *batch_thread(void *arg)
+{
+  struct batch_worker *w = arg;
+  struct batch_job *job = w->job;
+  int i;
+
+  while ((i = __sync_fetch_and_add(&job->next, 1)) < job->count)
+    switch(job->op) {
+    case BATCH_ENCRYPT: batch_encrypt(w, &job->items[i]); break;
+    case BATCH_DECRYPT: batch_decrypt(w, &job->items[i]); break;
+    case BATCH_SIGN: batch_sign(w, &job->items[i]); break;
+    case BATCH_VERIFY: batch_verify(w, &job->items[i]); break;
+    }
+  return NULL;
+}
+
+/* The calling thread is worker 0, as in segment_run() */
+void batch_run(struct batch_worker *w, int threads, struct batch_job *job)
+{
+  int i, err;
+
+  if (threads > job->count)
+    threads = job->count;
+  job->next = 0;
+  for(i = 0; i < threads; i++)
+    w[i].job = job;
+  for(i = 1; i < threads; i++)
+    if ((err = pthread_create(&w[i].thread, NULL, batch_thread, &w[i])))
+      fatal_errno("Cannot start worker thread", err);
+  if (threads)
+    batch_thread(&w[0]);
+  for(i = 1; i < threads; i++)
+    pthread_join(w[i].thread, NULL);
+}
+
+void batch_report(const struct batch_item *it)
+{
+  size_t len = strlen(it->infile) + (it->sig ? strlen(it->sig) : 0);
+  char line[len + BATCH_REASON_LEN + 16];
+  int c;
+
+  if (it->err)
+    c = snprintf(line, sizeof(line), "failed\t%s\t%s%s%s\n", it->infile, 
+		 it->err, it->errnum ? ": " : "", 
+		 it->errnum ? strerror(it->errnum) : "");
+  else
+    c = snprintf(line, sizeof(line), "ok\t%s%s%s\n", it->infile, 
+		 it->sig ? "\t" : "", it->sig ? it->sig : "");
+  if (c >= sizeof(line)) {
+    c = sizeof(line) - 1;
+    line[c - 1] = '\n';
+  }
+  write_block(opt_fdout, line, c);
+}
+
+int app_batch(enum batch_op op, const char *pubkey)
+{
+  struct batch_reader reader;
+  struct batch_worker *w;
+  struct point_table *qt;
+  struct curve_params *cp;
+  struct batch_job job;
+  struct affine_point Q;
+  int threads = segment_threads(), batch = threads * BATCH_ITEMS_PER_THREAD;
+  int total = 0, failed = 0, i;
+  char *privkey, *line;
+
+  if (opt_segmented || opt_sigcopy || opt_sigappend || opt_sigbin || opt_sigfile)
+    fatal("The option -B may not be combined with -x, -f, -a, -b or -s");
+
+  if ((op == BATCH_ENCRYPT || op == BATCH_DECRYPT) && opt_maclen < 0) {
+    opt_maclen = DEFAULT_MAC_LEN;
+    fprintf(stderr, "Assuming MAC length of %d bits.\n", 8 * DEFAULT_MAC_LEN);
+  }
+
+  memset(&job, 0, sizeof(job));
+  job.op = op;
+  qt = NULL;
+  if (pubkey) {
+    if (opt_curve) {
+      if (! (cp = curve_by_name(opt_curve)))
+	fatal("Invalid curve name");
+    }
+    else
+      if (! (cp = curve_by_pk_len_compact(strlen(pubkey))))
+	fatal("Invalid key (wrong length)");
+    if (strlen(pubkey) != cp->pk_len_compact)
+      fatal("Invalid key (wrong length)");
+    if (! decompress_from_string(&Q, pubkey, DF_COMPACT, cp))
+      fatal("Invalid key");
+    if (! (qt = point_table_new(&Q, KEY_WNAF_WIDTH, &cp->dp)))
+      fatal("Out of memory");
+    point_release(&Q);
+  }
+  else {
+    if (! opt_curve) {
+      opt_curve = DEFAULT_CURVE;
+      fprintf(stderr, "Assuming curve " DEFAULT_CURVE ".\n");
+    }
+    if (! (cp = curve_by_name(opt_curve)))
+      fatal("Invalid curve name");
+  }
+
+  if (opt_verbose) {
+    print_quiet("VERSION: ", 0);
+    fprintf(stderr, VERSION "\n"); 
+    print_quiet("CURVE: ", 0); 
+    fprintf(stderr, "%s\n", cp->name); 
+    if (op == BATCH_ENCRYPT || op == BATCH_DECRYPT) {
+      print_quiet("MACLEN: ", 0); 
+      fprintf(stderr, "%d\n", 8 * opt_maclen); 
+    }
+    print_quiet("THREADS: ", 0); 
+    fprintf(stderr, "%d\n", threads);
+  }
+
+  if (! pubkey) {
+    if (! (privkey = gcry_malloc_secure(32)))
+      fatal("Out of secure memory");
+    read_passphrase(privkey, "private key");
+    job.d = hash_to_exponent(privkey, cp);
+    gcry_free(privkey);
+  }
+  job.cp = cp;
+  job.qt = qt;
+
+  if (! (w = malloc(threads * sizeof(struct batch_worker))) ||
+      ! (job.items = malloc(batch * sizeof(struct batch_item))))
+    fatal("Out of memory");
+  for(i = 0; i < threads; i++) {
+    w[i].buf = NULL;
+    if ((op == BATCH_ENCRYPT || op == BATCH_DECRYPT) && 
+	! (w[i].buf = malloc(COPYBUF_SIZE)))
+      fatal("Out of memory");
+  }
+
+  if (isatty(opt_fdin))
+    print_quiet("Go ahead and enter the requests ...\n", 0);
+
+  memset(&reader, 0, sizeof(reader));
+  reader.fd = opt_fdin;
+  while (! reader.eof || reader.start < reader.end) {
+    for(job.count = 0; job.count < batch; ) {
+      if (! (line = batch_getline(&reader, ! job.count)))
+	break;
+      if (! *line) {
+	free(line);
+	continue;
+      }
+      job.items[job.count].line = job.items[job.count].infile = line;
+      if ((job.items[job.count].arg = strchr(line, '\t')))
+	*job.items[job.count].arg++ = 0;
+      job.items[job.count].err = NULL;
+      job.items[job.count].errnum = 0;
+      job.items[job.count].sig = NULL;
+      job.count++;
+    }
+
+    batch_run(w, threads, &job);
+    for(i = 0; i < job.count; i++) {
+      batch_report(&job.items[i]);
+      failed += !! job.items[i].err;
+      free(job.items[i].line);
+      free(job.items[i].sig);
+    }
+    total += job.count;
+  }
+
+  if (opt_verbose) {
+    print_quiet("REQUESTS: ", 0);
+    fprintf(stderr, "%d, %d failed\n", total, failed);
+  }
+
+  for(i = 0; i < threads; i++)
+    free(w[i].buf);
+  free(w);
+  free(job.items);
+  free(reader.buf);
+  if (job.d)
+    gcry_mpi_release(job.d);
+  if (qt)
+    point_table_release(qt);
+  curve_release(cp);
+  return failed != 0;
+}
+
+/******************************************************************************/
+
 int main(int argc, char **argv)
 {
   gcry_error_t err;
@@ -1118,7 +2063,7 @@ int main(int argc, char **argv)
 
   assert(gcry_check_version("1.4.1"));
 
-  err = gcry_control(GCRYCTL_INIT_SECMEM, 1);
+  err = gcry_control(GCRYCTL_INIT_SECMEM, SECMEM_SIZE);
   if (gcry_err_code(err))
     warning_gcrypt("Cannot enable gcrypt's secure memory management", err);
 
@@ -1133,12 +2078,19 @@ int main(int argc, char **argv)
   if ((progname = strrchr(argv[0], '/')) == NULL)
     progname = argv[0];
   
-  while((i = getopt(argc, argv, "fbadm:i:o:F:s:c:hvq")) != -1)
+  while((i = getopt(argc, argv, "fbadxBj:m:i:o:F:s:c:hvq")) != -1)
     switch(i) {
     case 'f': opt_sigcopy = 1; break;
     case 'b': opt_sigbin = 1; break;
     case 'a': opt_sigappend = 1; break;
     case 'd': opt_dblprompt = 1; break;
+    case 'x': opt_segmented = 1; break;
+    case 'B': opt_batch = 1; break;
+    case 'j':
+      opt_threads = atoi(optarg);
+      if (opt_threads < 1)
+	fatal("Invalid number of threads");
+      break;
     case 'm':
       opt_maclen = atoi(optarg); 
       if (opt_maclen < 0 || opt_maclen > 256 || opt_maclen % 8)
@@ -1178,10 +2130,17 @@ int main(int argc, char **argv)
       fatal_errno("Cannot open password file", errno);
   }
   else
-    if (! opt_infile && ! isatty(STDIN_FILENO))
+    /* In batch mode STDIN carries the requests, encrypt and verify do not
+       need a passphrase at all */
+    if (! opt_infile && ! isatty(STDIN_FILENO) && 
+	! (opt_batch && (strstr(progname, "encrypt") || strstr(progname, "verify"))))
       if ((opt_fdpw = open("/dev/tty", O_RDONLY)) < 0)
 	fatal_errno("Cannot open tty", errno);
 
+  if (opt_batch && (strstr(progname, "key") || strstr(progname, "signcrypt") ||
+		    strstr(progname, "veridec") || strstr(progname, "dh")))
+    fatal("The option -B is not available for this command");
+
   if (strstr(progname, "key")) {
     if (opt_help || optind != argc)
       puts("Generate public key from private key (seccure version " VERSION ").\n"
@@ -1194,7 +2153,10 @@ int main(int argc, char **argv)
     if (opt_help || optind != argc - 1)
       puts("Encrypt a message with a public key (seccure version" VERSION ").\n"
 	   "\n"
-	   "seccure-encrypt [-m maclen] [-c curve] [-i infile] [-o outfile] key");
+	   "seccure-encrypt [-m maclen] [-c curve] [-i infile] [-o outfile]\n"
+	   "                [-x | -B] [-j threads] key");
+    else if (opt_batch)
+      res = app_batch(BATCH_ENCRYPT, argv[optind]);
     else
       app_encrypt(argv[optind]);
   }
@@ -1203,7 +2165,9 @@ int main(int argc, char **argv)
       puts("Decrypt a message using a secret key (seccure version " VERSION ").\n"
 	   "\n"
 	   "seccure-decrypt [-m maclen] [-c curve] [-i infile] [-o outfile]\n"
-	   "                [-F pwfile] [-d]");
+	   "                [-F pwfile] [-d] [-x | -B] [-j threads]");
+    else if (opt_batch)
+      res = app_batch(BATCH_DECRYPT, NULL);
     else
       res = app_decrypt();
   }
@@ -1230,16 +2194,22 @@ int main(int argc, char **argv)
       puts("Generate a signature (seccure version " VERSION ").\n"
 	   "\n"
 	   "seccure-sign [-f] [-b] [-a] [-c curve] [-s sigfile] [-i infile]\n"
-	   "             [-o outfile] [-F pwfile] [-d]");
+	   "             [-o outfile] [-F pwfile] [-d] [-B [-j threads]]");
+    else if (opt_batch)
+      res = app_batch(BATCH_SIGN, NULL);
     else
       app_sign();
   }
   else if (strstr(progname, "verify")) {
-    if (opt_help || (optind != argc - 2 && optind != argc - 1))
+    if (opt_help || (optind != argc - 2 && optind != argc - 1) ||
+	(opt_batch && optind != argc - 1))
       puts("Verify the signature of a message (seccure version " VERSION ").\n"
 	   "\n"
 	   "seccure-verify [-f] [-b] [-a] [-c curve] [-s sigfile] [-i infile]\n" 
-	   "               [-o outfile] key [signature]");
+	   "               [-o outfile] key [signature]\n"
+	   "seccure-verify -B [-j threads] [-c curve] [-i infile] [-o outfile] key");
+    else if (opt_batch)
+      res = app_batch(BATCH_VERIFY, argv[optind]);
     else
       res = app_verify(argv[optind], argv[optind + 1]);
   }
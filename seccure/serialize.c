@@ -37,12 +37,14 @@
  */
 
 
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <gcrypt.h>
 #include <assert.h>
 
 #include "serialize.h"
+#include "stats.h"
 
 /******************************************************************************/
 
@@ -55,6 +57,60 @@ const char compact_digits[COMPACT_DIGITS_COUNT] = {
   'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 
   'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z', '{', '|', '}', '~' };
 
+/* The value of every compact digit, -1 for all other characters           */
+static const signed char compact_values[256] = {
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1,  0, -1,  1,  2,  3,  4, -1,  5,  6,  7,  8,  9, 10, 11, 12,
+  13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28,
+  29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44,
+  45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56, -1, 57, 58, 59,
+  -1, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70, 71, 72, 73, 74,
+  75, 76, 77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 88, 89, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+/* The compact format is converted COMPACT_CHUNK_DIGITS digits at a time on
+   32 bit words, 90^4 still fits one                                        */
+#define COMPACT_CHUNK_DIGITS 4
+#define COMPACT_CHUNK (90UL * 90 * 90 * 90)
+
+/* x as big endian 32 bit words, the first of which is non-zero            */
+static void mpi_to_words(uint32_t *w, unsigned char *buf, int words, 
+			const gcry_mpi_t x)
+{
+  int i, len = 4 * words;
+  serialize_mpi((char*)buf, len, DF_BIN, x);
+  for(i = 0; i < words; i++)
+    w[i] = (uint32_t)buf[4 * i] << 24 | (uint32_t)buf[4 * i + 1] << 16 |
+      (uint32_t)buf[4 * i + 2] << 8 | buf[4 * i + 3];
+}
+
+/* w /= COMPACT_CHUNK, returns the remainder; *top skips the leading zero
+   words                                                                    */
+static uint32_t words_divmod_chunk(uint32_t *w, int *top, int words)
+{
+  uint64_t r = 0;
+  int i;
+  for(i = *top; i < words; i++) {
+    r = r << 32 | w[i];
+    w[i] = r / COMPACT_CHUNK;
+    r %= COMPACT_CHUNK;
+  }
+  while (*top < words && ! w[*top])
+    (*top)++;
+  return r;
+}
+
+#define MPI_WORDS(x) ((gcry_mpi_get_nbits(x) + 31) / 32)
+
 int get_serialization_len(const gcry_mpi_t x, enum disp_format df)
 {
   int res = 0;
@@ -63,13 +119,20 @@ int get_serialization_len(const gcry_mpi_t x, enum disp_format df)
     res = (gcry_mpi_get_nbits(x) + 7) / 8;
     break;
   case DF_COMPACT: do {
-      gcry_mpi_t base, Q;
-      base = gcry_mpi_set_ui(NULL, COMPACT_DIGITS_COUNT);
-      Q = gcry_mpi_copy(x);
-      for(res = 0; gcry_mpi_cmp_ui(Q, 0); res++)
-	gcry_mpi_div(Q, NULL, Q, base, 0);
-      gcry_mpi_release(base);
-      gcry_mpi_release(Q);
+      int words = MPI_WORDS(x), top = 0;
+      uint32_t w[words + 1], r;
+      unsigned char buf[4 * words + 1];
+      mpi_to_words(w, buf, words, x);
+      while (top < words) {
+	r = words_divmod_chunk(w, &top, words);
+	if (top < words)
+	  res += COMPACT_CHUNK_DIGITS;
+	else
+	  for(; r; r /= COMPACT_DIGITS_COUNT)
+	    res++;
+      }
+      memset(w, 0, sizeof(w));
+      memset(buf, 0, sizeof(buf));
     } while (0);
     break;
   default:
@@ -83,33 +146,38 @@ void serialize_mpi(char *outbuf, int outlen, enum disp_format df,
 {
   switch(df) {
   case DF_BIN: do {
-      int len = (gcry_mpi_get_nbits(x) + 7) / 8;
+      int len = (gcry_mpi_get_nbits(x) + 7) / 8, i;
       assert(len <= outlen);
       memset(outbuf, 0, outlen - len);
-      gcry_mpi_print(GCRYMPI_FMT_USG, (unsigned char*)outbuf + (outlen - len), 
-		     len, NULL, x);
+      if (gcry_mpi_print(GCRYMPI_FMT_USG, (unsigned char*)outbuf + (outlen - len), 
+			 len, NULL, x)) {
+	/* gcry_mpi_print() needs scratch space in secure memory for secure
+	   MPIs, once that has run out the bits are read one by one        */
+	memset(outbuf + (outlen - len), 0, len);
+	for(i = 0; i < 8 * len; i++)
+	  if (gcry_mpi_test_bit(x, i))
+	    outbuf[outlen - 1 - i / 8] |= 1 << (i % 8);
+      }
     } while (0);
     break;
   case DF_COMPACT: do {
-      gcry_mpi_t base, Q, R;
-      int i;
-      base = gcry_mpi_set_ui(NULL, COMPACT_DIGITS_COUNT);
-      Q = gcry_mpi_copy(x);
-      R = gcry_mpi_snew(0);
-      for(i = outlen - 1; i >= 0; i--) {
-        unsigned char digit = 0;
-        gcry_mpi_div(Q, R, Q, base, 0);
-        gcry_mpi_print(GCRYMPI_FMT_USG, &digit, 1, NULL, R);
-        assert(digit < COMPACT_DIGITS_COUNT);
-        outbuf[i] = compact_digits[digit];
+      int words = MPI_WORDS(x), top = 0, i, j;
+      uint32_t w[words + 1], r = 0;
+      unsigned char buf[4 * words + 1];
+      mpi_to_words(w, buf, words, x);
+      for(i = outlen - 1; i >= 0; ) {
+	r = top < words ? words_divmod_chunk(w, &top, words) : 0;
+	for(j = 0; j < COMPACT_CHUNK_DIGITS && i >= 0; j++, i--) {
+	  outbuf[i] = compact_digits[r % COMPACT_DIGITS_COUNT];
+	  r /= COMPACT_DIGITS_COUNT;
+	}
       }
 
-      if (gcry_mpi_cmp_ui(Q, 0)) {
+      if (r || top < words) {
         fprintf(stderr, "Failed to execute gcry_mpi_cmp_ui()\n");
       }
-      gcry_mpi_release(base);
-      gcry_mpi_release(Q);
-      gcry_mpi_release(R);
+      memset(w, 0, sizeof(w));
+      memset(buf, 0, sizeof(buf));
     } while (0);
     break;
   default: 
@@ -117,27 +185,56 @@ void serialize_mpi(char *outbuf, int outlen, enum disp_format df,
   }
 }
 
-int deserialize_mpi(gcry_mpi_t *x, enum disp_format df, const char *buf, 
-		    int inlen)
+static int deserialize(gcry_mpi_t *x, enum disp_format df, const char *buf, 
+		       int inlen, int secure)
 {
   switch(df) {
   case DF_BIN:
     gcry_mpi_scan(x, GCRYMPI_FMT_USG, buf, inlen, NULL);
-    gcry_mpi_set_flag(*x, GCRYMPI_FLAG_SECURE);
+    if (secure)
+      gcry_mpi_set_flag(*x, GCRYMPI_FLAG_SECURE);
     break;
   case DF_COMPACT: do {
-      char *d;
-      int i;
-      *x = gcry_mpi_snew(0);
-      for(i = 0; i < inlen; i++) {
-	if (! (d = memchr(compact_digits, buf[i], COMPACT_DIGITS_COUNT))) {
-	  gcry_mpi_release(*x);
-	  *x = NULL;
-	  return 0;
+      /* two digits take at most 13 bits */
+      int words = ((inlen + 1) / 2 * 13 + 31) / 32 + 1, used = 0, i, j, n;
+      uint32_t w[words];
+      unsigned char bytes[4 * words];
+      uint64_t c, m;
+      for(i = 0; i < inlen; i += n) {
+	n = (inlen - i) % COMPACT_CHUNK_DIGITS;
+	if (! n || i)
+	  n = COMPACT_CHUNK_DIGITS;
+	for(c = 0, m = 1, j = i; j < i + n; j++) {
+	  int d = compact_values[(unsigned char)buf[j]];
+	  if (d < 0) {
+	    memset(w, 0, sizeof(w));
+	    *x = NULL;
+	    return 0;
+	  }
+	  c = c * COMPACT_DIGITS_COUNT + d;
+	  m *= COMPACT_DIGITS_COUNT;
+	}
+	/* w = w * 90^n + c, little endian */
+	for(j = 0; j < used; j++) {
+	  c += w[j] * m;
+	  w[j] = c;
+	  c >>= 32;
 	}
-	gcry_mpi_mul_ui(*x, *x, COMPACT_DIGITS_COUNT);
-	gcry_mpi_add_ui(*x, *x, d - compact_digits);
+	if (c)
+	  w[used++] = c;
       }
+      for(i = 0; i < used; i++) {
+	bytes[4 * i] = w[used - 1 - i] >> 24;
+	bytes[4 * i + 1] = w[used - 1 - i] >> 16;
+	bytes[4 * i + 2] = w[used - 1 - i] >> 8;
+	bytes[4 * i + 3] = w[used - 1 - i];
+      }
+      if (used)
+	deserialize(x, DF_BIN, (char*)bytes, 4 * used, secure);
+      else
+	*x = secure ? gcry_mpi_snew(0) : gcry_mpi_new(0);
+      memset(w, 0, sizeof(w));
+      memset(bytes, 0, sizeof(bytes));
     } while (0);
     break;
   default: 
@@ -145,3 +242,16 @@ int deserialize_mpi(gcry_mpi_t *x, enum disp_format df, const char *buf,
   }
   return 1;
 }
+
+int deserialize_mpi(gcry_mpi_t *x, enum disp_format df, const char *buf, 
+		    int inlen)
+{
+  return deserialize(x, df, buf, inlen, 1);
+}
+
+/* For public keys and signatures, which need not take up secure memory   */
+int deserialize_mpi_public(gcry_mpi_t *x, enum disp_format df, 
+			   const char *buf, int inlen)
+{
+  return deserialize(x, df, buf, inlen, 0);
+}
@@ -54,5 +54,7 @@ void serialize_mpi(char *outbuf, int outlen, enum disp_format df,
 		   const gcry_mpi_t x);
 int deserialize_mpi(gcry_mpi_t *x, enum disp_format ds, const char *buf, 
 		    int inlen);
+int deserialize_mpi_public(gcry_mpi_t *x, enum disp_format ds, 
+			   const char *buf, int inlen);
 
 #endif /* INC_SERIALIZE_H */
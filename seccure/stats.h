@@ -0,0 +1,76 @@
+/*
+ *  seccure  -  Copyright 2009 B. Poettering
+ *
+ *  Maintained by R. Tyler Ballance <tyler@slide.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* 
+ *   SECCURE Elliptic Curve Crypto Utility for Reliable Encryption
+ *
+ * Current homepage: http://slideinc.github.com/PyECC
+ * Original homepage: http://point-at-infinity.org/seccure/
+ *
+ *
+ * seccure implements a selection of asymmetric algorithms based on  
+ * elliptic curve cryptography (ECC). See the manpage or the project's  
+ * homepage for further details.
+ *
+ * This code links against the GNU gcrypt library "libgcrypt" (which
+ * is part of the GnuPG project). Use the included Makefile to build
+ * the binary.
+ * 
+ * Report bugs to: http://github.com/rtyler/PyECC/issues
+ */
+
+
+
+#ifndef INC_STATS_H
+#define INC_STATS_H
+
+#include <gcrypt.h>
+
+/* Hot path counters, only compiled in when building with -DECC_STATS.
+   Every thread counts into its own stats_thread, libseccure folds the
+   difference a public call made into that call's ECC_State.  The header
+   has to come after gcrypt.h: it routes the counted libgcrypt calls
+   through the wrappers below, native field multiplications are counted
+   as mulm next to the MPI ones.                                           */
+
+struct stats_counters {
+  unsigned long long invm, mulm;
+  unsigned long long pointmul_fixed, pointmul_variable, pointmul_dual;
+  unsigned long long decompress, secmem;
+};
+
+#ifdef ECC_STATS
+
+extern __thread struct stats_counters stats_thread;
+
+#define STATS_COUNT(counter) (stats_thread.counter++)
+
+#define gcry_mpi_invm(x, a, m) (STATS_COUNT(invm), gcry_mpi_invm(x, a, m))
+#define gcry_mpi_mulm(w, u, v, m) (STATS_COUNT(mulm), gcry_mpi_mulm(w, u, v, m))
+#define gcry_mpi_snew(nbits) (STATS_COUNT(secmem), gcry_mpi_snew(nbits))
+#define gcry_malloc_secure(n) (STATS_COUNT(secmem), gcry_malloc_secure(n))
+
+#else
+
+#define STATS_COUNT(counter) ((void)0)
+
+#endif
+
+#endif /* INC_STATS_H */
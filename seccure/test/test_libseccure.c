@@ -17,14 +17,19 @@
  * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
  */
 
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include <glib.h>
 #include <gcrypt.h>
 
+#include "aes256ctr.h"
+#include "ecc.h"
 #include "protocol.h"
 #include "serialize.h"
 #include "libseccure.h"
@@ -59,6 +64,83 @@ void __test_verify()
 	ecc_free_keypair(kp);
 }
 
+/**
+ * __test_verify_cached() will make sure the public key cached in the 
+ * ::ECC_KeyPair by the first call is reused by the following ones
+ */
+void __test_verify_cached()
+{
+	ECC_State state = ecc_new_state(NULL);
+	ECC_KeyPair kp = ecc_new_keypair(DEFAULT_PUBKEY, DEFAULT_PRIVKEY, state);
+	g_assert(kp->pub_table == NULL);
+	g_assert(ecc_verify(DEFAULT_DATA, DEFAULT_SIG, kp, state));
+	g_assert(kp->pub_table != NULL);
+	g_assert(ecc_verify(DEFAULT_DATA, DEFAULT_SIG, kp, state));
+	g_assert(ecc_verify("Not the data", DEFAULT_SIG, kp, state) == false);
+	ecc_free_state(state);
+	ecc_free_keypair(kp);
+}
+
+/**
+ * __test_verify_digest() checks that signing a digest is the same as 
+ * signing the data, and that NUL bytes are part of what gets signed
+ */
+void __test_verify_digest()
+{
+	ECC_State state = ecc_new_state(NULL);
+	ECC_KeyPair kp = ecc_new_keypair(DEFAULT_PUBKEY, DEFAULT_PRIVKEY, state);
+	char digest[ECC_DIGEST_LEN], binary[] = "\0binary\0data";
+	ECC_Data sig;
+
+	gcry_md_hash_buffer(GCRY_MD_SHA512, digest, DEFAULT_DATA, strlen(DEFAULT_DATA));
+	g_assert(ecc_verify_digest(digest, DEFAULT_SIG, kp, state));
+	sig = ecc_sign_digest(digest, kp, state);
+	g_assert_cmpstr(DEFAULT_SIG, ==, sig->data);
+	ecc_free_data(sig);
+
+	sig = ecc_sign_s(binary, sizeof(binary), kp, state);
+	g_assert(ecc_verify_s(binary, sizeof(binary), sig->data, kp, state));
+	g_assert(ecc_verify_s(binary, 1, sig->data, kp, state) == false);
+	ecc_free_data(sig);
+
+	ecc_free_state(state);
+	ecc_free_keypair(kp);
+}
+
+/**
+ * __test_verify_threads() verifies with one ::ECC_KeyPair and ::ECC_State
+ * shared by a handful of threads, which also create states of their own
+ */
+#define TEST_THREADS 8
+
+static gpointer __verify_thread(gpointer kp)
+{
+	ECC_State state = ecc_new_state(NULL);
+	int i, valid = 0;
+
+	for (i = 0; i < 16; i++)
+		valid += ecc_verify(DEFAULT_DATA, DEFAULT_SIG, (ECC_KeyPair)(kp), state);
+	ecc_free_state(state);
+	return GINT_TO_POINTER(valid);
+}
+
+void __test_verify_threads()
+{
+	ECC_State state = ecc_new_state(NULL);
+	ECC_KeyPair kp = ecc_new_keypair(DEFAULT_PUBKEY, DEFAULT_PRIVKEY, state);
+	GThread *threads[TEST_THREADS];
+	int i;
+
+	for (i = 0; i < TEST_THREADS; i++)
+		threads[i] = g_thread_new("verify", __verify_thread, kp);
+	for (i = 0; i < TEST_THREADS; i++)
+		g_assert_cmpint(GPOINTER_TO_INT(g_thread_join(threads[i])), ==, 16);
+
+	g_assert(ecc_verify(DEFAULT_DATA, DEFAULT_SIG, kp, state));
+	ecc_free_state(state);
+	ecc_free_keypair(kp);
+}
+
 void __test_verify_nullkp()
 {
 	g_assert(ecc_verify(DEFAULT_DATA, DEFAULT_SIG, NULL, NULL) == false);
@@ -91,6 +173,27 @@ void __test_verify_crapsig()
 	ecc_free_keypair(kp);
 }
 
+/**
+ * __test_verify_batch() will make sure ecc_verify_batch() agrees with 
+ * ecc_verify() for every single item of the batch
+ */
+void __test_verify_batch()
+{
+	ECC_State state = ecc_new_state(NULL);
+	ECC_KeyPair kp = ecc_new_keypair(DEFAULT_PUBKEY, DEFAULT_PRIVKEY, state);
+	char *messages[] = {DEFAULT_DATA, DEFAULT_DATA, "Not the data"};
+	char *sigs[] = {DEFAULT_SIG, "This sig is crap", DEFAULT_SIG};
+	ECC_KeyPair kps[] = {kp, kp, kp};
+	bool results[3];
+
+	g_assert(ecc_verify_batch(messages, NULL, sigs, kps, 1, results, state));
+	g_assert(results[0]);
+	g_assert(ecc_verify_batch(messages, NULL, sigs, kps, 3, results, state) == false);
+	g_assert(results[0] && !results[1] && !results[2]);
+	ecc_free_state(state);
+	ecc_free_keypair(kp);
+}
+
 
 
 /**
@@ -117,7 +220,23 @@ void __test_new_keypair()
 void __test_new_state()
 {
 	ECC_State state = ecc_new_state(NULL);
+	ECC_Options opts = ecc_new_options();
+	char curve[] = "p256";
+
+	g_assert(state != NULL);
+	g_assert_cmpstr(state->curve, ==, "secp384r1/nistp384");
+	ecc_free_state(state);
+
+	/*
+	 * The caller's curve name is left alone and may go away
+	 */
+	opts->curve = curve;
+	state = ecc_new_state(opts);
 	g_assert(state != NULL);
+	g_assert(opts->curve == curve);
+	g_assert_cmpstr(state->curve, ==, "secp256r1/nistp256");
+	memset(curve, 0, sizeof(curve));
+	g_assert_cmpstr(state->curve, ==, "secp256r1/nistp256");
 	ecc_free_state(state);
 }
 
@@ -191,6 +310,63 @@ void __test_sign_nullkp()
 	ecc_free_state(state);
 }
 
+/**
+ * __test_sign_binary should produce the same signature as __test_sign
+ * in ECC_FORMAT_BINARY, and keys that survive a round trip
+ */
+void __test_sign_binary()
+{
+	ECC_Options opts = ecc_new_options();
+	ECC_State compact = ecc_new_state(NULL), state;
+	ECC_KeyPair kp = ecc_new_keypair(DEFAULT_PUBKEY, DEFAULT_PRIVKEY, compact);
+	ECC_KeyPair generated, loaded;
+	ECC_Data result;
+	gcry_mpi_t expected;
+	char sig[256], *priv;
+	int siglen;
+
+	opts->format = ECC_FORMAT_BINARY;
+	state = ecc_new_state(opts);
+	siglen = ecc_signature_size(state);
+	g_assert_cmpint(siglen, <, ecc_signature_size(compact));
+	g_assert_cmpint(ecc_public_key_size(state), <, ecc_public_key_size(compact));
+
+	g_assert(deserialize_mpi(&expected, DF_COMPACT, DEFAULT_SIG, 
+				strlen(DEFAULT_SIG)));
+	serialize_mpi(sig, siglen, DF_BIN, expected);
+	gcry_mpi_release(expected);
+
+	result = ecc_sign(DEFAULT_DATA, kp, state);
+	g_assert(result != NULL);
+	g_assert_cmpint(result->datalen, ==, siglen);
+	g_assert(memcmp(result->data, sig, siglen) == 0);
+	ecc_free_data(result);
+
+	generated = ecc_keygen(NULL, state);
+	g_assert(generated != NULL);
+	g_assert_cmpint(generated->pub_bytes, ==, ecc_public_key_size(state));
+	priv = ecc_serialize_private_key(generated, state);
+	loaded = ecc_new_keypair_s(generated->pub, generated->pub_bytes, 
+			priv, ecc_private_key_size(state), state);
+	g_assert(loaded != NULL);
+
+	result = ecc_sign(DEFAULT_DATA, loaded, state);
+	g_assert(result != NULL);
+	g_assert(ecc_verify(DEFAULT_DATA, result->data, generated, state));
+	g_assert(ecc_verify_digest_s(NULL, result->data, siglen, 
+				generated, state) == false);
+	((char *)(result->data))[siglen / 2] ^= 1;
+	g_assert(ecc_verify(DEFAULT_DATA, result->data, generated, state) == false);
+	ecc_free_data(result);
+
+	free(priv);
+	ecc_free_keypair(loaded);
+	ecc_free_keypair(generated);
+	ecc_free_keypair(kp);
+	ecc_free_state(state);
+	ecc_free_state(compact);
+}
+
 
 /**
  * __test_keygen should test the canonical case
@@ -273,6 +449,801 @@ void __test_encrypt()
 	ecc_free_keypair(kp);
 }
 
+/**
+ * __test_encrypt_into should round trip through caller provided buffers
+ * and refuse ones that are too small or sizes that do not fit an int
+ */
+void __test_encrypt_into()
+{
+	ECC_State state = ecc_new_state(NULL);
+	ECC_KeyPair kp = ecc_new_keypair(DEFAULT_PUBKEY, DEFAULT_PRIVKEY, state);
+	unsigned int len = strlen(DEFAULT_PLAINTEXT);
+	int size = ecc_encrypted_size(len, state);
+	char encrypted[size], decrypted[len + 1];
+
+	g_assert_cmpint(ecc_decrypted_size(size, state), ==, len);
+	g_assert_cmpint(ecc_encrypted_size(UINT_MAX - 20, state), ==, -1);
+	g_assert_cmpint(ecc_encrypted_size(INT_MAX, state), ==, -1);
+	g_assert_cmpint(ecc_encrypt_into(DEFAULT_PLAINTEXT, UINT_MAX - 20, encrypted, 
+			size, kp, state), ==, -1);
+	g_assert_cmpint(ecc_encrypt_into(DEFAULT_PLAINTEXT, len, encrypted, size - 1, 
+			kp, state), ==, -1);
+	g_assert_cmpint(ecc_encrypt_into(DEFAULT_PLAINTEXT, len, encrypted, size, 
+			kp, state), ==, size);
+
+	g_assert_cmpint(ecc_decrypt_into(encrypted, size, decrypted, len - 1, 
+			kp, state), ==, -1);
+	g_assert_cmpint(ecc_decrypt_into(encrypted, size, decrypted, len, 
+			kp, state), ==, len);
+	decrypted[len] = '\0';
+	g_assert_cmpstr(DEFAULT_PLAINTEXT, ==, decrypted);
+
+	ecc_free_state(state);
+	ecc_free_keypair(kp);
+}
+
+/**
+ * __test_decrypt_tampered should refuse a ciphertext with a flipped bit 
+ * and leave nothing of it in the output buffer
+ */
+void __test_decrypt_tampered()
+{
+	ECC_State state = ecc_new_state(NULL);
+	ECC_KeyPair kp = ecc_new_keypair(DEFAULT_PUBKEY, DEFAULT_PRIVKEY, state);
+	unsigned int i, len = strlen(DEFAULT_PLAINTEXT);
+	int size = ecc_encrypted_size(len, state);
+	char encrypted[size], decrypted[len];
+	ECC_Data data;
+
+	g_assert_cmpint(ecc_encrypt_into(DEFAULT_PLAINTEXT, len, encrypted, size, 
+			kp, state), ==, size);
+	encrypted[size - DEFAULT_MAC_LEN - 1] ^= 0x01;
+
+	g_assert_cmpint(ecc_decrypt_into(encrypted, size, decrypted, len, 
+			kp, state), ==, -1);
+	for (i = 0; i < len; ++i)
+		g_assert_cmpint(decrypted[i], ==, 0);
+	data = ecc_new_data();
+	data->data = encrypted;
+	data->datalen = size;
+	g_assert(ecc_decrypt(data, kp, state) == NULL);
+	data->data = NULL;
+	ecc_free_data(data);
+
+	ecc_free_state(state);
+	ecc_free_keypair(kp);
+}
+
+/**
+ * __test_decrypt_legacy should only take a MAC over no data, as older 
+ * releases wrote them, when ECC_Options.legacy_mac asks for it
+ */
+void __test_decrypt_legacy()
+{
+	ECC_Options opts = ecc_new_options();
+	ECC_State state = ecc_new_state(NULL);
+	ECC_KeyPair kp = ecc_new_keypair(DEFAULT_PUBKEY, DEFAULT_PRIVKEY, state);
+	ECC_State legacy;
+	unsigned int len = strlen(DEFAULT_PLAINTEXT);
+	int size = ecc_encrypted_size(len, state);
+	char encrypted[size], decrypted[len + 1], keybuf[64];
+	struct affine_point R;
+	gcry_md_hd_t md;
+
+	g_assert_cmpint(ecc_encrypt_into(DEFAULT_PLAINTEXT, len, encrypted, size, 
+			kp, state), ==, size);
+	g_assert(decompress_from_string(&R, encrypted, DF_BIN, state->curveparams));
+	g_assert(ECIES_decryption(keybuf, &R, kp->priv, state->curveparams));
+	point_release(&R);
+	g_assert(hmacsha256_init(&md, keybuf + 32, HMAC_KEY_SIZE));
+	gcry_md_final(md);
+	memcpy(encrypted + size - DEFAULT_MAC_LEN, gcry_md_read(md, 0), 
+			DEFAULT_MAC_LEN);
+	gcry_md_close(md);
+
+	g_assert_cmpint(ecc_decrypt_into(encrypted, size, decrypted, len, 
+			kp, state), ==, -1);
+
+	opts->legacy_mac = true;
+	legacy = ecc_new_state(opts);
+	g_assert_cmpint(ecc_decrypt_into(encrypted, size, decrypted, len, 
+			kp, legacy), ==, len);
+	decrypted[len] = '\0';
+	g_assert_cmpstr(DEFAULT_PLAINTEXT, ==, decrypted);
+
+	ecc_free_state(legacy);
+	ecc_free_state(state);
+	ecc_free_keypair(kp);
+}
+
+/**
+ * __test_encrypt_stream should produce what ecc_encrypt() does when fed
+ * a byte at a time, and decrypt it back the same way
+ */
+void __test_encrypt_stream()
+{
+	ECC_State state = ecc_new_state(NULL);
+	ECC_KeyPair kp = ecc_new_keypair(DEFAULT_PUBKEY, DEFAULT_PRIVKEY, state);
+	unsigned int i, len = strlen(DEFAULT_PLAINTEXT);
+	int slack = ecc_encrypted_size(0, state), size = 0, plain = 0, c;
+	char encrypted[len + slack], decrypted[len + 1];
+	ECC_Stream stream = ecc_encrypt_init(kp, state);
+	ECC_Data result, decrypted_data;
+
+	g_assert(stream != NULL);
+	g_assert_cmpint(ecc_encrypt_update(stream, DEFAULT_PLAINTEXT, UINT_MAX - 20, 
+				encrypted, len + slack), ==, -1);
+	for (i = 0; i < len; i++) {
+		c = ecc_encrypt_update(stream, DEFAULT_PLAINTEXT + i, 1, encrypted + size, 
+				len + slack - size);
+		g_assert_cmpint(c, >=, 1);
+		size += c;
+	}
+	c = ecc_encrypt_final(stream, encrypted + size, len + slack - size);
+	g_assert_cmpint(c, ==, DEFAULT_MAC_LEN);
+	size += c;
+	g_assert_cmpint(size, ==, len + slack);
+	ecc_free_stream(stream);
+
+	stream = ecc_decrypt_init(kp, state);
+	for (i = 0; i < (unsigned int)(size); i++) {
+		c = ecc_decrypt_update(stream, encrypted + i, 1, decrypted + plain, 
+				len - plain);
+		g_assert_cmpint(c, >=, 0);
+		plain += c;
+	}
+	g_assert(ecc_decrypt_final(stream));
+	g_assert_cmpint(plain, ==, len);
+	decrypted[len] = '\0';
+	g_assert_cmpstr(DEFAULT_PLAINTEXT, ==, decrypted);
+	ecc_free_stream(stream);
+
+	result = ecc_new_data();
+	result->data = encrypted;
+	result->datalen = size;
+	decrypted_data = ecc_decrypt(result, kp, state);
+	g_assert_cmpstr(DEFAULT_PLAINTEXT, ==, decrypted_data->data);
+	ecc_free_data(decrypted_data);
+	free(result);
+
+	encrypted[size - DEFAULT_MAC_LEN - 1] ^= 0x01;
+	stream = ecc_decrypt_init(kp, state);
+	for (i = 0, plain = 0; i < (unsigned int)(size); i++) {
+		c = ecc_decrypt_update(stream, encrypted + i, 1, decrypted + plain, 
+				len - plain);
+		g_assert_cmpint(c, >=, 0);
+		plain += c;
+	}
+	g_assert(ecc_decrypt_final(stream) == false);
+	ecc_free_stream(stream);
+
+	ecc_free_state(state);
+	ecc_free_keypair(kp);
+}
+
+/**
+ * __test_encrypt_stream_seek should decrypt the tail of a message fed in
+ * from the middle, which leaves no MAC for ecc_decrypt_final() to check
+ */
+void __test_encrypt_stream_seek()
+{
+	ECC_State state = ecc_new_state(NULL);
+	ECC_KeyPair kp = ecc_new_keypair(DEFAULT_PUBKEY, DEFAULT_PRIVKEY, state);
+	unsigned int len = strlen(DEFAULT_PLAINTEXT), skip = 7;
+	int header = ecc_encrypted_size(0, state) - DEFAULT_MAC_LEN, c;
+	ECC_Data encrypted = ecc_encrypt(DEFAULT_PLAINTEXT, len, kp, state);
+	ECC_Stream stream = ecc_decrypt_init(kp, state);
+	char decrypted[len + header];
+
+	g_assert(encrypted != NULL);
+	g_assert(ecc_decrypt_seek(stream, skip) == false);
+	g_assert_cmpint(ecc_decrypt_update(stream, encrypted->data, header, 
+				decrypted, sizeof(decrypted)), ==, 0);
+	g_assert(ecc_decrypt_seek(stream, skip));
+	c = ecc_decrypt_update(stream, (char *)(encrypted->data) + header + skip, 
+			encrypted->datalen - header - skip, decrypted, sizeof(decrypted));
+	g_assert_cmpint(c, ==, len - skip);
+	g_assert(memcmp(decrypted, DEFAULT_PLAINTEXT + skip, c) == 0);
+	g_assert(ecc_decrypt_final(stream) == false);
+
+	ecc_free_stream(stream);
+	ecc_free_data(encrypted);
+	ecc_free_state(state);
+	ecc_free_keypair(kp);
+}
+
+/**
+ * __test_encrypt_segments should decrypt the segments of a message in any
+ * order and turn down a flipped byte, a segment moved to another index and
+ * a ciphertext cut short at a segment boundary
+ */
+void __test_encrypt_segments()
+{
+	ECC_State state = ecc_new_state(NULL);
+	ECC_KeyPair kp = ecc_new_keypair(DEFAULT_PUBKEY, DEFAULT_PRIVKEY, state);
+	unsigned int len = strlen(DEFAULT_PLAINTEXT), seglen = 16, count, i;
+	int header = ecc_segments_header_size(state), c;
+	unsigned int stride = seglen + DEFAULT_MAC_LEN;
+	char encrypted[header + 3 * stride + DEFAULT_MAC_LEN], decrypted[len + 1];
+	char *seg = encrypted + header;
+	ECC_Segments segments;
+
+	g_assert(ecc_encrypt_segments_init(24, encrypted, header, kp, state) == NULL);
+	g_assert(ecc_encrypt_segments_init(seglen, encrypted, header - 1, kp, state) == NULL);
+	segments = ecc_encrypt_segments_init(seglen, encrypted, header, kp, state);
+	g_assert(segments != NULL);
+	g_assert_cmpint(ecc_segment_length(segments), ==, seglen);
+	g_assert_cmpint(ecc_encrypt_segment(segments, 0, DEFAULT_PLAINTEXT, seglen + 1, 
+				seg, stride + 1), ==, -1);
+	for (count = 0; count * seglen < len; count++) {
+		c = len - count * seglen;
+		if (c > (int)(seglen))
+			c = seglen;
+		g_assert_cmpint(ecc_encrypt_segment(segments, count, 
+					DEFAULT_PLAINTEXT + count * seglen, c, seg + count * stride, 
+					stride), ==, c + DEFAULT_MAC_LEN);
+	}
+	g_assert_cmpint(count, ==, 3);
+	g_assert_cmpint(ecc_encrypt_segments_final(segments, count, 
+				seg + len + count * DEFAULT_MAC_LEN, DEFAULT_MAC_LEN), ==, DEFAULT_MAC_LEN);
+	ecc_free_segments(segments);
+
+	segments = ecc_decrypt_segments_init(encrypted, header, kp, state);
+	g_assert(segments != NULL);
+	g_assert_cmpint(ecc_segment_length(segments), ==, seglen);
+	for (i = count; i-- > 0; ) {
+		c = (i == count - 1) ? len - i * seglen : seglen;
+		g_assert_cmpint(ecc_decrypt_segment(segments, i, seg + i * stride, 
+					c + DEFAULT_MAC_LEN, decrypted + i * seglen, len - i * seglen), 
+				==, c);
+	}
+	decrypted[len] = '\0';
+	g_assert_cmpstr(DEFAULT_PLAINTEXT, ==, decrypted);
+	g_assert(ecc_decrypt_segments_final(segments, count, 
+				seg + len + count * DEFAULT_MAC_LEN, DEFAULT_MAC_LEN));
+	g_assert(ecc_decrypt_segments_final(segments, count - 1, 
+				seg + len + count * DEFAULT_MAC_LEN, DEFAULT_MAC_LEN) == false);
+
+	memset(decrypted, 0, sizeof(decrypted));
+	g_assert_cmpint(ecc_decrypt_segment(segments, 0, seg + stride, stride, 
+				decrypted, len), ==, -1);
+	seg[stride + 3] ^= 0x01;
+	g_assert_cmpint(ecc_decrypt_segment(segments, 1, seg + stride, stride, 
+				decrypted, len), ==, -1);
+	g_assert_cmpint(decrypted[0], ==, 0);
+	ecc_free_segments(segments);
+
+	encrypted[header - 1] = 0x01;
+	g_assert(ecc_decrypt_segments_init(encrypted, header, kp, state) == NULL);
+
+	ecc_free_state(state);
+	ecc_free_keypair(kp);
+}
+
+/*
+ * Set up the a = 0 curve y^2 = x^3 + b through (x, y) over the prime m by
+ * hand, none of the built-in curves has a = 0
+ */
+static void __load_a_zero(struct domain_params *dp, const char *m, 
+		const char *x, const char *y)
+{
+	gcry_mpi_t t = gcry_mpi_new(0);
+
+	memset(dp, 0, sizeof(struct domain_params));
+	gcry_mpi_scan(&dp->m, GCRYMPI_FMT_HEX, m, 0, NULL);
+	gcry_mpi_scan(&dp->base.x, GCRYMPI_FMT_HEX, x, 0, NULL);
+	gcry_mpi_scan(&dp->base.y, GCRYMPI_FMT_HEX, y, 0, NULL);
+	dp->a = gcry_mpi_new(0);
+	dp->b = gcry_mpi_new(0);
+	gcry_mpi_mulm(dp->b, dp->base.y, dp->base.y, dp->m);
+	gcry_mpi_mulm(t, dp->base.x, dp->base.x, dp->m);
+	gcry_mpi_mulm(t, t, dp->base.x, dp->m);
+	gcry_mpi_subm(dp->b, dp->b, t, dp->m);
+	dp->a_type = CURVE_A_ZERO;
+	if ((dp->field = field_new(dp->m)))
+		field_from_mpi(dp->field, dp->fa, dp->a);
+	gcry_mpi_release(t);
+}
+
+static void __release_a_zero(struct domain_params *dp)
+{
+	if (dp->field)
+		field_release(dp->field);
+	gcry_mpi_release(dp->m);
+	gcry_mpi_release(dp->a);
+	gcry_mpi_release(dp->b);
+	point_release(&dp->base);
+}
+
+/*
+ * pointmul() with the a = 0 doubling has to land on the point the generic
+ * doubling gets to
+ */
+static void __check_a_zero(struct domain_params *dp)
+{
+	struct domain_params generic = *dp;
+	struct affine_point R, S;
+	gcry_mpi_t k;
+
+	gcry_mpi_scan(&k, GCRYMPI_FMT_HEX, 
+			"9d1c4a7e53b8f06e2c71ad39e4f5b8026a7c3d91e0b45f68a2c7d3e91b06f4a5", 
+			0, NULL);
+	generic.a_type = CURVE_A_GENERIC;
+	R = pointmul(&dp->base, k, dp);
+	S = pointmul(&dp->base, k, &generic);
+	g_assert(point_on_curve(&R, dp));
+	g_assert(gcry_mpi_cmp(R.x, S.x) == 0);
+	g_assert(gcry_mpi_cmp(R.y, S.y) == 0);
+	point_release(&R);
+	point_release(&S);
+	gcry_mpi_release(k);
+}
+
+/**
+ * __test_curve_a_zero should run the a = 0 doubling on secp256k1 with MPIs
+ * and on an a = 0 curve over the P-256 prime with the native field
+ */
+void __test_curve_a_zero()
+{
+	ECC_State state = ecc_new_state(NULL);
+	struct domain_params dp;
+
+	__load_a_zero(&dp, 
+			"fffffffffffffffffffffffffffffffffffffffffffffffffffffffefffffc2f",
+			"79be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798",
+			"483ada7726a3c4655da4fbfc0e1108a8fd17b448a68554199c47d08ffb10d4b8");
+	g_assert(dp.field == NULL);
+	g_assert(gcry_mpi_cmp_ui(dp.b, 7) == 0);
+	__check_a_zero(&dp);
+	__release_a_zero(&dp);
+
+	__load_a_zero(&dp, 
+			"ffffffff00000001000000000000000000000000ffffffffffffffffffffffff",
+			"6b17d1f2e12c4247f8bce6e563a440f277037d812deb33a0f4a13945d898c296",
+			"4fe342e2fe1a7f9b8ee7eb4a7c0f9e162bce33576b315ececbb6406837bf51f5");
+	g_assert(dp.field != NULL);
+	__check_a_zero(&dp);
+	__release_a_zero(&dp);
+
+	ecc_free_state(state);
+}
+
+/**
+ * __test_field_from_mpi should reduce values wider than the limbs of the 
+ * field instead of cutting them off
+ */
+void __test_field_from_mpi()
+{
+	struct field *f;
+	field_elem r;
+	gcry_mpi_t m, a, b;
+
+	gcry_mpi_scan(&m, GCRYMPI_FMT_HEX, 
+			"ffffffff00000001000000000000000000000000ffffffffffffffffffffffff", 
+			0, NULL);
+	g_assert((f = field_new(m)) != NULL);
+	a = gcry_mpi_new(0);
+	b = gcry_mpi_new(0);
+	gcry_mpi_set_ui(a, 1);
+	gcry_mpi_mul_2exp(a, a, 300);
+	gcry_mpi_add_ui(a, a, 5);
+	field_from_mpi(f, r, a);
+	field_to_mpi(f, b, r);
+	gcry_mpi_mod(a, a, m);
+	g_assert(gcry_mpi_cmp(a, b) == 0);
+
+	gcry_mpi_release(a);
+	gcry_mpi_release(b);
+	gcry_mpi_release(m);
+	field_release(f);
+}
+
+/**
+ * __test_signcrypt should round trip through ecc_veridec() and turn down
+ * a flipped byte and the wrong sender
+ */
+void __test_signcrypt()
+{
+	ECC_State state = ecc_new_state(NULL);
+	ECC_KeyPair recipient = ecc_new_keypair(DEFAULT_PUBKEY, DEFAULT_PRIVKEY, state);
+	ECC_KeyPair sender = ecc_keygen(NULL, state);
+	unsigned int len = strlen(DEFAULT_PLAINTEXT);
+	ECC_Data signcrypted, plain;
+
+	g_assert(sender != NULL);
+	signcrypted = ecc_signcrypt(DEFAULT_PLAINTEXT, len, sender, recipient, state);
+	g_assert(signcrypted != NULL);
+	g_assert_cmpint(signcrypted->datalen, ==, ecc_signcrypted_size(len, state));
+	g_assert_cmpint(ecc_veridecrypted_size(signcrypted->datalen, state), ==, len);
+	g_assert_cmpint(ecc_signcrypted_size(UINT_MAX - 20, state), ==, -1);
+	g_assert(ecc_signcrypt(DEFAULT_PLAINTEXT, UINT_MAX - 20, sender, recipient, 
+			state) == NULL);
+
+	plain = ecc_veridec(signcrypted->data, signcrypted->datalen, recipient, 
+			sender, state);
+	g_assert(plain != NULL);
+	g_assert_cmpstr(DEFAULT_PLAINTEXT, ==, plain->data);
+	ecc_free_data(plain);
+
+	g_assert(ecc_veridec(signcrypted->data, signcrypted->datalen, recipient, 
+				recipient, state) == NULL);
+	((char *)(signcrypted->data))[signcrypted->datalen - len] ^= 1;
+	g_assert(ecc_veridec(signcrypted->data, signcrypted->datalen, recipient, 
+				sender, state) == NULL);
+
+	ecc_free_data(signcrypted);
+	free(sender->pub);
+	ecc_free_keypair(sender);
+	ecc_free_keypair(recipient);
+	ecc_free_state(state);
+}
+
+/**
+ * __test_signcrypt_stream should produce what ecc_veridec() takes when fed
+ * a byte at a time, and veridec it back the same way
+ */
+void __test_signcrypt_stream()
+{
+	ECC_State state = ecc_new_state(NULL);
+	ECC_KeyPair recipient = ecc_new_keypair(DEFAULT_PUBKEY, DEFAULT_PRIVKEY, state);
+	ECC_KeyPair sender = ecc_keygen(NULL, state);
+	unsigned int i, len = strlen(DEFAULT_PLAINTEXT);
+	int slack = ecc_signcrypted_size(0, state), size = 0, plain = 0, c;
+	char encrypted[len + slack], decrypted[len + 1], sink[len + slack];
+	ECC_Stream stream = ecc_signcrypt_init(sender, recipient, state);
+	ECC_Data result;
+
+	g_assert(stream != NULL);
+	g_assert_cmpint(ecc_encrypt_final(stream, encrypted, sizeof(encrypted)), ==, -1);
+	for (i = 0; i < len; i++) {
+		c = ecc_encrypt_update(stream, DEFAULT_PLAINTEXT + i, 1, encrypted + size, 
+				len + slack - size);
+		g_assert_cmpint(c, >=, 1);
+		size += c;
+	}
+	c = ecc_signcrypt_final(stream, encrypted + size, len + slack - size);
+	g_assert_cmpint(c, >, 0);
+	size += c;
+	g_assert_cmpint(size, ==, len + slack);
+	ecc_free_stream(stream);
+
+	result = ecc_veridec(encrypted, size, recipient, sender, state);
+	g_assert(result != NULL);
+	g_assert_cmpstr(DEFAULT_PLAINTEXT, ==, result->data);
+	ecc_free_data(result);
+
+	stream = ecc_veridec_init(recipient, sender, state);
+	for (i = 0; i < (unsigned int)(size); i++) {
+		c = ecc_decrypt_update(stream, encrypted + i, 1, decrypted + plain, 
+				len - plain);
+		g_assert_cmpint(c, >=, 0);
+		plain += c;
+	}
+	g_assert(ecc_decrypt_final(stream) == false);
+	g_assert(ecc_veridec_final(stream));
+	g_assert_cmpint(plain, ==, len);
+	decrypted[len] = '\0';
+	g_assert_cmpstr(DEFAULT_PLAINTEXT, ==, decrypted);
+	ecc_free_stream(stream);
+
+	encrypted[size - 1] ^= 1;
+	stream = ecc_veridec_init(recipient, sender, state);
+	g_assert_cmpint(ecc_decrypt_update(stream, encrypted, size, sink, size), ==, len);
+	g_assert(ecc_veridec_final(stream) == false);
+	ecc_free_stream(stream);
+
+	free(sender->pub);
+	ecc_free_keypair(sender);
+	ecc_free_keypair(recipient);
+	ecc_free_state(state);
+}
+
+/**
+ * __test_encrypt_ephemerals should round trip with a state whose pool
+ * hands out precomputed ephemeral keys, never the same one twice
+ */
+void __test_encrypt_ephemerals()
+{
+	ECC_Options opts = ecc_new_options();
+	ECC_State state, plain = ecc_new_state(NULL);
+	ECC_KeyPair kp = ecc_new_keypair(DEFAULT_PUBKEY, DEFAULT_PRIVKEY, plain);
+	unsigned int i, len = strlen(DEFAULT_PLAINTEXT);
+	int size = ecc_encrypted_size(len, plain);
+	char encrypted[size], previous[size], decrypted[len + 1];
+
+	opts->ephemerals = 4;
+	state = ecc_new_state(opts);
+	g_assert(state != NULL);
+
+	for (i = 0; i < 16; i++) {
+		g_assert_cmpint(ecc_encrypt_into(DEFAULT_PLAINTEXT, len, encrypted, 
+				size, kp, state), ==, size);
+		if (i > 0)
+			g_assert(memcmp(encrypted, previous, size) != 0);
+		memcpy(previous, encrypted, size);
+
+		g_assert_cmpint(ecc_decrypt_into(encrypted, size, decrypted, len, 
+				kp, plain), ==, len);
+		decrypted[len] = '\0';
+		g_assert_cmpstr(DEFAULT_PLAINTEXT, ==, decrypted);
+	}
+
+	ecc_free_state(state);
+	ecc_free_state(plain);
+	ecc_free_keypair(kp);
+}
+
+/**
+ * __test_encrypt_ephemerals_fork should not let a forked child hand out
+ * the ephemeral keys its parent precomputed: the same R would make both
+ * processes write the same ciphertext for the same plaintext
+ */
+void __test_encrypt_ephemerals_fork()
+{
+	ECC_Options opts = ecc_new_options();
+	ECC_State state;
+	ECC_KeyPair kp;
+	unsigned int len = strlen(DEFAULT_PLAINTEXT);
+	int size, fds[2], status;
+	pid_t pid;
+
+	opts->ephemerals = 4;
+	state = ecc_new_state(opts);
+	kp = ecc_new_keypair(DEFAULT_PUBKEY, DEFAULT_PRIVKEY, state);
+	size = ecc_encrypted_size(len, state);
+	{
+		char ours[size], theirs[size], decrypted[len];
+
+		/* Give the refill thread time to fill the pool */
+		usleep(200000);
+		g_assert(pipe(fds) == 0);
+		if ((pid = fork()) == 0) {
+			close(fds[0]);
+			status = (ecc_encrypt_into(DEFAULT_PLAINTEXT, len, theirs, size, 
+					kp, state) == size) && 
+					(write(fds[1], theirs, size) == size);
+			ecc_free_state(state);
+			_exit(status ? 0 : 1);
+		}
+		g_assert(pid > 0);
+		close(fds[1]);
+		g_assert_cmpint(ecc_encrypt_into(DEFAULT_PLAINTEXT, len, ours, size, 
+				kp, state), ==, size);
+		g_assert_cmpint(read(fds[0], theirs, size), ==, size);
+		close(fds[0]);
+		g_assert(waitpid(pid, &status, 0) == pid);
+		g_assert(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+
+		g_assert(memcmp(ours, theirs, size) != 0);
+		g_assert_cmpint(ecc_decrypt_into(theirs, size, decrypted, len, 
+				kp, state), ==, len);
+		g_assert(memcmp(decrypted, DEFAULT_PLAINTEXT, len) == 0);
+	}
+
+	ecc_free_keypair(kp);
+	ecc_free_state(state);
+}
+
+/**
+ * __test_encrypt_multi should let each recipient, and only them, decrypt
+ * the one ciphertext
+ */
+void __test_encrypt_multi()
+{
+	ECC_State state = ecc_new_state(NULL);
+	ECC_KeyPair kp[40], outsider = ecc_keygen(NULL, state);
+	unsigned int i, len = strlen(DEFAULT_PLAINTEXT);
+	ECC_Data encrypted, decrypted;
+
+	kp[0] = ecc_new_keypair(DEFAULT_PUBKEY, DEFAULT_PRIVKEY, state);
+	for (i = 1; i < 40; i++)
+		kp[i] = ecc_keygen(NULL, state);
+
+	encrypted = ecc_encrypt_multi(DEFAULT_PLAINTEXT, len, kp, 40, state);
+	g_assert(encrypted != NULL);
+	g_assert_cmpint(encrypted->datalen, ==, 
+			ecc_encrypted_multi_size(len, 40, state));
+
+	for (i = 0; i < 40; i += 13) {
+		decrypted = ecc_decrypt_multi(encrypted->data, encrypted->datalen, 
+				kp[i], state);
+		g_assert(decrypted != NULL);
+		g_assert_cmpstr(DEFAULT_PLAINTEXT, ==, decrypted->data);
+		ecc_free_data(decrypted);
+	}
+	g_assert(ecc_decrypt_multi(encrypted->data, encrypted->datalen, 
+			outsider, state) == NULL);
+	g_assert(ecc_decrypt_multi(encrypted->data, encrypted->datalen - 1, 
+			kp[0], state) == NULL);
+	/* The first slot, right after the 4 byte count, starts with its id */
+	((char *)(encrypted->data))[4] ^= 1;
+	g_assert(ecc_decrypt_multi(encrypted->data, encrypted->datalen, 
+			kp[0], state) == NULL);
+	((char *)(encrypted->data))[4] ^= 1;
+	((char *)(encrypted->data))[encrypted->datalen - DEFAULT_MAC_LEN - 1] ^= 1;
+	g_assert(ecc_decrypt_multi(encrypted->data, encrypted->datalen, 
+			kp[0], state) == NULL);
+
+	ecc_free_data(encrypted);
+	for (i = 0; i < 40; i++)
+		ecc_free_keypair(kp[i]);
+	ecc_free_keypair(outsider);
+	ecc_free_state(state);
+}
+
+/**
+ * __test_dh should agree on the same key from both sides
+ */
+void __test_dh()
+{
+	ECC_State state = ecc_new_state(NULL);
+	ECC_KeyPair a = ecc_new_keypair(DEFAULT_PUBKEY, DEFAULT_PRIVKEY, state);
+	ECC_KeyPair b = ecc_keygen(NULL, state);
+	char ka[ECC_DH_KEY_LEN], kb[ECC_DH_KEY_LEN];
+	char junk[strlen(DEFAULT_PUBKEY) + 1];
+	ECC_KeyPair bogus;
+
+	/* Right length, but not a point on the curve */
+	memset(junk, '~', sizeof(junk) - 1);
+	junk[sizeof(junk) - 1] = '\0';
+	bogus = ecc_new_keypair(junk, NULL, state);
+
+	g_assert(ecc_dh(a, b, ka, state));
+	g_assert(ecc_dh(b, a, kb, state));
+	g_assert(memcmp(ka, kb, ECC_DH_KEY_LEN) == 0);
+
+	g_assert(!ecc_dh(a, bogus, ka, state));
+	g_assert(!ecc_dh(bogus, a, ka, state));
+
+	ecc_free_keypair(a);
+	ecc_free_keypair(b);
+	ecc_free_keypair(bogus);
+	ecc_free_state(state);
+}
+
+/**
+ * __test_dh_cached should hand out the same keys with a cache small
+ * enough to evict
+ */
+void __test_dh_cached()
+{
+	ECC_Options opts = ecc_new_options();
+	ECC_State plain = ecc_new_state(NULL), state;
+	ECC_KeyPair a = ecc_new_keypair(DEFAULT_PUBKEY, DEFAULT_PRIVKEY, plain);
+	ECC_KeyPair peers[3];
+	char expected[3][ECC_DH_KEY_LEN], key[ECC_DH_KEY_LEN];
+	unsigned int i, round;
+
+	opts->dh_cache = 2;
+	state = ecc_new_state(opts);
+
+	for (i = 0; i < 3; i++) {
+		peers[i] = ecc_keygen(NULL, plain);
+		g_assert(ecc_dh(a, peers[i], expected[i], plain));
+	}
+	for (round = 0; round < 3; round++) {
+		for (i = 0; i < 3; i++) {
+			g_assert(ecc_dh(a, peers[i], key, state));
+			g_assert(memcmp(key, expected[i], ECC_DH_KEY_LEN) == 0);
+			g_assert(ecc_dh(a, peers[0], key, state));
+			g_assert(memcmp(key, expected[0], ECC_DH_KEY_LEN) == 0);
+		}
+	}
+
+	for (i = 0; i < 3; i++)
+		ecc_free_keypair(peers[i]);
+	ecc_free_keypair(a);
+	ecc_free_state(state);
+	ecc_free_state(plain);
+}
+
+/**
+ * __test_keygen_batch should hand out distinct keys over more than one
+ * batch of public points, each of them signing for its own public key
+ */
+void __test_keygen_batch()
+{
+	ECC_State state = ecc_new_state(NULL);
+	ECC_KeyPair *kps = ecc_keygen_batch(70, state), pub;
+	ECC_Data signature;
+	unsigned int i;
+
+	g_assert(kps != NULL);
+	for (i = 0; i < 70; i++) {
+		g_assert(kps[i]->priv != NULL);
+		g_assert(strlen((char *)(kps[i]->pub)) + 1 == kps[i]->pub_bytes);
+		if (i > 0)
+			g_assert(strcmp((char *)(kps[i]->pub), (char *)(kps[i - 1]->pub)) != 0);
+
+		signature = ecc_sign(DEFAULT_DATA, kps[i], state);
+		g_assert(signature != NULL);
+		pub = ecc_new_keypair((char *)(kps[i]->pub), NULL, state);
+		g_assert(ecc_verify(DEFAULT_DATA, (char *)(signature->data), pub, state));
+
+		ecc_free_keypair(pub);
+		ecc_free_data(signature);
+	}
+	for (i = 0; i < 70; i++) {
+		free(kps[i]->pub);
+		ecc_free_keypair(kps[i]);
+	}
+	free(kps);
+
+	g_assert(ecc_keygen_batch(0, state) == NULL);
+	ecc_free_state(state);
+}
+
+/**
+ * __test_stats should book a cached ecc_dh() without a scalar 
+ * multiplication, it does nothing unless built with ECC_STATS
+ */
+void __test_stats()
+{
+	ECC_Options opts = ecc_new_options();
+	ECC_State state;
+	ECC_KeyPair a, b;
+	struct _ECC_Stats stats;
+	char key[ECC_DH_KEY_LEN];
+	unsigned long long multiplications;
+
+	opts->dh_cache = 2;
+	state = ecc_new_state(opts);
+	if (!ecc_get_stats(state, &stats)) {
+		ecc_free_state(state);
+		return;
+	}
+	a = ecc_new_keypair(DEFAULT_PUBKEY, DEFAULT_PRIVKEY, state);
+	b = ecc_keygen(NULL, state);
+
+	ecc_reset_stats(state);
+	g_assert(ecc_dh(a, b, key, state));
+	g_assert(ecc_get_stats(state, &stats));
+	g_assert(stats.calls[ECC_OP_DH] == 1);
+	g_assert(stats.pointmul_variable == 1);
+	g_assert(stats.decompress == 1);
+	g_assert(stats.invm > 0);
+	multiplications = stats.mulm;
+
+	g_assert(ecc_dh(a, b, key, state));
+	g_assert(ecc_get_stats(state, &stats));
+	g_assert(stats.calls[ECC_OP_DH] == 2);
+	g_assert(stats.pointmul_variable == 1);
+	g_assert(stats.mulm == multiplications);
+	g_assert(stats.nsec[ECC_OP_DH] > 0);
+
+	ecc_free_keypair(a);
+	ecc_free_keypair(b);
+	ecc_free_state(state);
+}
+
+/**
+ * __test_stats_verify checks that ecc_verify() on a fresh public key keeps 
+ * out of the secure memory pool, it does nothing unless built with ECC_STATS
+ */
+void __test_stats_verify()
+{
+	ECC_State state = ecc_new_state(NULL);
+	ECC_KeyPair kp;
+	struct _ECC_Stats stats;
+
+	if (!ecc_get_stats(state, &stats)) {
+		ecc_free_state(state);
+		return;
+	}
+	kp = ecc_new_keypair(DEFAULT_PUBKEY, NULL, state);
+
+	ecc_reset_stats(state);
+	g_assert(ecc_verify(DEFAULT_DATA, DEFAULT_SIG, kp, state));
+	g_assert(ecc_verify("Not the data", DEFAULT_SIG, kp, state) == false);
+	g_assert(ecc_get_stats(state, &stats));
+	g_assert(stats.calls[ECC_OP_VERIFY] == 2);
+	g_assert(stats.decompress == 1);
+	g_assert(stats.secmem == 0);
+
+	ecc_free_keypair(kp);
+	ecc_free_state(state);
+}
+
 
 int main(int argc, char **argv)
 {
@@ -285,6 +1256,8 @@ int main(int argc, char **argv)
 	g_test_add_func("/libseccure/struct/ecc_new_data", __test_new_data);
 	g_test_add_func("/libseccure/struct/ecc_new_options", __test_new_options);
 	g_test_add_func("/libseccure/struct/ecc_new_state", __test_new_state);
+	g_test_add_func("/libseccure/curve/a_zero", __test_curve_a_zero);
+	g_test_add_func("/libseccure/field/from_mpi", __test_field_from_mpi);
 
 	/*
 	 * Tests for ecc_keygen()
@@ -297,10 +1270,14 @@ int main(int argc, char **argv)
 	 * Tests for ecc_verify()
 	 */
 	g_test_add_func("/libseccure/ecc_verify/default", __test_verify);
+	g_test_add_func("/libseccure/ecc_verify/cached", __test_verify_cached);
+	g_test_add_func("/libseccure/ecc_verify/threads", __test_verify_threads);
+	g_test_add_func("/libseccure/ecc_verify/digest", __test_verify_digest);
 	g_test_add_func("/libseccure/ecc_verify/null_keypair", __test_verify_nullkp);
 	g_test_add_func("/libseccure/ecc_verify/null_data", __test_verify_nulldata);
 	g_test_add_func("/libseccure/ecc_verify/null_sig", __test_verify_nullsig);
 	g_test_add_func("/libseccure/ecc_verify/crap_sig", __test_verify_crapsig);
+	g_test_add_func("/libseccure/ecc_verify/batch", __test_verify_batch);
 
 	/* 
 	 * Tests for ecc_sign()
@@ -308,11 +1285,44 @@ int main(int argc, char **argv)
 	g_test_add_func("/libseccure/ecc_sign/default", __test_sign);
 	g_test_add_func("/libseccure/ecc_sign/null_data", __test_sign_nulldata);
 	g_test_add_func("/libseccure/ecc_sign/null_keypair", __test_sign_nullkp);
+	g_test_add_func("/libseccure/ecc_sign/binary", __test_sign_binary);
 
 	/*
 	 * Tests for ecc_encrypt()
 	 */
 	g_test_add_func("/libseccure/ecc_encrypt/default", __test_encrypt);
+	g_test_add_func("/libseccure/ecc_encrypt/into", __test_encrypt_into);
+	g_test_add_func("/libseccure/ecc_decrypt/tampered", __test_decrypt_tampered);
+	g_test_add_func("/libseccure/ecc_decrypt/legacy_mac", __test_decrypt_legacy);
+	g_test_add_func("/libseccure/ecc_encrypt/stream", __test_encrypt_stream);
+	g_test_add_func("/libseccure/ecc_encrypt/stream_seek", __test_encrypt_stream_seek);
+	g_test_add_func("/libseccure/ecc_encrypt/segments", __test_encrypt_segments);
+	g_test_add_func("/libseccure/ecc_encrypt/ephemerals", __test_encrypt_ephemerals);
+	g_test_add_func("/libseccure/ecc_encrypt/ephemerals_fork", __test_encrypt_ephemerals_fork);
+	g_test_add_func("/libseccure/ecc_encrypt/multi", __test_encrypt_multi);
+
+	/*
+	 * Tests for ecc_signcrypt()
+	 */
+	g_test_add_func("/libseccure/ecc_signcrypt/default", __test_signcrypt);
+	g_test_add_func("/libseccure/ecc_signcrypt/stream", __test_signcrypt_stream);
+
+	/*
+	 * Tests for ecc_dh()
+	 */
+	g_test_add_func("/libseccure/ecc_dh/default", __test_dh);
+	g_test_add_func("/libseccure/ecc_dh/cached", __test_dh_cached);
+
+	/*
+	 * Tests for ecc_keygen_batch()
+	 */
+	g_test_add_func("/libseccure/ecc_keygen_batch/default", __test_keygen_batch);
+
+	/*
+	 * Tests for ecc_get_stats()
+	 */
+	g_test_add_func("/libseccure/ecc_get_stats/dh", __test_stats);
+	g_test_add_func("/libseccure/ecc_get_stats/verify", __test_stats_verify);
 
 
 	return g_test_run();
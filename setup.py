@@ -15,6 +15,7 @@ base_modules = [
             'seccure/libseccure.c',
             'seccure/numtheory.c',
             'seccure/ecc.c',
+            'seccure/field.c',
             'seccure/serialize.c',
             'seccure/protocol.c',
             'seccure/curves.c',
@@ -25,6 +26,7 @@ base_modules = [
         libraries=['gcrypt'],
         include_dirs=['/usr/include', '/usr/local/include',],
         library_dirs=['/usr/local/lib', '/usr/local/lib64',],
+        define_macros=[('ECC_STATS', None)] if os.environ.get('ECC_STATS') else [],
         extra_compile_args=['-Wall', '-Werror',]),
 ]
 
@@ -50,6 +50,38 @@ class ECC_Verify_Tests(unittest.TestCase):
         assert self.ecc.verify(DEFAULT_DATA, "FAIL") == False , ('Verified on a bad sig',
                 DEFAULT_DATA, DEFAULT_SIG, DEFAULT_PUBKEY, DEFAULT_PRIVKEY)
 
+    def test_BatchVerification(self):
+        rc = self.ecc.verify_batch([DEFAULT_DATA, DEFAULT_DATA, 'Not the data'],
+                [DEFAULT_SIG, 'FAIL', DEFAULT_SIG])
+        assert rc == [True, False, False], ('Batch verification is off', rc)
+
+    def test_BufferBatchVerification(self):
+        rc = self.ecc.verify_batch([bytearray(DEFAULT_DATA), bytearray('Not the data')],
+                [bytearray(DEFAULT_SIG), bytearray(DEFAULT_SIG)])
+        assert rc == [True, False], ('Batch verification of buffers is off', rc)
+        assert self.ecc.verify(memoryview(DEFAULT_DATA), bytearray(DEFAULT_SIG))
+
+class ECC_Digest_Tests(unittest.TestCase):
+    def setUp(self):
+        super(ECC_Digest_Tests, self).setUp()
+        self.ecc = pyecc.ECC(public=DEFAULT_PUBKEY, private=DEFAULT_PRIVKEY)
+
+    def test_Digest(self):
+        import hashlib
+        digest = hashlib.sha512(DEFAULT_DATA).digest()
+        assert self.ecc.sign_digest(digest) == DEFAULT_SIG
+        assert self.ecc.verify_digest(digest, DEFAULT_SIG)
+        assert not self.ecc.verify_digest(hashlib.sha512('Not the data').digest(),
+                DEFAULT_SIG)
+        self.failUnlessRaises(ValueError, self.ecc.sign_digest, digest[:32])
+
+    def test_Binary(self):
+        data = '\x00binary\x00' + DEFAULT_DATA
+        signature = self.ecc.sign(bytearray(data))
+        assert signature != self.ecc.sign(data[:1]), 'Signed up to the NUL byte'
+        assert self.ecc.verify(data, signature)
+        assert not self.ecc.verify(data[:1], signature)
+
 class ECC_Sign_Tests(unittest.TestCase):
     def setUp(self):
         super(ECC_Sign_Tests, self).setUp()
@@ -80,6 +112,115 @@ class ECC_Encrypt_Tests(unittest.TestCase):
         decrypted = self.ecc.decrypt(encrypted)
         assert decrypted == DEFAULT_PLAINTEXT
 
+    def test_Ephemerals(self):
+        self.ecc = pyecc.ECC(public=DEFAULT_PUBKEY, private=DEFAULT_PRIVKEY,
+                ephemerals=4)
+        encrypted = [self.ecc.encrypt(DEFAULT_PLAINTEXT) for i in range(8)]
+        assert len(set(encrypted)) == len(encrypted)
+        for e in encrypted:
+            assert self.ecc.decrypt(e) == DEFAULT_PLAINTEXT
+
+class ECC_Multi_Tests(unittest.TestCase):
+    def test_Recipients(self):
+        others = [pyecc.ECC.generate() for i in range(3)]
+        sender = pyecc.ECC(public=DEFAULT_PUBKEY)
+        encrypted = sender.encrypt_multi(DEFAULT_PLAINTEXT,
+                [DEFAULT_PUBKEY] + others)
+        assert encrypted
+
+        me = pyecc.ECC(public=DEFAULT_PUBKEY, private=DEFAULT_PRIVKEY)
+        for ecc in [me] + others:
+            assert ecc.decrypt_multi(encrypted) == DEFAULT_PLAINTEXT
+        assert pyecc.ECC.generate().decrypt_multi(encrypted) is None
+        assert me.decrypt_multi(encrypted[:-1]) is None
+
+class ECC_DH_Tests(unittest.TestCase):
+    def test_Agree(self):
+        me = pyecc.ECC(public=DEFAULT_PUBKEY, private=DEFAULT_PRIVKEY,
+                dh_cache=4)
+        peer = pyecc.ECC.generate()
+        key = me.dh(peer)
+        assert key and len(key) == 64
+        assert peer.dh(DEFAULT_PUBKEY) == key
+        assert me.dh(peer._public) == key
+
+class ECC_Signcrypt_Tests(unittest.TestCase):
+    def setUp(self):
+        super(ECC_Signcrypt_Tests, self).setUp()
+        self.me = pyecc.ECC(public=DEFAULT_PUBKEY, private=DEFAULT_PRIVKEY)
+        self.peer = pyecc.ECC.generate()
+
+    def test_RoundTrip(self):
+        sealed = self.me.signcrypt(DEFAULT_PLAINTEXT, self.peer._public)
+        assert sealed
+        assert self.peer.veridec(sealed, self.me) == DEFAULT_PLAINTEXT
+        assert self.peer.veridec(sealed, pyecc.ECC.generate()) is None
+        assert self.me.veridec(sealed, self.me) is None
+
+    def test_Stream(self):
+        import StringIO
+        out = StringIO.StringIO()
+        with self.me.signcrypt_to(out, self.peer) as writer:
+            writer.write(DEFAULT_PLAINTEXT * 3)
+        sealed = out.getvalue()
+        assert self.peer.veridec(sealed, DEFAULT_PUBKEY) == DEFAULT_PLAINTEXT * 3
+
+        out = StringIO.StringIO()
+        with self.peer.veridec_to(out, self.me) as writer:
+            writer.write(sealed)
+        assert out.getvalue() == DEFAULT_PLAINTEXT * 3
+
+        writer = self.peer.veridec_to(StringIO.StringIO(), pyecc.ECC.generate())
+        writer.write(sealed)
+        self.failUnlessRaises(ValueError, writer.close)
+
+class ECC_GenerateMany_Tests(unittest.TestCase):
+    def test_Default(self):
+        keys = pyecc.ECC.generate_many(5)
+        assert len(keys) == 5
+        assert len(set(k._public for k in keys)) == 5
+        for ecc in keys:
+            assert ecc.verify(DEFAULT_DATA, ecc.sign(DEFAULT_DATA))
+
+    def test_Curve(self):
+        keys = pyecc.ECC.generate_many(3, curve='p256', binary=True)
+        for ecc in keys:
+            assert ecc.decrypt(ecc.encrypt(DEFAULT_PLAINTEXT)) == DEFAULT_PLAINTEXT
+        assert len(keys[0]._public) < len(pyecc.ECC.generate(binary=True)._public)
+        self.assertRaises(ValueError, pyecc.ECC.generate_many, 1, curve='nonesuch')
+
+class ECC_Binary_Tests(unittest.TestCase):
+    def test_RoundTrip(self):
+        ecc = pyecc.ECC.generate(binary=True)
+        assert len(ecc._public) < len(DEFAULT_PUBKEY)
+        signature = ecc.sign(DEFAULT_DATA)
+        assert signature and len(signature) < len(DEFAULT_SIG)
+
+        loaded = pyecc.ECC(public=ecc._public, private=ecc._private,
+                binary=True)
+        assert loaded.verify(DEFAULT_DATA, signature)
+        assert loaded.verify(DEFAULT_DATA, loaded.sign(DEFAULT_DATA))
+        assert not loaded.verify(DEFAULT_DATA, signature[:-1])
+        assert loaded.verify_batch([DEFAULT_DATA] * 2,
+                [signature, signature[1:]]) == [True, False]
+        assert loaded.decrypt(ecc.encrypt(DEFAULT_PLAINTEXT)) == DEFAULT_PLAINTEXT
+
+class ECC_Stats_Tests(unittest.TestCase):
+    def test_Counters(self):
+        ecc = pyecc.ECC(public=DEFAULT_PUBKEY, private=DEFAULT_PRIVKEY)
+        stats = ecc.stats()
+        if stats is None:
+            # built without ECC_STATS
+            return
+        assert ecc.verify(DEFAULT_DATA, ecc.sign(DEFAULT_DATA))
+        stats = ecc.stats()
+        assert stats['calls']['sign'] == 1 and stats['calls']['verify'] == 1
+        assert stats['nsec']['verify'] > 0
+        assert stats['pointmul_fixed'] >= 1 and stats['pointmul_dual'] >= 1
+        assert stats['invm'] > 0 and stats['mulm'] > 0
+        ecc.reset_stats()
+        assert ecc.stats()['calls']['sign'] == 0
+
 class ECC_Decrypt_Tests(unittest.TestCase):
     def setUp(self):
         super(ECC_Decrypt_Tests, self).setUp()
@@ -87,9 +228,138 @@ class ECC_Decrypt_Tests(unittest.TestCase):
 
     def test_BasicDecrypt(self):
         encrypted = "\x01\xa9\xc0\x1a\x03\\h\xd8\xea,\x8f\xd6\x91W\x8d\xe74x:\x1d\xa8 \xee\x0eD\xfe\xb6\xb0P\x04\xbf\xd5=\xf1?\x00\x9cDw\xae\x0b\xc3\x05BuX\xf1\x9a\x05f\x81\xd1\x15\x8c\x80Q\xa6\xf9\xd7\xf0\x8e\x99\xf2\x11<t\xff\x92\x14\x1c%0W\x8e\x8f\n\n\x9ed\xf8\xff\xc7p\r\x03\xbbw|\xb1h\xc9\xbd+\x02\x87"
-        decrypted = self.ecc.decrypt(encrypted)
+        # Written by an older release, its MAC covers no data
+        assert self.ecc.decrypt(encrypted) is None
+        legacy = pyecc.ECC(public=DEFAULT_PUBKEY, private=DEFAULT_PRIVKEY, 
+                legacy_mac=True)
+        decrypted = legacy.decrypt(encrypted)
         assert decrypted  == DEFAULT_PLAINTEXT
 
+    def test_TamperedDecrypt(self):
+        encrypted = self.ecc.encrypt(DEFAULT_PLAINTEXT)
+        tampered = encrypted[:-15] + chr(ord(encrypted[-15]) ^ 1) + encrypted[-14:]
+        assert self.ecc.decrypt(tampered) is None
+
+class ECC_Buffer_Tests(unittest.TestCase):
+    def setUp(self):
+        super(ECC_Buffer_Tests, self).setUp()
+        self.ecc = pyecc.ECC(public=DEFAULT_PUBKEY, private=DEFAULT_PRIVKEY)
+
+    def test_BufferInput(self):
+        for data in (bytearray(DEFAULT_PLAINTEXT), memoryview(DEFAULT_PLAINTEXT),
+                buffer(DEFAULT_PLAINTEXT)):
+            encrypted = self.ecc.encrypt(data)
+            assert self.ecc.decrypt(bytearray(encrypted)) == DEFAULT_PLAINTEXT
+
+    def test_DecryptLeavesInput(self):
+        encrypted = self.ecc.encrypt(DEFAULT_PLAINTEXT)
+        copied = str(bytearray(encrypted))
+        self.ecc.decrypt(encrypted)
+        assert encrypted == copied, 'decrypt() modified its input'
+
+    def test_Into(self):
+        import mmap
+        out = mmap.mmap(-1, 4096)
+        n = self.ecc.encrypt_into(DEFAULT_PLAINTEXT, out)
+        assert n > len(DEFAULT_PLAINTEXT), n
+
+        buf = bytearray(len(DEFAULT_PLAINTEXT))
+        assert self.ecc.decrypt_into(out[:n], buf) == len(DEFAULT_PLAINTEXT)
+        assert str(buf) == DEFAULT_PLAINTEXT
+        self.failUnlessRaises(ValueError, self.ecc.encrypt_into, DEFAULT_PLAINTEXT,
+                bytearray(n - 1))
+
+    def test_Oversized(self):
+        import mmap
+        # Anonymous mappings are lazy, nothing gets read past the length
+        huge = mmap.mmap(-1, 2 ** 32 + len(DEFAULT_DATA))
+        for f in (self.ecc.encrypt, self.ecc.decrypt, self.ecc.sign):
+            self.failUnlessRaises(OverflowError, f, huge)
+        self.failUnlessRaises(OverflowError, self.ecc.verify, huge, DEFAULT_SIG)
+        self.failUnlessRaises(OverflowError, self.ecc.sign_many, [huge])
+        self.failUnlessRaises(OverflowError, self.ecc.encrypt_multi, huge,
+                [DEFAULT_PUBKEY])
+        self.failUnlessRaises(OverflowError, self.ecc.signcrypt, huge,
+                DEFAULT_PUBKEY)
+        huge.close()
+
+class ECC_Stream_Tests(unittest.TestCase):
+    def setUp(self):
+        super(ECC_Stream_Tests, self).setUp()
+        self.ecc = pyecc.ECC(public=DEFAULT_PUBKEY, private=DEFAULT_PRIVKEY)
+        self.chunks = [DEFAULT_PLAINTEXT * i for i in xrange(LOOPS)]
+
+    def test_Writer(self):
+        import StringIO
+        out = StringIO.StringIO()
+        with self.ecc.encrypt_to(out) as writer:
+            writer.writelines(self.chunks)
+        encrypted = out.getvalue()
+        assert self.ecc.decrypt(encrypted) == ''.join(self.chunks)
+
+        out = StringIO.StringIO()
+        with self.ecc.decrypt_to(out) as writer:
+            for i in xrange(0, len(encrypted), 7):
+                writer.write(encrypted[i:i + 7])
+        assert out.getvalue() == ''.join(self.chunks)
+
+    def test_Iter(self):
+        encrypted = self.ecc.encrypt(''.join(self.chunks))
+        decrypted = self.ecc.decrypt_iter(encrypted[i:i + 1000]
+                for i in xrange(0, len(encrypted), 1000))
+        assert ''.join(decrypted) == ''.join(self.chunks)
+
+        encrypted = ''.join(self.ecc.encrypt_iter(iter(self.chunks)))
+        assert self.ecc.decrypt(encrypted) == ''.join(self.chunks)
+
+    def test_Truncated(self):
+        encrypted = self.ecc.encrypt(DEFAULT_PLAINTEXT)
+        self.failUnlessRaises(ValueError, list, self.ecc.decrypt_iter([encrypted[:20]]))
+
+    def test_Tampered(self):
+        import StringIO
+        encrypted = self.ecc.encrypt(DEFAULT_PLAINTEXT)
+        tampered = encrypted[:-15] + chr(ord(encrypted[-15]) ^ 1) + encrypted[-14:]
+        self.failUnlessRaises(ValueError, list, self.ecc.decrypt_iter([tampered]))
+        writer = self.ecc.decrypt_to(StringIO.StringIO())
+        writer.write(tampered)
+        self.failUnlessRaises(ValueError, writer.close)
+
+class ECC_Many_Tests(unittest.TestCase):
+    def setUp(self):
+        super(ECC_Many_Tests, self).setUp()
+        self.ecc = pyecc.ECC(public=DEFAULT_PUBKEY, private=DEFAULT_PRIVKEY)
+
+    def test_EncryptDecryptMany(self):
+        plaintexts = ['%d: %s' % (i, DEFAULT_PLAINTEXT) for i in xrange(LOOPS)]
+        encrypted = self.ecc.encrypt_many(plaintexts, 4)
+        assert len(encrypted) == LOOPS and all(encrypted), encrypted
+
+        decrypted = self.ecc.decrypt_many(encrypted)
+        assert decrypted == plaintexts, ('Decrypted wrong', decrypted)
+
+    def test_SignVerifyMany(self):
+        data = ['%d: %s' % (i, DEFAULT_DATA) for i in xrange(LOOPS)]
+        signatures = self.ecc.sign_many(data, 4)
+        assert signatures == [self.ecc.sign(d) for d in data], signatures
+
+        signatures[1] = 'FAIL'
+        rc = self.ecc.verify_many(data, signatures)
+        assert rc == [True, False] + [True] * (LOOPS - 2), rc
+
+    def test_Threads(self):
+        import threading
+        results = []
+        def work():
+            results.append(all(self.ecc.verify(DEFAULT_DATA, DEFAULT_SIG)
+                    for i in xrange(10)))
+        threads = [threading.Thread(target=work) for i in xrange(4)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        assert results == [True] * 4, results
+
 class ECC_Fail(unittest.TestCase):
     def setUp(self):
         super(ECC_Fail, self).setUp()
@@ -102,6 +372,9 @@ class ECC_Fail(unittest.TestCase):
     def test_EmptyString(self):
         self.failUnlessRaises(TypeError, self.ecc.encrypt, '')
 
+    def test_TruncatedDecrypt(self):
+        assert self.ecc.decrypt('\x01\x02\x03') == None
+
 class ECC_GC_Checks(unittest.TestCase):
     def setUp(self):
         super(ECC_GC_Checks, self).setUp()